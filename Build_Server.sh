@@ -0,0 +1,18 @@
+#!/bin/sh
+
+CAKELISP_DIR=Dependencies/cakelisp
+
+# Build Cakelisp itself
+echo "\n\nCakelisp\n\n"
+cd $CAKELISP_DIR
+./Build.sh || exit $?
+
+cd ../..
+
+echo "\n\nSpace Factory (server)\n\n"
+
+CAKELISP=./Dependencies/cakelisp/bin/cakelisp
+
+$CAKELISP --verbose-processes \
+		  src/Config_Linux.cake \
+		  src/SpaceFactoryServer.cake || exit $?
@@ -0,0 +1,124 @@
+#include "Autosave.h"
+
+#include "Snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The smallest page size we run on. Touching more often than needed is harmless
+static const size_t c_autosavePageSize = 4096;
+
+// Replaces filename with the finished temporary file in one step
+static bool replaceFile(const char* temporaryFilename, const char* filename)
+{
+#ifdef WINDOWS
+	return MoveFileExA(temporaryFilename, filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(temporaryFilename, filename) == 0;
+#endif
+}
+
+static void autosaveThreadMain(void* userData)
+{
+	Autosave* autosave = (Autosave*)userData;
+	// Writing is never urgent, and shouldn't take the simulation's core away from it
+	threadSetBackgroundPriority();
+	mutexLock(&autosave->mutex);
+	for (;;)
+	{
+		while (!autosave->hasPendingSave && !autosave->isShuttingDown)
+			conditionWait(&autosave->wakeUp, &autosave->mutex);
+		// A save requested before shutting down still gets written
+		if (!autosave->hasPendingSave)
+			break;
+		const SimulationState* state = autosave->states[autosave->back];
+		autosave->back ^= 1;
+		autosave->hasPendingSave = false;
+		mutexUnlock(&autosave->mutex);
+
+		if (snapshotSave(state, autosave->temporaryFilename) &&
+		    replaceFile(autosave->temporaryFilename, autosave->filename))
+			++autosave->numSaved;
+		else
+		{
+			fprintf(stderr, "Autosave to %s failed\n", autosave->filename);
+			++autosave->numFailed;
+		}
+
+		mutexLock(&autosave->mutex);
+	}
+	mutexUnlock(&autosave->mutex);
+}
+
+bool autosaveInitialize(Autosave* autosave, const char* filename)
+{
+	memset(autosave, 0, sizeof(Autosave));
+	autosave->filename = filename;
+	if (snprintf(autosave->temporaryFilename, sizeof(autosave->temporaryFilename), "%s.tmp",
+	             filename) >= (int)sizeof(autosave->temporaryFilename))
+		return false;
+	for (int i = 0; i < 2; ++i)
+	{
+		autosave->states[i] = malloc(sizeof(SimulationState));
+		if (!autosave->states[i])
+		{
+			free(autosave->states[0]);
+			return false;
+		}
+		// Touch every page now, so the first request doesn't pay for faulting them in. Not with
+		// memset(), which compilers merge with the malloc() into a calloc() that touches nothing
+		volatile char* bytes = (volatile char*)autosave->states[i];
+		for (size_t offset = 0; offset < sizeof(SimulationState); offset += c_autosavePageSize)
+			bytes[offset] = 0;
+	}
+	mutexInitialize(&autosave->mutex);
+	conditionInitialize(&autosave->wakeUp);
+	if (!threadCreate(&autosave->thread, autosaveThreadMain, autosave))
+	{
+		conditionDestroy(&autosave->wakeUp);
+		mutexDestroy(&autosave->mutex);
+		free(autosave->states[0]);
+		free(autosave->states[1]);
+		return false;
+	}
+	return true;
+}
+
+void autosaveDestroy(Autosave* autosave)
+{
+	mutexLock(&autosave->mutex);
+	autosave->isShuttingDown = true;
+	conditionWakeAll(&autosave->wakeUp);
+	mutexUnlock(&autosave->mutex);
+	threadJoin(&autosave->thread);
+
+	conditionDestroy(&autosave->wakeUp);
+	mutexDestroy(&autosave->mutex);
+	free(autosave->states[0]);
+	free(autosave->states[1]);
+	autosave->states[0] = autosave->states[1] = NULL;
+}
+
+bool autosaveRequest(Autosave* autosave, const SimulationState* state)
+{
+	mutexLock(&autosave->mutex);
+	bool isBackFree = !autosave->hasPendingSave;
+	int back = autosave->back;
+	mutexUnlock(&autosave->mutex);
+	if (!isBackFree)
+	{
+		++autosave->numSkipped;
+		return false;
+	}
+
+	// The autosave thread only touches the other buffer until this one is handed over, so the copy
+	// doesn't need the lock
+	memcpy(autosave->states[back], state, sizeof(SimulationState));
+
+	mutexLock(&autosave->mutex);
+	autosave->hasPendingSave = true;
+	mutexUnlock(&autosave->mutex);
+	conditionWakeAll(&autosave->wakeUp);
+	return true;
+}
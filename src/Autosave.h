@@ -0,0 +1,49 @@
+#pragma once
+
+// Saves snapshots of a running simulation without holding it up. The thread running the simulation
+// only copies the state into a spare buffer; checksumming and writing the file happen on the
+// autosave's own thread. The file is written next to its destination and renamed over it, so a
+// crash partway through leaves the previous autosave intact
+//
+// Like Simulation.h, this must not depend on SDL
+
+#include "Simulation.h"
+#include "Threads.h"
+
+// How much game time goes by between autosaves, unless the caller picks something else
+static const int c_autosaveDefaultIntervalSeconds = 60;
+// The most autosaveRequest() should hold up the simulation, including the very first request. The
+// headless runner checks the median request against it
+static const double c_autosaveMaxRequestSeconds = 0.0005;
+
+typedef struct Autosave
+{
+	const char* filename;
+	Thread thread;
+	Mutex mutex;
+	Condition wakeUp;
+
+	// The simulation's thread copies into states[back] while the autosave thread writes the other.
+	// back only changes when the autosave thread takes a pending save, with the mutex locked
+	SimulationState* states[2];
+	int back;
+	bool hasPendingSave;
+	bool isShuttingDown;
+
+	char temporaryFilename[256];
+
+	// Only the autosave thread writes these
+	unsigned int numSaved;
+	unsigned int numFailed;
+	// Only the requesting thread writes this. Requests dropped because the previous save was still
+	// waiting to start
+	unsigned int numSkipped;
+} Autosave;
+
+bool autosaveInitialize(Autosave* autosave, const char* filename);
+// Finishes writing any save already requested before returning
+void autosaveDestroy(Autosave* autosave);
+
+// Costs one copy of the state. Returns false, saving nothing, if the autosave thread hasn't started
+// writing the previous request yet
+bool autosaveRequest(Autosave* autosave, const SimulationState* state);
@@ -0,0 +1,43 @@
+#include "Bot.h"
+
+// The bot wants to close this fraction of the distance to the goal every second
+static const float c_botApproachRate = 0.5f;
+// Leaves some speed in hand so the ship can still turn around
+static const float c_botMaxSpeed = c_maxSpeed / 2.f;
+// Don't flip between opposite engines over small differences
+static const float c_botSpeedTolerance = 20.f;
+
+static unsigned char steerAxis(float distance, float velocity, unsigned char towardsNegative,
+                               unsigned char towardsPositive)
+{
+	float desiredVelocity = distance * c_botApproachRate;
+	if (desiredVelocity > c_botMaxSpeed)
+		desiredVelocity = c_botMaxSpeed;
+	if (desiredVelocity < -c_botMaxSpeed)
+		desiredVelocity = -c_botMaxSpeed;
+
+	if (velocity < desiredVelocity - c_botSpeedTolerance)
+		return towardsPositive;
+	if (velocity > desiredVelocity + c_botSpeedTolerance)
+		return towardsNegative;
+	return 0;
+}
+
+unsigned char botPilotInput(SimulationState* state, int player)
+{
+	const GamePhase* phase = simulationCurrentPhase(state);
+	if (!phase || phase->objective != Objective_ReachGoalPoint ||
+	    simulationIsPlayerDestroyed(state))
+		return 0;
+
+	const Ship* ship = &state->ships[player];
+	float shipCenterX = ship->body.position.x + ((ship->width * c_tileSize) / 2.f);
+	float shipCenterY = ship->body.position.y + ((ship->height * c_tileSize) / 2.f);
+	float goalCenterX = state->goal.x + (state->goal.w / 2.f);
+	float goalCenterY = state->goal.y + (state->goal.h / 2.f);
+
+	return steerAxis(goalCenterX - shipCenterX, ship->body.velocity.x, EngineInput_Left,
+	                 EngineInput_Right) |
+	       steerAxis(goalCenterY - shipCenterY, ship->body.velocity.y, EngineInput_Up,
+	                 EngineInput_Down);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// A simple pilot for sessions nobody is playing, e.g. on the server. Like Simulation.h, this must
+// not depend on SDL
+
+#include "Simulation.h"
+
+// EngineInput flags which fly the player's ship towards the goal, if there is one
+unsigned char botPilotInput(SimulationState* state, int player);
@@ -0,0 +1,529 @@
+#include "Control.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WINDOWS
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//
+// Observations
+//
+
+static void observeShip(SimulationState* state, Ship* ship, ControlShipObservation* observation)
+{
+	observation->positionX = ship->body.position.x;
+	observation->positionY = ship->body.position.y;
+	observation->velocityX = ship->body.velocity.x;
+	observation->velocityY = ship->body.velocity.y;
+	observation->numSolidCells = ship->numSolidCells;
+	observation->width = ship->width;
+	observation->height = ship->height;
+
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	for (int i = 0; i < gridSpace.width * gridSpace.height; ++i)
+	{
+		if (!isEngineTile(gridSpace.data[i].type))
+			continue;
+		observation->engineFuel += gridSpace.data[i].engineCell.fuel;
+		++observation->numEngines;
+	}
+}
+
+void controlObserve(SimulationState* state, ControlObservation* observation)
+{
+	memset(observation, 0, sizeof(ControlObservation));
+	observation->stateHash = simulationStateHash(state);
+	observation->tick = state->tick;
+	observation->ticksPerSecond = state->ticksPerSecond;
+	observation->goalX = state->goal.x;
+	observation->goalY = state->goal.y;
+	observation->goalWidth = state->goal.w;
+	observation->goalHeight = state->goal.h;
+	observation->constructionFuelPool = state->constructionFuelPool;
+	const GamePhase* phase = simulationCurrentPhase(state);
+	observation->currentGamePhase = phase ? state->currentGamePhase : -1;
+	if (phase)
+	{
+		observation->secondsLeftInPhase =
+		    phase->timeToCompleteSeconds - simulationSecondsInCurrentPhase(state);
+		observation->objective = phase->objective;
+	}
+	observation->isPlayerDestroyed = simulationIsPlayerDestroyed(state);
+	observation->numDamagesSustained = state->numDamagesSustained;
+	observation->numPlayers = state->numPlayers;
+	for (int player = 0; player < state->numPlayers; ++player)
+		observeShip(state, &state->ships[player], &observation->ships[player]);
+
+	// Keep the nearest asteroids sorted by insertion; there are only a handful
+	Ship* playerShip = &state->ships[0];
+	float centreX = playerShip->body.position.x + (playerShip->width * c_tileSize) / 2;
+	float centreY = playerShip->body.position.y + (playerShip->height * c_tileSize) / 2;
+	float distancesSquared[CONTROL_NUM_OBSERVED_ASTEROIDS];
+	unsigned int numAsteroids = 0;
+	for (int i = 0; i < ARRAY_SIZE(state->objects); ++i)
+	{
+		const Object* object = &state->objects[i];
+		if (!object->type || object->inFactory)
+			continue;
+		float offsetX = object->body.position.x - centreX;
+		float offsetY = object->body.position.y - centreY;
+		float distanceSquared = (offsetX * offsetX) + (offsetY * offsetY);
+		if (numAsteroids == CONTROL_NUM_OBSERVED_ASTEROIDS &&
+		    distanceSquared >= distancesSquared[numAsteroids - 1])
+			continue;
+
+		unsigned int insertAt =
+		    numAsteroids < CONTROL_NUM_OBSERVED_ASTEROIDS ? numAsteroids++ : numAsteroids - 1;
+		while (insertAt > 0 && distancesSquared[insertAt - 1] > distanceSquared)
+		{
+			distancesSquared[insertAt] = distancesSquared[insertAt - 1];
+			observation->asteroids[insertAt] = observation->asteroids[insertAt - 1];
+			--insertAt;
+		}
+		distancesSquared[insertAt] = distanceSquared;
+		ControlAsteroidObservation* asteroid = &observation->asteroids[insertAt];
+		asteroid->offsetX = offsetX;
+		asteroid->offsetY = offsetY;
+		asteroid->velocityX = object->body.velocity.x;
+		asteroid->velocityY = object->body.velocity.y;
+	}
+	observation->numAsteroids = numAsteroids;
+}
+
+//
+// Server
+//
+
+#ifdef WINDOWS
+
+bool controlServe(const char* socketPath, int maxClients, JobSystem* jobs)
+{
+	fprintf(stderr, "The control socket is only supported on Unix\n");
+	return false;
+}
+
+#else
+
+typedef struct ControlClient
+{
+	// -1 if this slot is free
+	int socket;
+	// NULL until the first Reset
+	SimulationState* state;
+	// NULL unless the client asked for MapObservations
+	ControlObservation* sharedObservation;
+
+	unsigned char receiveBuffer[CONTROL_MAX_MESSAGE_SIZE];
+	int numReceived;
+
+	// The reply and observation are sent straight from here
+	ControlReply reply;
+	ControlObservation observation;
+
+	// Set while a step waits to run with everyone else's
+	bool isStepPending;
+	ControlStepRequest step;
+} ControlClient;
+
+static volatile sig_atomic_t s_controlInterrupted = 0;
+
+static void onInterrupt(int signalNumber)
+{
+	s_controlInterrupted = 1;
+}
+
+static ControlObservation* observationDestination(ControlClient* client)
+{
+	return client->sharedObservation ? client->sharedObservation : &client->observation;
+}
+
+static void setReply(ControlClient* client, ControlStatus status, unsigned int numTicksRun,
+                     unsigned int events)
+{
+	memset(&client->reply, 0, sizeof(ControlReply));
+	client->reply.header.size = sizeof(ControlReply);
+	client->reply.header.type = ControlMessage_Reply;
+	client->reply.status = status;
+	client->reply.numTicksRun = numTicksRun;
+	client->reply.events = events;
+	// A client may map observations before its first reset
+	if (status == ControlStatus_Ok && client->state)
+	{
+		controlObserve(client->state, observationDestination(client));
+		if (!client->sharedObservation)
+			client->reply.header.size += sizeof(ControlObservation);
+	}
+}
+
+// Sends client->reply, and the observation if the header includes it. fileDescriptor is passed to
+// the client unless it is -1
+static bool sendReply(ControlClient* client, int fileDescriptor)
+{
+	struct iovec pieces[2] = {{&client->reply, sizeof(ControlReply)},
+	                          {&client->observation, sizeof(ControlObservation)}};
+	struct msghdr message = {0};
+	message.msg_iov = pieces;
+	message.msg_iovlen = client->reply.header.size > sizeof(ControlReply) ? 2 : 1;
+
+	union
+	{
+		struct cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+	if (fileDescriptor != -1)
+	{
+		memset(&control, 0, sizeof(control));
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+		struct cmsghdr* controlHeader = CMSG_FIRSTHDR(&message);
+		controlHeader->cmsg_level = SOL_SOCKET;
+		controlHeader->cmsg_type = SCM_RIGHTS;
+		controlHeader->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(controlHeader), &fileDescriptor, sizeof(int));
+	}
+
+	// Replies are small, so a partial send only happens if the client stopped reading
+	ssize_t numSent = sendmsg(client->socket, &message, 0);
+	return numSent == (ssize_t)client->reply.header.size;
+}
+
+static bool mapObservations(ControlClient* client, int* fileDescriptorOut)
+{
+	if (client->sharedObservation)
+		munmap(client->sharedObservation, sizeof(ControlObservation));
+	client->sharedObservation = NULL;
+
+	// Unlinked straight away; it only needs to live as long as the two mappings
+	char name[64];
+	static unsigned int s_numMappings = 0;
+	snprintf(name, sizeof(name), "/space-factory-%d-%u", (int)getpid(), s_numMappings++);
+	int fileDescriptor = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fileDescriptor == -1)
+		return false;
+	shm_unlink(name);
+	if (ftruncate(fileDescriptor, sizeof(ControlObservation)) != 0)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+	void* mapping = mmap(NULL, sizeof(ControlObservation), PROT_READ | PROT_WRITE, MAP_SHARED,
+	                     fileDescriptor, 0);
+	if (mapping == MAP_FAILED)
+	{
+		close(fileDescriptor);
+		return false;
+	}
+	client->sharedObservation = (ControlObservation*)mapping;
+	*fileDescriptorOut = fileDescriptor;
+	return true;
+}
+
+static bool handleReset(ControlClient* client, const ControlResetRequest* request, uint32_t size)
+{
+	int ticksPerSecond =
+	    request->ticksPerSecond ? request->ticksPerSecond : c_defaultTicksPerSecond;
+	int numPlayers = request->numPlayers ? request->numPlayers : 1;
+	int numLayoutCells = request->layoutWidth * request->layoutHeight;
+	char layoutCells[(MAX_SHIP_DIMENSION * MAX_SHIP_DIMENSION) + 1];
+	if (size != sizeof(ControlResetRequest) + numLayoutCells ||
+	    numLayoutCells >= (int)sizeof(layoutCells) || !simulationIsValidTickRate(ticksPerSecond) ||
+	    numPlayers > MAX_PLAYERS)
+		return false;
+
+	ShipLayout layout = c_defaultPlayerShipLayout;
+	if (numLayoutCells)
+	{
+		memcpy(layoutCells, request + 1, numLayoutCells);
+		layoutCells[numLayoutCells] = 0;
+		layout.width = request->layoutWidth;
+		layout.height = request->layoutHeight;
+		layout.cells = layoutCells;
+	}
+	if (!simulationIsValidShipLayout(&layout))
+		return false;
+
+	if (!client->state)
+		client->state = malloc(sizeof(SimulationState));
+	if (!client->state)
+		return false;
+	simulationInitializeWithShipLayout(client->state, request->seed, ticksPerSecond, numPlayers,
+	                                   &layout);
+	return true;
+}
+
+// Returns false if the client should be disconnected. Stops at the first step, which is answered
+// once every pending step has run
+static bool handleBufferedRequests(ControlClient* client)
+{
+	while (!client->isStepPending && client->numReceived >= (int)sizeof(ControlMessageHeader))
+	{
+		ControlMessageHeader header;
+		memcpy(&header, client->receiveBuffer, sizeof(header));
+		if (header.size < sizeof(header) || header.size > CONTROL_MAX_MESSAGE_SIZE)
+			return false;
+		if (client->numReceived < (int)header.size)
+			break;
+
+		// Copy out of the receive buffer so the requests are aligned
+		union
+		{
+			ControlMessageHeader header;
+			ControlResetRequest reset;
+			ControlStepRequest step;
+			unsigned char bytes[CONTROL_MAX_MESSAGE_SIZE];
+		} request;
+		memcpy(&request, client->receiveBuffer, header.size);
+		client->numReceived -= header.size;
+		memmove(client->receiveBuffer, client->receiveBuffer + header.size, client->numReceived);
+
+		int fileDescriptor = -1;
+		switch (header.type)
+		{
+			case ControlMessage_Reset:
+				if (header.size < sizeof(ControlResetRequest) ||
+				    !handleReset(client, &request.reset, header.size))
+					setReply(client, ControlStatus_BadRequest, 0, 0);
+				else
+					setReply(client, ControlStatus_Ok, 0, 0);
+				break;
+			case ControlMessage_Step:
+				if (header.size != sizeof(ControlStepRequest))
+					setReply(client, ControlStatus_BadRequest, 0, 0);
+				else if (!client->state)
+					setReply(client, ControlStatus_NoSession, 0, 0);
+				else
+				{
+					client->step = request.step;
+					client->isStepPending = true;
+					continue;
+				}
+				break;
+			case ControlMessage_Observe:
+				setReply(client, client->state ? ControlStatus_Ok : ControlStatus_NoSession, 0, 0);
+				break;
+			case ControlMessage_MapObservations:
+				if (!mapObservations(client, &fileDescriptor))
+					setReply(client, ControlStatus_MapFailed, 0, 0);
+				else
+					setReply(client, ControlStatus_Ok, 0, 0);
+				break;
+			default:
+				setReply(client, ControlStatus_BadRequest, 0, 0);
+				break;
+		}
+
+		bool sent = sendReply(client, fileDescriptor);
+		if (fileDescriptor != -1)
+			close(fileDescriptor);
+		if (!sent)
+			return false;
+	}
+	return true;
+}
+
+static void runStep(ControlClient* client)
+{
+	SimulationState* state = client->state;
+	SimulationInput input = {0};
+	for (int player = 0; player < state->numPlayers; ++player)
+		input.engineInput[player] = client->step.engineInput[player];
+
+	unsigned int numTicksRun = 0;
+	unsigned int events = 0;
+	while (numTicksRun < client->step.numTicks && simulationCurrentPhase(state) &&
+	       !simulationIsPlayerDestroyed(state))
+	{
+		events |= simulationTick(state, &input);
+		++numTicksRun;
+	}
+	setReply(client, ControlStatus_Ok, numTicksRun, events);
+}
+
+static void runSteps(void* userData, int begin, int end, int workerIndex)
+{
+	for (int i = begin; i < end; ++i)
+		runStep(((ControlClient**)userData)[i]);
+}
+
+static void disconnectClient(ControlClient* client)
+{
+	close(client->socket);
+	if (client->sharedObservation)
+		munmap(client->sharedObservation, sizeof(ControlObservation));
+	free(client->state);
+	memset(client, 0, sizeof(ControlClient));
+	client->socket = -1;
+}
+
+static int openListenSocket(const char* socketPath)
+{
+	struct sockaddr_un address = {0};
+	address.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Control socket path is too long: %s\n", socketPath);
+		return -1;
+	}
+	strcpy(address.sun_path, socketPath);
+
+	int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenSocket == -1)
+	{
+		perror("Failed to create control socket");
+		return -1;
+	}
+	unlink(socketPath);
+	if (bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+	    listen(listenSocket, 64) != 0)
+	{
+		perror("Failed to listen on control socket");
+		close(listenSocket);
+		return -1;
+	}
+	return listenSocket;
+}
+
+bool controlServe(const char* socketPath, int maxClients, JobSystem* jobs)
+{
+	int listenSocket = openListenSocket(socketPath);
+	if (listenSocket == -1)
+		return false;
+
+	ControlClient* clients = malloc(maxClients * sizeof(ControlClient));
+	struct pollfd* pollSockets = malloc((maxClients + 1) * sizeof(struct pollfd));
+	// pollSockets[i + 1] is for clients[pollClients[i]]
+	int* pollClients = malloc(maxClients * sizeof(int));
+	ControlClient** steppingClients = malloc(maxClients * sizeof(ControlClient*));
+	if (!clients || !pollSockets || !pollClients || !steppingClients)
+	{
+		fprintf(stderr, "Not enough memory for %d control clients\n", maxClients);
+		free(clients);
+		free(pollSockets);
+		free(pollClients);
+		free(steppingClients);
+		close(listenSocket);
+		unlink(socketPath);
+		return false;
+	}
+	memset(clients, 0, maxClients * sizeof(ControlClient));
+	for (int i = 0; i < maxClients; ++i)
+		clients[i].socket = -1;
+
+	// A client which hangs up mid-reply shouldn't take the server down with it
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction interruptAction = {0};
+	interruptAction.sa_handler = onInterrupt;
+	sigaction(SIGINT, &interruptAction, NULL);
+	sigaction(SIGTERM, &interruptAction, NULL);
+	s_controlInterrupted = 0;
+
+	printf("Listening for control clients on %s\n", socketPath);
+	bool hasBufferedRequests = false;
+	while (!s_controlInterrupted)
+	{
+		pollSockets[0].fd = listenSocket;
+		pollSockets[0].events = POLLIN;
+		int numPollSockets = 1;
+		for (int i = 0; i < maxClients; ++i)
+		{
+			if (clients[i].socket == -1)
+				continue;
+			pollSockets[numPollSockets].fd = clients[i].socket;
+			pollSockets[numPollSockets].events = POLLIN;
+			pollClients[numPollSockets - 1] = i;
+			++numPollSockets;
+		}
+		// Requests which are already buffered don't make a socket readable again
+		if (poll(pollSockets, numPollSockets, hasBufferedRequests ? 0 : -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("Failed to poll control sockets");
+			break;
+		}
+
+		if (pollSockets[0].revents & POLLIN)
+		{
+			int clientSocket = accept(listenSocket, NULL, NULL);
+			if (clientSocket != -1)
+			{
+				ControlClient* freeClient = NULL;
+				for (int i = 0; i < maxClients && !freeClient; ++i)
+				{
+					if (clients[i].socket == -1)
+						freeClient = &clients[i];
+				}
+				if (freeClient)
+					freeClient->socket = clientSocket;
+				else
+					close(clientSocket);
+			}
+		}
+
+		for (int i = 1; i < numPollSockets; ++i)
+		{
+			ControlClient* client = &clients[pollClients[i - 1]];
+			if (!pollSockets[i].revents)
+				continue;
+			ssize_t numReceived =
+			    recv(client->socket, client->receiveBuffer + client->numReceived,
+			         sizeof(client->receiveBuffer) - client->numReceived, MSG_DONTWAIT);
+			if (numReceived == 0 ||
+			    (numReceived < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				disconnectClient(client);
+			else if (numReceived > 0)
+				client->numReceived += numReceived;
+		}
+
+		int numSteppingClients = 0;
+		for (int i = 0; i < maxClients; ++i)
+		{
+			ControlClient* client = &clients[i];
+			if (client->socket == -1)
+				continue;
+			if (!handleBufferedRequests(client))
+				disconnectClient(client);
+			else if (client->isStepPending)
+				steppingClients[numSteppingClients++] = client;
+		}
+
+		// Every step which arrived together runs together
+		jobSystemParallelFor(jobs, numSteppingClients, 1, runSteps, steppingClients);
+
+		hasBufferedRequests = false;
+		for (int i = 0; i < numSteppingClients; ++i)
+		{
+			ControlClient* client = steppingClients[i];
+			client->isStepPending = false;
+			if (!sendReply(client, -1))
+				disconnectClient(client);
+			else if (client->numReceived >= (int)sizeof(ControlMessageHeader))
+				hasBufferedRequests = true;
+		}
+	}
+
+	for (int i = 0; i < maxClients; ++i)
+	{
+		if (clients[i].socket != -1)
+			disconnectClient(&clients[i]);
+	}
+	free(clients);
+	free(pollSockets);
+	free(pollClients);
+	free(steppingClients);
+	close(listenSocket);
+	unlink(socketPath);
+	return true;
+}
+
+#endif
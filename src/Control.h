@@ -0,0 +1,149 @@
+#pragma once
+
+// Lets other programs (scripted pilots, trainers) drive sessions over a Unix domain socket instead
+// of reading the screen. Each connection owns one session
+//
+// Client and server are on the same machine, so messages are these structs exactly as they are in
+// memory. Every message starts with a ControlMessageHeader. The client sends one request and reads
+// its reply before sending the next, or pipelines them; replies come back in order
+//
+// Requests:
+//   Reset: ControlResetRequest, then layoutWidth * layoutHeight tile characters (see ShipLayout)
+//   Step: ControlStepRequest. Runs many ticks in one round trip
+//   Observe: just the header
+//   MapObservations: just the header. The reply carries a file descriptor (SCM_RIGHTS) of
+//     sizeof(ControlObservation) bytes of shared memory to mmap. From then on replies leave the
+//     observation out; it is written to the shared memory before the reply is sent
+//
+// Each reply is a ControlReply followed by a ControlObservation. header.size says whether the
+// observation is there; it is left out when mapped, before the first Reset, or if status isn't Ok
+//
+// Like Simulation.h, this must not depend on SDL. Unix only
+
+#include "Jobs.h"
+#include "Simulation.h"
+
+// How many of the free-floating asteroids nearest the first player's ship are observed
+#define CONTROL_NUM_OBSERVED_ASTEROIDS 16
+#define CONTROL_MAX_MESSAGE_SIZE 2048
+
+static const int c_controlDefaultMaxClients = 256;
+
+typedef enum ControlMessageType
+{
+	ControlMessage_Reset = 1,
+	ControlMessage_Step = 2,
+	ControlMessage_Observe = 3,
+	ControlMessage_MapObservations = 4,
+	ControlMessage_Reply = 5,
+} ControlMessageType;
+
+typedef struct ControlMessageHeader
+{
+	// Of the whole message, including this header
+	uint32_t size;
+	// ControlMessageType
+	uint32_t type;
+} ControlMessageHeader;
+
+typedef struct ControlResetRequest
+{
+	ControlMessageHeader header;
+	uint64_t seed;
+	// 0 means c_defaultTicksPerSecond
+	uint16_t ticksPerSecond;
+	// 0 means 1. Input for every player is sent in each step
+	uint8_t numPlayers;
+	// 0 by 0 means c_defaultPlayerShipLayout
+	uint8_t layoutWidth;
+	uint8_t layoutHeight;
+	uint8_t padding[3];
+} ControlResetRequest;
+
+typedef struct ControlStepRequest
+{
+	ControlMessageHeader header;
+	// Stops early once the game is over
+	uint32_t numTicks;
+	// EngineInput flags for each player, held for every tick of the step
+	uint8_t engineInput[MAX_PLAYERS];
+	uint8_t padding[2];
+} ControlStepRequest;
+
+typedef enum ControlStatus
+{
+	ControlStatus_Ok = 0,
+	ControlStatus_BadRequest = 1,
+	// Step or Observe before the first Reset
+	ControlStatus_NoSession = 2,
+	ControlStatus_MapFailed = 3,
+} ControlStatus;
+
+typedef struct ControlReply
+{
+	ControlMessageHeader header;
+	// ControlStatus
+	uint32_t status;
+	// By this request
+	uint32_t numTicksRun;
+	// SimulationEvent flags of every tick run by this request
+	uint32_t events;
+	uint32_t padding;
+} ControlReply;
+
+typedef struct ControlShipObservation
+{
+	// Of the top left corner, in pixels
+	float positionX;
+	float positionY;
+	// Pixels per second
+	float velocityX;
+	float velocityY;
+	// Total left in the ship's engines, in fixed units of burn time (see FIXED_UNITS_PER_SECOND)
+	int32_t engineFuel;
+	uint16_t numEngines;
+	uint16_t numSolidCells;
+	uint8_t width;
+	uint8_t height;
+	uint8_t padding[2];
+} ControlShipObservation;
+
+typedef struct ControlAsteroidObservation
+{
+	// From the centre of the first player's ship
+	float offsetX;
+	float offsetY;
+	float velocityX;
+	float velocityY;
+} ControlAsteroidObservation;
+
+typedef struct ControlObservation
+{
+	uint64_t stateHash;
+	uint32_t tick;
+	uint32_t ticksPerSecond;
+	int32_t goalX;
+	int32_t goalY;
+	int32_t goalWidth;
+	int32_t goalHeight;
+	int32_t constructionFuelPool;
+	// -1 once the game is over
+	int32_t currentGamePhase;
+	int32_t secondsLeftInPhase;
+	// Objective
+	uint8_t objective;
+	uint8_t isPlayerDestroyed;
+	uint8_t numDamagesSustained;
+	uint8_t numPlayers;
+	ControlShipObservation ships[MAX_PLAYERS];
+	// Nearest first. Only the first numAsteroids are valid
+	uint32_t numAsteroids;
+	ControlAsteroidObservation asteroids[CONTROL_NUM_OBSERVED_ASTEROIDS];
+} ControlObservation;
+
+void controlObserve(SimulationState* state, ControlObservation* observation);
+
+// Listens on socketPath (replacing any stale socket there) and serves clients until interrupted.
+// Steps requested by different clients at the same time run in parallel on jobs. Returns false if
+// the socket could not be opened
+bool controlServe(const char* socketPath, int maxClients, JobSystem* jobs);
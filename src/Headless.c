@@ -0,0 +1,780 @@
+// Runs the simulation without a window, renderer, or SDL. Useful for benchmarking the simulation on
+// its own and for testing gameplay changes from a script
+
+#include "Autosave.h"
+#include "Jobs.h"
+#include "Netplay.h"
+#include "Replay.h"
+#include "Rewind.h"
+#include "Simulation.h"
+#include "Snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void printUsage(const char* programName)
+{
+	fprintf(stderr,
+	        "Usage: %s [--ticks N | --seconds N] [--tick-rate N] [--seed N] [--players N]\n"
+	        "          [--input script.txt | --replay file] [--record file] [--hash-every N]\n"
+	        "          [--load-snapshot file] [--save-snapshot file] [--rewind-seconds N]\n"
+	        "          [--jobs N [--jobs-scaling]] [--autosave file]\n"
+	        "          [--netplay-test [--net-port N] [--net-latency MS] [--net-jitter MS]\n"
+	        "           [--net-loss PERCENT] [--input-delay N]]\n"
+	        "\n"
+	        "--tick-rate must divide %d evenly, e.g. 30, 60, 120, or 240. Factory throughput is\n"
+	        "the same at every rate. --players is 1 (default) or %d for co-op.\n"
+	        "\n"
+	        "--replay plays back a recorded session as fast as possible. Its seed and tick rate\n"
+	        "override --seed and --tick-rate, and it runs until the recording ends.\n"
+	        "--record saves this run so it can be replayed by the game or this program.\n"
+	        "\n"
+	        "--load-snapshot starts from a saved state instead of a new game (not with --replay).\n"
+	        "--save-snapshot saves the final state. Both report how long they took.\n"
+	        "--autosave saves a snapshot every %d game seconds in the background, and reports how\n"
+	        "long the simulation waited on them. It fails if the median wait is over budget.\n"
+	        "\n"
+	        "--rewind-seconds keeps a rewind history during the run, then rewinds N seconds at\n"
+	        "the end and checks the result against the state that was simulated then. It also\n"
+	        "checks the history fit in its memory budget.\n"
+	        "\n"
+	        "--netplay-test plays a co-op session between two rollback netcode peers in this\n"
+	        "process, over UDP loopback with the given artificial latency and loss, each pressing\n"
+	        "random inputs. It checks both peers end up in the same state.\n"
+	        "\n"
+	        "--jobs runs each tick's stages on N threads (0 for one per core) instead of only\n"
+	        "this one. The result must be exactly the same, so compare hashes with and without.\n"
+	        "--jobs-scaling runs the input script without jobs, then again on 1, 2, 4... up to\n"
+	        "--jobs threads, and reports each one's speed and checks they all end the same.\n"
+	        "\n"
+	        "--hash-every prints the state hashes every N ticks so runs can be diffed, and checks\n"
+	        "that the incrementally maintained hash is correct.\n"
+	        "\n"
+	        "Each line of the input script is a tick number followed by a command:\n"
+	        "  <tick> engine <any of UDLR, or - for none> [player]  (held until changed)\n"
+	        "  <tick> place <cellX> <cellY> <buildableTileIndex> [player]\n"
+	        "  <tick> skip  (advance to the next phase)\n"
+	        "Lines must be sorted by tick. Lines starting with # are ignored.\n",
+	        programName, FIXED_UNITS_PER_SECOND, MAX_PLAYERS, c_autosaveDefaultIntervalSeconds);
+}
+
+typedef struct InputScript
+{
+	FILE* file;
+	// The next line is read ahead so we know which tick it applies to
+	char line[256];
+	unsigned int lineTick;
+	bool hasLine;
+	int lineNumber;
+} InputScript;
+
+static void readNextScriptLine(InputScript* script)
+{
+	script->hasLine = false;
+	if (!script->file)
+		return;
+	while (fgets(script->line, sizeof(script->line), script->file))
+	{
+		++script->lineNumber;
+		if (script->line[0] == '#' || script->line[0] == '\n')
+			continue;
+		if (sscanf(script->line, "%u", &script->lineTick) != 1)
+		{
+			fprintf(stderr, "Script line %d: expected tick number\n", script->lineNumber);
+			continue;
+		}
+		script->hasLine = true;
+		return;
+	}
+}
+
+// Returns false on a malformed line
+static bool applyScriptLine(InputScript* script, int numPlayers, SimulationInput* input)
+{
+	char command[32] = {0};
+	char argument[32] = {0};
+	int player = 0;
+	int numRead = sscanf(script->line, "%*u %31s %31s %d", command, argument, &player);
+	if (numRead < 1)
+		return false;
+
+	if (strcmp(command, "engine") == 0 && numRead >= 2)
+	{
+		if (player < 0 || player >= numPlayers)
+			return false;
+		unsigned char* engineInput = &input->engineInput[player];
+		*engineInput = 0;
+		for (const char* c = argument; *c; ++c)
+		{
+			switch (*c)
+			{
+				case 'U':
+					*engineInput |= EngineInput_Up;
+					break;
+				case 'D':
+					*engineInput |= EngineInput_Down;
+					break;
+				case 'L':
+					*engineInput |= EngineInput_Left;
+					break;
+				case 'R':
+					*engineInput |= EngineInput_Right;
+					break;
+				default:
+					break;
+			}
+		}
+		return true;
+	}
+	else if (strcmp(command, "place") == 0)
+	{
+		int cellX = 0;
+		int cellY = 0;
+		int buildableTile = 0;
+		player = 0;
+		if (sscanf(script->line, "%*u %*s %d %d %d %d", &cellX, &cellY, &buildableTile,
+		           &player) < 3 ||
+		    player < 0 || player >= numPlayers || input->numEdits >= ARRAY_SIZE(input->edits))
+			return false;
+		EditCommand edit = {player, cellX, cellY, buildableTile};
+		input->edits[input->numEdits++] = edit;
+		return true;
+	}
+	else if (strcmp(command, "skip") == 0)
+	{
+		input->skipPhase = true;
+		return true;
+	}
+	return false;
+}
+
+static double secondsNow()
+{
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (double)time.tv_sec + (double)time.tv_nsec / 1000000000.0;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+	double difference = *(const double*)a - *(const double*)b;
+	return difference < 0.0 ? -1 : difference > 0.0 ? 1 : 0;
+}
+
+//
+// Netplay test
+//
+
+// Holds the engines for a while at a time, and sometimes tries to build something
+static void randomPlayerInput(RandomState* random, PlayerInput* input)
+{
+	if (randomRange(random, 30) == 0)
+		input->engineInput = randomRange(random, 16);
+	input->skipPhase = false;
+	input->numEdits = 0;
+	if (randomRange(random, 120) == 0)
+	{
+		EditCommand edit = {0, randomRange(random, 18), randomRange(random, 7),
+		                    randomRange(random, NUM_BUILDABLE_TILES)};
+		input->edits[input->numEdits++] = edit;
+	}
+}
+
+// Both peers tick once per frame on a shared virtual clock, so the only differences between them
+// come from the network
+static int runNetplayTest(uint64_t seed, int ticksPerSecond, unsigned int numTicks,
+                          const NetplayOptions* baseOptions)
+{
+	static NetplaySession sessions[MAX_PLAYERS];
+	static SimulationState states[MAX_PLAYERS];
+	RandomState inputRandom[MAX_PLAYERS];
+	PlayerInput inputs[MAX_PLAYERS] = {0};
+	double netplaySeconds[MAX_PLAYERS] = {0};
+	for (int player = 0; player < MAX_PLAYERS; ++player)
+	{
+		NetplayOptions options = *baseOptions;
+		options.localPlayer = player;
+		options.seed = seed;
+		options.ticksPerSecond = ticksPerSecond;
+		if (!netplayOpen(&sessions[player], &options))
+		{
+			fprintf(stderr, "Could not start netplay peer %d\n", player + 1);
+			return 1;
+		}
+		randomSeed(&inputRandom[player], seed, 100 + player);
+	}
+
+	const NetplayConditions* conditions = &baseOptions->conditions;
+	printf("Netplay test on UDP port %d: %d ms latency, %d ms jitter, %d%% loss, %d ticks input "
+	       "delay\n",
+	       baseOptions->port, conditions->latencyMilliseconds, conditions->jitterMilliseconds,
+	       conditions->lossPercent, baseOptions->inputDelayTicks);
+
+	double secondsPerFrame = 1.0 / ticksPerSecond;
+	// Plenty of time to connect and catch up
+	double timeLimit = (numTicks * secondsPerFrame) + 30.0;
+	double now = 0.0;
+	unsigned int numFrames = 0;
+	bool isDone = false;
+	for (; !isDone && now < timeLimit; now += secondsPerFrame, ++numFrames)
+	{
+		isDone = true;
+		for (int player = 0; player < MAX_PLAYERS; ++player)
+		{
+			NetplaySession* session = &sessions[player];
+			SimulationState* state = &states[player];
+			double startTime = secondsNow();
+			netplayPoll(session, state, now);
+			if (session->isConnected && state->tick < numTicks)
+			{
+				randomPlayerInput(&inputRandom[player], &inputs[player]);
+				unsigned int events = 0;
+				netplayAdvance(session, state, &inputs[player], now, &events);
+			}
+			netplaySeconds[player] += secondsNow() - startTime;
+
+			if (!session->isConnected || state->tick < numTicks ||
+			    !netplayIsTickConfirmed(session, numTicks))
+				isDone = false;
+		}
+	}
+
+	int result = 0;
+	for (int player = 0; player < MAX_PLAYERS; ++player)
+	{
+		const NetplayStats* stats = &sessions[player].stats;
+		printf("Player %d: %u rollbacks (%.1f ticks on average, longest %u), %u stalls, %u sync "
+		       "waits, %u packets sent (%u dropped), %u received. %.3f ms per frame in netplay and "
+		       "simulation\n",
+		       player + 1, stats->numRollbacks,
+		       stats->numRollbacks ? (double)stats->numTicksResimulated / stats->numRollbacks : 0.0,
+		       stats->longestRollbackTicks, stats->numStalls, stats->numSyncWaits,
+		       stats->numPacketsSent,
+		       stats->numPacketsDropped, stats->numPacketsReceived,
+		       (netplaySeconds[player] * 1000.0) / numFrames);
+		if (sessions[player].isDesynced)
+			result = 1;
+	}
+
+	if (!isDone)
+	{
+		fprintf(stderr, "Netplay test did not finish: peers at ticks %u and %u\n", states[0].tick,
+		        states[1].tick);
+		result = 1;
+	}
+	else if (simulationFullHash(&states[0]) != simulationFullHash(&states[1]))
+	{
+		fprintf(stderr, "Netplay peers DESYNCED: full hashes %016llx and %016llx\n",
+		        (unsigned long long)simulationFullHash(&states[0]),
+		        (unsigned long long)simulationFullHash(&states[1]));
+		result = 1;
+	}
+	else
+		printf("Both peers reached tick %u in the same state after %.1f game seconds. State hash "
+		       "%016llx, full hash %016llx\n",
+		       numTicks, now, (unsigned long long)simulationStateHash(&states[0]),
+		       (unsigned long long)simulationFullHash(&states[0]));
+
+	for (int player = 0; player < MAX_PLAYERS; ++player)
+		netplayClose(&sessions[player]);
+	return result;
+}
+
+//
+// Job scaling
+//
+
+// Returns false if the script couldn't be opened
+static bool runScript(SimulationState* simulation, const char* scriptFilename, int numPlayers,
+                      unsigned int numTicks, JobSystem* jobs, double* elapsedSecondsOut)
+{
+	InputScript script = {0};
+	if (scriptFilename)
+	{
+		script.file = fopen(scriptFilename, "r");
+		if (!script.file)
+		{
+			fprintf(stderr, "Could not open input script %s\n", scriptFilename);
+			return false;
+		}
+		readNextScriptLine(&script);
+	}
+
+	SimulationInput input = {0};
+	double startTime = secondsNow();
+	for (unsigned int tick = 0; tick < numTicks; ++tick)
+	{
+		while (script.hasLine && script.lineTick <= tick)
+		{
+			applyScriptLine(&script, numPlayers, &input);
+			readNextScriptLine(&script);
+		}
+		simulationTickWithJobs(simulation, &input, jobs);
+		input.numEdits = 0;
+		input.skipPhase = false;
+	}
+	*elapsedSecondsOut = secondsNow() - startTime;
+
+	if (script.file)
+		fclose(script.file);
+	return true;
+}
+
+// The first run has no job system, which is what the game does without spare cores. The rest show
+// what the stage graph gains on more threads, and what its bookkeeping costs on one
+static int runJobScaling(uint64_t seed, int ticksPerSecond, int numPlayers, unsigned int numTicks,
+                         const char* scriptFilename, int maxThreads)
+{
+	// Too big for the stack
+	static SimulationState simulation;
+	static JobSystem jobSystem;
+	if (maxThreads <= 0)
+		maxThreads = threadNumHardwareThreads();
+	if (maxThreads > MAX_WORKER_THREADS)
+		maxThreads = MAX_WORKER_THREADS;
+	printf("Simulating %u ticks without jobs, then on up to %d job threads (%d hardware "
+	       "threads)\n",
+	       numTicks, maxThreads, threadNumHardwareThreads());
+
+	int result = 0;
+	double serialTicksPerSecond = 0.0;
+	uint64_t serialHash = 0;
+	for (int threads = 0;; threads = threads ? threads * 2 : 1)
+	{
+		if (threads > maxThreads)
+			threads = maxThreads;
+		JobSystem* jobs = NULL;
+		if (threads)
+		{
+			if (!jobSystemInitialize(&jobSystem, threads))
+			{
+				fprintf(stderr, "Could not start job threads\n");
+				return 1;
+			}
+			jobs = &jobSystem;
+		}
+
+		simulationInitialize(&simulation, seed, ticksPerSecond, numPlayers);
+		double elapsedSeconds = 0.0;
+		bool ranScript =
+		    runScript(&simulation, scriptFilename, numPlayers, numTicks, jobs, &elapsedSeconds);
+		if (jobs)
+			jobSystemDestroy(jobs);
+		if (!ranScript)
+			return 1;
+
+		double ticksPerSecondNow = elapsedSeconds > 0.0 ? numTicks / elapsedSeconds : 0.0;
+		uint64_t hash = simulationFullHash(&simulation);
+		if (!threads)
+		{
+			serialTicksPerSecond = ticksPerSecondNow;
+			serialHash = hash;
+			printf("Without jobs: %.0f ticks per second\n", ticksPerSecondNow);
+		}
+		else
+		{
+			printf("On %d job threads: %.0f ticks per second, %.2fx the speed without jobs\n",
+			       threads, ticksPerSecondNow,
+			       serialTicksPerSecond > 0.0 ? ticksPerSecondNow / serialTicksPerSecond : 0.0);
+			if (hash != serialHash)
+			{
+				fprintf(stderr, "On %d job threads the full hash is %016llx, not %016llx\n",
+				        threads, (unsigned long long)hash, (unsigned long long)serialHash);
+				result = 1;
+			}
+		}
+		if (threads == maxThreads)
+			break;
+	}
+	printf("State hash %016llx, full hash %016llx\n",
+	       (unsigned long long)simulationStateHash(&simulation), (unsigned long long)serialHash);
+	return result;
+}
+
+int main(int numArguments, char** arguments)
+{
+	unsigned int numTicks = 0;
+	unsigned int numSeconds = 60;
+	int ticksPerSecond = c_defaultTicksPerSecond;
+	int numPlayers = 1;
+	uint64_t seed = 0;
+	unsigned int hashInterval = 0;
+	unsigned int rewindSeconds = 0;
+	int numJobThreads = -1;
+	bool runNetplay = false;
+	bool measureJobScaling = false;
+	NetplayOptions netplayOptions = {0};
+	netplayOptions.port = c_netplayDefaultPort;
+	netplayOptions.inputDelayTicks = c_netplayDefaultInputDelayTicks;
+	const char* scriptFilename = NULL;
+	const char* replayFilename = NULL;
+	const char* recordFilename = NULL;
+	const char* loadSnapshotFilename = NULL;
+	const char* saveSnapshotFilename = NULL;
+	const char* autosaveFilename = NULL;
+	for (int i = 1; i < numArguments; ++i)
+	{
+		if (strcmp(arguments[i], "--ticks") == 0 && i + 1 < numArguments)
+			numTicks = strtoul(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--seconds") == 0 && i + 1 < numArguments)
+			numSeconds = strtoul(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--tick-rate") == 0 && i + 1 < numArguments)
+			ticksPerSecond = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--players") == 0 && i + 1 < numArguments)
+			numPlayers = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--seed") == 0 && i + 1 < numArguments)
+			seed = strtoull(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--input") == 0 && i + 1 < numArguments)
+			scriptFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--replay") == 0 && i + 1 < numArguments)
+			replayFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--record") == 0 && i + 1 < numArguments)
+			recordFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--load-snapshot") == 0 && i + 1 < numArguments)
+			loadSnapshotFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--save-snapshot") == 0 && i + 1 < numArguments)
+			saveSnapshotFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--autosave") == 0 && i + 1 < numArguments)
+			autosaveFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--rewind-seconds") == 0 && i + 1 < numArguments)
+			rewindSeconds = strtoul(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--netplay-test") == 0)
+			runNetplay = true;
+		else if (strcmp(arguments[i], "--net-port") == 0 && i + 1 < numArguments)
+			netplayOptions.port = (unsigned short)atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--net-latency") == 0 && i + 1 < numArguments)
+			netplayOptions.conditions.latencyMilliseconds = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--net-jitter") == 0 && i + 1 < numArguments)
+			netplayOptions.conditions.jitterMilliseconds = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--net-loss") == 0 && i + 1 < numArguments)
+			netplayOptions.conditions.lossPercent = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--input-delay") == 0 && i + 1 < numArguments)
+			netplayOptions.inputDelayTicks = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--jobs") == 0 && i + 1 < numArguments)
+			numJobThreads = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--jobs-scaling") == 0)
+			measureJobScaling = true;
+		else if (strcmp(arguments[i], "--hash-every") == 0 && i + 1 < numArguments)
+			hashInterval = strtoul(arguments[++i], NULL, 10);
+		else
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+	}
+
+	if (runNetplay)
+	{
+		// Both peers make up their own input
+		if (scriptFilename || replayFilename || recordFilename || loadSnapshotFilename ||
+		    saveSnapshotFilename || autosaveFilename || !simulationIsValidTickRate(ticksPerSecond))
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+		if (!numTicks)
+			numTicks = numSeconds * ticksPerSecond;
+		return runNetplayTest(seed, ticksPerSecond, numTicks, &netplayOptions);
+	}
+
+	if (measureJobScaling)
+	{
+		// Every run plays the same script from a new game
+		if (replayFilename || recordFilename || loadSnapshotFilename || saveSnapshotFilename ||
+		    autosaveFilename || rewindSeconds || hashInterval ||
+		    !simulationIsValidTickRate(ticksPerSecond) || numPlayers < 1 ||
+		    numPlayers > MAX_PLAYERS)
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+		if (!numTicks)
+			numTicks = numSeconds * ticksPerSecond;
+		return runJobScaling(seed, ticksPerSecond, numPlayers, numTicks, scriptFilename,
+		                     numJobThreads);
+	}
+
+	// Too big for the stack
+	static SimulationState simulationState;
+	SimulationState* simulation = &simulationState;
+	if (loadSnapshotFilename)
+	{
+		// Replays start from a new game, so they can't start from or be recorded after a snapshot
+		if (replayFilename || recordFilename)
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+		double loadStartTime = secondsNow();
+		if (!snapshotLoad(simulation, loadSnapshotFilename))
+			return 1;
+		printf("Loaded snapshot in %.3f milliseconds\n", (secondsNow() - loadStartTime) * 1000.0);
+		ticksPerSecond = simulation->ticksPerSecond;
+		numPlayers = simulation->numPlayers;
+	}
+
+	ReplayReader replay = {0};
+	if (replayFilename)
+	{
+		if (scriptFilename)
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+		if (!replayReaderOpen(&replay, replayFilename))
+			return 1;
+		seed = replay.seed;
+		ticksPerSecond = replay.ticksPerSecond;
+		numPlayers = replay.numPlayers;
+		// Run until the replay ends
+		numTicks = UINT32_MAX;
+	}
+
+	if (!simulationIsValidTickRate(ticksPerSecond) || numPlayers < 1 || numPlayers > MAX_PLAYERS)
+	{
+		printUsage(arguments[0]);
+		return 1;
+	}
+	if (!numTicks)
+		numTicks = numSeconds * ticksPerSecond;
+
+	InputScript script = {0};
+	if (scriptFilename)
+	{
+		script.file = fopen(scriptFilename, "r");
+		if (!script.file)
+		{
+			fprintf(stderr, "Could not open input script %s\n", scriptFilename);
+			return 1;
+		}
+		readNextScriptLine(&script);
+	}
+
+	if (!loadSnapshotFilename)
+		simulationInitialize(simulation, seed, ticksPerSecond, numPlayers);
+
+	ReplayWriter recorder = {0};
+	if (recordFilename &&
+	    !replayWriterOpen(&recorder, recordFilename, seed, ticksPerSecond, numPlayers))
+		return 1;
+
+	RewindBuffer rewind = {0};
+	unsigned int rewindTargetTick = 0;
+	uint64_t rewindTargetHash = 0;
+	if (rewindSeconds)
+	{
+		// Only checkable if we know when the run will end, and it runs past the target
+		unsigned int rewindTicks = rewindSeconds * ticksPerSecond;
+		if (replay.file)
+		{
+			fprintf(stderr, "--rewind-seconds can't be used with --replay\n");
+			return 1;
+		}
+		if (numTicks <= rewindTicks)
+		{
+			fprintf(stderr, "--rewind-seconds %u is %u ticks, but the run is only %u ticks\n",
+			        rewindSeconds, rewindTicks, numTicks);
+			return 1;
+		}
+		if (!rewindInitialize(&rewind, ticksPerSecond, rewindSeconds, 64 * 1024 * 1024))
+			return 1;
+		rewindTargetTick = simulation->tick + numTicks - rewindTicks;
+	}
+
+	// Too big for the stack
+	static JobSystem jobSystem;
+	JobSystem* jobs = NULL;
+	if (numJobThreads >= 0)
+	{
+		if (!jobSystemInitialize(&jobSystem, numJobThreads))
+		{
+			fprintf(stderr, "Could not start job threads\n");
+			return 1;
+		}
+		jobs = &jobSystem;
+	}
+
+	static Autosave autosave;
+	unsigned int autosaveIntervalTicks = c_autosaveDefaultIntervalSeconds * ticksPerSecond;
+	double longestAutosaveSeconds = 0.0;
+	// Requests which copied the state, rather than being skipped. Over a day of game time at the
+	// default interval; later ones only count towards the longest
+	static double autosaveSeconds[2048];
+	int numAutosaveSeconds = 0;
+	if (autosaveFilename && !autosaveInitialize(&autosave, autosaveFilename))
+	{
+		fprintf(stderr, "Could not start autosaving to %s\n", autosaveFilename);
+		return 1;
+	}
+
+	SimulationInput input = {0};
+	int numPhasesFailed = 0;
+	double startTime = secondsNow();
+	unsigned int tick = 0;
+	for (; tick < numTicks; ++tick)
+	{
+		if (replay.file)
+		{
+			if (!replayReaderNextTick(&replay, tick, &input))
+				break;
+		}
+		while (script.hasLine && script.lineTick <= tick)
+		{
+			if (!applyScriptLine(&script, numPlayers, &input))
+				fprintf(stderr, "Script line %d: could not apply command\n", script.lineNumber);
+			readNextScriptLine(&script);
+		}
+
+		if (recorder.file)
+			replayWriterRecordTick(&recorder, tick, &input);
+		if (rewindSeconds)
+		{
+			if (simulation->tick == rewindTargetTick)
+				rewindTargetHash = simulationFullHash(simulation);
+			rewindRecordTick(&rewind, simulation, &input);
+		}
+
+		unsigned int events = simulationTickWithJobs(simulation, &input, jobs);
+		if (events & SimulationEvent_PhaseFailed)
+			++numPhasesFailed;
+
+		if (autosaveFilename && (tick + 1) % autosaveIntervalTicks == 0)
+		{
+			double autosaveStartTime = secondsNow();
+			bool isCopied = autosaveRequest(&autosave, simulation);
+			double requestSeconds = secondsNow() - autosaveStartTime;
+			if (requestSeconds > longestAutosaveSeconds)
+				longestAutosaveSeconds = requestSeconds;
+			if (isCopied && numAutosaveSeconds < ARRAY_SIZE(autosaveSeconds))
+				autosaveSeconds[numAutosaveSeconds++] = requestSeconds;
+		}
+
+		if (hashInterval && (tick + 1) % hashInterval == 0)
+		{
+			printf("Tick %u state %016llx full %016llx\n", tick + 1,
+			       (unsigned long long)simulationStateHash(simulation),
+			       (unsigned long long)simulationFullHash(simulation));
+			if (!simulationVerifyStateHash(simulation))
+			{
+				fprintf(stderr, "Incremental state hash is wrong after tick %u\n", tick + 1);
+				return 1;
+			}
+		}
+
+		// Engine input is held, everything else is only delivered once
+		input.numEdits = 0;
+		input.skipPhase = false;
+	}
+	double elapsedSeconds = secondsNow() - startTime;
+	numTicks = tick;
+
+	int result = 0;
+	if (autosaveFilename)
+	{
+		autosaveDestroy(&autosave);
+		qsort(autosaveSeconds, numAutosaveSeconds, sizeof(double), compareDoubles);
+		double medianAutosaveSeconds =
+		    numAutosaveSeconds ? autosaveSeconds[numAutosaveSeconds / 2] : 0.0;
+		printf("Autosaved %u times (%u skipped, %u failed). The simulation waited %.3f "
+		       "milliseconds on the median one, and at most %.3f\n",
+		       autosave.numSaved, autosave.numSkipped, autosave.numFailed,
+		       medianAutosaveSeconds * 1000.0, longestAutosaveSeconds * 1000.0);
+		// Not the longest: the OS can preempt any one copy for a whole time slice, however short
+		// the copy is, which says nothing about the copy itself
+		if (medianAutosaveSeconds > c_autosaveMaxRequestSeconds)
+		{
+			fprintf(stderr, "Autosaving typically held up the simulation for longer than %.3f "
+			        "milliseconds\n",
+			        c_autosaveMaxRequestSeconds * 1000.0);
+			result = 1;
+		}
+	}
+
+	if (script.file)
+		fclose(script.file);
+	replayWriterClose(&recorder, numTicks, simulationStateHash(simulation));
+
+	if (saveSnapshotFilename)
+	{
+		double saveStartTime = secondsNow();
+		if (snapshotSave(simulation, saveSnapshotFilename))
+			printf("Saved snapshot in %.3f milliseconds\n",
+			       (secondsNow() - saveStartTime) * 1000.0);
+		else
+			result = 1;
+	}
+	if (replay.file)
+	{
+		if (replay.isCorrupt)
+			fprintf(stderr, "Replay was cut short or is corrupt. Stopped after tick %u\n", tick);
+		else if (replay.finalStateHash != simulationStateHash(simulation))
+		{
+			fprintf(stderr, "Replay DESYNCED: final state hash %016llx, recorded %016llx\n",
+			        (unsigned long long)simulationStateHash(simulation),
+			        (unsigned long long)replay.finalStateHash);
+			result = 1;
+		}
+		else
+			printf("Replay reproduced the recorded session exactly\n");
+		replayReaderClose(&replay);
+	}
+
+	Vec2* playerPosition = &simulation->ships[c_playerShipIndex].body.position;
+	const GamePhase* phase = simulationCurrentPhase(simulation);
+	printf("Simulated %u ticks at %d Hz (%.1f game seconds) in %.3f seconds: %.0f ticks per "
+	       "second\n",
+	       numTicks, ticksPerSecond, numTicks * simulation->secondsPerTick, elapsedSeconds,
+	       elapsedSeconds > 0.0 ? numTicks / elapsedSeconds : 0.0);
+	printf("Player at %.1f, %.1f. Phase %d%s. %d phases failed, %d damages sustained%s\n",
+	       playerPosition->x, playerPosition->y, simulation->currentGamePhase,
+	       phase ? "" : " (game over)", numPhasesFailed, simulation->numDamagesSustained,
+	       simulationIsPlayerDestroyed(simulation) ? " (destroyed)" : "");
+	if (jobs)
+	{
+		printf("Ran on %d job threads:", jobs->numThreads);
+		for (int i = 0; i < jobs->numThreads; ++i)
+		{
+			printf(" %d jobs (%d stolen)%s", jobs->workers[i].stats.numJobsRun,
+			       jobs->workers[i].stats.numJobsStolen, i + 1 < jobs->numThreads ? "," : "\n");
+		}
+		jobSystemDestroy(jobs);
+	}
+	printf("State hash %016llx, full hash %016llx\n",
+	       (unsigned long long)simulationStateHash(simulation),
+	       (unsigned long long)simulationFullHash(simulation));
+
+	if (rewindSeconds)
+	{
+		size_t rewindMemory = rewindMemoryUsed(&rewind);
+		size_t rewindBudget = sizeof(SimulationState) + ((size_t)rewindSeconds * ticksPerSecond *
+		                                                 c_rewindBudgetBytesPerTick);
+		printf("Rewind history uses %.1f KiB of its %.1f KiB budget\n", rewindMemory / 1024.0,
+		       rewindBudget / 1024.0);
+		if (rewindMemory > rewindBudget)
+		{
+			fprintf(stderr, "Rewind history is over its memory budget\n");
+			result = 1;
+		}
+		double rewindStartTime = secondsNow();
+		if (!rewindTo(&rewind, simulation, rewindTargetTick))
+		{
+			fprintf(stderr, "Could not rewind to tick %u\n", rewindTargetTick);
+			result = 1;
+		}
+		else
+		{
+			printf("Rewound %u seconds in %.3f milliseconds\n", rewindSeconds,
+			       (secondsNow() - rewindStartTime) * 1000.0);
+			if (simulationFullHash(simulation) != rewindTargetHash)
+			{
+				fprintf(stderr, "Rewound state doesn't match what was simulated at tick %u\n",
+				        rewindTargetTick);
+				result = 1;
+			}
+		}
+	}
+	rewindDestroy(&rewind);
+	return result;
+}
@@ -0,0 +1,325 @@
+#include "Jobs.h"
+
+#include <assert.h>
+#include <string.h>
+
+// How many times an idle worker looks for work before sleeping. Stages tend to start right after
+// the previous one finishes, so going straight to sleep would mean a wake up for nearly every stage
+static const int c_numIdleSpins = 64;
+
+//
+// Deques
+//
+
+// Returns false if the deque is full
+static bool pushJob(JobSystem* system, JobDeque* deque, Job* job)
+{
+	mutexLock(&deque->mutex);
+	bool isFull = deque->bottom - deque->top >= JOB_DEQUE_SIZE;
+	if (!isFull)
+		deque->jobs[deque->bottom++ % JOB_DEQUE_SIZE] = *job;
+	mutexUnlock(&deque->mutex);
+	if (isFull)
+		return false;
+
+	atomicFetchAdd(&system->numQueuedJobs, 1);
+	// A worker about to sleep increments numSleeping before checking numQueuedJobs, so either it
+	// sees this job or we see it and wake it
+	if (atomicLoad(&system->numSleeping))
+	{
+		mutexLock(&system->sleepMutex);
+		conditionWakeAll(&system->wakeUp);
+		mutexUnlock(&system->sleepMutex);
+	}
+	return true;
+}
+
+// fromTop takes the oldest job, which is what thieves want; the owner takes the newest
+static bool takeJob(JobSystem* system, JobDeque* deque, Job* jobOut, bool fromTop)
+{
+	mutexLock(&deque->mutex);
+	bool isEmpty = deque->top == deque->bottom;
+	if (!isEmpty)
+	{
+		if (fromTop)
+			*jobOut = deque->jobs[deque->top++ % JOB_DEQUE_SIZE];
+		else
+			*jobOut = deque->jobs[--deque->bottom % JOB_DEQUE_SIZE];
+		if (deque->top == deque->bottom)
+			deque->top = deque->bottom = 0;
+	}
+	mutexUnlock(&deque->mutex);
+	if (isEmpty)
+		return false;
+	atomicFetchAdd(&system->numQueuedJobs, -1);
+	return true;
+}
+
+static bool findJob(JobSystem* system, JobWorker* worker, Job* jobOut)
+{
+	if (takeJob(system, &worker->deque, jobOut, false))
+		return true;
+	if (!atomicLoad(&system->numQueuedJobs))
+		return false;
+	for (int i = 0; i < system->numThreads - 1; ++i)
+	{
+		int victimIndex = (worker->nextVictim + i) % system->numThreads;
+		if (victimIndex == worker->workerIndex)
+			victimIndex = (victimIndex + 1) % system->numThreads;
+		if (takeJob(system, &system->workers[victimIndex].deque, jobOut, true))
+		{
+			worker->nextVictim = victimIndex;
+			++worker->stats.numJobsStolen;
+			return true;
+		}
+	}
+	return false;
+}
+
+//
+// Stages
+//
+
+static void startStage(JobSystem* system, JobWorker* worker, JobStage* stage);
+
+static void finishStage(JobSystem* system, JobWorker* worker, JobStage* stage)
+{
+	int stageIndex = (int)(stage - system->stages);
+	for (int i = stageIndex + 1; i < system->numStages; ++i)
+	{
+		JobStage* dependent = &system->stages[i];
+		if (!(dependent->dependencies & (1u << stageIndex)))
+			continue;
+		if (atomicFetchAdd(&dependent->numDependenciesLeft, -1) == 1)
+			startStage(system, worker, dependent);
+	}
+
+	if (atomicFetchAdd(&system->numStagesLeft, -1) == 1 && atomicLoad(&system->numSleeping))
+	{
+		// The thread waiting on the graph may be asleep
+		mutexLock(&system->sleepMutex);
+		conditionWakeAll(&system->wakeUp);
+		mutexUnlock(&system->sleepMutex);
+	}
+}
+
+static void startStage(JobSystem* system, JobWorker* worker, JobStage* stage)
+{
+	if (stage->numItems <= 0)
+	{
+		finishStage(system, worker, stage);
+		return;
+	}
+	Job job = {stage, 0, stage->numItems};
+	if (!pushJob(system, &worker->deque, &job))
+	{
+		// Nowhere to put it; this only delays the work, it doesn't lose it
+		stage->function(stage->userData, job.begin, job.end, worker->workerIndex);
+		if (atomicFetchAdd(&stage->numItemsLeft, -stage->numItems) == stage->numItems)
+			finishStage(system, worker, stage);
+	}
+}
+
+static void runJob(JobSystem* system, JobWorker* worker, Job* job)
+{
+	JobStage* stage = job->stage;
+	while (stage->grainSize > 0 && job->end - job->begin > stage->grainSize)
+	{
+		int middle = job->begin + ((job->end - job->begin) / 2);
+		Job upperHalf = {stage, middle, job->end};
+		if (!pushJob(system, &worker->deque, &upperHalf))
+			break;
+		job->end = middle;
+	}
+
+	stage->function(stage->userData, job->begin, job->end, worker->workerIndex);
+	++worker->stats.numJobsRun;
+
+	int numItems = job->end - job->begin;
+	if (atomicFetchAdd(&stage->numItemsLeft, -numItems) == numItems)
+		finishStage(system, worker, stage);
+}
+
+// Returns once there is probably something to do, or done() is true
+static void waitForJobs(JobSystem* system, bool (*done)(JobSystem* system))
+{
+	for (int i = 0; i < c_numIdleSpins; ++i)
+	{
+		if (atomicLoad(&system->numQueuedJobs) || done(system))
+			return;
+		threadYield();
+	}
+
+	mutexLock(&system->sleepMutex);
+	atomicFetchAdd(&system->numSleeping, 1);
+	while (!atomicLoad(&system->numQueuedJobs) && !done(system))
+		conditionWait(&system->wakeUp, &system->sleepMutex);
+	atomicFetchAdd(&system->numSleeping, -1);
+	mutexUnlock(&system->sleepMutex);
+}
+
+static bool isShuttingDown(JobSystem* system)
+{
+	return atomicLoad(&system->isShuttingDown) != 0;
+}
+
+static bool isGraphDone(JobSystem* system)
+{
+	return atomicLoad(&system->numStagesLeft) == 0;
+}
+
+//
+// Workers
+//
+
+static void workerThreadMain(void* userData)
+{
+	JobWorker* worker = (JobWorker*)userData;
+	JobSystem* system = worker->system;
+	for (;;)
+	{
+		Job job;
+		if (findJob(system, worker, &job))
+		{
+			runJob(system, worker, &job);
+			continue;
+		}
+		if (isShuttingDown(system))
+			break;
+		waitForJobs(system, isShuttingDown);
+	}
+}
+
+bool jobSystemInitialize(JobSystem* system, int numThreads)
+{
+	memset(system, 0, sizeof(JobSystem));
+	if (numThreads <= 0)
+		numThreads = threadNumHardwareThreads();
+	if (numThreads > MAX_WORKER_THREADS)
+		numThreads = MAX_WORKER_THREADS;
+	mutexInitialize(&system->sleepMutex);
+	conditionInitialize(&system->wakeUp);
+	for (int i = 0; i < numThreads; ++i)
+	{
+		JobWorker* worker = &system->workers[i];
+		worker->system = system;
+		worker->workerIndex = i;
+		worker->nextVictim = (i + 1) % numThreads;
+		mutexInitialize(&worker->deque.mutex);
+		++system->numDeques;
+	}
+
+	// The calling thread is worker 0
+	system->numThreads = 1;
+	for (int i = 1; i < numThreads; ++i)
+	{
+		JobWorker* worker = &system->workers[i];
+		if (!threadCreate(&worker->thread, workerThreadMain, worker))
+		{
+			jobSystemDestroy(system);
+			return false;
+		}
+		++system->numThreads;
+	}
+	return true;
+}
+
+void jobSystemDestroy(JobSystem* system)
+{
+	mutexLock(&system->sleepMutex);
+	atomicFetchAdd(&system->isShuttingDown, 1);
+	conditionWakeAll(&system->wakeUp);
+	mutexUnlock(&system->sleepMutex);
+	for (int i = 1; i < system->numThreads; ++i)
+		threadJoin(&system->workers[i].thread);
+
+	for (int i = 0; i < system->numDeques; ++i)
+		mutexDestroy(&system->workers[i].deque.mutex);
+	conditionDestroy(&system->wakeUp);
+	mutexDestroy(&system->sleepMutex);
+	system->numThreads = 0;
+	system->numDeques = 0;
+}
+
+//
+// Graphs
+//
+
+static int countBits(uint32_t bits)
+{
+	int count = 0;
+	for (; bits; bits &= bits - 1)
+		++count;
+	return count;
+}
+
+void jobSystemBeginGraph(JobSystem* system, JobStage* stages, int numStages)
+{
+	if (!system)
+	{
+		// Dependencies are always on earlier stages, so in order is a valid order
+		for (int i = 0; i < numStages; ++i)
+		{
+			if (stages[i].numItems > 0)
+				stages[i].function(stages[i].userData, 0, stages[i].numItems, 0);
+		}
+		return;
+	}
+
+	assert(numStages <= JOB_MAX_STAGES);
+	assert(isGraphDone(system) && "Only one graph can run at a time");
+	for (int i = 0; i < numStages; ++i)
+	{
+		assert(!(stages[i].dependencies >> i) && "Stages can only depend on earlier stages");
+		stages[i].numItemsLeft = stages[i].numItems;
+		stages[i].numDependenciesLeft = countBits(stages[i].dependencies);
+	}
+	system->stages = stages;
+	system->numStages = numStages;
+	atomicFetchAdd(&system->numStagesLeft, numStages);
+
+	for (int i = 0; i < numStages; ++i)
+	{
+		if (!stages[i].dependencies)
+			startStage(system, &system->workers[0], &stages[i]);
+	}
+}
+
+void jobSystemWaitGraph(JobSystem* system)
+{
+	if (!system)
+		return;
+	JobWorker* worker = &system->workers[0];
+	while (!isGraphDone(system))
+	{
+		Job job;
+		if (findJob(system, worker, &job))
+			runJob(system, worker, &job);
+		else
+			waitForJobs(system, isGraphDone);
+	}
+}
+
+void jobSystemRunGraph(JobSystem* system, JobStage* stages, int numStages)
+{
+	jobSystemBeginGraph(system, stages, numStages);
+	jobSystemWaitGraph(system);
+}
+
+void jobSystemParallelFor(JobSystem* system, int numItems, int grainSize, JobRangeFunction function,
+                          void* userData)
+{
+	JobStage stage = {0};
+	stage.name = "ParallelFor";
+	stage.function = function;
+	stage.userData = userData;
+	stage.numItems = numItems;
+	stage.grainSize = grainSize;
+	jobSystemRunGraph(system, &stage, 1);
+}
+
+void jobSystemResetStats(JobSystem* system)
+{
+	for (int i = 0; i < system->numThreads; ++i)
+		memset(&system->workers[i].stats, 0, sizeof(JobWorkerStats));
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// A small work-stealing job system. Work is described as a graph of stages, each a range of items
+// split into jobs. Stages whose dependencies are done run at the same time, so independent work
+// overlaps instead of waiting on the slowest part of the previous stage
+//
+// Each worker pushes and pops jobs at the bottom of its own deque, and steals from the top of the
+// others' when it runs dry. Splitting a range pushes the upper half and keeps working on the lower,
+// so the big pieces are the ones left to steal
+//
+// Like Simulation.h, this must not depend on SDL
+
+#include "Threads.h"
+
+#define MAX_WORKER_THREADS 64
+#define JOB_MAX_STAGES 32
+#define JOB_DEQUE_SIZE 256
+
+// Items [begin, end) of the stage. workerIndex is 0 for the thread which started the graph and 1 to
+// numThreads - 1 for the system's threads, so per-worker data can be indexed without locking
+typedef void (*JobRangeFunction)(void* userData, int begin, int end, int workerIndex);
+
+typedef struct JobStage
+{
+	// For debugging and stats only
+	const char* name;
+	JobRangeFunction function;
+	void* userData;
+	int numItems;
+	// Ranges are split until they are no larger than this. 0 runs the whole range as one job, e.g.
+	// for work which must happen in order
+	int grainSize;
+	// Bit i set means the stage waits for stage i of the same graph, which must be an earlier one
+	uint32_t dependencies;
+
+	// Set up by jobSystemBeginGraph()
+	volatile int32_t numItemsLeft;
+	volatile int32_t numDependenciesLeft;
+} JobStage;
+
+typedef struct Job
+{
+	JobStage* stage;
+	int begin;
+	int end;
+} Job;
+
+// Mutex-guarded ring. The owner only contends with thieves, and jobs are coarse enough that this
+// doesn't show up next to the work itself
+typedef struct JobDeque
+{
+	Mutex mutex;
+	// Oldest (stolen first) at top, newest at bottom. Grow without wrapping; indexed modulo size
+	int top;
+	int bottom;
+	Job jobs[JOB_DEQUE_SIZE];
+} JobDeque;
+
+typedef struct JobWorkerStats
+{
+	int numJobsRun;
+	// Of numJobsRun, how many came from other workers' deques
+	int numJobsStolen;
+} JobWorkerStats;
+
+struct JobSystem;
+typedef struct JobWorker
+{
+	struct JobSystem* system;
+	int workerIndex;
+	// Where this worker starts looking when stealing, so thieves spread out
+	int nextVictim;
+	Thread thread;
+	JobDeque deque;
+	JobWorkerStats stats;
+	// Keep workers' counters off each others' cache lines
+	char padding[64];
+} JobWorker;
+
+typedef struct JobSystem
+{
+	// Including the thread which starts graphs
+	int numThreads;
+	JobWorker workers[MAX_WORKER_THREADS];
+	// Workers whose deque mutex is set up. Threads may have failed to start for some of them
+	int numDeques;
+
+	JobStage* stages;
+	int numStages;
+	volatile int32_t numStagesLeft;
+
+	// Jobs pushed but not yet popped or stolen, summed across deques
+	volatile int32_t numQueuedJobs;
+	// Workers only sleep once there is nothing queued; pushing wakes them
+	volatile int32_t numSleeping;
+	Mutex sleepMutex;
+	Condition wakeUp;
+	// Read while spinning, so set atomically
+	volatile int32_t isShuttingDown;
+} JobSystem;
+
+// numThreads <= 0 means one per hardware thread
+bool jobSystemInitialize(JobSystem* system, int numThreads);
+void jobSystemDestroy(JobSystem* system);
+
+// Starts running the stages, which must stay valid until jobSystemWaitGraph() returns. The caller
+// is free to do other work in the meantime. Only one graph runs at a time, and only from one
+// thread, which acts as worker 0. Threads which each need to run graphs should each have their own
+// system. A NULL system runs the stages one after another on the calling thread before returning
+void jobSystemBeginGraph(JobSystem* system, JobStage* stages, int numStages);
+// Helps run the graph's jobs until all of its stages are done
+void jobSystemWaitGraph(JobSystem* system);
+void jobSystemRunGraph(JobSystem* system, JobStage* stages, int numStages);
+void jobSystemParallelFor(JobSystem* system, int numItems, int grainSize, JobRangeFunction function,
+                          void* userData);
+
+void jobSystemResetStats(JobSystem* system);
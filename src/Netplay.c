@@ -0,0 +1,665 @@
+#include "Netplay.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#include <winsock2.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef int socklen_t;
+#define closeSocket closesocket
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define closeSocket close
+#endif
+
+static const char c_netplayMagic[4] = {'S', 'F', 'N', 'P'};
+static const unsigned char c_netplayProtocolVersion = 1;
+// The guest says hello this often until the host answers
+static const double c_netplayHelloIntervalSeconds = 0.1;
+// Unacknowledged inputs are resent this often even when there are no new ones to send
+static const double c_netplayResendIntervalSeconds = 0.02;
+
+#define NETPLAY_MAX_INPUTS_PER_PACKET 32
+#define NUM_SAVED_STATES (NETPLAY_MAX_PREDICTION_TICKS + 1)
+
+typedef enum NetplayPacketType
+{
+	// Host and guest find each other. The host's says which session to start
+	NetplayPacket_Hello = 1,
+	// A run of the sender's inputs, plus acknowledgement, the sender's latest confirmed hash, and
+	// how far ahead the sender is
+	NetplayPacket_Inputs = 2,
+} NetplayPacketType;
+
+//
+// Packet encoding
+//
+
+typedef struct PacketWriter
+{
+	unsigned char data[NETPLAY_MAX_PACKET_SIZE];
+	int size;
+} PacketWriter;
+
+static void writeU8(PacketWriter* writer, unsigned int value)
+{
+	assert(writer->size + 1 <= NETPLAY_MAX_PACKET_SIZE);
+	writer->data[writer->size++] = (unsigned char)value;
+}
+
+static void writeU32(PacketWriter* writer, uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		writeU8(writer, (value >> (i * 8)) & 0xff);
+}
+
+static void writeU64(PacketWriter* writer, uint64_t value)
+{
+	for (int i = 0; i < 8; ++i)
+		writeU8(writer, (value >> (i * 8)) & 0xff);
+}
+
+typedef struct PacketReader
+{
+	const unsigned char* data;
+	int size;
+	int position;
+	// Reads past the end return 0 and set this
+	bool isOverrun;
+} PacketReader;
+
+static unsigned int readU8(PacketReader* reader)
+{
+	if (reader->position >= reader->size)
+	{
+		reader->isOverrun = true;
+		return 0;
+	}
+	return reader->data[reader->position++];
+}
+
+static uint32_t readU32(PacketReader* reader)
+{
+	uint32_t value = 0;
+	for (int i = 0; i < 4; ++i)
+		value |= (uint32_t)readU8(reader) << (i * 8);
+	return value;
+}
+
+static uint64_t readU64(PacketReader* reader)
+{
+	uint64_t value = 0;
+	for (int i = 0; i < 8; ++i)
+		value |= (uint64_t)readU8(reader) << (i * 8);
+	return value;
+}
+
+static void writePacketHeader(NetplaySession* session, PacketWriter* writer,
+                              NetplayPacketType type)
+{
+	writer->size = 0;
+	for (int i = 0; i < 4; ++i)
+		writeU8(writer, c_netplayMagic[i]);
+	writeU8(writer, c_netplayProtocolVersion);
+	writeU8(writer, type);
+	writeU8(writer, session->localPlayer);
+}
+
+// The edits' ship is implied by the player
+static void writePlayerInput(PacketWriter* writer, const PlayerInput* input)
+{
+	writeU8(writer, input->engineInput);
+	writeU8(writer, input->skipPhase);
+	writeU8(writer, input->numEdits);
+	for (int i = 0; i < input->numEdits; ++i)
+	{
+		writeU8(writer, input->edits[i].cellX);
+		writeU8(writer, input->edits[i].cellY);
+		writeU8(writer, input->edits[i].buildableTile);
+	}
+}
+
+static bool readPlayerInput(PacketReader* reader, int player, PlayerInput* input)
+{
+	memset(input, 0, sizeof(PlayerInput));
+	input->engineInput = readU8(reader);
+	input->skipPhase = readU8(reader) != 0;
+	input->numEdits = readU8(reader);
+	if (input->numEdits > MAX_EDITS_PER_PLAYER)
+		return false;
+	for (int i = 0; i < input->numEdits; ++i)
+	{
+		EditCommand* edit = &input->edits[i];
+		edit->ship = player;
+		edit->cellX = readU8(reader);
+		edit->cellY = readU8(reader);
+		edit->buildableTile = readU8(reader);
+	}
+	return !reader->isOverrun;
+}
+
+static bool playerInputsEqual(const PlayerInput* a, const PlayerInput* b)
+{
+	return a->engineInput == b->engineInput && a->skipPhase == b->skipPhase &&
+	       a->numEdits == b->numEdits &&
+	       memcmp(a->edits, b->edits, a->numEdits * sizeof(EditCommand)) == 0;
+}
+
+//
+// Sockets and network conditions
+//
+
+static void sendRaw(NetplaySession* session, const unsigned char* data, int size)
+{
+	struct sockaddr_in address = {0};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = session->peerAddress;
+	address.sin_port = session->peerPort;
+	sendto(session->socket, (const char*)data, size, 0, (struct sockaddr*)&address,
+	       sizeof(address));
+}
+
+static void sendPacket(NetplaySession* session, const PacketWriter* writer, double nowSeconds)
+{
+	if (!session->hasPeerAddress)
+		return;
+	++session->stats.numPacketsSent;
+
+	const NetplayConditions* conditions = &session->options.conditions;
+	if (conditions->lossPercent &&
+	    randomRange(&session->conditionsRandom, 100) < conditions->lossPercent)
+	{
+		++session->stats.numPacketsDropped;
+		return;
+	}
+
+	int latencyMilliseconds = conditions->latencyMilliseconds;
+	if (conditions->jitterMilliseconds)
+		latencyMilliseconds += randomRange(&session->conditionsRandom,
+		                                   (conditions->jitterMilliseconds * 2) + 1) -
+		                       conditions->jitterMilliseconds;
+	if (latencyMilliseconds <= 0)
+	{
+		sendRaw(session, writer->data, writer->size);
+		return;
+	}
+
+	if (session->numDelayedPackets == NETPLAY_MAX_DELAYED_PACKETS)
+	{
+		++session->stats.numPacketsDropped;
+		return;
+	}
+	NetplayDelayedPacket* packet = &session->delayedPackets[session->numDelayedPackets++];
+	packet->sendTime = nowSeconds + (latencyMilliseconds / 1000.0);
+	packet->size = writer->size;
+	memcpy(packet->data, writer->data, writer->size);
+}
+
+static void sendDelayedPackets(NetplaySession* session, double nowSeconds)
+{
+	for (int i = 0; i < session->numDelayedPackets;)
+	{
+		NetplayDelayedPacket* packet = &session->delayedPackets[i];
+		if (packet->sendTime > nowSeconds)
+		{
+			++i;
+			continue;
+		}
+		sendRaw(session, packet->data, packet->size);
+		// Order doesn't matter; jitter reorders packets anyways
+		*packet = session->delayedPackets[--session->numDelayedPackets];
+	}
+}
+
+static bool openSocket(NetplaySession* session, unsigned short port)
+{
+#ifdef WINDOWS
+	WSADATA windowsSocketsData;
+	if (WSAStartup(MAKEWORD(2, 2), &windowsSocketsData) != 0)
+		return false;
+	SOCKET newSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (newSocket == INVALID_SOCKET)
+	{
+		WSACleanup();
+		return false;
+	}
+#else
+	int newSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (newSocket < 0)
+		return false;
+#endif
+	session->socket = (intptr_t)newSocket;
+
+	struct sockaddr_in address = {0};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(newSocket, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "Could not bind netplay socket to port %d\n", port);
+		closeSocket(newSocket);
+#ifdef WINDOWS
+		WSACleanup();
+#endif
+		return false;
+	}
+
+#ifdef WINDOWS
+	u_long isNonBlocking = 1;
+	ioctlsocket(newSocket, FIONBIO, &isNonBlocking);
+#else
+	fcntl(newSocket, F_SETFL, fcntl(newSocket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	return true;
+}
+
+//
+// Rollback
+//
+
+static PlayerInput* inputAt(NetplaySession* session, unsigned int tick, int player)
+{
+	return &session->inputs[tick % NETPLAY_INPUT_HISTORY_TICKS][player];
+}
+
+static void startSession(NetplaySession* session, SimulationState* state)
+{
+	session->isConnected = true;
+	simulationInitialize(state, session->options.seed, session->options.ticksPerSecond,
+	                     MAX_PLAYERS);
+
+	// Nobody has input for the first ticks; they are covered by the input delay
+	memset(session->inputs, 0, sizeof(session->inputs));
+	session->localInputEnd = session->options.inputDelayTicks;
+	session->remoteInputEnd = session->options.inputDelayTicks;
+	session->localInputAcknowledgedEnd = session->options.inputDelayTicks;
+	session->firstMispredictedTick = UINT32_MAX;
+	session->remoteTickAdvantage = 0;
+	session->lastSyncWaitTick = 0;
+	for (int i = 0; i < NETPLAY_NUM_CHECKED_HASHES; ++i)
+		session->confirmedHashes[i].tick = UINT32_MAX;
+	session->latestConfirmedHash.tick = UINT32_MAX;
+
+	fprintf(stderr, "Netplay: connected as player %d. Seed %llu, %d Hz, %d ticks input delay\n",
+	        session->localPlayer + 1, (unsigned long long)session->options.seed,
+	        session->options.ticksPerSecond, session->options.inputDelayTicks);
+}
+
+// Remote input we don't have yet is predicted to be the same as the last we got, minus any one-off
+// actions. Players tend to hold their engines for a while, so this is usually right
+static void buildSimulationInput(NetplaySession* session, unsigned int tick,
+                                 SimulationInput* input)
+{
+	PlayerInput* remoteInput = inputAt(session, tick, session->remotePlayer);
+	if (tick >= session->remoteInputEnd)
+	{
+		memset(remoteInput, 0, sizeof(PlayerInput));
+		if (session->remoteInputEnd)
+			remoteInput->engineInput =
+			    inputAt(session, session->remoteInputEnd - 1, session->remotePlayer)->engineInput;
+	}
+
+	memset(input, 0, sizeof(SimulationInput));
+	for (int player = 0; player < MAX_PLAYERS; ++player)
+	{
+		const PlayerInput* playerInput = inputAt(session, tick, player);
+		input->engineInput[player] = playerInput->engineInput;
+		input->skipPhase |= playerInput->skipPhase;
+		for (int i = 0; i < playerInput->numEdits; ++i)
+			input->edits[input->numEdits++] = playerInput->edits[i];
+	}
+}
+
+static unsigned int simulateTick(NetplaySession* session, SimulationState* state)
+{
+	SimulationInput input;
+	buildSimulationInput(session, state->tick, &input);
+
+	memcpy(&session->savedStates[state->tick % NUM_SAVED_STATES], state, sizeof(SimulationState));
+	// Rollbacks never go back past a tick all the inputs were known for, so its hash is final
+	if (state->tick % c_netplayHashInterval == 0 && state->tick <= session->remoteInputEnd)
+	{
+		NetplayConfirmedHash confirmed = {state->tick, simulationStateHash(state)};
+		session->confirmedHashes[(state->tick / c_netplayHashInterval) %
+		                         NETPLAY_NUM_CHECKED_HASHES] = confirmed;
+		session->latestConfirmedHash = confirmed;
+	}
+
+	return simulationTick(state, &input);
+}
+
+static bool rollBack(NetplaySession* session, SimulationState* state)
+{
+	unsigned int rollbackTick = session->firstMispredictedTick;
+	session->firstMispredictedTick = UINT32_MAX;
+	if (rollbackTick >= state->tick)
+		return false;
+
+	unsigned int endTick = state->tick;
+	unsigned int numTicks = endTick - rollbackTick;
+	assert(numTicks <= NETPLAY_MAX_PREDICTION_TICKS && "Rolled back further than was saved");
+	memcpy(state, &session->savedStates[rollbackTick % NUM_SAVED_STATES],
+	       sizeof(SimulationState));
+	// The events already happened as far as the presentation is concerned
+	while (state->tick < endTick)
+		simulateTick(session, state);
+
+	++session->stats.numRollbacks;
+	session->stats.numTicksResimulated += numTicks;
+	if (numTicks > session->stats.longestRollbackTicks)
+		session->stats.longestRollbackTicks = numTicks;
+	return true;
+}
+
+// How many ticks ahead we are of the last input we got from the remote. Includes the time it took
+// to get here, which is the same both ways on average
+static int localTickAdvantage(const NetplaySession* session, const SimulationState* state)
+{
+	return (int)state->tick - (int)(session->remoteInputEnd - session->options.inputDelayTicks);
+}
+
+//
+// Messages
+//
+
+static void sendHello(NetplaySession* session, double nowSeconds)
+{
+	PacketWriter writer;
+	writePacketHeader(session, &writer, NetplayPacket_Hello);
+	writeU64(&writer, session->options.seed);
+	writeU32(&writer, session->options.ticksPerSecond);
+	writeU8(&writer, session->options.inputDelayTicks);
+	sendPacket(session, &writer, nowSeconds);
+	session->lastHelloTime = nowSeconds;
+}
+
+// Resends everything the remote hasn't acknowledged, so a lost packet costs nothing as long as a
+// later one gets through
+static void sendInputs(NetplaySession* session, const SimulationState* state, double nowSeconds)
+{
+	PacketWriter writer;
+	writePacketHeader(session, &writer, NetplayPacket_Inputs);
+	writeU32(&writer, session->remoteInputEnd);
+	writeU32(&writer, session->latestConfirmedHash.tick);
+	writeU64(&writer, session->latestConfirmedHash.hash);
+	writeU8(&writer, (unsigned char)(signed char)localTickAdvantage(session, state));
+
+	unsigned int firstTick = session->localInputAcknowledgedEnd;
+	unsigned int numInputs = session->localInputEnd - firstTick;
+	if (numInputs > NETPLAY_MAX_INPUTS_PER_PACKET)
+		numInputs = NETPLAY_MAX_INPUTS_PER_PACKET;
+	writeU32(&writer, firstTick);
+	writeU8(&writer, numInputs);
+	for (unsigned int tick = firstTick; tick < firstTick + numInputs; ++tick)
+		writePlayerInput(&writer, inputAt(session, tick, session->localPlayer));
+
+	sendPacket(session, &writer, nowSeconds);
+	session->lastSendTime = nowSeconds;
+}
+
+static unsigned int receiveHello(NetplaySession* session, PacketReader* reader,
+                                 SimulationState* state, double nowSeconds)
+{
+	uint64_t seed = readU64(reader);
+	int ticksPerSecond = (int)readU32(reader);
+	int inputDelayTicks = readU8(reader);
+	if (reader->isOverrun)
+		return 0;
+
+	if (session->localPlayer == 0)
+	{
+		// Answer every hello, in case our previous answer was lost
+		sendHello(session, nowSeconds);
+		if (session->isConnected)
+			return 0;
+	}
+	else
+	{
+		if (session->isConnected)
+			return 0;
+		if (!simulationIsValidTickRate(ticksPerSecond) ||
+		    inputDelayTicks > c_netplayMaxInputDelayTicks)
+		{
+			fprintf(stderr, "Netplay: host sent an invalid session\n");
+			return 0;
+		}
+		session->options.seed = seed;
+		session->options.ticksPerSecond = ticksPerSecond;
+		session->options.inputDelayTicks = inputDelayTicks;
+	}
+
+	startSession(session, state);
+	return NetplayPoll_Connected;
+}
+
+static void receiveInputs(NetplaySession* session, PacketReader* reader,
+                          const SimulationState* state)
+{
+	unsigned int acknowledgedEnd = readU32(reader);
+	NetplayConfirmedHash remoteHash;
+	remoteHash.tick = readU32(reader);
+	remoteHash.hash = readU64(reader);
+	int remoteTickAdvantage = (signed char)readU8(reader);
+	unsigned int firstTick = readU32(reader);
+	unsigned int numInputs = readU8(reader);
+	if (reader->isOverrun)
+		return;
+
+	session->remoteTickAdvantage = remoteTickAdvantage;
+	if (acknowledgedEnd > session->localInputAcknowledgedEnd &&
+	    acknowledgedEnd <= session->localInputEnd)
+		session->localInputAcknowledgedEnd = acknowledgedEnd;
+
+	const NetplayConfirmedHash* localHash =
+	    &session->confirmedHashes[(remoteHash.tick / c_netplayHashInterval) %
+	                              NETPLAY_NUM_CHECKED_HASHES];
+	if (!session->isDesynced && localHash->tick == remoteHash.tick &&
+	    localHash->hash != remoteHash.hash)
+	{
+		session->isDesynced = true;
+		session->desyncTick = remoteHash.tick;
+		fprintf(stderr, "Netplay: DESYNCED at tick %u\n", remoteHash.tick);
+	}
+
+	for (unsigned int i = 0; i < numInputs; ++i)
+	{
+		PlayerInput input;
+		if (!readPlayerInput(reader, session->remotePlayer, &input))
+			return;
+
+		unsigned int tick = firstTick + i;
+		if (tick < session->remoteInputEnd)
+			continue;
+		// Inputs are only taken in order. Also, don't overwrite inputs a rollback could still need
+		if (tick > session->remoteInputEnd ||
+		    tick + NETPLAY_MAX_PREDICTION_TICKS >= state->tick + NETPLAY_INPUT_HISTORY_TICKS)
+			return;
+
+		PlayerInput* storedInput = inputAt(session, tick, session->remotePlayer);
+		if (tick < state->tick && !playerInputsEqual(storedInput, &input) &&
+		    tick < session->firstMispredictedTick)
+			session->firstMispredictedTick = tick;
+		*storedInput = input;
+		++session->remoteInputEnd;
+	}
+}
+
+//
+// Interface
+//
+
+bool netplayOpen(NetplaySession* session, const NetplayOptions* options)
+{
+	memset(session, 0, sizeof(NetplaySession));
+	if (options->localPlayer < 0 || options->localPlayer >= MAX_PLAYERS ||
+	    options->inputDelayTicks < 0 || options->inputDelayTicks > c_netplayMaxInputDelayTicks ||
+	    (options->localPlayer == 0 && !simulationIsValidTickRate(options->ticksPerSecond)))
+		return false;
+	session->options = *options;
+	session->localPlayer = options->localPlayer;
+	session->remotePlayer = options->localPlayer == 0 ? 1 : 0;
+	session->lastHelloTime = -c_netplayHelloIntervalSeconds;
+	randomSeed(&session->conditionsRandom, options->port, options->localPlayer);
+
+	session->savedStates = malloc(NUM_SAVED_STATES * sizeof(SimulationState));
+	session->delayedPackets = malloc(NETPLAY_MAX_DELAYED_PACKETS * sizeof(NetplayDelayedPacket));
+	if (!session->savedStates || !session->delayedPackets)
+	{
+		free(session->savedStates);
+		free(session->delayedPackets);
+		return false;
+	}
+
+	// The guest lets the system pick its port; the host learns it from the guest's hello
+	if (!openSocket(session, options->localPlayer == 0 ? options->port : 0))
+	{
+		free(session->savedStates);
+		free(session->delayedPackets);
+		return false;
+	}
+	if (options->localPlayer != 0)
+	{
+		session->peerAddress =
+		    inet_addr(options->hostAddress ? options->hostAddress : "127.0.0.1");
+		session->peerPort = htons(options->port);
+		session->hasPeerAddress = true;
+	}
+	return true;
+}
+
+void netplayClose(NetplaySession* session)
+{
+	closeSocket(session->socket);
+#ifdef WINDOWS
+	WSACleanup();
+#endif
+	free(session->savedStates);
+	free(session->delayedPackets);
+	memset(session, 0, sizeof(NetplaySession));
+}
+
+unsigned int netplayPoll(NetplaySession* session, SimulationState* state, double nowSeconds)
+{
+	unsigned int result = 0;
+	sendDelayedPackets(session, nowSeconds);
+
+	for (;;)
+	{
+		unsigned char data[NETPLAY_MAX_PACKET_SIZE];
+		struct sockaddr_in fromAddress;
+		socklen_t fromAddressSize = sizeof(fromAddress);
+		int size = recvfrom(session->socket, (char*)data, sizeof(data), 0,
+		                    (struct sockaddr*)&fromAddress, &fromAddressSize);
+		if (size < 0)
+		{
+#ifdef WINDOWS
+			// Windows reports ICMP port unreachable here when the peer isn't up yet
+			if (WSAGetLastError() == WSAECONNRESET)
+				continue;
+#endif
+			break;
+		}
+
+		PacketReader reader = {data, size, 0, false};
+		char magic[4];
+		for (int i = 0; i < 4; ++i)
+			magic[i] = readU8(&reader);
+		unsigned int version = readU8(&reader);
+		unsigned int type = readU8(&reader);
+		unsigned int player = readU8(&reader);
+		if (reader.isOverrun || memcmp(magic, c_netplayMagic, sizeof(magic)) != 0 ||
+		    version != c_netplayProtocolVersion || player != (unsigned int)session->remotePlayer)
+			continue;
+
+		if (session->hasPeerAddress)
+		{
+			if (fromAddress.sin_addr.s_addr != session->peerAddress ||
+			    fromAddress.sin_port != session->peerPort)
+				continue;
+		}
+		else if (type == NetplayPacket_Hello)
+		{
+			// The first guest to say hello is the one we play with
+			session->peerAddress = fromAddress.sin_addr.s_addr;
+			session->peerPort = fromAddress.sin_port;
+			session->hasPeerAddress = true;
+		}
+		else
+			continue;
+
+		++session->stats.numPacketsReceived;
+		if (type == NetplayPacket_Hello)
+			result |= receiveHello(session, &reader, state, nowSeconds);
+		else if (type == NetplayPacket_Inputs && session->isConnected)
+			receiveInputs(session, &reader, state);
+	}
+
+	if (!session->isConnected)
+	{
+		if (session->localPlayer != 0 &&
+		    nowSeconds - session->lastHelloTime >= c_netplayHelloIntervalSeconds)
+			sendHello(session, nowSeconds);
+		sendDelayedPackets(session, nowSeconds);
+		return result;
+	}
+
+	if (rollBack(session, state))
+		result |= NetplayPoll_RolledBack;
+
+	if (nowSeconds - session->lastSendTime >= c_netplayResendIntervalSeconds)
+		sendInputs(session, state, nowSeconds);
+	sendDelayedPackets(session, nowSeconds);
+	return result;
+}
+
+bool netplayAdvance(NetplaySession* session, SimulationState* state, const PlayerInput* localInput,
+                    double nowSeconds, unsigned int* events)
+{
+	*events = 0;
+	if (!session->isConnected)
+		return false;
+	// Predicting further would need a longer rollback than we keep states for
+	if (state->tick >= session->remoteInputEnd + NETPLAY_MAX_PREDICTION_TICKS)
+	{
+		++session->stats.numStalls;
+		return false;
+	}
+	// Each wait moves us one tick closer to the remote and them one further from us. Only wait
+	// every so often so the time lost isn't noticeable
+	if (localTickAdvantage(session, state) - session->remoteTickAdvantage >= 2 &&
+	    state->tick >= session->lastSyncWaitTick + c_netplayTicksBetweenSyncWaits)
+	{
+		session->lastSyncWaitTick = state->tick;
+		++session->stats.numSyncWaits;
+		return false;
+	}
+
+	PlayerInput* storedInput = inputAt(session, session->localInputEnd, session->localPlayer);
+	*storedInput = *localInput;
+	if (storedInput->numEdits > MAX_EDITS_PER_PLAYER)
+		storedInput->numEdits = MAX_EDITS_PER_PLAYER;
+	for (int i = 0; i < storedInput->numEdits; ++i)
+		storedInput->edits[i].ship = session->localPlayer;
+	++session->localInputEnd;
+
+	*events = simulateTick(session, state);
+
+	// Get the new input out as soon as possible
+	sendInputs(session, state, nowSeconds);
+	sendDelayedPackets(session, nowSeconds);
+	return true;
+}
+
+bool netplayIsTickConfirmed(const NetplaySession* session, unsigned int tick)
+{
+	return session->isConnected && tick <= session->remoteInputEnd;
+}
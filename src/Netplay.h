@@ -0,0 +1,176 @@
+#pragma once
+
+// Rollback netcode for two player co-op over UDP
+//
+// Each peer simulates every tick as soon as its own player's input is known, predicting that the
+// remote player is still doing whatever they last did. Every tick's starting state is saved first.
+// When the real remote input arrives and differs from the prediction, the state is restored to that
+// tick and the ticks since are re-simulated with the right input. The simulation is deterministic,
+// so once both peers have all the inputs they are in the same state, which is checked by exchanging
+// state hashes
+//
+// Like Simulation.h, this must not depend on SDL. The caller passes in the time, which is only used
+// for resending and for the artificial network conditions
+
+#include "Simulation.h"
+
+// How far a peer may run ahead of the remote input it has. Also the longest possible rollback
+#define NETPLAY_MAX_PREDICTION_TICKS 16
+// Inputs are kept in a ring indexed by tick % NETPLAY_INPUT_HISTORY_TICKS. It must hold the
+// rollback window, plus how far ahead the remote can get, plus the input delay
+#define NETPLAY_INPUT_HISTORY_TICKS 64
+#define NETPLAY_MAX_DELAYED_PACKETS 256
+#define NETPLAY_MAX_PACKET_SIZE 512
+#define NETPLAY_NUM_CHECKED_HASHES 16
+
+static const int c_netplayMaxInputDelayTicks = 8;
+static const int c_netplayDefaultInputDelayTicks = 2;
+static const unsigned short c_netplayDefaultPort = 27960;
+// How often peers compare state hashes
+static const unsigned int c_netplayHashInterval = 30;
+// The peer which is further ahead waits a tick at most this often to let the other catch up
+static const unsigned int c_netplayTicksBetweenSyncWaits = 10;
+
+#define MAX_EDITS_PER_PLAYER (MAX_EDITS_PER_TICK / MAX_PLAYERS)
+
+// What one player does in one tick. Merged with the other player's to make a SimulationInput
+typedef struct PlayerInput
+{
+	unsigned char engineInput;
+	bool skipPhase;
+	unsigned char numEdits;
+	// Always on the player's own ship
+	EditCommand edits[MAX_EDITS_PER_PLAYER];
+} PlayerInput;
+
+// Applied to outgoing packets, so both peers need them for the full effect
+typedef struct NetplayConditions
+{
+	// One way
+	int latencyMilliseconds;
+	// Each packet's latency varies by up to this much either way, which also reorders packets
+	int jitterMilliseconds;
+	int lossPercent;
+} NetplayConditions;
+
+typedef struct NetplayOptions
+{
+	// 0 hosts, 1 joins
+	int localPlayer;
+	// The host listens on this port. The guest sends to it
+	unsigned short port;
+	// The guest connects to this IPv4 address. NULL means 127.0.0.1
+	const char* hostAddress;
+
+	// The host decides these for both peers
+	uint64_t seed;
+	int ticksPerSecond;
+	// Local input is applied this many ticks later than it is read. Costs responsiveness, but
+	// gives it time to reach the remote before they need it, which means fewer rollbacks
+	int inputDelayTicks;
+
+	NetplayConditions conditions;
+} NetplayOptions;
+
+typedef struct NetplayStats
+{
+	unsigned int numRollbacks;
+	unsigned int numTicksResimulated;
+	unsigned int longestRollbackTicks;
+	// netplayAdvance() calls which had to wait for the remote to catch up
+	unsigned int numStalls;
+	// netplayAdvance() calls which waited to even out how far ahead each peer runs
+	unsigned int numSyncWaits;
+	unsigned int numPacketsSent;
+	unsigned int numPacketsReceived;
+	// By the artificial loss
+	unsigned int numPacketsDropped;
+} NetplayStats;
+
+typedef struct NetplayDelayedPacket
+{
+	double sendTime;
+	int size;
+	unsigned char data[NETPLAY_MAX_PACKET_SIZE];
+} NetplayDelayedPacket;
+
+typedef struct NetplayConfirmedHash
+{
+	unsigned int tick;
+	uint64_t hash;
+} NetplayConfirmedHash;
+
+typedef struct NetplaySession
+{
+	NetplayOptions options;
+	intptr_t socket;
+	// In network byte order. The host learns these from the guest's first packet
+	uint32_t peerAddress;
+	unsigned short peerPort;
+	bool hasPeerAddress;
+	bool isConnected;
+	double lastHelloTime;
+	double lastSendTime;
+
+	int localPlayer;
+	int remotePlayer;
+
+	// Indexed by tick % NETPLAY_INPUT_HISTORY_TICKS. The remote column holds predictions for ticks
+	// at or after remoteInputEnd
+	PlayerInput inputs[NETPLAY_INPUT_HISTORY_TICKS][MAX_PLAYERS];
+	// One past the last tick each player's input is known for
+	unsigned int localInputEnd;
+	unsigned int remoteInputEnd;
+	// One past the last local input the remote told us it has
+	unsigned int localInputAcknowledgedEnd;
+	// The earliest simulated tick whose remote input turned out to be predicted wrong
+	unsigned int firstMispredictedTick;
+
+	// How many ticks the remote is ahead of the last input it got from us. If we are further ahead
+	// of them than that, we are the one causing rollbacks and should slow down
+	int remoteTickAdvantage;
+	unsigned int lastSyncWaitTick;
+
+	// The state at the start of each recent tick, indexed by tick % (NETPLAY_MAX_PREDICTION_TICKS
+	// + 1). Saving a whole state is a single copy with no pointers to fix up
+	SimulationState* savedStates;
+
+	// Hashes of states both peers agree on the inputs leading to. Indexed by
+	// (tick / c_netplayHashInterval) % NETPLAY_NUM_CHECKED_HASHES
+	NetplayConfirmedHash confirmedHashes[NETPLAY_NUM_CHECKED_HASHES];
+	NetplayConfirmedHash latestConfirmedHash;
+	bool isDesynced;
+	unsigned int desyncTick;
+
+	RandomState conditionsRandom;
+	NetplayDelayedPacket* delayedPackets;
+	int numDelayedPackets;
+
+	NetplayStats stats;
+} NetplaySession;
+
+bool netplayOpen(NetplaySession* session, const NetplayOptions* options);
+void netplayClose(NetplaySession* session);
+
+typedef enum NetplayPollResult
+{
+	// The state was initialized for a new session. Only happens once
+	NetplayPoll_Connected = 1 << 0,
+	// The state was rolled back and re-simulated, so anything derived from it is stale
+	NetplayPoll_RolledBack = 1 << 1,
+} NetplayPollResult;
+
+// Send and receive packets, and correct any mispredictions. Call once per frame, before
+// netplayAdvance(). state is only touched once connected; connecting initializes it with the host's
+// seed and tick rate. Returns NetplayPollResult flags
+unsigned int netplayPoll(NetplaySession* session, SimulationState* state, double nowSeconds);
+
+// Simulate the next tick with the local player's input. Returns false without simulating if not
+// connected, too far ahead of the remote player, or waiting a tick so the remote can catch up. Drop
+// the time for this tick and try again next frame. events gets the SimulationEvent flags of the
+// tick
+bool netplayAdvance(NetplaySession* session, SimulationState* state, const PlayerInput* localInput,
+                    double nowSeconds, unsigned int* events);
+
+// Whether every input up to tick is known, i.e. the state there can no longer be rolled back
+bool netplayIsTickConfirmed(const NetplaySession* session, unsigned int tick);
@@ -0,0 +1,408 @@
+// Searches for better player ship layouts offline. Simulated annealing over the cells of the
+// player's ship: each round proposes a batch of single-cell changes to the current layout, scores
+// them in parallel by letting the bot fly the first goal phases on a fixed set of seeds, then moves
+// to the best proposal which passes the annealing test
+//
+// Layouts are only reachable the way a player could build them: every changed cell is an edit from
+// the default ship, so the starting inventory, fuel pool, and placement restrictions all apply
+
+#include "Bot.h"
+#include "Jobs.h"
+#include "Simulation.h"
+#include "Threads.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void printUsage(const char* programName)
+{
+	fprintf(stderr,
+	        "Usage: %s [--rounds N] [--proposals N] [--seeds N] [--threads N] [--seed N]\n"
+	        "          [--temperature START END] [--output FILE]\n"
+	        "\n"
+	        "Each round scores --proposals changed layouts (default two per thread) on --seeds\n"
+	        "seeded sessions each (default 8). --output writes the best layout found, one row of\n"
+	        "tiles per line.\n",
+	        programName);
+}
+
+static double secondsNow()
+{
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (double)time.tv_sec + (double)time.tv_nsec / 1000000000.0;
+}
+
+#define MAX_LAYOUT_CELLS (MAX_SHIP_DIMENSION * MAX_SHIP_DIMENSION)
+#define MAX_PROPOSALS 256
+
+// Each goal phase is worth up to this much. See scoreSession()
+static const float c_maxGoalPhaseScore = 2.f;
+
+typedef struct Candidate
+{
+	char cells[MAX_LAYOUT_CELLS + 1];
+	// Drawn before scoring, so a candidate which can't reach it is abandoned part way through
+	float acceptThreshold;
+
+	// Results
+	float score;
+	bool isValid;
+	bool wasAbandoned;
+	unsigned int numTicksSimulated;
+} Candidate;
+
+typedef struct Optimizer
+{
+	int width;
+	int height;
+	int numSeeds;
+	// Each seed's session right after initialization, so candidates start from a copy
+	SimulationState* startStates;
+	// Scratch state for each worker
+	SimulationState* workerStates;
+
+	Candidate* candidates;
+
+	// The first run of goal phases, [firstScoredPhase, endScoredPhase). Later goals come after
+	// refitting, which the bot doesn't do
+	int firstScoredPhase;
+	int endScoredPhase;
+} Optimizer;
+
+static bool isGoalPhase(int phaseIndex)
+{
+	const GamePhase* phase = simulationGamePhase(phaseIndex);
+	return phase && phase->objective == Objective_ReachGoalPoint;
+}
+
+static void findScoredPhases(Optimizer* optimizer)
+{
+	int phaseIndex = 0;
+	while (simulationGamePhase(phaseIndex) && !isGoalPhase(phaseIndex))
+		++phaseIndex;
+	optimizer->firstScoredPhase = phaseIndex;
+	while (isGoalPhase(phaseIndex))
+		++phaseIndex;
+	optimizer->endScoredPhase = phaseIndex;
+}
+
+// Turns the default ship into cells one edit at a time, like a player would. Returns false if the
+// rules don't allow it
+static bool buildLayout(SimulationState* state, const char* cells)
+{
+	GridSpace gridSpace = shipGridSpace(state, &state->ships[0]);
+	for (int cellY = 0; cellY < gridSpace.height; ++cellY)
+	{
+		for (int cellX = 0; cellX < gridSpace.width; ++cellX)
+		{
+			char tile = cells[(cellY * gridSpace.width) + cellX];
+			if (GridCellAt(&gridSpace, cellX, cellY).type == tile)
+				continue;
+			const char* buildableTile = memchr(c_buildableTiles, tile, sizeof(c_buildableTiles));
+			if (!buildableTile)
+				return false;
+			EditCommand edit = {0, (unsigned char)cellX, (unsigned char)cellY,
+			                    (unsigned char)(buildableTile - c_buildableTiles)};
+			if (!simulationApplyEdit(state, &edit))
+				return false;
+		}
+	}
+	return true;
+}
+
+static float distanceToGoal(SimulationState* state)
+{
+	Ship* ship = &state->ships[0];
+	Vec2 offset = {(state->goal.x + state->goal.w / 2) -
+	                   (ship->body.position.x + (ship->width * c_tileSize) / 2),
+	               (state->goal.y + state->goal.h / 2) -
+	                   (ship->body.position.y + (ship->height * c_tileSize) / 2)};
+	return Magnitude(&offset);
+}
+
+// Skips construction and lets the bot fly the goal phases. Reaching a goal scores 1, plus up to 1
+// more for time to spare. Missing one scores up to 0.5 for how much closer the ship got
+static float scoreSession(Optimizer* optimizer, SimulationState* state,
+                          unsigned int* numTicksOut)
+{
+	SimulationInput input = {0};
+	input.skipPhase = true;
+	while (state->currentGamePhase < optimizer->firstScoredPhase)
+		simulationTick(state, &input);
+	input.skipPhase = false;
+
+	float score = 0.f;
+	float startDistance = distanceToGoal(state);
+	unsigned int numTicks = 0;
+	const GamePhase* phase = simulationCurrentPhase(state);
+	while (phase && state->currentGamePhase < optimizer->endScoredPhase &&
+	       !simulationIsPlayerDestroyed(state))
+	{
+		const GamePhase* phaseBefore = phase;
+		int secondsInPhase = simulationSecondsInCurrentPhase(state);
+		float distance = distanceToGoal(state);
+		input.engineInput[0] = botPilotInput(state, 0);
+		unsigned int events = simulationTick(state, &input);
+		++numTicks;
+		phase = simulationCurrentPhase(state);
+		if (!(events & SimulationEvent_PhaseStarted) ||
+		    phaseBefore->objective != Objective_ReachGoalPoint)
+			continue;
+
+		if (events & SimulationEvent_PhaseFailed)
+		{
+			if (startDistance > 0.f && distance < startDistance)
+				score += 0.5f * (1.f - (distance / startDistance));
+		}
+		else
+			score += c_maxGoalPhaseScore -
+			         ((float)secondsInPhase / phaseBefore->timeToCompleteSeconds);
+		startDistance = distanceToGoal(state);
+	}
+	*numTicksOut += numTicks;
+	return score;
+}
+
+static void evaluateCandidate(Optimizer* optimizer, int candidateIndex, int workerIndex)
+{
+	Candidate* candidate = &optimizer->candidates[candidateIndex];
+	SimulationState* state = &optimizer->workerStates[workerIndex];
+	candidate->isValid = true;
+	candidate->wasAbandoned = false;
+	candidate->numTicksSimulated = 0;
+
+	const float maxSessionScore =
+	    c_maxGoalPhaseScore * (optimizer->endScoredPhase - optimizer->firstScoredPhase);
+	float totalScore = 0.f;
+	for (int seedIndex = 0; seedIndex < optimizer->numSeeds; ++seedIndex)
+	{
+		memcpy(state, &optimizer->startStates[seedIndex], sizeof(SimulationState));
+		// Every seed starts with the same ship and inventory, so the first tells for all
+		if (!buildLayout(state, candidate->cells))
+		{
+			candidate->isValid = false;
+			return;
+		}
+		totalScore += scoreSession(optimizer, state, &candidate->numTicksSimulated);
+
+		int numSeedsLeft = optimizer->numSeeds - seedIndex - 1;
+		float bestPossibleScore =
+		    (totalScore + (numSeedsLeft * maxSessionScore)) / optimizer->numSeeds;
+		if (numSeedsLeft && bestPossibleScore < candidate->acceptThreshold)
+		{
+			candidate->wasAbandoned = true;
+			candidate->score = bestPossibleScore;
+			return;
+		}
+	}
+	candidate->score = totalScore / optimizer->numSeeds;
+}
+
+static void evaluateCandidates(void* userData, int begin, int end, int workerIndex)
+{
+	for (int i = begin; i < end; ++i)
+		evaluateCandidate((Optimizer*)userData, i, workerIndex);
+}
+
+static float randomUnit(RandomState* random)
+{
+	return (randomNext(random) + 1.f) / 4294967296.f;
+}
+
+// Changes one cell to a tile allowed there
+static void mutateLayout(Optimizer* optimizer, SimulationState* scratchState, RandomState* random,
+                         char* cells)
+{
+	for (;;)
+	{
+		EditCommand edit = {0};
+		edit.cellX = randomRange(random, optimizer->width);
+		edit.cellY = randomRange(random, optimizer->height);
+		edit.buildableTile = randomRange(random, NUM_BUILDABLE_TILES);
+		char* cell = &cells[(edit.cellY * optimizer->width) + edit.cellX];
+		if (*cell == c_buildableTiles[edit.buildableTile] ||
+		    simulationPlacementRestriction(scratchState, &edit) != Restrict_None)
+			continue;
+		*cell = c_buildableTiles[edit.buildableTile];
+		return;
+	}
+}
+
+static void printLayout(FILE* file, const char* cells, int width, int height)
+{
+	for (int row = 0; row < height; ++row)
+		fprintf(file, "%.*s\n", width, &cells[row * width]);
+}
+
+int main(int numArguments, char** arguments)
+{
+	int numRounds = 100;
+	int numProposals = 0;
+	int numSeeds = 8;
+	int numThreads = 0;
+	uint64_t seed = 0;
+	float startTemperature = 0.3f;
+	float endTemperature = 0.01f;
+	const char* outputFilename = NULL;
+	for (int i = 1; i < numArguments; ++i)
+	{
+		if (strcmp(arguments[i], "--rounds") == 0 && i + 1 < numArguments)
+			numRounds = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--proposals") == 0 && i + 1 < numArguments)
+			numProposals = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--seeds") == 0 && i + 1 < numArguments)
+			numSeeds = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--threads") == 0 && i + 1 < numArguments)
+			numThreads = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--seed") == 0 && i + 1 < numArguments)
+			seed = strtoull(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--temperature") == 0 && i + 2 < numArguments)
+		{
+			startTemperature = atof(arguments[++i]);
+			endTemperature = atof(arguments[++i]);
+		}
+		else if (strcmp(arguments[i], "--output") == 0 && i + 1 < numArguments)
+			outputFilename = arguments[++i];
+		else
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+	}
+	if (numRounds < 1 || numSeeds < 1 || numProposals < 0 || numProposals > MAX_PROPOSALS ||
+	    startTemperature <= 0.f || endTemperature <= 0.f)
+	{
+		printUsage(arguments[0]);
+		return 1;
+	}
+
+	// Too big for the stack
+	static JobSystem jobs;
+	if (!jobSystemInitialize(&jobs, numThreads))
+		return 1;
+	if (!numProposals)
+		numProposals = jobs.numThreads * 2 > MAX_PROPOSALS ? MAX_PROPOSALS : jobs.numThreads * 2;
+
+	Optimizer* optimizer = calloc(1, sizeof(Optimizer));
+	if (optimizer)
+	{
+		optimizer->startStates = malloc(numSeeds * sizeof(SimulationState));
+		optimizer->workerStates = malloc(jobs.numThreads * sizeof(SimulationState));
+		// The last one holds the current layout
+		optimizer->candidates = malloc((numProposals + 1) * sizeof(Candidate));
+	}
+	if (!optimizer || !optimizer->startStates || !optimizer->workerStates ||
+	    !optimizer->candidates)
+	{
+		fprintf(stderr, "Not enough memory\n");
+		return 1;
+	}
+	optimizer->numSeeds = numSeeds;
+	findScoredPhases(optimizer);
+	for (int i = 0; i < numSeeds; ++i)
+		simulationInitialize(&optimizer->startStates[i], seed + i, c_defaultTicksPerSecond, 1);
+	optimizer->width = c_defaultPlayerShipLayout.width;
+	optimizer->height = c_defaultPlayerShipLayout.height;
+	int numCells = optimizer->width * optimizer->height;
+	// For checking placement restrictions, which only need the ship's size
+	SimulationState* scratchState = &optimizer->startStates[0];
+
+	// Score the default ship first, which everything is compared to
+	Candidate* current = &optimizer->candidates[numProposals];
+	memset(current, 0, sizeof(Candidate));
+	memcpy(current->cells, c_defaultPlayerShipLayout.cells, numCells);
+	// Never abandoned
+	current->acceptThreshold = -1.f;
+	evaluateCandidate(optimizer, numProposals, 0);
+	float defaultScore = current->score;
+	Candidate best = *current;
+	printf("Default layout scores %.3f over %d seeds\n", defaultScore, numSeeds);
+
+	RandomState random;
+	randomSeed(&random, seed, 0);
+	unsigned int numEvaluated = 0;
+	unsigned int numInvalid = 0;
+	unsigned int numAbandoned = 0;
+	uint64_t numTicksSimulated = current->numTicksSimulated;
+	double startTime = secondsNow();
+	for (int round = 0; round < numRounds; ++round)
+	{
+		float temperature =
+		    startTemperature * powf(endTemperature / startTemperature, (float)round / numRounds);
+		for (int i = 0; i < numProposals; ++i)
+		{
+			Candidate* candidate = &optimizer->candidates[i];
+			memcpy(candidate->cells, current->cells, sizeof(candidate->cells));
+			mutateLayout(optimizer, scratchState, &random, candidate->cells);
+			// Metropolis: accept anything better, and worse by d with probability exp(-d / T)
+			candidate->acceptThreshold = current->score + temperature * logf(randomUnit(&random));
+		}
+		jobSystemParallelFor(&jobs, numProposals, 1, evaluateCandidates, optimizer);
+
+		int acceptedIndex = -1;
+		for (int i = 0; i < numProposals; ++i)
+		{
+			Candidate* candidate = &optimizer->candidates[i];
+			++numEvaluated;
+			numTicksSimulated += candidate->numTicksSimulated;
+			if (!candidate->isValid)
+				++numInvalid;
+			else if (candidate->wasAbandoned)
+				++numAbandoned;
+			if (!candidate->isValid || candidate->wasAbandoned ||
+			    candidate->score < candidate->acceptThreshold)
+				continue;
+			if (acceptedIndex == -1 ||
+			    candidate->score > optimizer->candidates[acceptedIndex].score)
+				acceptedIndex = i;
+		}
+		if (acceptedIndex != -1)
+		{
+			*current = optimizer->candidates[acceptedIndex];
+			if (current->score > best.score)
+				best = *current;
+		}
+
+		if ((round + 1) % 10 == 0 || round + 1 == numRounds)
+		{
+			double elapsedSeconds = secondsNow() - startTime;
+			printf("Round %d of %d: temperature %.3f, current %.3f, best %.3f. %.1f layouts per "
+			       "second\n",
+			       round + 1, numRounds, temperature, current->score, best.score,
+			       numEvaluated / elapsedSeconds);
+		}
+	}
+	double elapsedSeconds = secondsNow() - startTime;
+
+	printf("\nBest layout scores %.3f (default %.3f):\n", best.score, defaultScore);
+	printLayout(stdout, best.cells, optimizer->width, optimizer->height);
+	printf("\n%u layouts simulated in %.2f seconds on %d threads: %.1f layouts per second, %.0f "
+	       "ticks per second\n",
+	       numEvaluated, elapsedSeconds, jobs.numThreads, numEvaluated / elapsedSeconds,
+	       numTicksSimulated / elapsedSeconds);
+	printf("%u broke the building rules, %u were abandoned once they couldn't be accepted\n",
+	       numInvalid, numAbandoned);
+
+	if (outputFilename)
+	{
+		FILE* outputFile = fopen(outputFilename, "w");
+		if (!outputFile)
+			fprintf(stderr, "Failed to write %s\n", outputFilename);
+		else
+		{
+			printLayout(outputFile, best.cells, optimizer->width, optimizer->height);
+			fclose(outputFile);
+		}
+	}
+
+	jobSystemDestroy(&jobs);
+	free(optimizer->candidates);
+	free(optimizer->workerStates);
+	free(optimizer->startStates);
+	free(optimizer);
+	return 0;
+}
@@ -0,0 +1,571 @@
+#include "Rasterizer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RASTER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow intrinsics in functions built for their instruction set. MSVC allows
+// them anywhere, so the whole file can be built without special flags either way
+#if defined(__GNUC__) || defined(__clang__)
+#define RASTER_TARGET(instructionSet) __attribute__((target(instructionSet)))
+#else
+#define RASTER_TARGET(instructionSet)
+#endif
+
+//
+// Rows
+//
+
+// Each draws n pixels of one row, already clipped to the framebuffer
+typedef struct RowFunctions
+{
+	void (*fillOpaque)(uint32_t* destination, int n, uint32_t color);
+	void (*fillBlended)(uint32_t* destination, int n, uint32_t color);
+	void (*copyKeyed)(uint32_t* destination, const uint32_t* source, int n);
+	// sourceX and step are 16.16 fixed point
+	void (*copyKeyedScaled)(uint32_t* destination, const uint32_t* sourceRow, int n,
+	                        uint32_t sourceX, uint32_t step);
+} RowFunctions;
+
+// x / 255, rounded, for x <= 255 * 255
+static uint32_t divideBy255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+// Blends color over pixel. Anything drawn over nothing keeps its own alpha; anything drawn over
+// something opaque stays opaque
+static uint32_t blendPixel(uint32_t pixel, uint32_t color)
+{
+	if (!(pixel >> 24))
+		return color;
+	uint32_t alpha = color >> 24;
+	uint32_t inverseAlpha = 255 - alpha;
+	// Blending the alpha channel towards 255 gives alpha + pixelAlpha * (1 - alpha)
+	color |= 0xff000000;
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		uint32_t channel = (((color >> shift) & 0xff) * alpha) +
+		                   (((pixel >> shift) & 0xff) * inverseAlpha);
+		result |= divideBy255(channel) << shift;
+	}
+	return result;
+}
+
+static void fillOpaqueScalar(uint32_t* destination, int n, uint32_t color)
+{
+	for (int i = 0; i < n; ++i)
+		destination[i] = color;
+}
+
+static void fillBlendedScalar(uint32_t* destination, int n, uint32_t color)
+{
+	for (int i = 0; i < n; ++i)
+		destination[i] = blendPixel(destination[i], color);
+}
+
+static void copyKeyedScalar(uint32_t* destination, const uint32_t* source, int n)
+{
+	for (int i = 0; i < n; ++i)
+	{
+		if (source[i] >> 24)
+			destination[i] = source[i];
+	}
+}
+
+static void copyKeyedScaledScalar(uint32_t* destination, const uint32_t* sourceRow, int n,
+                                  uint32_t sourceX, uint32_t step)
+{
+	for (int i = 0; i < n; ++i, sourceX += step)
+	{
+		uint32_t pixel = sourceRow[sourceX >> 16];
+		if (pixel >> 24)
+			destination[i] = pixel;
+	}
+}
+
+#ifdef RASTER_X86
+
+RASTER_TARGET("sse2")
+static void fillOpaqueSse2(uint32_t* destination, int n, uint32_t color)
+{
+	__m128i colors = _mm_set1_epi32((int)color);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i*)&destination[i], colors);
+	fillOpaqueScalar(&destination[i], n - i, color);
+}
+
+// Two pixels per 16-bit half; see blendPixel()
+RASTER_TARGET("sse2")
+static __m128i blendHalfSse2(__m128i pixels, __m128i weightedColor, __m128i inverseAlpha)
+{
+	__m128i blended = _mm_add_epi16(_mm_mullo_epi16(pixels, inverseAlpha), weightedColor);
+	blended = _mm_add_epi16(blended, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(blended, _mm_srli_epi16(blended, 8)), 8);
+}
+
+RASTER_TARGET("sse2")
+static void fillBlendedSse2(uint32_t* destination, int n, uint32_t color)
+{
+	uint32_t alpha = color >> 24;
+	__m128i zero = _mm_setzero_si128();
+	__m128i colors = _mm_set1_epi32((int)color);
+	__m128i opaqueColor = _mm_unpacklo_epi8(_mm_set1_epi32((int)(color | 0xff000000)), zero);
+	__m128i weightedColor = _mm_mullo_epi16(opaqueColor, _mm_set1_epi16((short)alpha));
+	__m128i inverseAlpha = _mm_set1_epi16((short)(255 - alpha));
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)&destination[i]);
+		__m128i low = blendHalfSse2(_mm_unpacklo_epi8(pixels, zero), weightedColor, inverseAlpha);
+		__m128i high = blendHalfSse2(_mm_unpackhi_epi8(pixels, zero), weightedColor, inverseAlpha);
+		__m128i blended = _mm_packus_epi16(low, high);
+		__m128i isEmpty = _mm_cmpeq_epi32(_mm_srli_epi32(pixels, 24), zero);
+		blended = _mm_or_si128(_mm_and_si128(isEmpty, colors), _mm_andnot_si128(isEmpty, blended));
+		_mm_storeu_si128((__m128i*)&destination[i], blended);
+	}
+	fillBlendedScalar(&destination[i], n - i, color);
+}
+
+RASTER_TARGET("sse2")
+static void copyKeyedSse2(uint32_t* destination, const uint32_t* source, int n)
+{
+	__m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i sourcePixels = _mm_loadu_si128((const __m128i*)&source[i]);
+		__m128i pixels = _mm_loadu_si128((const __m128i*)&destination[i]);
+		__m128i isKeyed = _mm_cmpeq_epi32(_mm_srli_epi32(sourcePixels, 24), zero);
+		pixels = _mm_or_si128(_mm_and_si128(isKeyed, pixels),
+		                      _mm_andnot_si128(isKeyed, sourcePixels));
+		_mm_storeu_si128((__m128i*)&destination[i], pixels);
+	}
+	copyKeyedScalar(&destination[i], &source[i], n - i);
+}
+
+RASTER_TARGET("avx2")
+static void fillOpaqueAvx2(uint32_t* destination, int n, uint32_t color)
+{
+	__m256i colors = _mm256_set1_epi32((int)color);
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_si256((__m256i*)&destination[i], colors);
+	fillOpaqueScalar(&destination[i], n - i, color);
+}
+
+RASTER_TARGET("avx2")
+static __m256i blendHalfAvx2(__m256i pixels, __m256i weightedColor, __m256i inverseAlpha)
+{
+	__m256i blended = _mm256_add_epi16(_mm256_mullo_epi16(pixels, inverseAlpha), weightedColor);
+	blended = _mm256_add_epi16(blended, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(blended, _mm256_srli_epi16(blended, 8)), 8);
+}
+
+RASTER_TARGET("avx2")
+static void fillBlendedAvx2(uint32_t* destination, int n, uint32_t color)
+{
+	uint32_t alpha = color >> 24;
+	__m256i zero = _mm256_setzero_si256();
+	__m256i colors = _mm256_set1_epi32((int)color);
+	__m256i opaqueColor =
+	    _mm256_unpacklo_epi8(_mm256_set1_epi32((int)(color | 0xff000000)), zero);
+	__m256i weightedColor = _mm256_mullo_epi16(opaqueColor, _mm256_set1_epi16((short)alpha));
+	__m256i inverseAlpha = _mm256_set1_epi16((short)(255 - alpha));
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)&destination[i]);
+		// Unpacking works within each 128-bit lane, and packing undoes it the same way
+		__m256i low =
+		    blendHalfAvx2(_mm256_unpacklo_epi8(pixels, zero), weightedColor, inverseAlpha);
+		__m256i high =
+		    blendHalfAvx2(_mm256_unpackhi_epi8(pixels, zero), weightedColor, inverseAlpha);
+		__m256i blended = _mm256_packus_epi16(low, high);
+		__m256i isEmpty = _mm256_cmpeq_epi32(_mm256_srli_epi32(pixels, 24), zero);
+		blended = _mm256_blendv_epi8(blended, colors, isEmpty);
+		_mm256_storeu_si256((__m256i*)&destination[i], blended);
+	}
+	fillBlendedScalar(&destination[i], n - i, color);
+}
+
+RASTER_TARGET("avx2")
+static void copyKeyedAvx2(uint32_t* destination, const uint32_t* source, int n)
+{
+	__m256i zero = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i sourcePixels = _mm256_loadu_si256((const __m256i*)&source[i]);
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)&destination[i]);
+		__m256i isKeyed = _mm256_cmpeq_epi32(_mm256_srli_epi32(sourcePixels, 24), zero);
+		pixels = _mm256_blendv_epi8(sourcePixels, pixels, isKeyed);
+		_mm256_storeu_si256((__m256i*)&destination[i], pixels);
+	}
+	copyKeyedScalar(&destination[i], &source[i], n - i);
+}
+
+// Gathers eight source pixels at a time
+RASTER_TARGET("avx2")
+static void copyKeyedScaledAvx2(uint32_t* destination, const uint32_t* sourceRow, int n,
+                                uint32_t sourceX, uint32_t step)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i laneOffsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+	                                         _mm256_set1_epi32((int)step));
+	int i = 0;
+	for (; i + 8 <= n; i += 8, sourceX += step * 8)
+	{
+		__m256i indices =
+		    _mm256_srli_epi32(_mm256_add_epi32(_mm256_set1_epi32((int)sourceX), laneOffsets), 16);
+		__m256i sourcePixels = _mm256_i32gather_epi32((const int*)sourceRow, indices, 4);
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)&destination[i]);
+		__m256i isKeyed = _mm256_cmpeq_epi32(_mm256_srli_epi32(sourcePixels, 24), zero);
+		pixels = _mm256_blendv_epi8(sourcePixels, pixels, isKeyed);
+		_mm256_storeu_si256((__m256i*)&destination[i], pixels);
+	}
+	copyKeyedScaledScalar(&destination[i], sourceRow, n - i, sourceX, step);
+}
+
+#endif  // RASTER_X86
+
+static const RowFunctions c_rowFunctions[NUM_RASTER_INSTRUCTION_SETS] = {
+    {fillOpaqueScalar, fillBlendedScalar, copyKeyedScalar, copyKeyedScaledScalar},
+#ifdef RASTER_X86
+    // SSE2 has no gather, so scaled sprites fetch one pixel at a time anyway
+    {fillOpaqueSse2, fillBlendedSse2, copyKeyedSse2, copyKeyedScaledScalar},
+    {fillOpaqueAvx2, fillBlendedAvx2, copyKeyedAvx2, copyKeyedScaledAvx2},
+#else
+    {fillOpaqueScalar, fillBlendedScalar, copyKeyedScalar, copyKeyedScaledScalar},
+    {fillOpaqueScalar, fillBlendedScalar, copyKeyedScalar, copyKeyedScaledScalar},
+#endif
+};
+
+RasterInstructionSet rasterizerBestInstructionSet()
+{
+#if defined(RASTER_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool hasSse2 = (info[3] & (1 << 26)) != 0;
+	// AVX2 also needs the OS to save the upper halves of the registers
+	bool hasAvxState = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+	__cpuidex(info, 7, 0);
+	if (hasAvxState && (info[1] & (1 << 5)))
+		return RasterInstructionSet_Avx2;
+	if (hasSse2)
+		return RasterInstructionSet_Sse2;
+#elif defined(RASTER_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return RasterInstructionSet_Avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return RasterInstructionSet_Sse2;
+#endif
+	return RasterInstructionSet_Scalar;
+}
+
+const char* rasterInstructionSetName(RasterInstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+		case RasterInstructionSet_Scalar:
+			return "scalar";
+		case RasterInstructionSet_Sse2:
+			return "SSE2";
+		case RasterInstructionSet_Avx2:
+			return "AVX2";
+		default:
+			return "unknown";
+	}
+}
+
+//
+// Commands
+//
+
+static void drawCommand(const Rasterizer* rasterizer, const RowFunctions* rows,
+                        const RasterCommand* command, int bandTop, int bandBottom)
+{
+	int left = command->x > 0 ? command->x : 0;
+	int right = command->x + command->width;
+	if (right > rasterizer->width)
+		right = rasterizer->width;
+	int top = command->y > bandTop ? command->y : bandTop;
+	int bottom = command->y + command->height;
+	if (bottom > bandBottom)
+		bottom = bandBottom;
+	if (left >= right || top >= bottom)
+		return;
+	int n = right - left;
+
+	if (!command->image)
+	{
+		uint32_t alpha = command->color >> 24;
+		for (int y = top; y < bottom && alpha; ++y)
+		{
+			uint32_t* destination = &rasterizer->pixels[(y * rasterizer->width) + left];
+			if (alpha == 255)
+				rows->fillOpaque(destination, n, command->color);
+			else
+				rows->fillBlended(destination, n, command->color);
+		}
+		return;
+	}
+
+	const RasterImage* image = command->image;
+	if (command->sourceWidth == command->width && command->sourceHeight == command->height)
+	{
+		for (int y = top; y < bottom; ++y)
+		{
+			int sourceY = command->sourceY + (y - command->y);
+			int sourceX = command->sourceX + (left - command->x);
+			rows->copyKeyed(&rasterizer->pixels[(y * rasterizer->width) + left],
+			                &image->pixels[(sourceY * image->width) + sourceX], n);
+		}
+		return;
+	}
+
+	// Sample the middle of each destination pixel
+	uint32_t step = ((uint32_t)command->sourceWidth << 16) / (uint32_t)command->width;
+	uint32_t sourceX =
+	    ((uint32_t)command->sourceX << 16) + ((uint32_t)(left - command->x) * step) + (step / 2);
+	for (int y = top; y < bottom; ++y)
+	{
+		int sourceY = command->sourceY + ((((2 * (y - command->y)) + 1) * command->sourceHeight) /
+		                                  (2 * command->height));
+		rows->copyKeyedScaled(&rasterizer->pixels[(y * rasterizer->width) + left],
+		                      &image->pixels[sourceY * image->width], n, sourceX, step);
+	}
+}
+
+static void drawBands(void* userData, int begin, int end, int workerIndex)
+{
+	Rasterizer* rasterizer = (Rasterizer*)userData;
+	const RowFunctions* rows = &c_rowFunctions[rasterizer->instructionSet];
+	for (int band = begin; band < end; ++band)
+	{
+		int bandTop = band * RASTER_BAND_HEIGHT;
+		int bandBottom = bandTop + RASTER_BAND_HEIGHT;
+		if (bandBottom > rasterizer->height)
+			bandBottom = rasterizer->height;
+		for (int i = rasterizer->bandStart[band]; i < rasterizer->bandStart[band + 1]; ++i)
+			drawCommand(rasterizer, rows, &rasterizer->commands[rasterizer->bandCommands[i]],
+			            bandTop, bandBottom);
+	}
+}
+
+static void clearBands(void* userData, int begin, int end, int workerIndex)
+{
+	Rasterizer* rasterizer = (Rasterizer*)userData;
+	RasterRect* dirty = &rasterizer->dirty;
+	for (int band = begin; band < end; ++band)
+	{
+		int top = (dirty->y / RASTER_BAND_HEIGHT + band) * RASTER_BAND_HEIGHT;
+		int bottom = top + RASTER_BAND_HEIGHT;
+		if (top < dirty->y)
+			top = dirty->y;
+		if (bottom > dirty->y + dirty->height)
+			bottom = dirty->y + dirty->height;
+		for (int y = top; y < bottom; ++y)
+			memset(&rasterizer->pixels[(y * rasterizer->width) + dirty->x], 0,
+			       dirty->width * sizeof(uint32_t));
+	}
+}
+
+// Grows the dirty rect to cover the command, clipped to the framebuffer. Returns false if none of
+// it is on the framebuffer
+static bool markDirty(Rasterizer* rasterizer, int x, int y, int width, int height)
+{
+	int left = x > 0 ? x : 0;
+	int top = y > 0 ? y : 0;
+	int right = x + width < rasterizer->width ? x + width : rasterizer->width;
+	int bottom = y + height < rasterizer->height ? y + height : rasterizer->height;
+	if (left >= right || top >= bottom)
+		return false;
+
+	RasterRect* dirty = &rasterizer->dirty;
+	if (dirty->width && dirty->height)
+	{
+		if (dirty->x < left)
+			left = dirty->x;
+		if (dirty->y < top)
+			top = dirty->y;
+		if (dirty->x + dirty->width > right)
+			right = dirty->x + dirty->width;
+		if (dirty->y + dirty->height > bottom)
+			bottom = dirty->y + dirty->height;
+	}
+	dirty->x = left;
+	dirty->y = top;
+	dirty->width = right - left;
+	dirty->height = bottom - top;
+	return true;
+}
+
+static RasterCommand* addCommand(Rasterizer* rasterizer, int x, int y, int width, int height)
+{
+	if (width <= 0 || height <= 0 || !markDirty(rasterizer, x, y, width, height))
+		return NULL;
+	// Drawing is in order, so drawing what's there early changes nothing
+	if (rasterizer->numCommands == RASTER_MAX_COMMANDS)
+		rasterizerDraw(rasterizer);
+	RasterCommand* command = &rasterizer->commands[rasterizer->numCommands++];
+	memset(command, 0, sizeof(RasterCommand));
+	command->x = x;
+	command->y = y;
+	command->width = width;
+	command->height = height;
+	return command;
+}
+
+//
+// Rasterizer
+//
+
+void rasterizerInitialize(Rasterizer* rasterizer, JobSystem* jobs)
+{
+	memset(rasterizer, 0, sizeof(Rasterizer));
+	rasterizer->jobs = jobs;
+	rasterizer->instructionSet = rasterizerBestInstructionSet();
+}
+
+void rasterizerDestroy(Rasterizer* rasterizer)
+{
+	free(rasterizer->pixels);
+	free(rasterizer->bandStart);
+	free(rasterizer->bandCommands);
+	rasterizer->pixels = NULL;
+	rasterizer->bandStart = NULL;
+	rasterizer->bandCommands = NULL;
+	rasterizer->bandCommandsCapacity = 0;
+	rasterizer->width = rasterizer->height = rasterizer->numBands = 0;
+}
+
+bool rasterizerResize(Rasterizer* rasterizer, int width, int height)
+{
+	free(rasterizer->pixels);
+	free(rasterizer->bandStart);
+	rasterizer->numCommands = 0;
+	memset(&rasterizer->dirty, 0, sizeof(rasterizer->dirty));
+	rasterizer->width = width;
+	rasterizer->height = height;
+	rasterizer->numBands = (height + RASTER_BAND_HEIGHT - 1) / RASTER_BAND_HEIGHT;
+	rasterizer->pixels = calloc((size_t)width * height, sizeof(uint32_t));
+	// Start offsets followed by write cursors, one per band
+	rasterizer->bandStart = malloc(((rasterizer->numBands * 2) + 1) * sizeof(int));
+	if (!rasterizer->pixels || !rasterizer->bandStart)
+	{
+		rasterizerDestroy(rasterizer);
+		return false;
+	}
+	return true;
+}
+
+void rasterizerAddSprite(Rasterizer* rasterizer, const RasterImage* image, int x, int y, int width,
+                         int height, int sourceX, int sourceY, int sourceWidth, int sourceHeight)
+{
+	if (sourceWidth <= 0 || sourceHeight <= 0)
+		return;
+	RasterCommand* command = addCommand(rasterizer, x, y, width, height);
+	if (!command)
+		return;
+	command->image = image;
+	command->sourceX = sourceX;
+	command->sourceY = sourceY;
+	command->sourceWidth = sourceWidth;
+	command->sourceHeight = sourceHeight;
+}
+
+void rasterizerAddFill(Rasterizer* rasterizer, int x, int y, int width, int height, uint32_t color)
+{
+	if (!(color >> 24))
+		return;
+	RasterCommand* command = addCommand(rasterizer, x, y, width, height);
+	if (command)
+		command->color = color;
+}
+
+static void commandBands(const Rasterizer* rasterizer, const RasterCommand* command,
+                         int* firstBand, int* lastBand)
+{
+	int top = command->y > 0 ? command->y : 0;
+	int bottom = command->y + command->height;
+	if (bottom > rasterizer->height)
+		bottom = rasterizer->height;
+	*firstBand = top / RASTER_BAND_HEIGHT;
+	*lastBand = (bottom - 1) / RASTER_BAND_HEIGHT;
+}
+
+void rasterizerDraw(Rasterizer* rasterizer)
+{
+	if (!rasterizer->numCommands || !rasterizer->pixels)
+	{
+		rasterizer->numCommands = 0;
+		return;
+	}
+
+	// Counting sort, like the simulation's ship buckets, so each band keeps the commands in order.
+	// Commands were already checked to be on the framebuffer when added
+	int numBands = rasterizer->numBands;
+	int* bandStart = rasterizer->bandStart;
+	int* bandCursor = &rasterizer->bandStart[numBands + 1];
+	memset(bandStart, 0, (numBands + 1) * sizeof(int));
+	for (int i = 0; i < rasterizer->numCommands; ++i)
+	{
+		int firstBand, lastBand;
+		commandBands(rasterizer, &rasterizer->commands[i], &firstBand, &lastBand);
+		for (int band = firstBand; band <= lastBand; ++band)
+			++bandStart[band + 1];
+	}
+	for (int band = 0; band < numBands; ++band)
+	{
+		bandStart[band + 1] += bandStart[band];
+		bandCursor[band] = bandStart[band];
+	}
+	int numBandCommands = bandStart[numBands];
+	if (numBandCommands > rasterizer->bandCommandsCapacity)
+	{
+		unsigned short* bandCommands =
+		    realloc(rasterizer->bandCommands, numBandCommands * sizeof(unsigned short));
+		if (!bandCommands)
+		{
+			rasterizer->numCommands = 0;
+			return;
+		}
+		rasterizer->bandCommands = bandCommands;
+		rasterizer->bandCommandsCapacity = numBandCommands;
+	}
+	for (int i = 0; i < rasterizer->numCommands; ++i)
+	{
+		int firstBand, lastBand;
+		commandBands(rasterizer, &rasterizer->commands[i], &firstBand, &lastBand);
+		for (int band = firstBand; band <= lastBand; ++band)
+			rasterizer->bandCommands[bandCursor[band]++] = (unsigned short)i;
+	}
+
+	jobSystemParallelFor(rasterizer->jobs, numBands, 1, drawBands, rasterizer);
+	rasterizer->numCommands = 0;
+}
+
+void rasterizerClearDirty(Rasterizer* rasterizer)
+{
+	RasterRect* dirty = &rasterizer->dirty;
+	if (dirty->width && dirty->height)
+	{
+		int firstBand = dirty->y / RASTER_BAND_HEIGHT;
+		int lastBand = (dirty->y + dirty->height - 1) / RASTER_BAND_HEIGHT;
+		jobSystemParallelFor(rasterizer->jobs, (lastBand - firstBand) + 1, 1, clearBands,
+		                     rasterizer);
+	}
+	memset(dirty, 0, sizeof(RasterRect));
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Draws our 2D content on the CPU, for machines without a GPU, where SDL's own software renderer is
+// slow. It only knows what the game actually draws: axis-aligned sprites with color-keyed (all or
+// nothing) transparency, scaled with nearest neighbor, and filled rectangles. Rows are written
+// with SSE2 or AVX2 where the CPU has them
+//
+// The framebuffer is split into bands of rows, which the job system draws in parallel. Each band
+// only looks at the commands which touch it, in the order they were added
+//
+// Like Simulation.h, this must not depend on SDL
+
+#include "Jobs.h"
+
+#include <stdint.h>
+
+#define RASTER_MAX_COMMANDS 8192
+#define RASTER_BAND_HEIGHT 32
+
+// Pixels are ARGB, 0xAARRGGBB. Alpha is either 0 (a color-keyed pixel) or 255
+typedef struct RasterImage
+{
+	uint32_t* pixels;
+	int width;
+	int height;
+} RasterImage;
+
+typedef struct RasterCommand
+{
+	// NULL to fill with color
+	const RasterImage* image;
+	// Where it goes in the framebuffer. It may hang off the edges
+	int x;
+	int y;
+	int width;
+	int height;
+	// Which part of the image, stretched to fit
+	int sourceX;
+	int sourceY;
+	int sourceWidth;
+	int sourceHeight;
+	// ARGB, for fills. Sprites are drawn as they are
+	uint32_t color;
+} RasterCommand;
+
+typedef enum RasterInstructionSet
+{
+	RasterInstructionSet_Scalar,
+	RasterInstructionSet_Sse2,
+	RasterInstructionSet_Avx2,
+	NUM_RASTER_INSTRUCTION_SETS,
+} RasterInstructionSet;
+
+typedef struct RasterRect
+{
+	int x;
+	int y;
+	int width;
+	int height;
+} RasterRect;
+
+typedef struct Rasterizer
+{
+	// width * height pixels, cleared to transparent black. Colors are blended as if what's
+	// underneath were opaque, which holds for everything but translucent fills over translucent
+	// fills
+	uint32_t* pixels;
+	int width;
+	int height;
+	RasterInstructionSet instructionSet;
+	// NULL draws on the calling thread
+	JobSystem* jobs;
+
+	int numCommands;
+	RasterCommand commands[RASTER_MAX_COMMANDS];
+	// Commands binned by band, bandCommands[bandStart[band]] up to bandStart[band + 1]
+	int numBands;
+	int* bandStart;
+	unsigned short* bandCommands;
+	int bandCommandsCapacity;
+
+	// Everything drawn since the last rasterizerClearDirty()
+	RasterRect dirty;
+} Rasterizer;
+
+// The fastest the CPU supports
+RasterInstructionSet rasterizerBestInstructionSet();
+const char* rasterInstructionSetName(RasterInstructionSet instructionSet);
+
+void rasterizerInitialize(Rasterizer* rasterizer, JobSystem* jobs);
+void rasterizerDestroy(Rasterizer* rasterizer);
+// Throws away what was drawn. Returns false if the framebuffer couldn't be allocated
+bool rasterizerResize(Rasterizer* rasterizer, int width, int height);
+
+// Commands are drawn in the order they are added. Adding more than RASTER_MAX_COMMANDS draws the
+// ones already added first
+void rasterizerAddSprite(Rasterizer* rasterizer, const RasterImage* image, int x, int y, int width,
+                         int height, int sourceX, int sourceY, int sourceWidth, int sourceHeight);
+void rasterizerAddFill(Rasterizer* rasterizer, int x, int y, int width, int height, uint32_t color);
+// Draws everything added since the last call into pixels
+void rasterizerDraw(Rasterizer* rasterizer);
+// Clears what was drawn back to transparent, e.g. once it has been copied out
+void rasterizerClearDirty(Rasterizer* rasterizer);
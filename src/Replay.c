@@ -0,0 +1,249 @@
+#include "Replay.h"
+
+#include <string.h>
+
+static const char c_replayMagic[4] = {'S', 'F', 'R', 'P'};
+static const unsigned char c_replayVersion = 2;
+
+typedef enum ReplayRecordFlags
+{
+	ReplayRecord_EngineChanged = 1 << 0,
+	ReplayRecord_SkipPhase = 1 << 1,
+	ReplayRecord_Edits = 1 << 2,
+	ReplayRecord_End = 1 << 7,
+} ReplayRecordFlags;
+
+//
+// Varints
+//
+
+static void writeVarint(FILE* file, uint64_t value)
+{
+	unsigned char buffer[10];
+	int numBytes = 0;
+	do
+	{
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		buffer[numBytes++] = byte;
+	} while (value);
+	fwrite(buffer, 1, numBytes, file);
+}
+
+static bool readVarint(FILE* file, uint64_t* valueOut)
+{
+	uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int byte = fgetc(file);
+		if (byte == EOF)
+			return false;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			*valueOut = value;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool readByte(FILE* file, unsigned char* byteOut)
+{
+	int byte = fgetc(file);
+	if (byte == EOF)
+		return false;
+	*byteOut = (unsigned char)byte;
+	return true;
+}
+
+//
+// Writing
+//
+
+bool replayWriterOpen(ReplayWriter* writer, const char* filename, uint64_t seed,
+                      int ticksPerSecond, int numPlayers)
+{
+	memset(writer, 0, sizeof(ReplayWriter));
+	writer->numPlayers = numPlayers;
+	writer->file = fopen(filename, "wb");
+	if (!writer->file)
+	{
+		fprintf(stderr, "Could not open %s to record a replay\n", filename);
+		return false;
+	}
+
+	fwrite(c_replayMagic, 1, sizeof(c_replayMagic), writer->file);
+	fputc(c_replayVersion, writer->file);
+	writeVarint(writer->file, seed);
+	writeVarint(writer->file, ticksPerSecond);
+	writeVarint(writer->file, numPlayers);
+	return true;
+}
+
+void replayWriterRecordTick(ReplayWriter* writer, unsigned int tick, const SimulationInput* input)
+{
+	unsigned char flags = 0;
+	if (memcmp(input->engineInput, writer->lastEngineInput, writer->numPlayers) != 0)
+		flags |= ReplayRecord_EngineChanged;
+	if (input->skipPhase)
+		flags |= ReplayRecord_SkipPhase;
+	if (input->numEdits)
+		flags |= ReplayRecord_Edits;
+	// Most ticks are the same as the last one, which costs nothing
+	if (!flags)
+		return;
+
+	writeVarint(writer->file, tick - writer->lastRecordTick);
+	fputc(flags, writer->file);
+	if (flags & ReplayRecord_EngineChanged)
+		fwrite(input->engineInput, 1, writer->numPlayers, writer->file);
+	if (flags & ReplayRecord_Edits)
+	{
+		fputc(input->numEdits, writer->file);
+		for (int i = 0; i < input->numEdits; ++i)
+		{
+			const EditCommand* edit = &input->edits[i];
+			unsigned char editBytes[] = {edit->ship, edit->cellX, edit->cellY,
+			                             edit->buildableTile};
+			fwrite(editBytes, 1, sizeof(editBytes), writer->file);
+		}
+	}
+
+	writer->lastRecordTick = tick;
+	memcpy(writer->lastEngineInput, input->engineInput, writer->numPlayers);
+}
+
+void replayWriterClose(ReplayWriter* writer, unsigned int numTicks, uint64_t finalStateHash)
+{
+	if (!writer->file)
+		return;
+
+	writeVarint(writer->file, numTicks - writer->lastRecordTick);
+	fputc(ReplayRecord_End, writer->file);
+	for (int i = 0; i < 8; ++i)
+		fputc((finalStateHash >> (i * 8)) & 0xff, writer->file);
+
+	fclose(writer->file);
+	writer->file = NULL;
+}
+
+//
+// Reading
+//
+
+// Reads the tick and flags of the next record, plus the hash if it is the end record
+static void readNextRecordHeader(ReplayReader* reader)
+{
+	uint64_t ticksSinceLastRecord = 0;
+	if (!readVarint(reader->file, &ticksSinceLastRecord) ||
+	    !readByte(reader->file, &reader->nextRecordFlags))
+	{
+		reader->isCorrupt = true;
+		return;
+	}
+	reader->nextRecordTick += (unsigned int)ticksSinceLastRecord;
+
+	if (reader->nextRecordFlags & ReplayRecord_End)
+	{
+		reader->finalStateHash = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			unsigned char byte = 0;
+			if (!readByte(reader->file, &byte))
+			{
+				reader->isCorrupt = true;
+				return;
+			}
+			reader->finalStateHash |= (uint64_t)byte << (i * 8);
+		}
+		reader->hasEnd = true;
+		reader->endTick = reader->nextRecordTick;
+	}
+}
+
+bool replayReaderOpen(ReplayReader* reader, const char* filename)
+{
+	memset(reader, 0, sizeof(ReplayReader));
+	reader->file = fopen(filename, "rb");
+	if (!reader->file)
+	{
+		fprintf(stderr, "Could not open replay %s\n", filename);
+		return false;
+	}
+
+	char magic[sizeof(c_replayMagic)];
+	unsigned char version = 0;
+	uint64_t ticksPerSecond = 0;
+	uint64_t numPlayers = 0;
+	if (fread(magic, 1, sizeof(magic), reader->file) != sizeof(magic) ||
+	    memcmp(magic, c_replayMagic, sizeof(magic)) != 0 || !readByte(reader->file, &version) ||
+	    version != c_replayVersion || !readVarint(reader->file, &reader->seed) ||
+	    !readVarint(reader->file, &ticksPerSecond) ||
+	    !simulationIsValidTickRate((int)ticksPerSecond) ||
+	    !readVarint(reader->file, &numPlayers) || numPlayers < 1 || numPlayers > MAX_PLAYERS)
+	{
+		fprintf(stderr, "%s is not a replay this version can play\n", filename);
+		replayReaderClose(reader);
+		return false;
+	}
+	reader->ticksPerSecond = (int)ticksPerSecond;
+	reader->numPlayers = (int)numPlayers;
+
+	readNextRecordHeader(reader);
+	return true;
+}
+
+bool replayReaderNextTick(ReplayReader* reader, unsigned int tick, SimulationInput* input)
+{
+	memset(input, 0, sizeof(SimulationInput));
+	if (reader->isCorrupt || (reader->hasEnd && tick >= reader->endTick))
+		return false;
+
+	if (tick == reader->nextRecordTick)
+	{
+		unsigned char flags = reader->nextRecordFlags;
+		if (flags & ReplayRecord_EngineChanged &&
+		    fread(reader->engineInput, 1, reader->numPlayers, reader->file) !=
+		        (size_t)reader->numPlayers)
+		{
+			reader->isCorrupt = true;
+			return false;
+		}
+		input->skipPhase = flags & ReplayRecord_SkipPhase;
+		if (flags & ReplayRecord_Edits)
+		{
+			unsigned char numEdits = 0;
+			if (!readByte(reader->file, &numEdits) || numEdits > ARRAY_SIZE(input->edits))
+			{
+				reader->isCorrupt = true;
+				return false;
+			}
+			for (int i = 0; i < numEdits; ++i)
+			{
+				unsigned char editBytes[4];
+				if (fread(editBytes, 1, sizeof(editBytes), reader->file) != sizeof(editBytes))
+				{
+					reader->isCorrupt = true;
+					return false;
+				}
+				EditCommand edit = {editBytes[0], editBytes[1], editBytes[2], editBytes[3]};
+				input->edits[i] = edit;
+			}
+			input->numEdits = numEdits;
+		}
+		readNextRecordHeader(reader);
+	}
+
+	memcpy(input->engineInput, reader->engineInput, sizeof(input->engineInput));
+	return true;
+}
+
+void replayReaderClose(ReplayReader* reader)
+{
+	if (reader->file)
+		fclose(reader->file);
+	reader->file = NULL;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+// Records everything needed to reproduce a session: the seed, the tick rate, and the simulation
+// input of every tick. Like Simulation.h, this must not depend on SDL
+//
+// File layout (all integers are LEB128 varints unless noted):
+//   "SFRP", version byte, seed, ticksPerSecond, numPlayers
+//   Records, one for each tick whose input differs from "same engine input, nothing else":
+//     ticks since the previous record, flags byte (ReplayRecordFlags)
+//     [engine input byte per player] [number of edits byte, 4 bytes per edit]
+//   An end record with the End flag, followed by the final simulationStateHash() (8 bytes, little
+//   endian) so playback can tell whether it reproduced the session
+
+#include "Simulation.h"
+
+#include <stdio.h>
+
+typedef struct ReplayWriter
+{
+	FILE* file;
+	unsigned int lastRecordTick;
+	int numPlayers;
+	unsigned char lastEngineInput[MAX_PLAYERS];
+} ReplayWriter;
+
+bool replayWriterOpen(ReplayWriter* writer, const char* filename, uint64_t seed,
+                      int ticksPerSecond, int numPlayers);
+// Call with the input of every tick, in order, before it is simulated
+void replayWriterRecordTick(ReplayWriter* writer, unsigned int tick, const SimulationInput* input);
+// numTicks is the number of ticks simulated. finalStateHash is simulationStateHash() after them
+void replayWriterClose(ReplayWriter* writer, unsigned int numTicks, uint64_t finalStateHash);
+
+typedef struct ReplayReader
+{
+	FILE* file;
+	uint64_t seed;
+	int ticksPerSecond;
+	int numPlayers;
+
+	// The next record, read ahead so we know which tick it applies to
+	unsigned int nextRecordTick;
+	unsigned char nextRecordFlags;
+
+	// Engine input is held until a record changes it
+	unsigned char engineInput[MAX_PLAYERS];
+
+	// Only valid once the end record has been read
+	bool hasEnd;
+	unsigned int endTick;
+	uint64_t finalStateHash;
+
+	// The file was truncated or malformed. Playback stops where the problem was
+	bool isCorrupt;
+} ReplayReader;
+
+// Reads the header. On success, initialize the simulation with reader->seed,
+// reader->ticksPerSecond, and reader->numPlayers before playing it back
+bool replayReaderOpen(ReplayReader* reader, const char* filename);
+// Fills input for the given tick. Ticks must be requested in order starting from 0. Returns false
+// once the replay has no more ticks
+bool replayReaderNextTick(ReplayReader* reader, unsigned int tick, SimulationInput* input);
+void replayReaderClose(ReplayReader* reader);
@@ -0,0 +1,265 @@
+#include "Rewind.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_STATE_WORDS (sizeof(SimulationState) / sizeof(uint64_t))
+
+//
+// Delta encoding
+//
+
+static unsigned char* writeVarint(unsigned char* out, uint64_t value)
+{
+	do
+	{
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		*out++ = byte;
+	} while (value);
+	return out;
+}
+
+static const unsigned char* readVarint(const unsigned char* in, uint64_t* valueOut)
+{
+	uint64_t value = 0;
+	for (int shift = 0;; shift += 7)
+	{
+		unsigned char byte = *in++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
+	}
+	*valueOut = value;
+	return in;
+}
+
+// Encodes newState XOR oldState as runs of [zero words, literal words, literals...]. Returns the
+// number of bytes written
+static size_t encodeXorDelta(const SimulationState* oldState, const SimulationState* newState,
+                             unsigned char* out)
+{
+	const uint64_t* oldWords = (const uint64_t*)oldState;
+	const uint64_t* newWords = (const uint64_t*)newState;
+	unsigned char* write = out;
+	size_t wordIndex = 0;
+	while (wordIndex < NUM_STATE_WORDS)
+	{
+		size_t zeroStart = wordIndex;
+		while (wordIndex < NUM_STATE_WORDS && oldWords[wordIndex] == newWords[wordIndex])
+			++wordIndex;
+		size_t literalStart = wordIndex;
+		while (wordIndex < NUM_STATE_WORDS && oldWords[wordIndex] != newWords[wordIndex])
+			++wordIndex;
+
+		write = writeVarint(write, literalStart - zeroStart);
+		write = writeVarint(write, wordIndex - literalStart);
+		for (size_t i = literalStart; i < wordIndex; ++i)
+		{
+			uint64_t xorWord = oldWords[i] ^ newWords[i];
+			memcpy(write, &xorWord, sizeof(xorWord));
+			write += sizeof(xorWord);
+		}
+	}
+	return write - out;
+}
+
+static void applyXorDelta(SimulationState* state, const unsigned char* delta, size_t deltaSize)
+{
+	uint64_t* words = (uint64_t*)state;
+	const unsigned char* read = delta;
+	const unsigned char* end = delta + deltaSize;
+	size_t wordIndex = 0;
+	while (read < end)
+	{
+		uint64_t numZeroWords = 0;
+		uint64_t numLiteralWords = 0;
+		read = readVarint(read, &numZeroWords);
+		read = readVarint(read, &numLiteralWords);
+		wordIndex += numZeroWords;
+		assert(wordIndex + numLiteralWords <= NUM_STATE_WORDS && "Corrupt rewind delta");
+		for (uint64_t i = 0; i < numLiteralWords; ++i)
+		{
+			uint64_t xorWord;
+			memcpy(&xorWord, read, sizeof(xorWord));
+			read += sizeof(xorWord);
+			words[wordIndex++] ^= xorWord;
+		}
+	}
+}
+
+//
+// Ring buffers
+//
+
+static RewindKeyframe* keyframeAt(const RewindBuffer* rewind, int index)
+{
+	return &rewind->keyframes[(rewind->firstKeyframe + index) % rewind->keyframeCapacity];
+}
+
+static void evictOldestKeyframe(RewindBuffer* rewind)
+{
+	rewind->firstKeyframe = (rewind->firstKeyframe + 1) % rewind->keyframeCapacity;
+	--rewind->numKeyframes;
+}
+
+static void copyIntoDeltaRing(RewindBuffer* rewind, uint64_t position, const unsigned char* bytes,
+                              size_t size)
+{
+	size_t offset = position % rewind->deltaCapacity;
+	size_t firstPart = rewind->deltaCapacity - offset;
+	if (firstPart > size)
+		firstPart = size;
+	memcpy(rewind->deltaBytes + offset, bytes, firstPart);
+	memcpy(rewind->deltaBytes, bytes + firstPart, size - firstPart);
+}
+
+static void copyOutOfDeltaRing(const RewindBuffer* rewind, uint64_t position, unsigned char* bytes,
+                               size_t size)
+{
+	size_t offset = position % rewind->deltaCapacity;
+	size_t firstPart = rewind->deltaCapacity - offset;
+	if (firstPart > size)
+		firstPart = size;
+	memcpy(bytes, rewind->deltaBytes + offset, firstPart);
+	memcpy(bytes + firstPart, rewind->deltaBytes, size - firstPart);
+}
+
+static void pushKeyframe(RewindBuffer* rewind, const SimulationState* state)
+{
+	RewindKeyframe newKeyframe = {state->tick, rewind->deltaWritePosition, 0};
+	if (rewind->numKeyframes)
+	{
+		size_t deltaSize = encodeXorDelta(state, rewind->newestKeyframe, rewind->scratch);
+		// Only the deltas of the second-oldest keyframe onwards are needed; the oldest keyframe is
+		// as far back as we can go
+		while (rewind->numKeyframes > 1 &&
+		       rewind->deltaWritePosition + deltaSize - keyframeAt(rewind, 1)->deltaStart >
+		           rewind->deltaCapacity)
+			evictOldestKeyframe(rewind);
+		if (deltaSize > rewind->deltaCapacity)
+		{
+			// Can't link this keyframe to any history, so start over from it
+			rewind->numKeyframes = 0;
+		}
+		else
+		{
+			copyIntoDeltaRing(rewind, rewind->deltaWritePosition, rewind->scratch, deltaSize);
+			rewind->deltaWritePosition += deltaSize;
+			newKeyframe.deltaSize = deltaSize;
+		}
+	}
+
+	if (rewind->numKeyframes == rewind->keyframeCapacity)
+		evictOldestKeyframe(rewind);
+	++rewind->numKeyframes;
+	*keyframeAt(rewind, rewind->numKeyframes - 1) = newKeyframe;
+	memcpy(rewind->newestKeyframe, state, sizeof(SimulationState));
+}
+
+//
+// Interface
+//
+
+bool rewindInitialize(RewindBuffer* rewind, int ticksPerSecond, int secondsToKeep,
+                      size_t maxDeltaBytes)
+{
+	assert(sizeof(SimulationState) % sizeof(uint64_t) == 0 &&
+	       "Deltas are encoded a word at a time");
+	memset(rewind, 0, sizeof(RewindBuffer));
+	rewind->maxTicksToKeep = ticksPerSecond * secondsToKeep;
+	// Rewinding needs the inputs from the keyframe before the oldest tick in the window
+	rewind->inputCapacity = rewind->maxTicksToKeep + c_rewindKeyframeInterval + 1;
+	rewind->keyframeCapacity = (rewind->maxTicksToKeep / c_rewindKeyframeInterval) + 2;
+	rewind->deltaCapacity = maxDeltaBytes;
+
+	rewind->newestKeyframe = malloc(sizeof(SimulationState));
+	// Worst case is alternating changed and unchanged words, which costs less than the raw state
+	rewind->scratch = malloc(sizeof(SimulationState) + 32);
+	rewind->deltaBytes = malloc(maxDeltaBytes);
+	rewind->keyframes = malloc(rewind->keyframeCapacity * sizeof(RewindKeyframe));
+	rewind->inputs = malloc(rewind->inputCapacity * sizeof(SimulationInput));
+	if (!rewind->newestKeyframe || !rewind->scratch || !rewind->deltaBytes || !rewind->keyframes ||
+	    !rewind->inputs)
+	{
+		rewindDestroy(rewind);
+		return false;
+	}
+	return true;
+}
+
+void rewindDestroy(RewindBuffer* rewind)
+{
+	free(rewind->newestKeyframe);
+	free(rewind->scratch);
+	free(rewind->deltaBytes);
+	free(rewind->keyframes);
+	free(rewind->inputs);
+	memset(rewind, 0, sizeof(RewindBuffer));
+}
+
+void rewindRecordTick(RewindBuffer* rewind, const SimulationState* state,
+                      const SimulationInput* input)
+{
+	unsigned int tick = state->tick;
+	// The caller jumped somewhere else (e.g. loaded a snapshot), so the history no longer leads
+	// here
+	if (rewind->numKeyframes && tick != rewind->endTick)
+		rewind->numKeyframes = 0;
+
+	// Rewinding onto a keyframe leaves it as the newest one, which doesn't need pushing again
+	if (!rewind->numKeyframes || (tick % c_rewindKeyframeInterval == 0 &&
+	                              keyframeAt(rewind, rewind->numKeyframes - 1)->tick != tick))
+		pushKeyframe(rewind, state);
+
+	rewind->inputs[tick % rewind->inputCapacity] = *input;
+	rewind->endTick = tick + 1;
+
+	// Keep the newest keyframe at or before the start of the window
+	while (rewind->numKeyframes > 1 &&
+	       keyframeAt(rewind, 1)->tick + rewind->maxTicksToKeep <= rewind->endTick)
+		evictOldestKeyframe(rewind);
+}
+
+unsigned int rewindOldestTick(const RewindBuffer* rewind)
+{
+	if (!rewind->numKeyframes)
+		return rewind->endTick;
+	return keyframeAt(rewind, 0)->tick;
+}
+
+size_t rewindMemoryUsed(const RewindBuffer* rewind)
+{
+	size_t deltaBytesUsed = 0;
+	if (rewind->numKeyframes > 1)
+		deltaBytesUsed = rewind->deltaWritePosition - keyframeAt(rewind, 1)->deltaStart;
+	return deltaBytesUsed + sizeof(SimulationState) +
+	       (rewind->inputCapacity * sizeof(SimulationInput)) +
+	       (rewind->keyframeCapacity * sizeof(RewindKeyframe));
+}
+
+bool rewindTo(RewindBuffer* rewind, SimulationState* state, unsigned int tick)
+{
+	if (!rewind->numKeyframes || tick < rewindOldestTick(rewind) || tick > rewind->endTick)
+		return false;
+
+	// Walk the newest keyframe back until it is at or before the tick. Those deltas are consumed,
+	// so their space is reused by the next keyframe
+	for (RewindKeyframe* newest = keyframeAt(rewind, rewind->numKeyframes - 1); newest->tick > tick;
+	     newest = keyframeAt(rewind, rewind->numKeyframes - 1))
+	{
+		copyOutOfDeltaRing(rewind, newest->deltaStart, rewind->scratch, newest->deltaSize);
+		applyXorDelta(rewind->newestKeyframe, rewind->scratch, newest->deltaSize);
+		rewind->deltaWritePosition = newest->deltaStart;
+		--rewind->numKeyframes;
+	}
+
+	memcpy(state, rewind->newestKeyframe, sizeof(SimulationState));
+	while (state->tick < tick)
+		simulationTick(state, &rewind->inputs[state->tick % rewind->inputCapacity]);
+	rewind->endTick = tick;
+	return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+// Keeps the recent history of a simulation so it can be rewound to any tick in it
+//
+// Every c_rewindKeyframeInterval ticks the state is XORed against the previous keyframe and the
+// zero runs are RLE compressed. Only the newest keyframe is kept whole; older ones are recovered by
+// XORing deltas back into it. Between keyframes, only each tick's input is stored: the simulation
+// is deterministic, so rewinding re-simulates from the nearest keyframe instead of storing the
+// state of every tick
+//
+// Like Simulation.h, this must not depend on SDL
+
+#include "Simulation.h"
+
+#include <stddef.h>
+
+// Each keyframe's delta is mostly the drifting objects, so spacing keyframes out is what keeps the
+// history small. Rewinding re-simulates at most this many ticks
+static const unsigned int c_rewindKeyframeInterval = 60;
+
+// rewindMemoryUsed() should stay under the newest keyframe plus this much per tick of history,
+// which fits 60 seconds at 60 Hz in 1 MB. The headless runner's --rewind-seconds check enforces it
+static const size_t c_rewindBudgetBytesPerTick = 220;
+
+typedef struct RewindKeyframe
+{
+	unsigned int tick;
+	// Position of the delta in deltaBytes which turns this keyframe into the previous one.
+	// Positions only ever increase; wrap them with deltaCapacity
+	uint64_t deltaStart;
+	uint32_t deltaSize;
+} RewindKeyframe;
+
+typedef struct RewindBuffer
+{
+	SimulationState* newestKeyframe;
+	// Encoding and decoding happen here so the ring never needs to be contiguous
+	unsigned char* scratch;
+
+	unsigned char* deltaBytes;
+	size_t deltaCapacity;
+	uint64_t deltaWritePosition;
+
+	RewindKeyframe* keyframes;
+	int keyframeCapacity;
+	int firstKeyframe;
+	int numKeyframes;
+
+	// Indexed by tick % inputCapacity
+	SimulationInput* inputs;
+	unsigned int inputCapacity;
+	unsigned int maxTicksToKeep;
+	// One past the last tick recorded, i.e. the tick of the state after it
+	unsigned int endTick;
+} RewindBuffer;
+
+// Keeps up to secondsToKeep of history, or less if the deltas outgrow maxDeltaBytes
+bool rewindInitialize(RewindBuffer* rewind, int ticksPerSecond, int secondsToKeep,
+                      size_t maxDeltaBytes);
+void rewindDestroy(RewindBuffer* rewind);
+
+// Call before every simulationTick(), with the state and input about to be simulated
+void rewindRecordTick(RewindBuffer* rewind, const SimulationState* state,
+                      const SimulationInput* input);
+
+// The earliest tick rewindTo() can reach
+unsigned int rewindOldestTick(const RewindBuffer* rewind);
+// How much memory the history is using right now
+size_t rewindMemoryUsed(const RewindBuffer* rewind);
+
+// Put state back to how it was at the start of tick. History after that tick is discarded, so
+// recording picks up from there. Returns false if the tick is outside the history
+bool rewindTo(RewindBuffer* rewind, SimulationState* state, unsigned int tick);
@@ -0,0 +1,346 @@
+// Hosts many independent sessions in one process, each flown by a bot. Sessions share nothing, so
+// each step hands them out to a fixed set of worker threads; no locks are taken while simulating
+
+#include "Bot.h"
+#include "Control.h"
+#include "Jobs.h"
+#include "Simulation.h"
+#include "Threads.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void printUsage(const char* programName)
+{
+	fprintf(stderr,
+	        "Usage: %s [--sessions N] [--threads N] [--seconds N] [--tick-rate N] [--seed N]\n"
+	        "          [--players N] [--realtime | --scaling]\n"
+	        "       %s --control SOCKET_PATH [--threads N] [--max-clients N]\n"
+	        "\n"
+	        "Runs N sessions (default 256) of --seconds game seconds each on a pool of worker\n"
+	        "threads (default one per hardware thread). Session i uses seed + i. Bots fly every\n"
+	        "player's ship towards the goal.\n"
+	        "\n"
+	        "By default sessions are simulated as fast as possible. --realtime paces them at the\n"
+	        "tick rate like a real server would, and reports how much of each tick was spare.\n"
+	        "--scaling repeats the run with 1, 2, 4... threads and reports the speedup.\n"
+	        "\n"
+	        "--control serves sessions to other programs over a Unix domain socket instead. See\n"
+	        "Control.h for the protocol.\n",
+	        programName, programName);
+}
+
+static double secondsNow()
+{
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return (double)time.tv_sec + (double)time.tv_nsec / 1000000000.0;
+}
+
+typedef struct ServerSession
+{
+	SimulationState state;
+	unsigned int numTicksToRun;
+
+	// Tick time accounting
+	unsigned int numTicks;
+	double tickSeconds;
+	double slowestTickSeconds;
+} ServerSession;
+
+// Each worker writes only its own, padded so workers don't fight over cache lines
+typedef struct WorkerAccounting
+{
+	double busySeconds;
+	char padding[64 - sizeof(double)];
+} WorkerAccounting;
+
+typedef struct Server
+{
+	ServerSession* sessions;
+	int numSessions;
+	JobSystem* jobs;
+	// How many ticks each session advances per step
+	unsigned int ticksPerStep;
+	WorkerAccounting workers[MAX_WORKER_THREADS];
+} Server;
+
+static void advanceSession(Server* server, int sessionIndex, int workerIndex)
+{
+	ServerSession* session = &server->sessions[sessionIndex];
+	double startTime = secondsNow();
+	double tickStartTime = startTime;
+	for (unsigned int i = 0; i < server->ticksPerStep && session->numTicks < session->numTicksToRun;
+	     ++i)
+	{
+		SimulationInput input = {0};
+		for (int player = 0; player < session->state.numPlayers; ++player)
+			input.engineInput[player] = botPilotInput(&session->state, player);
+		simulationTick(&session->state, &input);
+
+		double tickEndTime = secondsNow();
+		double tickSeconds = tickEndTime - tickStartTime;
+		tickStartTime = tickEndTime;
+		session->tickSeconds += tickSeconds;
+		if (tickSeconds > session->slowestTickSeconds)
+			session->slowestTickSeconds = tickSeconds;
+		++session->numTicks;
+	}
+	server->workers[workerIndex].busySeconds += tickStartTime - startTime;
+}
+
+static void advanceSessions(void* userData, int begin, int end, int workerIndex)
+{
+	for (int i = begin; i < end; ++i)
+		advanceSession((Server*)userData, i, workerIndex);
+}
+
+static void startSessions(Server* server, uint64_t seed, int ticksPerSecond, int numPlayers,
+                          unsigned int numTicks)
+{
+	for (int i = 0; i < server->numSessions; ++i)
+	{
+		ServerSession* session = &server->sessions[i];
+		memset(session, 0, sizeof(ServerSession));
+		simulationInitialize(&session->state, seed + i, ticksPerSecond, numPlayers);
+		session->numTicksToRun = numTicks;
+	}
+	memset(server->workers, 0, sizeof(server->workers));
+}
+
+static bool allSessionsFinished(const Server* server)
+{
+	for (int i = 0; i < server->numSessions; ++i)
+	{
+		if (server->sessions[i].numTicks < server->sessions[i].numTicksToRun)
+			return false;
+	}
+	return true;
+}
+
+// Returns the total ticks per second
+static double reportRun(const Server* server, double elapsedSeconds)
+{
+	uint64_t totalTicks = 0;
+	double totalTickSeconds = 0.0;
+	double slowestTickSeconds = 0.0;
+	int slowestTickSession = 0;
+	double slowestSessionSeconds = 0.0;
+	int slowestSession = 0;
+	int numReachedEnd = 0;
+	int numDestroyed = 0;
+	for (int i = 0; i < server->numSessions; ++i)
+	{
+		const ServerSession* session = &server->sessions[i];
+		totalTicks += session->numTicks;
+		totalTickSeconds += session->tickSeconds;
+		if (session->slowestTickSeconds > slowestTickSeconds)
+		{
+			slowestTickSeconds = session->slowestTickSeconds;
+			slowestTickSession = i;
+		}
+		if (session->tickSeconds > slowestSessionSeconds)
+		{
+			slowestSessionSeconds = session->tickSeconds;
+			slowestSession = i;
+		}
+		if (simulationIsPlayerDestroyed((SimulationState*)&session->state))
+			++numDestroyed;
+		else if (!simulationCurrentPhase((SimulationState*)&session->state))
+			++numReachedEnd;
+	}
+
+	double ticksPerSecond = elapsedSeconds > 0.0 ? totalTicks / elapsedSeconds : 0.0;
+	printf("%d sessions on %d threads: %llu ticks in %.3f seconds, %.0f ticks per second\n",
+	       server->numSessions, server->jobs->numThreads, (unsigned long long)totalTicks,
+	       elapsedSeconds, ticksPerSecond);
+	if (totalTicks)
+		printf("Tick time: %.2f us on average. Slowest session averaged %.2f us (session %d). "
+		       "Slowest tick %.2f us (session %d)\n",
+		       (totalTickSeconds * 1000000.0) / totalTicks,
+		       (slowestSessionSeconds * 1000000.0) / server->sessions[slowestSession].numTicks,
+		       slowestSession, slowestTickSeconds * 1000000.0, slowestTickSession);
+
+	double minBusySeconds = elapsedSeconds;
+	double maxBusySeconds = 0.0;
+	for (int i = 0; i < server->jobs->numThreads; ++i)
+	{
+		double busySeconds = server->workers[i].busySeconds;
+		if (busySeconds < minBusySeconds)
+			minBusySeconds = busySeconds;
+		if (busySeconds > maxBusySeconds)
+			maxBusySeconds = busySeconds;
+	}
+	if (elapsedSeconds > 0.0)
+		printf("Workers were busy %.0f%% to %.0f%% of the time\n",
+		       (minBusySeconds * 100.0) / elapsedSeconds,
+		       (maxBusySeconds * 100.0) / elapsedSeconds);
+	printf("Bots: %d reached the end, %d destroyed, %d still playing\n", numReachedEnd,
+	       numDestroyed, server->numSessions - numReachedEnd - numDestroyed);
+	return ticksPerSecond;
+}
+
+// As fast as possible. Each step covers a game second so workers rarely wait on each other
+static double runFlatOut(Server* server, int ticksPerSecond)
+{
+	server->ticksPerStep = ticksPerSecond;
+	double startTime = secondsNow();
+	while (!allSessionsFinished(server))
+		jobSystemParallelFor(server->jobs, server->numSessions, 1, advanceSessions, server);
+	return secondsNow() - startTime;
+}
+
+// One tick per step, at the tick rate
+static double runRealtime(Server* server, int ticksPerSecond)
+{
+	server->ticksPerStep = 1;
+	double secondsPerTick = 1.0 / ticksPerSecond;
+	unsigned int numSteps = 0;
+	unsigned int numLateSteps = 0;
+	double totalStepSeconds = 0.0;
+	double slowestStepSeconds = 0.0;
+	double startTime = secondsNow();
+	double nextStepTime = startTime;
+	while (!allSessionsFinished(server))
+	{
+		double stepStartTime = secondsNow();
+		jobSystemParallelFor(server->jobs, server->numSessions, 1, advanceSessions, server);
+		double stepSeconds = secondsNow() - stepStartTime;
+		totalStepSeconds += stepSeconds;
+		if (stepSeconds > slowestStepSeconds)
+			slowestStepSeconds = stepSeconds;
+		++numSteps;
+
+		nextStepTime += secondsPerTick;
+		double now = secondsNow();
+		if (now > nextStepTime)
+		{
+			// Don't try to catch up; a server which is behind stays behind
+			++numLateSteps;
+			nextStepTime = now;
+		}
+		else
+			threadSleep(nextStepTime - now);
+	}
+	double elapsedSeconds = secondsNow() - startTime;
+
+	if (numSteps)
+		printf("Realtime: steps took %.3f ms on average and %.3f ms at worst, of %.3f ms available "
+		       "(%.0f%% spare). %u of %u steps were late\n",
+		       (totalStepSeconds * 1000.0) / numSteps, slowestStepSeconds * 1000.0,
+		       secondsPerTick * 1000.0,
+		       100.0 - ((totalStepSeconds * 100.0) / (numSteps * secondsPerTick)), numLateSteps,
+		       numSteps);
+	return elapsedSeconds;
+}
+
+int main(int numArguments, char** arguments)
+{
+	int numSessions = 256;
+	int numThreads = 0;
+	unsigned int numSeconds = 60;
+	int ticksPerSecond = c_defaultTicksPerSecond;
+	int numPlayers = 1;
+	uint64_t seed = 0;
+	bool isRealtime = false;
+	bool measureScaling = false;
+	const char* controlSocketPath = NULL;
+	int maxControlClients = c_controlDefaultMaxClients;
+	for (int i = 1; i < numArguments; ++i)
+	{
+		if (strcmp(arguments[i], "--sessions") == 0 && i + 1 < numArguments)
+			numSessions = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--threads") == 0 && i + 1 < numArguments)
+			numThreads = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--seconds") == 0 && i + 1 < numArguments)
+			numSeconds = strtoul(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--tick-rate") == 0 && i + 1 < numArguments)
+			ticksPerSecond = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--players") == 0 && i + 1 < numArguments)
+			numPlayers = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--seed") == 0 && i + 1 < numArguments)
+			seed = strtoull(arguments[++i], NULL, 10);
+		else if (strcmp(arguments[i], "--control") == 0 && i + 1 < numArguments)
+			controlSocketPath = arguments[++i];
+		else if (strcmp(arguments[i], "--max-clients") == 0 && i + 1 < numArguments)
+			maxControlClients = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--realtime") == 0)
+			isRealtime = true;
+		else if (strcmp(arguments[i], "--scaling") == 0)
+			measureScaling = true;
+		else
+		{
+			printUsage(arguments[0]);
+			return 1;
+		}
+	}
+	if (numSessions < 1 || !simulationIsValidTickRate(ticksPerSecond) || numPlayers < 1 ||
+	    numPlayers > MAX_PLAYERS || (isRealtime && measureScaling) || maxControlClients < 1)
+	{
+		printUsage(arguments[0]);
+		return 1;
+	}
+
+	// Too big for the stack
+	static JobSystem jobSystem;
+	if (controlSocketPath)
+	{
+		if (!jobSystemInitialize(&jobSystem, numThreads))
+			return 1;
+		bool served = controlServe(controlSocketPath, maxControlClients, &jobSystem);
+		jobSystemDestroy(&jobSystem);
+		return served ? 0 : 1;
+	}
+
+	Server server = {0};
+	server.jobs = &jobSystem;
+	server.numSessions = numSessions;
+	server.sessions = malloc(numSessions * sizeof(ServerSession));
+	if (!server.sessions)
+	{
+		fprintf(stderr, "Not enough memory for %d sessions\n", numSessions);
+		return 1;
+	}
+	unsigned int numTicks = numSeconds * ticksPerSecond;
+
+	if (measureScaling)
+	{
+		int maxThreads = numThreads > 0 ? numThreads : threadNumHardwareThreads();
+		double singleThreadTicksPerSecond = 0.0;
+		for (int threads = 1;; threads *= 2)
+		{
+			if (threads > maxThreads)
+				threads = maxThreads;
+			if (!jobSystemInitialize(&jobSystem, threads))
+				return 1;
+			startSessions(&server, seed, ticksPerSecond, numPlayers, numTicks);
+			double ticksPerSecondNow = reportRun(&server, runFlatOut(&server, ticksPerSecond));
+			jobSystemDestroy(&jobSystem);
+			if (threads == 1)
+				singleThreadTicksPerSecond = ticksPerSecondNow;
+			double speedup = singleThreadTicksPerSecond > 0.0 ?
+			                     ticksPerSecondNow / singleThreadTicksPerSecond :
+			                     0.0;
+			printf("Speedup on %d threads: %.2fx (%.0f%% of linear)\n\n", threads, speedup,
+			       (speedup * 100.0) / threads);
+			if (threads == maxThreads)
+				break;
+		}
+	}
+	else
+	{
+		if (!jobSystemInitialize(&jobSystem, numThreads))
+			return 1;
+		startSessions(&server, seed, ticksPerSecond, numPlayers, numTicks);
+		if (isRealtime)
+			reportRun(&server, runRealtime(&server, ticksPerSecond));
+		else
+			reportRun(&server, runFlatOut(&server, ticksPerSecond));
+		jobSystemDestroy(&jobSystem);
+	}
+
+	free(server.sessions);
+	return 0;
+}
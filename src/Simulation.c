@@ -0,0 +1,1608 @@
+#include "Simulation.h"
+
+#include "Jobs.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Constants
+//
+
+// space
+const int c_spawnBuffer = /*c_spaceSize / 10*/ 1000;  // 10% margins
+
+// On failure
+const unsigned int c_perCellDamageRoll = 30;
+
+// Ship
+const float c_shipThrust = 300.f;
+// Fixed units of fuel burned per fixed unit of time
+const int c_fuelConsumptionRate = 1;
+const int c_numDerelictShips = 12;
+
+// Physics
+const float c_playerDrag = 0.f;
+const float c_onFailurePlayerDrag = 0.1f;
+const float c_objectDrag = 0.05f;
+
+// These force transfer values fake Newton's Third Law of Motion (equal and opposite reactions) by
+// using hard-coded values rather than F=MA. This gives us more control over the feel.
+
+// Objects colliding with the ship will receive the player's velocity plus a bit more
+const float c_objectForceTransfer = 1.2f;
+// This will go straight to reducing player velocity, regardless of the object's velocity. By reducing the player's velocity, we give the asteriods a feeling of weight
+const float c_shipObjectForceTransfer = 8.f;
+
+// Factory
+// How long an object sits on a tile before moving on, in fixed units. These are what the old
+// per-tick accumulators actually worked out to at 60 Hz (0.55 and 2.15 seconds)
+const unsigned short c_conveyorTransitionTime = 132;
+const unsigned short c_furnaceTransitionTime = 516;
+const int c_fuelPerRefinedObject = 1 * FIXED_UNITS_PER_SECOND;
+
+// Objects
+const int c_numObjectsToCreate = 400;
+
+//
+// Math
+//
+
+bool pointInFRect(Vec2* point, FRect* rect)
+{
+	return point->x >= rect->x && point->x < (rect->x + rect->w) && point->y >= rect->y &&
+	       point->y < (rect->y + rect->h);
+}
+
+bool pointInRect(Vec2* point, IRect* rect)
+{
+	return point->x > rect->x && point->x < (rect->x + rect->w) && point->y > rect->y &&
+	       point->y < (rect->y + rect->h);
+}
+
+float Magnitude(Vec2* vec)
+{
+	return sqrt(vec->x * vec->x + vec->y * vec->y);
+}
+
+//
+// Random
+//
+
+void randomSeed(RandomState* random, uint64_t seed, uint64_t stream)
+{
+	random->state = 0;
+	random->increment = (stream << 1u) | 1u;
+	randomNext(random);
+	random->state += seed;
+	randomNext(random);
+}
+
+uint32_t randomNext(RandomState* random)
+{
+	uint64_t oldState = random->state;
+	random->state = oldState * 6364136223846793005ULL + random->increment;
+	uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+	uint32_t rotation = (uint32_t)(oldState >> 59u);
+	return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+}
+
+int randomRange(RandomState* random, int max)
+{
+	// Multiply-shift instead of modulo. Bias is negligible for the small ranges used here
+	return (int)(((uint64_t)randomNext(random) * (uint64_t)max) >> 32);
+}
+
+//
+// State hash
+//
+
+// splitmix64's finalizer. Turns structured keys into random-looking ones, which gives us Zobrist
+// hashing without storing a table of keys for every cell and object
+static uint64_t hashMix(uint64_t value)
+{
+	value ^= value >> 30;
+	value *= 0xbf58476d1ce4e5b9ULL;
+	value ^= value >> 27;
+	value *= 0x94d049bb133111ebULL;
+	value ^= value >> 31;
+	return value;
+}
+
+static uint64_t hashFloat(uint64_t hash, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return hashMix(hash ^ bits);
+}
+
+// Engine firing is left out: it is recomputed from input each tick before anything reads it
+static uint64_t cellHashKey(const SimulationState* state, const GridCell* cell)
+{
+	uint64_t cellIndex = cell - state->shipCells;
+	return hashMix((cellIndex << 40) ^ ((uint64_t)cell->type << 32) ^
+	               (uint32_t)cell->engineCell.fuel);
+}
+
+// Destroyed objects contribute nothing, so destroying one is just XORing its old key out
+static uint64_t objectHashKey(const SimulationState* state, const Object* object)
+{
+	if (!object->type)
+		return 0;
+	uint64_t objectIndex = object - state->objects;
+	// Set a high bit so these never collide with cell keys
+	return hashMix((1ULL << 63) ^ (objectIndex << 48) ^ ((uint64_t)object->type << 40) ^
+	               ((uint64_t)object->inFactory << 39) ^ ((uint64_t)object->ship << 32) ^
+	               ((uint64_t)object->tileX << 24) ^ ((uint64_t)object->tileY << 16) ^
+	               object->transition);
+}
+
+static uint64_t inventoryHash(const SimulationState* state)
+{
+	uint64_t hash = 0;
+	for (int i = 0; i < ARRAY_SIZE(state->inventory); ++i)
+		hash = hashMix(hash ^ ((uint64_t)i << 32) ^ state->inventory[i]);
+	return hash;
+}
+
+static uint64_t computeStateHash(const SimulationState* state)
+{
+	uint64_t hash = inventoryHash(state);
+	for (int i = 0; i < state->numShipCellsUsed; ++i)
+		hash ^= cellHashKey(state, &state->shipCells[i]);
+	for (int i = 0; i < ARRAY_SIZE(state->objects); ++i)
+		hash ^= objectHashKey(state, &state->objects[i]);
+	return hash;
+}
+
+uint64_t simulationStateHash(const SimulationState* state)
+{
+	// The handful of values which change rarely are cheaper to mix in here than to track
+	uint64_t hash = hashMix(state->stateHash ^ state->tick);
+	hash = hashMix(hash ^ ((uint64_t)state->currentGamePhase << 32) ^ state->numDamagesSustained);
+	hash = hashMix(hash ^ (uint32_t)state->constructionFuelPool);
+	hash = hashMix(hash ^ ((uint64_t)(uint32_t)state->goal.x << 32) ^ (uint32_t)state->goal.y);
+	return hash;
+}
+
+uint64_t simulationFullHash(const SimulationState* state)
+{
+	uint64_t hash = hashMix(computeStateHash(state) ^ simulationStateHash(state));
+	for (int i = 0; i < state->numShips; ++i)
+	{
+		const RigidBody* body = &state->ships[i].body;
+		hash = hashFloat(hash, body->position.x);
+		hash = hashFloat(hash, body->position.y);
+		hash = hashFloat(hash, body->velocity.x);
+		hash = hashFloat(hash, body->velocity.y);
+	}
+	for (int i = 0; i < ARRAY_SIZE(state->objects); ++i)
+	{
+		const Object* object = &state->objects[i];
+		if (!object->type)
+			continue;
+		hash = hashFloat(hash, object->body.position.x);
+		hash = hashFloat(hash, object->body.position.y);
+		hash = hashFloat(hash, object->body.velocity.x);
+		hash = hashFloat(hash, object->body.velocity.y);
+	}
+	return hash;
+}
+
+bool simulationVerifyStateHash(const SimulationState* state)
+{
+	return computeStateHash(state) == state->stateHash;
+}
+
+//
+// Grid
+//
+
+// Let's try to keep it static for now
+/* static GridSpace* createGridSpace(unsigned char width, unsigned char height) */
+/* { */
+/* 	char* mem = (char*)malloc(sizeof(GridSpace) + (width * height * sizeof(GridCell))); */
+/* 	GridSpace* newSpace = (GridSpace*)mem; */
+/* 	newSpace->width = width; */
+/* 	newSpace->height = height; */
+/* 	newSpace->data = (GridCell*)(mem + sizeof(GridSpace)); */
+/* 	return newSpace; */
+/* } */
+
+/* static void freeGridSpace(GridSpace* gridSpace) */
+/* { */
+/* 	free(gridSpace); */
+/* } */
+
+void renderGridSpaceText(GridSpace* gridSpace)
+{
+	for (int y = 0; y < gridSpace->height; ++y)
+	{
+		for (int x = 0; x < gridSpace->width; ++x)
+		{
+			fprintf(stderr, "%c", GridCellAt(gridSpace, x, y).type);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+bool isEngineTile(unsigned char c)
+{
+	return c == 'u' || c == 'l' || c == 'r' || c == 'd';
+}
+
+void setGridSpaceFromString(GridSpace* gridSpace, const char* str)
+{
+	GridCell* writeHead = gridSpace->data;
+	GridCell* gridSpaceEnd = writeHead + (gridSpace->width * gridSpace->height);
+	for (const char* c = str; *c != 0; ++c)
+	{
+		if (*c == '\n')
+			continue;
+		assert(writeHead < gridSpaceEnd && "GridSpace doesn't have enough room to fit the string.");
+		writeHead->type = *c;
+		if (isEngineTile(*c))
+		{
+			writeHead->engineCell.fuel = c_defaultStartFuel;
+			writeHead->engineCell.firing = false;
+		}
+
+		++writeHead;
+	}
+}
+
+//
+// Physics
+//
+
+static bool objHittingGrid(RigidBody* gridPos, GridSpace* gridSheet, RigidBody* objPos)
+{
+	FRect playerBoundingBox = {
+	    gridPos->position.x,
+	    gridPos->position.y,
+	    (float)((gridSheet->width) * c_tileSize),
+	    (float)((gridSheet->height) * c_tileSize),
+	};
+
+	return (pointInFRect(&objPos->position, &playerBoundingBox));
+}
+
+// Collision Detection
+static IVec2 TileCoordinateHit(RigidBody* gridPos, GridSpace* gridSheet, RigidBody* objPos)
+{
+	assert(objHittingGrid(gridPos, gridSheet, objPos));
+
+	float objX = objPos->position.x;
+	float objY = objPos->position.y;
+	float gridX = gridPos->position.x;
+	float gridY = gridPos->position.y;
+
+	float distToTop = abs(gridY - objY);
+	float distToBottom = abs(gridY + gridSheet->height * c_tileSize - objY);
+	float distToLeft = abs(gridX - objX);
+	float distToRight = abs(gridX + gridSheet->width * c_tileSize - objX);
+	int tileX;
+	int tileY;
+	if (distToTop < distToBottom && distToTop < distToLeft && distToTop < distToRight)
+	{
+		tileX = (int)(objX - gridX) / c_tileSize;
+		tileY = 0;
+		assert(tileX < gridSheet->width);
+		assert(tileY < gridSheet->height);
+	}
+	else if (distToBottom < distToTop && distToBottom < distToLeft && distToBottom < distToRight)
+	{
+		tileX = (int)(objX - gridX) / c_tileSize;
+		tileY = gridSheet->height - 1;
+		assert(tileX < gridSheet->width);
+		assert(tileY < gridSheet->height);
+	}
+	else if (distToLeft < distToTop && distToLeft < distToBottom && distToLeft < distToRight)
+	{
+		tileX = 0;
+		tileY = (int)(objY - gridPos->position.y) / c_tileSize;
+		assert(tileX < gridSheet->width);
+		assert(tileY < gridSheet->height);
+	}
+	else
+	{  // must be hitting the right side
+		tileX = gridSheet->width - 1;
+		tileY = (int)(objY - gridPos->position.y) / c_tileSize;
+		assert(tileX < gridSheet->width);
+		assert(tileY < gridSheet->height);
+	}
+	IVec2 result = {tileX, tileY};
+	return result;
+}
+
+static void UpdatePhysics(RigidBody* object, float drag, float dt)
+{
+	// update via implicit euler integration
+	object->velocity.x /= (1.f + (dt * drag));
+	object->velocity.y /= (1.f + (dt * drag));
+
+	object->position.x += object->velocity.x * dt;
+	object->position.y += object->velocity.y * dt;
+
+	if (object->position.x > c_spaceSize)
+		object->position.x = 0;
+
+	if (object->position.x < 0)
+		object->position.x = c_spaceSize;
+
+	if (object->position.y > c_spaceSize)
+		object->position.y = 0;
+
+	if (object->position.y < 0)
+		object->position.y = c_spaceSize;
+}
+
+static RigidBody SpawnPlayerPhys(int playerIndex)
+{
+	RigidBody player;
+	player.position.x = c_spaceSize / 2;
+	// Co-op ships start stacked a few cells apart
+	player.position.y = (c_spaceSize / 2) + (playerIndex * 10 * c_tileSize);
+	player.velocity.x = 0.f;
+	player.velocity.y = 0.f;
+	return player;
+}
+
+static void damageShip(SimulationState* state, Ship* ship)
+{
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	for (int cellY = 0; cellY < gridSpace.height; ++cellY)
+	{
+		for (int cellX = 0; cellX < gridSpace.width; ++cellX)
+		{
+			GridCell* currentCell = &GridCellAt(&gridSpace, cellX, cellY);
+			if (randomRange(&ship->random, c_perCellDamageRoll) == 1)
+			{
+				state->stateHash ^= cellHashKey(state, currentCell);
+				memset(currentCell, 0, sizeof(GridCell));
+				state->stateHash ^= cellHashKey(state, currentCell);
+			}
+		}
+	}
+}
+
+//
+// Ships
+//
+
+// Ships are bucketed into a coarse grid each tick so objects only test ships near them
+#define SHIP_BUCKET_SIZE 1024
+#define NUM_SHIP_BUCKETS_PER_AXIS 10
+
+typedef struct ShipBuckets
+{
+	FRect shipBounds[MAX_SHIPS];
+	// bucketStart[bucket]..bucketStart[bucket + 1] indexes bucketShips
+	unsigned short bucketStart[(NUM_SHIP_BUCKETS_PER_AXIS * NUM_SHIP_BUCKETS_PER_AXIS) + 1];
+	// A ship can overlap at most four buckets because buckets are larger than any ship
+	unsigned char bucketShips[MAX_SHIPS * 4];
+} ShipBuckets;
+
+GridSpace shipGridSpace(SimulationState* state, Ship* ship)
+{
+	GridSpace gridSpace = {ship->width, ship->height, &state->shipCells[ship->firstCell]};
+	return gridSpace;
+}
+
+// Must be called whenever a ship's cells are built, replaced or destroyed
+static void updateShipLayout(SimulationState* state, Ship* ship)
+{
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	ship->numSolidCells = 0;
+	memset(ship->rowMasks, 0, sizeof(ship->rowMasks));
+	// FNV-1a
+	uint64_t layoutHash = 14695981039346656037ull;
+	for (int cellY = 0; cellY < gridSpace.height; ++cellY)
+	{
+		for (int cellX = 0; cellX < gridSpace.width; ++cellX)
+		{
+			unsigned char type = GridCellAt(&gridSpace, cellX, cellY).type;
+			layoutHash = (layoutHash ^ type) * 1099511628211ull;
+			if (!type)
+				continue;
+			ship->rowMasks[cellY] |= 1u << cellX;
+			++ship->numSolidCells;
+		}
+	}
+	ship->layoutHash = layoutHash;
+}
+
+// Returns NULL if there is no room left in the fleet
+static Ship* spawnShip(SimulationState* state, unsigned char width, unsigned char height,
+                       const char* layout, RigidBody body)
+{
+	assert(width <= MAX_SHIP_DIMENSION && height <= MAX_SHIP_DIMENSION &&
+	       "Ship is too large for the collision masks");
+	if (state->numShips >= ARRAY_SIZE(state->ships) ||
+	    state->numShipCellsUsed + (width * height) > ARRAY_SIZE(state->shipCells))
+		return NULL;
+
+	Ship* ship = &state->ships[state->numShips++];
+	memset(ship, 0, sizeof(Ship));
+	ship->body = body;
+	ship->width = width;
+	ship->height = height;
+	ship->firstCell = state->numShipCellsUsed;
+	state->numShipCellsUsed += width * height;
+	randomSeed(&ship->random, state->seed, c_randomStreamFirstShip + (ship - state->ships));
+
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	memset(gridSpace.data, 0, width * height * sizeof(GridCell));
+	setGridSpaceFromString(&gridSpace, layout);
+	updateShipLayout(state, ship);
+	return ship;
+}
+
+static FRect shipBoundingBox(Ship* ship)
+{
+	FRect bounds = {ship->body.position.x, ship->body.position.y,
+	                (float)(ship->width * c_tileSize), (float)(ship->height * c_tileSize)};
+	return bounds;
+}
+
+static int shipBucketCoordinate(float worldCoordinate)
+{
+	int bucket = (int)worldCoordinate / SHIP_BUCKET_SIZE;
+	if (bucket < 0)
+		return 0;
+	if (bucket >= NUM_SHIP_BUCKETS_PER_AXIS)
+		return NUM_SHIP_BUCKETS_PER_AXIS - 1;
+	return bucket;
+}
+
+// Counting sort of ships into buckets: one pass to count, one to fill
+static void updateShipBuckets(SimulationState* state, ShipBuckets* buckets)
+{
+	unsigned short bucketCounts[ARRAY_SIZE(buckets->bucketStart)] = {0};
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (int shipIndex = 0; shipIndex < state->numShips; ++shipIndex)
+		{
+			if (pass == 0)
+				buckets->shipBounds[shipIndex] = shipBoundingBox(&state->ships[shipIndex]);
+			FRect bounds = buckets->shipBounds[shipIndex];
+			int minBucketX = shipBucketCoordinate(bounds.x);
+			int maxBucketX = shipBucketCoordinate(bounds.x + bounds.w);
+			int minBucketY = shipBucketCoordinate(bounds.y);
+			int maxBucketY = shipBucketCoordinate(bounds.y + bounds.h);
+			for (int bucketY = minBucketY; bucketY <= maxBucketY; ++bucketY)
+			{
+				for (int bucketX = minBucketX; bucketX <= maxBucketX; ++bucketX)
+				{
+					int bucket = (bucketY * NUM_SHIP_BUCKETS_PER_AXIS) + bucketX;
+					if (pass == 0)
+						++bucketCounts[bucket];
+					else
+						buckets->bucketShips[--bucketCounts[bucket]] = shipIndex;
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			// Exclusive prefix sum. Counts become end offsets, which the fill pass decrements
+			unsigned short total = 0;
+			for (int bucket = 0; bucket < ARRAY_SIZE(bucketCounts) - 1; ++bucket)
+			{
+				buckets->bucketStart[bucket] = total;
+				total += bucketCounts[bucket];
+				bucketCounts[bucket] = total;
+			}
+			buckets->bucketStart[ARRAY_SIZE(bucketCounts) - 1] = total;
+		}
+	}
+}
+
+// Returns the index of the ship the point is inside the bounds of, or -1
+static int findShipAtPoint(ShipBuckets* buckets, Vec2* point)
+{
+	int bucket = (shipBucketCoordinate(point->y) * NUM_SHIP_BUCKETS_PER_AXIS) +
+	             shipBucketCoordinate(point->x);
+	for (int i = buckets->bucketStart[bucket]; i < buckets->bucketStart[bucket + 1]; ++i)
+	{
+		int shipIndex = buckets->bucketShips[i];
+		if (pointInFRect(point, &buckets->shipBounds[shipIndex]))
+			return shipIndex;
+	}
+	return -1;
+}
+
+// Shift a row mask by a (possibly negative) number of cells
+static unsigned long long shiftRowMask(unsigned int mask, int shift)
+{
+	if (shift >= 64 || shift <= -64)
+		return 0;
+	if (shift >= 0)
+		return (unsigned long long)mask << shift;
+	return (unsigned long long)mask >> -shift;
+}
+
+// Narrowphase: do any non-empty cells of the two ships overlap? Ship B's rows are shifted into
+// ship A's cell space. When B isn't aligned to A's grid, each B cell covers two A cells per axis
+static bool shipsOverlap(Ship* a, Ship* b)
+{
+	float offsetX = (b->body.position.x - a->body.position.x) / c_tileSize;
+	float offsetY = (b->body.position.y - a->body.position.y) / c_tileSize;
+	int cellOffsetX = (int)floorf(offsetX);
+	int cellOffsetY = (int)floorf(offsetY);
+	bool straddlesX = offsetX != (float)cellOffsetX;
+	bool straddlesY = offsetY != (float)cellOffsetY;
+
+	for (int rowA = 0; rowA < a->height; ++rowA)
+	{
+		if (!a->rowMasks[rowA])
+			continue;
+		unsigned long long overlappingB = 0;
+		for (int rowB = rowA - cellOffsetY - (straddlesY ? 1 : 0); rowB <= rowA - cellOffsetY;
+		     ++rowB)
+		{
+			if (rowB < 0 || rowB >= b->height)
+				continue;
+			overlappingB |= shiftRowMask(b->rowMasks[rowB], cellOffsetX);
+			if (straddlesX)
+				overlappingB |= shiftRowMask(b->rowMasks[rowB], cellOffsetX + 1);
+		}
+		if (overlappingB & a->rowMasks[rowA])
+			return true;
+	}
+	return false;
+}
+
+// Push the ships apart along the axis of least penetration and exchange momentum along it, using
+// the number of cells as mass
+static void resolveShipContact(Ship* a, Ship* b, FRect* boundsA, FRect* boundsB)
+{
+	float penetrationX = fminf(boundsA->x + boundsA->w, boundsB->x + boundsB->w) -
+	                     fmaxf(boundsA->x, boundsB->x);
+	float penetrationY = fminf(boundsA->y + boundsA->h, boundsB->y + boundsB->h) -
+	                     fmaxf(boundsA->y, boundsB->y);
+	float massA = a->numSolidCells ? a->numSolidCells : 1;
+	float massB = b->numSolidCells ? b->numSolidCells : 1;
+	float shareA = massB / (massA + massB);
+	float shareB = massA / (massA + massB);
+
+	bool separateOnX = penetrationX < penetrationY;
+	float* positionA = separateOnX ? &a->body.position.x : &a->body.position.y;
+	float* positionB = separateOnX ? &b->body.position.x : &b->body.position.y;
+	float* velocityA = separateOnX ? &a->body.velocity.x : &a->body.velocity.y;
+	float* velocityB = separateOnX ? &b->body.velocity.x : &b->body.velocity.y;
+	float penetration = separateOnX ? penetrationX : penetrationY;
+	// +1 if B is on the positive side of A
+	float direction = *positionB >= *positionA ? 1.f : -1.f;
+
+	*positionA -= direction * penetration * shareA;
+	*positionB += direction * penetration * shareB;
+
+	// Only exchange momentum if they are moving towards each other
+	float approachSpeed = (*velocityA - *velocityB) * direction;
+	if (approachSpeed > 0.f)
+	{
+		*velocityA -= direction * approachSpeed * 2.f * shareA;
+		*velocityB += direction * approachSpeed * 2.f * shareB;
+	}
+}
+
+// Broadphase is sort-and-sweep along X over the bounds computed by updateShipBuckets(). Ships
+// barely move between ticks, so the insertion sort is close to linear
+static void collideShips(SimulationState* state, ShipBuckets* buckets)
+{
+	unsigned char sortedShips[ARRAY_SIZE(state->ships)];
+	for (int i = 0; i < state->numShips; ++i)
+		sortedShips[i] = i;
+	for (int i = 1; i < state->numShips; ++i)
+	{
+		unsigned char shipIndex = sortedShips[i];
+		float minX = buckets->shipBounds[shipIndex].x;
+		int j = i - 1;
+		for (; j >= 0 && buckets->shipBounds[sortedShips[j]].x > minX; --j)
+			sortedShips[j + 1] = sortedShips[j];
+		sortedShips[j + 1] = shipIndex;
+	}
+
+	for (int i = 0; i < state->numShips; ++i)
+	{
+		FRect* boundsA = &buckets->shipBounds[sortedShips[i]];
+		for (int j = i + 1; j < state->numShips; ++j)
+		{
+			FRect* boundsB = &buckets->shipBounds[sortedShips[j]];
+			if (boundsB->x >= boundsA->x + boundsA->w)
+				break;
+			if (boundsB->y >= boundsA->y + boundsA->h || boundsA->y >= boundsB->y + boundsB->h)
+				continue;
+
+			Ship* a = &state->ships[sortedShips[i]];
+			Ship* b = &state->ships[sortedShips[j]];
+			if (shipsOverlap(a, b))
+				resolveShipContact(a, b, boundsA, boundsB);
+		}
+	}
+}
+
+//
+// Factory
+//
+
+// Set every engine on the ship in one pass over its cells, then apply the thrust of the ones which
+// fired. Returns whether the ship tried to exceed max velocity
+static bool controlShipEngines(SimulationState* state, Ship* ship, unsigned char engineInput,
+                               float deltaTime)
+{
+	int numFiring[4] = {0};
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	for (int cellY = 0; cellY < gridSpace.height; ++cellY)
+	{
+		for (int cellX = 0; cellX < gridSpace.width; ++cellX)
+		{
+			GridCell* cell = &GridCellAt(&gridSpace, cellX, cellY);
+			if (!isEngineTile(cell->type) || cell->engineCell.fuel <= 0)
+				continue;
+			// Engines push the ship away from the side they're on
+			int direction = 0;
+			switch (cell->type)
+			{
+				case 'u':
+					direction = 0;
+					break;
+				case 'd':
+					direction = 1;
+					break;
+				case 'r':
+					direction = 2;
+					break;
+				case 'l':
+					direction = 3;
+					break;
+			}
+			cell->engineCell.firing = engineInput & (1 << direction);
+			if (cell->engineCell.firing)
+				++numFiring[direction];
+		}
+	}
+
+	float shipThrust = c_shipThrust * deltaTime;
+	RigidBody* body = &ship->body;
+	body->velocity.y += -shipThrust * numFiring[0];
+	body->velocity.y += shipThrust * numFiring[1];
+	body->velocity.x += -shipThrust * numFiring[2];
+	body->velocity.x += shipThrust * numFiring[3];
+
+	bool atMaxVelocity = false;
+	if (body->velocity.y > c_maxSpeed)
+	{
+		body->velocity.y = c_maxSpeed;
+		atMaxVelocity = true;
+	}
+	if (body->velocity.y < -c_maxSpeed)
+	{
+		body->velocity.y = -c_maxSpeed;
+		atMaxVelocity = true;
+	}
+	if (body->velocity.x > c_maxSpeed)
+	{
+		body->velocity.x = c_maxSpeed;
+		atMaxVelocity = true;
+	}
+	if (body->velocity.x < -c_maxSpeed)
+	{
+		body->velocity.x = -c_maxSpeed;
+		atMaxVelocity = true;
+	}
+	return atMaxVelocity;
+}
+
+// Cells [firstCell, endCell). Returns the change to the state hash
+static uint64_t updateEngineFuel(SimulationState* state, int firstCell, int endCell,
+                                 int fixedUnitsPerTick)
+{
+	uint64_t hashDelta = 0;
+	for (int i = firstCell; i < endCell; ++i)
+	{
+		GridCell* cell = &state->shipCells[i];
+		if (isEngineTile(cell->type) && cell->engineCell.firing)
+		{
+			uint64_t oldKey = cellHashKey(state, cell);
+			cell->engineCell.fuel -= c_fuelConsumptionRate * fixedUnitsPerTick;
+
+			if (cell->engineCell.fuel <= 0)
+			{
+				cell->engineCell.fuel = 0;
+				cell->engineCell.firing = false;
+			}
+			hashDelta ^= oldKey ^ cellHashKey(state, cell);
+		}
+	}
+	return hashDelta;
+}
+
+typedef struct TransitionDelta
+{
+	char tile;
+	char x;
+	char y;
+} TransitionDelta;
+
+static const TransitionDelta c_transitions[] = {{'R', -1, 0}, {'U', 0, 1},  {'D', 0, -1},
+                                                {'L', 1, 0},  {'<', -1, 0}, {'V', 0, 1},
+                                                {'A', 0, -1}, {'>', 1, 0}};
+typedef struct TileDelta
+{
+	char x;
+	char y;
+	char conveyor;
+} TileDelta;
+// Useful to check all cardinal directions of a tile
+static const TileDelta c_deltas[] = {{-1, 0, '<'}, {1, 0, '>'}, {0, -1, 'A'}, {0, 1, 'V'}};
+
+// Pick a random outgoing conveyor and move the object onto it. Returns false if there is nowhere to
+// go. This rolls once rather than once per direction per tick so that the odds of leaving don't
+// depend on the tick rate
+static bool conveyorAway(GridSpace* gridSpace, RandomState* random, Object* objectToConveyor)
+{
+	int outgoingDirections[ARRAY_SIZE(c_deltas)];
+	int numOutgoingDirections = 0;
+	for (int directionIndex = 0; directionIndex < ARRAY_SIZE(c_deltas); ++directionIndex)
+	{
+		char directionCellX = objectToConveyor->tileX + c_deltas[directionIndex].x;
+		char directionCellY = objectToConveyor->tileY + c_deltas[directionIndex].y;
+
+		// Don't allow out of bounds
+		if (directionCellX < 0 || directionCellX >= gridSpace->width || directionCellY < 0 ||
+		    directionCellY >= gridSpace->height)
+			continue;
+
+		GridCell* cellTo = &GridCellAt(gridSpace, directionCellX, directionCellY);
+		if (cellTo->type == c_deltas[directionIndex].conveyor)
+			outgoingDirections[numOutgoingDirections++] = directionIndex;
+	}
+
+	if (!numOutgoingDirections)
+		return false;
+
+	const TileDelta* delta =
+	    &c_deltas[outgoingDirections[randomRange(random, numOutgoingDirections)]];
+	objectToConveyor->tileX += delta->x;
+	objectToConveyor->tileY += delta->y;
+	return true;
+}
+
+static bool isIntake(char cellType)
+{
+	static const char intakes[] = {'L', 'R', 'U', 'D'};
+	for (int i = 0; i < ARRAY_SIZE(intakes); ++i)
+	{
+		if (intakes[i] == cellType)
+			return true;
+	}
+	return false;
+}
+
+// Walks the objects in one ship's factory rather than its cells, so the cost scales with the number
+// of objects in it. Objects must be in index order so the ship's random rolls happen in the same
+// order however ships are spread across threads. Returns the change to the state hash
+static uint64_t doFactory(SimulationState* state, Ship* ship, const short* objectIndices,
+                          int numObjects, int fixedUnitsPerTick)
+{
+	uint64_t hashDelta = 0;
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	for (int i = 0; i < numObjects; ++i)
+	{
+		Object* currentObject = &state->objects[objectIndices[i]];
+		if (currentObject->tileX >= gridSpace.width || currentObject->tileY >= gridSpace.height)
+			continue;
+		GridCell* cell = &GridCellAt(&gridSpace, currentObject->tileX, currentObject->tileY);
+		uint64_t oldObjectKey = objectHashKey(state, currentObject);
+		switch (cell->type)
+		{
+			// Destroy anything that touches empty spaces. Usually only from ship damage
+			case 0:
+			{
+				currentObject->type = 0;
+				break;
+			}
+
+			case 'L':
+			case 'R':
+			case 'U':
+			case 'D':
+			case '<':
+			case 'V':
+			case 'A':
+			case '>':
+			{
+				currentObject->transition += fixedUnitsPerTick;
+				if (currentObject->transition >= c_conveyorTransitionTime)
+				{
+					// Keep the remainder so lower tick rates don't lose time
+					currentObject->transition -= c_conveyorTransitionTime;
+					for (int transitionIndex = 0; transitionIndex < ARRAY_SIZE(c_transitions);
+					     ++transitionIndex)
+					{
+						if (c_transitions[transitionIndex].tile != cell->type)
+							continue;
+						currentObject->tileX += c_transitions[transitionIndex].x;
+						currentObject->tileY += c_transitions[transitionIndex].y;
+						break;
+					}
+				}
+				break;
+			}
+				// Furnaces always output to cells away from them
+			case 'f':
+			{
+				// Move objects along which aren't unrefined the same speed as a conveyor
+				unsigned short transitionTime = currentObject->type == 'a' ?
+				                                    c_furnaceTransitionTime :
+				                                    c_conveyorTransitionTime;
+				currentObject->transition += fixedUnitsPerTick;
+				if (currentObject->transition >= transitionTime)
+				{
+					if (currentObject->type == 'a')
+						currentObject->type = 'g';
+
+					if (conveyorAway(&gridSpace, &ship->random, currentObject))
+						currentObject->transition -= transitionTime;
+					else
+						// Wait for somewhere to go without letting the accumulator run away
+						currentObject->transition = c_conveyorTransitionTime;
+				}
+				break;
+			}
+			case 'l':
+			case 'r':
+			case 'u':
+			case 'd':
+			{
+				// Only refined objects will give fuel; everything else just gets destroyed
+				if (currentObject->type == 'g')
+				{
+					hashDelta ^= cellHashKey(state, cell);
+					cell->engineCell.fuel += c_fuelPerRefinedObject;
+					hashDelta ^= cellHashKey(state, cell);
+				}
+				currentObject->type = 0;
+				break;
+			}
+			default:
+				break;
+		}
+		hashDelta ^= oldObjectKey ^ objectHashKey(state, currentObject);
+	}
+	return hashDelta;
+}
+
+//
+// Objects
+//
+
+// Free-floating objects don't depend on ships, so this can run alongside them
+static void updateFreeObjectPhysics(SimulationState* state, int firstObject, int endObject,
+                                    float deltaTime)
+{
+	for (int i = firstObject; i < endObject; i++)
+	{
+		Object* currentObject = &state->objects[i];
+		if (currentObject->type && !currentObject->inFactory)
+			UpdatePhysics(&currentObject->body, c_objectDrag, deltaTime);
+	}
+}
+
+// Snaps objects in factories to their ships and records which ship each free object is inside the
+// bounds of, or -1. Only reads ships, so objects can be split across threads. Expects buckets to be
+// up to date with the ships' current positions
+static void findObjectHits(SimulationState* state, ShipBuckets* buckets, int firstObject,
+                           int endObject, short* objectHitShips)
+{
+	for (int i = firstObject; i < endObject; i++)
+	{
+		Object* currentObject = &state->objects[i];
+		objectHitShips[i] = -1;
+		if (!currentObject->type)
+			continue;
+		if (currentObject->inFactory)
+		{
+			// if the object has been captured into the ship factory, snap it to its tile
+			// location, and don't update any other physics
+			RigidBody* shipPhys = &state->ships[currentObject->ship].body;
+			currentObject->body.position.x =
+			    (currentObject->tileX * c_tileSize) + shipPhys->position.x;
+			currentObject->body.position.y =
+			    (currentObject->tileY * c_tileSize) + shipPhys->position.y;
+			currentObject->body.velocity.x = 0;
+			currentObject->body.velocity.y = 0;
+			continue;
+		}
+		objectHitShips[i] = findShipAtPoint(buckets, &currentObject->body.position);
+	}
+}
+
+// Each response reads the velocity the previous ones left the ship with, so these happen in object
+// order on one thread. Returns the change to the state hash
+static uint64_t resolveObjectHits(SimulationState* state, const short* objectHitShips)
+{
+	uint64_t hashDelta = 0;
+	for (int i = 0; i < ARRAY_SIZE(state->objects); i++)
+	{
+		Object* currentObject = &state->objects[i];
+		int shipIndex = objectHitShips[i];
+		if (shipIndex >= 0)
+		{
+			RigidBody* shipPhys = &state->ships[shipIndex].body;
+			GridSpace shipGrid = shipGridSpace(state, &state->ships[shipIndex]);
+			GridSpace* shipData = &shipGrid;
+			IVec2 tileCoords = TileCoordinateHit(shipPhys, shipData, &currentObject->body);
+			unsigned char shipTileX = (unsigned char)tileCoords.x;
+			unsigned char shipTileY = (unsigned char)tileCoords.y;
+			GridCell cell = GridCellAt(shipData, shipTileX, shipTileY);
+
+			if (isIntake(cell.type))
+			{
+				hashDelta ^= objectHashKey(state, currentObject);
+				currentObject->body.position.x = (shipTileX * c_tileSize) + shipPhys->position.x;
+				currentObject->body.position.y = (shipTileY * c_tileSize) + shipPhys->position.y;
+				currentObject->body.velocity.x = 0;
+				currentObject->body.velocity.y = 0;
+				currentObject->tileX = shipTileX;
+				currentObject->tileY = shipTileY;
+				currentObject->ship = shipIndex;
+				currentObject->inFactory = true;
+				hashDelta ^= objectHashKey(state, currentObject);
+			}
+			else  // collide with an edge of the ship, accounting for momentum
+			{
+				float* objX = &currentObject->body.position.x;
+				float* objY = &currentObject->body.position.y;
+				float* objVX = &currentObject->body.velocity.x;
+				float* objVY = &currentObject->body.velocity.y;
+				float plyVX = shipPhys->velocity.x;
+				float plyVY = shipPhys->velocity.y;
+				// if the asteroid hits an edge, move it to the outside of the ship,
+				// then give it velocity
+				if (shipTileX == 0)  // hit left side
+				{
+					if (*objX > shipPhys->position.x)
+						*objX = shipPhys->position.x;
+
+					if (plyVX <= 0)
+					{
+						*objVX = plyVX * c_objectForceTransfer;
+						shipPhys->velocity.x += c_shipObjectForceTransfer;
+					}
+				}
+				else if (shipTileX == shipData->width - 1)
+				{  // hit right side
+
+					if (*objX < shipPhys->position.x + shipData->width * c_tileSize)
+						*objX = shipPhys->position.x + shipData->width * c_tileSize;
+
+					if (plyVX >= 0)
+					{
+						*objVX = plyVX * c_objectForceTransfer;
+						shipPhys->velocity.x -= c_shipObjectForceTransfer;
+					}
+				}
+				else if (shipTileY == 0)
+				{  // hit top
+					if (*objY > shipPhys->position.y)
+						*objY = shipPhys->position.y;
+					*objY = shipPhys->position.y;
+					if (plyVY <= 0)
+					{
+						*objVY = plyVY * c_objectForceTransfer;
+						shipPhys->velocity.y += c_shipObjectForceTransfer;
+					}
+				}
+				else if (shipTileY == shipData->height - 1)
+				{  // hit bottom
+					if (*objY < shipPhys->position.y + shipData->height * c_tileSize)
+						*objY = shipPhys->position.y + shipData->height * c_tileSize;
+					if (plyVY >= 0)
+					{
+						*objVY = plyVY * c_objectForceTransfer;
+						shipPhys->velocity.y -= c_shipObjectForceTransfer;
+					}
+				}
+			}
+		};
+	}
+	return hashDelta;
+}
+
+//
+// Ship editing
+//
+
+const char c_buildableTiles[NUM_BUILDABLE_TILES] = {'#', '.', '<', '>', 'A', 'V', 'f', 'L',
+                                                    'R', 'U', 'D', 'l', 'r', 'u', 'd'};
+
+const PlacementRestriction c_buildableTileRestrictions[NUM_BUILDABLE_TILES] = {
+    /*WALL*/ Restrict_EdgeAny, /*FLOOR*/ Restrict_Inside, /*CONVEYOR LEFT*/ Restrict_Inside,
+    /*CONVEYOR RIGHT*/ Restrict_Inside,
+    /*CONVEYOR UP*/ Restrict_Inside, /*CONVEYOR DOWN*/ Restrict_Inside,
+    /*REFINERY*/ Restrict_Inside,
+    // Intakes
+    /*INTAKE LEFT*/ Restrict_EdgeLeft, /*INTAKE RIGHT*/ Restrict_EdgeRight,
+    /*INTAKE UP*/ Restrict_EdgeTop, /*INTAKE DOWN*/ Restrict_EdgeBottom,
+    // Engines
+    /*ENGINE LEFT*/ Restrict_EdgeLeft, /*ENGINE RIGHT*/ Restrict_EdgeRight,
+    /*ENGINE UP*/ Restrict_EdgeBottom, /*ENGINE DOWN*/ Restrict_EdgeTop};
+
+static const unsigned short c_startingInventory[NUM_BUILDABLE_TILES] = {
+    /*'#'=*/100, /*'.'=*/999, /*'<'=*/100, /*'>'=*/100, /*'A'=*/100,
+    /*'V'=*/100, /*'f'=*/8,   /*'L'=*/8,   /*'R'=*/8,   /*'U'=*/8,
+    /*'D'=*/8,   /*'l'=*/4,   /*'r'=*/4,   /*'u'=*/4,   /*'d'=*/4};
+
+// Assumes the cell is on the ship
+PlacementRestriction simulationPlacementRestriction(SimulationState* state,
+                                                    const EditCommand* edit)
+{
+	Ship* ship = &state->ships[edit->ship];
+	unsigned char cellX = edit->cellX;
+	unsigned char cellY = edit->cellY;
+	PlacementRestriction restriction = c_buildableTileRestrictions[edit->buildableTile];
+	bool isValidPlacement = true;
+	switch (restriction)
+	{
+		case Restrict_None:
+			break;
+		case Restrict_Inside:
+			if (cellX == 0 || cellX == ship->width - 1 || cellY == 0 || cellY == ship->height - 1)
+				isValidPlacement = false;
+			break;
+		case Restrict_EdgeAny:
+			if ((cellX != 0 && cellX != ship->width - 1) &&
+			    (cellY != 0 && cellY != ship->height - 1))
+				isValidPlacement = false;
+			break;
+		case Restrict_EdgeLeft:
+			if (cellX != 0)
+				isValidPlacement = false;
+			break;
+		case Restrict_EdgeRight:
+			if (cellX != ship->width - 1)
+				isValidPlacement = false;
+			break;
+		case Restrict_EdgeTop:
+			if (cellY != 0)
+				isValidPlacement = false;
+			break;
+		case Restrict_EdgeBottom:
+			if (cellY != ship->height - 1)
+				isValidPlacement = false;
+			break;
+	}
+	return isValidPlacement ? Restrict_None : restriction;
+}
+
+bool simulationCanApplyEdit(SimulationState* state, const EditCommand* edit)
+{
+	if (!simulationCurrentPhase(state) || simulationIsPlayerDestroyed(state))
+		return false;
+	// Players can only build on their own ships
+	if (edit->ship >= state->numPlayers || edit->buildableTile >= NUM_BUILDABLE_TILES)
+		return false;
+	Ship* ship = &state->ships[edit->ship];
+	if (edit->cellX >= ship->width || edit->cellY >= ship->height)
+		return false;
+	if (simulationPlacementRestriction(state, edit) != Restrict_None)
+		return false;
+	if (!state->inventory[edit->buildableTile])
+		return false;
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	return GridCellAt(&gridSpace, edit->cellX, edit->cellY).type !=
+	       c_buildableTiles[edit->buildableTile];
+}
+
+bool simulationApplyEdit(SimulationState* state, const EditCommand* edit)
+{
+	if (!simulationCanApplyEdit(state, edit))
+		return false;
+
+	Ship* ship = &state->ships[edit->ship];
+	GridSpace gridSpace = shipGridSpace(state, ship);
+	GridCell* selectedCell = &GridCellAt(&gridSpace, edit->cellX, edit->cellY);
+	int* fuelPool = &state->constructionFuelPool;
+	state->stateHash ^= inventoryHash(state) ^ cellHashKey(state, selectedCell);
+
+	// Give back resources
+	for (int buttonIndex = 0; buttonIndex < ARRAY_SIZE(c_buildableTiles); ++buttonIndex)
+	{
+		if (selectedCell->type == c_buildableTiles[buttonIndex])
+		{
+			state->inventory[buttonIndex] += 1;
+			if (isEngineTile(selectedCell->type))
+				*fuelPool += selectedCell->engineCell.fuel;
+			break;
+		}
+	}
+
+	// Make the placement
+	state->inventory[edit->buildableTile] -= 1;
+	memset(selectedCell, 0, sizeof(GridCell));
+	selectedCell->type = c_buildableTiles[edit->buildableTile];
+	if (isEngineTile(selectedCell->type))
+	{
+		int fuelToAdd = *fuelPool >= c_defaultStartFuel ? c_defaultStartFuel : *fuelPool;
+		if (fuelToAdd > 0)
+		{
+			selectedCell->engineCell.fuel = fuelToAdd;
+			*fuelPool -= fuelToAdd;
+		}
+	}
+	state->stateHash ^= inventoryHash(state) ^ cellHashKey(state, selectedCell);
+
+	updateShipLayout(state, ship);
+	return true;
+}
+
+//
+// Goal
+// for now just a simple rect
+//
+
+static bool CheckGoalSatisfied(Vec2* playerPos, GridSpace* playerShip, IRect* goal)
+{
+	// aligned box collision WILL BREAK IF WE EVER ROTATE ANYTHING
+	Vec2 goalTL = {(float)goal->x, (float)goal->y};
+	Vec2 goalTR = {(float)(goal->x + goal->w), (float)goal->y};
+	Vec2 goalBL = {(float)goal->x, (float)(goal->y + goal->h)};
+	Vec2 goalBR = {(float)(goal->x + goal->w), (float)(goal->y + goal->h)};
+
+	int playerWidth = playerShip->width * c_tileSize;
+	int playerHeight = playerShip->height * c_tileSize;
+
+	Vec2 playerTR = {(playerPos->x + playerWidth), (float)playerPos->y};
+	Vec2 playerBL = {(float)playerPos->x, (float)(playerPos->y + playerHeight)};
+	Vec2 playerBR = {(float)(playerPos->x + playerWidth), (float)(playerPos->y + playerHeight)};
+
+	IRect playerBoundingBox = {(int)playerPos->x, (int)playerPos->y, playerWidth, playerHeight};
+
+	return pointInRect(&goalTL, &playerBoundingBox) || pointInRect(&goalTR, &playerBoundingBox) ||
+	       pointInRect(&goalBL, &playerBoundingBox) || pointInRect(&goalBR, &playerBoundingBox) ||
+	       pointInRect(playerPos, goal) || pointInRect(&playerTR, goal) ||
+	       pointInRect(&playerBL, goal) || pointInRect(&playerBR, goal);
+}
+
+static void placeGoal(SimulationState* state)
+{
+	RandomState* random = &state->gameplayRandom;
+	state->goal.x = randomRange(random, c_spaceSize - (c_spawnBuffer * 2)) + c_spawnBuffer;
+	state->goal.y = randomRange(random, c_spaceSize - (c_spawnBuffer * 2)) + c_spawnBuffer;
+	state->goal.w = c_goalSize;
+	state->goal.h = c_goalSize;
+}
+
+//
+// Game phases
+//
+
+static const GamePhase c_gamePhases[] = {
+    {"CONSTRUCT YOUR SHIP", 60 + 30, Objective_ShipConstruct},
+    {"ENEMY RADAR SIGNAL DETECTED", 10, Objective_None},
+    {"REACH GREEN AREA 1", 30, Objective_ReachGoalPoint},
+    {"REACH GREEN AREA 2", 25, Objective_ReachGoalPoint},
+    {"ENEMY RADAR IN COOLDOWN", 5, Objective_None},
+    {"REFIT YOUR SHIP", 30, Objective_None},
+    {"REACH GREEN AREA 3", 15, Objective_ReachGoalPoint},
+    {"REACH GREEN AREA 4", 10, Objective_ReachGoalPoint},
+    {"REACH GREEN AREA 5", 5, Objective_ReachGoalPoint},
+};
+
+const GamePhase* simulationGamePhase(int phaseIndex)
+{
+	if (phaseIndex < 0 || phaseIndex >= ARRAY_SIZE(c_gamePhases))
+		return NULL;
+	return &c_gamePhases[phaseIndex];
+}
+
+const GamePhase* simulationCurrentPhase(SimulationState* state)
+{
+	return simulationGamePhase(state->currentGamePhase);
+}
+
+int simulationSecondsInCurrentPhase(SimulationState* state)
+{
+	return (state->tick - state->phaseStartTick) / state->ticksPerSecond;
+}
+
+bool simulationIsPlayerDestroyed(SimulationState* state)
+{
+	return state->numDamagesSustained > c_numSustainableDamagesBeforeGameOver;
+}
+
+static unsigned int updateGamePhase(SimulationState* state, bool skipPhase)
+{
+	const GamePhase* phase = simulationCurrentPhase(state);
+	// Nothing changes once the game is over
+	if (!phase || simulationIsPlayerDestroyed(state))
+		return 0;
+
+	unsigned int events = 0;
+
+	bool startNewPhase = false;
+	if (phase->objective == Objective_ReachGoalPoint)
+	{
+		// Any player reaching the goal completes it for everyone
+		for (int playerIndex = 0; playerIndex < state->numPlayers; ++playerIndex)
+		{
+			Ship* playerShip = &state->ships[playerIndex];
+			GridSpace playerGridSpace = shipGridSpace(state, playerShip);
+			if (CheckGoalSatisfied(&playerShip->body.position, &playerGridSpace, &state->goal))
+				startNewPhase = true;
+		}
+	}
+
+	bool failedPhase = false;
+	if (simulationSecondsInCurrentPhase(state) >= phase->timeToCompleteSeconds)
+	{
+		switch (phase->objective)
+		{
+			case Objective_None:
+				startNewPhase = true;
+				break;
+			case Objective_ShipConstruct:
+				startNewPhase = true;
+				break;
+			case Objective_ReachGoalPoint:
+				failedPhase = true;
+				break;
+		}
+	}
+
+	if (failedPhase)
+	{
+		events |= SimulationEvent_PhaseFailed;
+		startNewPhase = true;
+
+		for (int playerIndex = 0; playerIndex < state->numPlayers; ++playerIndex)
+		{
+			damageShip(state, &state->ships[playerIndex]);
+			updateShipLayout(state, &state->ships[playerIndex]);
+		}
+		++state->numDamagesSustained;
+	}
+
+	if (startNewPhase || skipPhase)
+	{
+		events |= SimulationEvent_PhaseStarted;
+		state->phaseStartTick = state->tick;
+		++state->currentGamePhase;
+		phase = simulationCurrentPhase(state);
+		if (phase && phase->objective == Objective_ReachGoalPoint)
+			placeGoal(state);
+	}
+	return events;
+}
+
+//
+// Simulation
+//
+
+bool simulationIsValidTickRate(int ticksPerSecond)
+{
+	return ticksPerSecond > 0 && ticksPerSecond <= FIXED_UNITS_PER_SECOND &&
+	       FIXED_UNITS_PER_SECOND % ticksPerSecond == 0;
+}
+
+const ShipLayout c_defaultPlayerShipLayout = {18, 7,
+                                               "#######d##########"
+                                               "#......A.........#"
+                                               "l<<<<<<f<<<<<<<<<R"
+                                               "l<<<<<<<<<<f<<<<<R"
+                                               "#..........V.....#"
+                                               "#..........>>>>>>r"
+                                               "#######u##########"};
+
+bool simulationIsValidShipLayout(const ShipLayout* layout)
+{
+	if (!layout->width || !layout->height || layout->width > MAX_SHIP_DIMENSION ||
+	    layout->height > MAX_SHIP_DIMENSION || !layout->cells ||
+	    strlen(layout->cells) != (size_t)(layout->width * layout->height))
+		return false;
+	for (int i = 0; i < layout->width * layout->height; ++i)
+	{
+		if (!memchr(c_buildableTiles, layout->cells[i], sizeof(c_buildableTiles)))
+			return false;
+	}
+	return true;
+}
+
+void simulationInitialize(SimulationState* state, uint64_t seed, int ticksPerSecond,
+                          int numPlayers)
+{
+	simulationInitializeWithShipLayout(state, seed, ticksPerSecond, numPlayers,
+	                                   &c_defaultPlayerShipLayout);
+}
+
+void simulationInitializeWithShipLayout(SimulationState* state, uint64_t seed, int ticksPerSecond,
+                                        int numPlayers, const ShipLayout* playerShipLayout)
+{
+	assert(simulationIsValidTickRate(ticksPerSecond));
+	assert(simulationIsValidShipLayout(playerShipLayout));
+	assert(numPlayers >= 1 && numPlayers <= MAX_PLAYERS);
+	memset(state, 0, sizeof(SimulationState));
+	state->ticksPerSecond = ticksPerSecond;
+	state->secondsPerTick = 1.f / ticksPerSecond;
+	state->fixedUnitsPerTick = FIXED_UNITS_PER_SECOND / ticksPerSecond;
+	state->seed = seed;
+	state->numPlayers = numPlayers;
+	randomSeed(&state->gameplayRandom, seed, c_randomStreamGameplay);
+	randomSeed(&state->cosmeticRandom, seed, c_randomStreamCosmetic);
+	RandomState* random = &state->gameplayRandom;
+
+	// Make the fleet. The players' ships are always first
+	for (int playerIndex = 0; playerIndex < numPlayers; ++playerIndex)
+	{
+		spawnShip(state, playerShipLayout->width, playerShipLayout->height,
+		          playerShipLayout->cells, SpawnPlayerPhys(playerIndex));
+	}
+
+	state->goal.x = randomRange(random, c_spaceSize);
+	state->goal.y = randomRange(random, c_spaceSize);
+	state->goal.w = c_goalSize;
+	state->goal.h = c_goalSize;
+
+	// Make some objects
+	for (int i = 0; i < c_numObjectsToCreate; ++i)
+	{
+		Object* object = &state->objects[i];
+		object->type = 'a';
+		object->body.position.x = (float)randomRange(random, c_spaceSize);
+		object->body.position.y = (float)randomRange(random, c_spaceSize);
+		object->body.velocity.x = (float)(randomRange(random, 50) - 25);
+		object->body.velocity.y = (float)(randomRange(random, 50) - 25);
+	}
+
+	// Derelict hulls drifting through the field
+	for (int i = 0; i < c_numDerelictShips; ++i)
+	{
+		RigidBody derelictPhys;
+		derelictPhys.position.x =
+		    (float)(randomRange(random, c_spaceSize - (c_spawnBuffer * 2)) + c_spawnBuffer);
+		derelictPhys.position.y =
+		    (float)(randomRange(random, c_spaceSize - (c_spawnBuffer * 2)) + c_spawnBuffer);
+		derelictPhys.velocity.x = (float)(randomRange(random, 50) - 25);
+		derelictPhys.velocity.y = (float)(randomRange(random, 50) - 25);
+		spawnShip(state, 5, 4,
+		          "#####"
+		          "#...#"
+		          "#..##"
+		          "###..",
+		          derelictPhys);
+	}
+
+	memcpy(state->inventory, c_startingInventory, sizeof(state->inventory));
+	// Enough to fuel two engines per side
+	state->constructionFuelPool = 4 * 2 * c_defaultStartFuel;
+
+	state->stateHash = computeStateHash(state);
+}
+
+//
+// Tick
+//
+
+// Each worker XORs its hash key changes into its own delta. XOR doesn't care about order, so the
+// total is the same however the work was split
+typedef struct TickHashDelta
+{
+	uint64_t value;
+	char padding[56];
+} TickHashDelta;
+
+typedef struct TickContext
+{
+	SimulationState* state;
+	const SimulationInput* input;
+	ShipBuckets shipBuckets;
+	// The ship each free object is inside the bounds of, or -1
+	short objectHitShips[MAX_OBJECTS];
+	// Objects in each ship's factory, in index order. Ship i's are
+	// factoryObjects[shipFactoryStart[i]] to factoryObjects[shipFactoryStart[i + 1]]
+	short factoryObjects[MAX_OBJECTS];
+	unsigned short shipFactoryStart[MAX_SHIPS + 1];
+	TickHashDelta hashDeltas[MAX_WORKER_THREADS];
+} TickContext;
+
+static void tickEngines(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	SimulationState* state = context->state;
+	for (int shipIndex = begin; shipIndex < end; ++shipIndex)
+	{
+		controlShipEngines(state, &state->ships[shipIndex],
+		                   shipIndex < state->numPlayers ? context->input->engineInput[shipIndex] :
+		                                                   0,
+		                   state->secondsPerTick);
+	}
+}
+
+static void tickEngineFuel(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	context->hashDeltas[workerIndex].value ^=
+	    updateEngineFuel(context->state, begin, end, context->state->fixedUnitsPerTick);
+}
+
+static void tickShipPhysics(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	SimulationState* state = context->state;
+	bool isPlayerDestroyed = simulationIsPlayerDestroyed(state);
+	for (int shipIndex = begin; shipIndex < end; ++shipIndex)
+	{
+		bool isCrippled = shipIndex < state->numPlayers && isPlayerDestroyed;
+		UpdatePhysics(&state->ships[shipIndex].body,
+		              isCrippled ? c_onFailurePlayerDrag : c_playerDrag, state->secondsPerTick);
+	}
+}
+
+static void tickFreeObjectPhysics(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	updateFreeObjectPhysics(context->state, begin, end, context->state->secondsPerTick);
+}
+
+static void tickShipCollisions(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	updateShipBuckets(context->state, &context->shipBuckets);
+	collideShips(context->state, &context->shipBuckets);
+	// Contacts moved ships, so the bounds need refreshing before objects test them
+	updateShipBuckets(context->state, &context->shipBuckets);
+}
+
+static void tickFindObjectHits(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	findObjectHits(context->state, &context->shipBuckets, begin, end, context->objectHitShips);
+}
+
+// Also sorts the objects now in factories by ship, for the factory stage
+static void tickObjectHits(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	SimulationState* state = context->state;
+	context->hashDeltas[workerIndex].value ^=
+	    resolveObjectHits(state, context->objectHitShips);
+
+	unsigned short* shipFactoryStart = context->shipFactoryStart;
+	memset(shipFactoryStart, 0, sizeof(context->shipFactoryStart));
+	for (int i = 0; i < ARRAY_SIZE(state->objects); ++i)
+	{
+		if (state->objects[i].type && state->objects[i].inFactory)
+			++shipFactoryStart[state->objects[i].ship + 1];
+	}
+	for (int shipIndex = 0; shipIndex < state->numShips; ++shipIndex)
+		shipFactoryStart[shipIndex + 1] += shipFactoryStart[shipIndex];
+	unsigned short nextObject[MAX_SHIPS];
+	memcpy(nextObject, shipFactoryStart, sizeof(nextObject));
+	for (int i = 0; i < ARRAY_SIZE(state->objects); ++i)
+	{
+		if (state->objects[i].type && state->objects[i].inFactory)
+			context->factoryObjects[nextObject[state->objects[i].ship]++] = i;
+	}
+}
+
+static void tickFactories(void* userData, int begin, int end, int workerIndex)
+{
+	TickContext* context = (TickContext*)userData;
+	SimulationState* state = context->state;
+	for (int shipIndex = begin; shipIndex < end; ++shipIndex)
+	{
+		int firstObject = context->shipFactoryStart[shipIndex];
+		context->hashDeltas[workerIndex].value ^=
+		    doFactory(state, &state->ships[shipIndex], &context->factoryObjects[firstObject],
+		              context->shipFactoryStart[shipIndex + 1] - firstObject,
+		              state->fixedUnitsPerTick);
+	}
+}
+
+typedef enum TickStage
+{
+	TickStage_Engines,
+	TickStage_EngineFuel,
+	TickStage_ShipPhysics,
+	TickStage_FreeObjectPhysics,
+	TickStage_ShipCollisions,
+	TickStage_FindObjectHits,
+	TickStage_ObjectHits,
+	TickStage_Factories,
+	TickStage_Count
+} TickStage;
+
+#define TICK_STAGE_BIT(stage) (1u << (stage))
+
+unsigned int simulationTick(SimulationState* state, const SimulationInput* input)
+{
+	return simulationTickWithJobs(state, input, NULL);
+}
+
+unsigned int simulationTickWithJobs(SimulationState* state, const SimulationInput* input,
+                                    struct JobSystem* jobs)
+{
+	for (int i = 0; i < input->numEdits && i < ARRAY_SIZE(input->edits); ++i)
+		simulationApplyEdit(state, &input->edits[i]);
+
+	TickContext context;
+	context.state = state;
+	context.input = input;
+	memset(context.hashDeltas, 0, sizeof(context.hashDeltas));
+
+	// Stages only write disjoint parts of the state, and anything order dependent (ship collisions,
+	// object hits, each ship's random rolls) happens in a fixed order within one job, so the result
+	// doesn't depend on the number of threads
+	JobStage stages[TickStage_Count] = {0};
+	JobStage* stage = &stages[TickStage_Engines];
+	stage->name = "Engines";
+	stage->function = tickEngines;
+	stage->numItems = state->numShips;
+	stage->grainSize = 8;
+
+	stage = &stages[TickStage_EngineFuel];
+	stage->name = "EngineFuel";
+	stage->function = tickEngineFuel;
+	stage->numItems = state->numShipCellsUsed;
+	stage->grainSize = 512;
+	stage->dependencies = TICK_STAGE_BIT(TickStage_Engines);
+
+	stage = &stages[TickStage_ShipPhysics];
+	stage->name = "ShipPhysics";
+	stage->function = tickShipPhysics;
+	stage->numItems = state->numShips;
+	stage->grainSize = 32;
+	stage->dependencies = TICK_STAGE_BIT(TickStage_Engines);
+
+	stage = &stages[TickStage_FreeObjectPhysics];
+	stage->name = "FreeObjectPhysics";
+	stage->function = tickFreeObjectPhysics;
+	stage->numItems = ARRAY_SIZE(state->objects);
+	stage->grainSize = 256;
+
+	stage = &stages[TickStage_ShipCollisions];
+	stage->name = "ShipCollisions";
+	stage->function = tickShipCollisions;
+	stage->numItems = 1;
+	stage->dependencies = TICK_STAGE_BIT(TickStage_ShipPhysics);
+
+	stage = &stages[TickStage_FindObjectHits];
+	stage->name = "FindObjectHits";
+	stage->function = tickFindObjectHits;
+	stage->numItems = ARRAY_SIZE(state->objects);
+	stage->grainSize = 256;
+	stage->dependencies =
+	    TICK_STAGE_BIT(TickStage_FreeObjectPhysics) | TICK_STAGE_BIT(TickStage_ShipCollisions);
+
+	stage = &stages[TickStage_ObjectHits];
+	stage->name = "ObjectHits";
+	stage->function = tickObjectHits;
+	stage->numItems = 1;
+	stage->dependencies = TICK_STAGE_BIT(TickStage_FindObjectHits);
+
+	// Most factories are empty derelicts, so ships are handed out a few at a time
+	stage = &stages[TickStage_Factories];
+	stage->name = "Factories";
+	stage->function = tickFactories;
+	stage->numItems = state->numShips;
+	stage->grainSize = 4;
+	stage->dependencies =
+	    TICK_STAGE_BIT(TickStage_EngineFuel) | TICK_STAGE_BIT(TickStage_ObjectHits);
+
+	for (int i = 0; i < TickStage_Count; ++i)
+		stages[i].userData = &context;
+	jobSystemRunGraph(jobs, stages, TickStage_Count);
+
+	for (int i = 0; i < ARRAY_SIZE(context.hashDeltas); ++i)
+		state->stateHash ^= context.hashDeltas[i].value;
+
+	unsigned int events = updateGamePhase(state, input->skipPhase);
+	++state->tick;
+	return events;
+}
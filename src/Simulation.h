@@ -0,0 +1,366 @@
+#pragma once
+
+// Everything needed to run the game world. This must not depend on SDL so that it can run without
+// a display (see Headless.c)
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
+
+// Math
+typedef struct Vec2
+{
+	float x;
+	float y;
+} Vec2;
+
+typedef struct IVec2
+{
+	int x;
+	int y;
+} IVec2;
+
+typedef struct FRect
+{
+	float x;
+	float y;
+	float w;
+	float h;
+} FRect;
+
+typedef struct IRect
+{
+	int x;
+	int y;
+	int w;
+	int h;
+} IRect;
+
+bool pointInFRect(Vec2* point, FRect* rect);
+bool pointInRect(Vec2* point, IRect* rect);
+float Magnitude(Vec2* vec);
+
+//
+// Random
+//
+
+// PCG32. Every consumer of randomness owns one of these so that runs can be reproduced from a seed
+// and separate simulations (or ships) never share hidden state
+typedef struct RandomState
+{
+	uint64_t state;
+	// Selects the stream. Always odd
+	uint64_t increment;
+} RandomState;
+
+// Different streams from the same seed are independent sequences
+void randomSeed(RandomState* random, uint64_t seed, uint64_t stream);
+uint32_t randomNext(RandomState* random);
+// Uniform-ish in [0, max). max must be > 0
+int randomRange(RandomState* random, int max);
+
+//
+// Constants
+//
+
+static const char c_tileSize = 32;
+
+// Fixed-point time. Factory and fuel accumulators count in these units. Every supported tick rate
+// advances them by a whole number each tick, so throughput doesn't depend on the tick rate
+#define FIXED_UNITS_PER_SECOND 240
+// Any rate which divides FIXED_UNITS_PER_SECOND evenly works, e.g. 30, 60, 120, or 240
+static const int c_defaultTicksPerSecond = 60;
+
+// space
+static const int c_spaceSize = 10000;
+
+// goal
+static const int c_goalSize = /*c_tileSize * 5*/ 160;
+
+static const unsigned char c_numSustainableDamagesBeforeGameOver = 2;
+
+// Ship
+static const float c_maxSpeed = 1500.f;
+// Fuel is measured in fixed units of engine burn time
+static const int c_defaultStartFuel = 2 * FIXED_UNITS_PER_SECOND;
+
+// Factory
+static const int c_maxFuel = 5 * FIXED_UNITS_PER_SECOND;
+
+//
+// Factory Cells
+//
+typedef struct EngineCell
+{
+	// In fixed units of burn time
+	int fuel;
+	bool firing;
+} EngineCell;
+
+//
+// Grid
+//
+
+typedef struct GridCell
+{
+	unsigned char type;
+	EngineCell engineCell;
+} GridCell;
+
+typedef struct GridSpace
+{
+	unsigned char width;
+	unsigned char height;
+	GridCell* data;
+} GridSpace;
+
+#define GridCellAt(gridSpace, x, y) ((gridSpace)->data[((y) * (gridSpace)->width) + (x)])
+
+bool isEngineTile(unsigned char c);
+void setGridSpaceFromString(GridSpace* gridSpace, const char* str);
+void renderGridSpaceText(GridSpace* gridSpace);
+
+//
+// Physics
+//
+
+typedef struct RigidBody
+{
+	Vec2 position;
+	Vec2 velocity;
+} RigidBody;
+
+//
+// Ships
+//
+
+// Ship-vs-ship narrowphase stores one bit per cell in a row, so ships can't be wider than this
+#define MAX_SHIP_DIMENSION 32
+
+typedef struct Ship
+{
+	RigidBody body;
+	unsigned char width;
+	unsigned char height;
+	// Cells live contiguously (row-major) in shipCells so fleet-wide passes can walk one array
+	// instead of hopping between ships
+	unsigned short firstCell;
+	// Number of non-empty cells. Used as the ship's mass for ship-vs-ship collisions
+	unsigned short numSolidCells;
+	// Bit X of rowMasks[Y] is set when cell (X, Y) is not empty
+	unsigned int rowMasks[MAX_SHIP_DIMENSION];
+	// Factory and damage rolls. Per ship so ships can be updated in any order
+	RandomState random;
+	// Changes whenever a cell is built, replaced or destroyed, so the renderer can tell when its
+	// drawing of the ship is out of date without comparing cells. Computed from the cells, so
+	// rewinding or loading a different ship changes it too
+	uint64_t layoutHash;
+} Ship;
+
+// Player N flies ship N, so the first player's ship is always first
+#define MAX_PLAYERS 2
+static const int c_playerShipIndex = 0;
+
+typedef enum EngineInput
+{
+	EngineInput_Up = 1 << 0,
+	EngineInput_Down = 1 << 1,
+	EngineInput_Left = 1 << 2,
+	EngineInput_Right = 1 << 3,
+} EngineInput;
+
+//
+// Objects
+//
+
+typedef struct Object
+{
+	char type;
+	bool inFactory;
+	unsigned char tileX;
+	unsigned char tileY;
+	// Index into ships of the factory this object is in. Only valid if inFactory
+	unsigned char ship;
+	// Fixed units spent on the current tile. Once this reaches the tile's transition time, move on
+	unsigned short transition;
+	RigidBody body;
+} Object;
+
+//
+// Ship editing
+//
+
+// The tiles the player can build, in the order the edit UI shows them
+#define NUM_BUILDABLE_TILES 15
+extern const char c_buildableTiles[NUM_BUILDABLE_TILES];
+
+typedef enum PlacementRestriction
+{
+	Restrict_None,
+	Restrict_Inside,
+	Restrict_EdgeAny,
+	Restrict_EdgeLeft,
+	Restrict_EdgeRight,
+	Restrict_EdgeTop,
+	Restrict_EdgeBottom,
+} PlacementRestriction;
+
+extern const PlacementRestriction c_buildableTileRestrictions[NUM_BUILDABLE_TILES];
+
+typedef struct EditCommand
+{
+	unsigned char ship;
+	unsigned char cellX;
+	unsigned char cellY;
+	// Index into c_buildableTiles
+	unsigned char buildableTile;
+} EditCommand;
+
+//
+// Game phases
+//
+
+typedef enum Objective
+{
+	Objective_None,
+	// This does some weird stuff like hide the HUD, so use with caution
+	Objective_ShipConstruct,
+	Objective_ReachGoalPoint,
+} Objective;
+
+typedef struct GamePhase
+{
+	const char* prompt;
+	int timeToCompleteSeconds;
+	Objective objective;
+} GamePhase;
+
+//
+// Simulation
+//
+
+#define MAX_SHIPS 128
+#define MAX_SHIP_CELLS 16384
+#define MAX_OBJECTS 1024
+
+// Streams seeded from the session seed. Ships use c_randomStreamFirstShip + their index
+static const uint64_t c_randomStreamGameplay = 0;
+// Anything only the presentation sees. Using it never changes the outcome of a simulation
+static const uint64_t c_randomStreamCosmetic = 1;
+static const uint64_t c_randomStreamFirstShip = 2;
+
+typedef struct SimulationState
+{
+	unsigned int tick;
+	int ticksPerSecond;
+	float secondsPerTick;
+	// How far fixed-point accumulators advance each tick
+	int fixedUnitsPerTick;
+	uint64_t seed;
+	// Ships [0, numPlayers) are flown by players
+	int numPlayers;
+	// Zobrist-style hash of the discrete state. Every mutation XORs out the old key and XORs in the
+	// new one. See simulationStateHash()
+	uint64_t stateHash;
+	// Spawning and goal placement
+	RandomState gameplayRandom;
+	RandomState cosmeticRandom;
+
+	Ship ships[MAX_SHIPS];
+	int numShips;
+	GridCell shipCells[MAX_SHIP_CELLS];
+	int numShipCellsUsed;
+
+	Object objects[MAX_OBJECTS];
+
+	// Player inventory (index matches c_buildableTiles)
+	unsigned short inventory[NUM_BUILDABLE_TILES];
+	// In the same units as EngineCell fuel
+	int constructionFuelPool;
+
+	IRect goal;
+	int currentGamePhase;
+	unsigned int phaseStartTick;
+	unsigned char numDamagesSustained;
+} SimulationState;
+
+#define MAX_EDITS_PER_TICK 8
+
+// Everything the outside world can do to the simulation in one tick
+typedef struct SimulationInput
+{
+	// EngineInput flags for each player's ship
+	unsigned char engineInput[MAX_PLAYERS];
+	// Developer option to advance to the next phase
+	bool skipPhase;
+	unsigned char numEdits;
+	EditCommand edits[MAX_EDITS_PER_TICK];
+} SimulationInput;
+
+// Things which happened during a tick that the presentation might want to react to
+typedef enum SimulationEvent
+{
+	SimulationEvent_PhaseStarted = 1 << 0,
+	SimulationEvent_PhaseFailed = 1 << 1,
+} SimulationEvent;
+
+// A ship's cells as tile characters, row by row
+typedef struct ShipLayout
+{
+	unsigned char width;
+	unsigned char height;
+	// width * height characters, null terminated
+	const char* cells;
+} ShipLayout;
+
+// What every player's ship starts as
+extern const ShipLayout c_defaultPlayerShipLayout;
+
+bool simulationIsValidTickRate(int ticksPerSecond);
+// Whether players could start with this ship: it fits the collision masks and is only made of
+// tiles the player could build
+bool simulationIsValidShipLayout(const ShipLayout* layout);
+// The same seed and inputs always produce the same simulation. ticksPerSecond must be valid, and
+// numPlayers between 1 and MAX_PLAYERS
+void simulationInitialize(SimulationState* state, uint64_t seed, int ticksPerSecond,
+                          int numPlayers);
+// Like simulationInitialize(), but every player starts with playerShipLayout, which must be valid.
+// Replays and snapshots only record the seed, so they can't reproduce such a session
+void simulationInitializeWithShipLayout(SimulationState* state, uint64_t seed, int ticksPerSecond,
+                                        int numPlayers, const ShipLayout* playerShipLayout);
+// Advance by state->secondsPerTick. Returns SimulationEvent flags
+unsigned int simulationTick(SimulationState* state, const SimulationInput* input);
+// Like simulationTick(), but independent parts of the tick run on the job system's threads (see
+// Jobs.h). The result is exactly the same as simulationTick()'s. NULL runs it all on this thread
+struct JobSystem;
+unsigned int simulationTickWithJobs(SimulationState* state, const SimulationInput* input,
+                                    struct JobSystem* jobs);
+
+GridSpace shipGridSpace(SimulationState* state, Ship* ship);
+
+// Cheap enough to check every tick. Covers ship cells, fuel, objects' factory state, inventory, and
+// game progress. Positions and velocities change every tick, so they are only in
+// simulationFullHash()
+uint64_t simulationStateHash(const SimulationState* state);
+// Hashes everything from scratch, including positions and velocities. Much slower
+uint64_t simulationFullHash(const SimulationState* state);
+// Returns whether the incrementally maintained hash matches one recomputed from scratch. If not,
+// some mutation forgot to update it
+bool simulationVerifyStateHash(const SimulationState* state);
+
+// Returns NULL if the game is over
+const GamePhase* simulationCurrentPhase(SimulationState* state);
+// NULL past the last phase
+const GamePhase* simulationGamePhase(int phaseIndex);
+int simulationSecondsInCurrentPhase(SimulationState* state);
+bool simulationIsPlayerDestroyed(SimulationState* state);
+
+// Checks the rules without changing anything. Returns Restrict_None if the placement is allowed
+PlacementRestriction simulationPlacementRestriction(SimulationState* state,
+                                                    const EditCommand* edit);
+// Also returns false if the tile type is not in the inventory or the cell already has that type
+bool simulationCanApplyEdit(SimulationState* state, const EditCommand* edit);
+// Applies the edit right away instead of at the next tick, e.g. to build a ship before simulating.
+// Returns false and changes nothing if simulationCanApplyEdit() says no
+bool simulationApplyEdit(SimulationState* state, const EditCommand* edit);
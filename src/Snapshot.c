@@ -0,0 +1,222 @@
+#include "Snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char c_snapshotMagic[4] = {'S', 'F', 'S', 'S'};
+static const uint32_t c_snapshotVersion = 1;
+
+static uint64_t snapshotLayoutHash()
+{
+	const uint64_t layout[] = {
+	    // Byte order
+	    0x0102030405060708ULL,
+	    sizeof(SimulationState),
+	    sizeof(Ship),
+	    sizeof(GridCell),
+	    sizeof(Object),
+	    sizeof(RandomState),
+	    offsetof(SimulationState, ships),
+	    offsetof(SimulationState, shipCells),
+	    offsetof(SimulationState, objects),
+	    offsetof(SimulationState, inventory),
+	    offsetof(SimulationState, goal),
+	    offsetof(Ship, body),
+	    offsetof(Ship, rowMasks),
+	    offsetof(Ship, random),
+	    offsetof(Object, body),
+	    MAX_SHIPS,
+	    MAX_PLAYERS,
+	    MAX_SHIP_CELLS,
+	    MAX_OBJECTS,
+	    NUM_BUILDABLE_TILES,
+	    FIXED_UNITS_PER_SECOND,
+	};
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const unsigned char* bytes = (const unsigned char*)layout;
+	for (size_t i = 0; i < sizeof(layout); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// A word at a time so checking a snapshot costs a small fraction of loading it
+static uint64_t snapshotChecksum(const SimulationState* state)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const unsigned char* bytes = (const unsigned char*)state;
+	size_t numWords = sizeof(SimulationState) / sizeof(uint64_t);
+	for (size_t i = 0; i < numWords; ++i)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + (i * sizeof(uint64_t)), sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ULL;
+		hash ^= hash >> 32;
+	}
+	for (size_t i = numWords * sizeof(uint64_t); i < sizeof(SimulationState); ++i)
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+bool snapshotSave(const SimulationState* state, const char* filename)
+{
+	SnapshotHeader header = {0};
+	memcpy(header.magic, c_snapshotMagic, sizeof(header.magic));
+	header.version = c_snapshotVersion;
+	header.headerSize = sizeof(SnapshotHeader);
+	header.stateSize = sizeof(SimulationState);
+	header.layoutHash = snapshotLayoutHash();
+	header.checksum = snapshotChecksum(state);
+
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		fprintf(stderr, "Could not open %s to save a snapshot\n", filename);
+		return false;
+	}
+	bool success = fwrite(&header, sizeof(header), 1, file) == 1 &&
+	               fwrite(state, sizeof(SimulationState), 1, file) == 1;
+	if (fclose(file) != 0)
+		success = false;
+	if (!success)
+		fprintf(stderr, "Failed to write snapshot %s\n", filename);
+	return success;
+}
+
+// Indices in the state are trusted everywhere else. This catches a snapshot which was written
+// wrong, rather than one which was damaged afterwards
+static bool snapshotStateInBounds(const SimulationState* state)
+{
+	if (state->numShips < 1 || state->numShips > MAX_SHIPS || state->numPlayers < 1 ||
+	    state->numPlayers > MAX_PLAYERS || state->numPlayers > state->numShips ||
+	    state->numShipCellsUsed < 0 || state->numShipCellsUsed > MAX_SHIP_CELLS ||
+	    !simulationIsValidTickRate(state->ticksPerSecond))
+		return false;
+	for (int i = 0; i < state->numShips; ++i)
+	{
+		const Ship* ship = &state->ships[i];
+		if (ship->width > MAX_SHIP_DIMENSION || ship->height > MAX_SHIP_DIMENSION ||
+		    ship->firstCell + (ship->width * ship->height) > state->numShipCellsUsed)
+			return false;
+	}
+	for (int i = 0; i < MAX_OBJECTS; ++i)
+	{
+		const Object* object = &state->objects[i];
+		if (object->type && object->inFactory && object->ship >= state->numShips)
+			return false;
+	}
+	return true;
+}
+
+bool snapshotMap(SnapshotMapping* mapping, const char* filename)
+{
+	memset(mapping, 0, sizeof(SnapshotMapping));
+
+#ifdef WINDOWS
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Could not open snapshot %s\n", filename);
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE fileMapping = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart)
+		fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (fileMapping)
+	{
+		mapping->data = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+		mapping->size = (size_t)fileSize.QuadPart;
+		// The view keeps the file alive
+		CloseHandle(fileMapping);
+	}
+	CloseHandle(file);
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+	{
+		fprintf(stderr, "Could not open snapshot %s\n", filename);
+		return false;
+	}
+	struct stat fileStatus;
+	if (fstat(file, &fileStatus) == 0 && fileStatus.st_size)
+	{
+		void* data = mmap(NULL, fileStatus.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED)
+		{
+			mapping->data = data;
+			mapping->size = fileStatus.st_size;
+		}
+	}
+	// The mapping keeps the file alive
+	close(file);
+#endif
+
+	if (!mapping->data)
+	{
+		fprintf(stderr, "Could not map snapshot %s\n", filename);
+		return false;
+	}
+
+	const SnapshotHeader* header = (const SnapshotHeader*)mapping->data;
+	if (mapping->size < sizeof(SnapshotHeader) ||
+	    memcmp(header->magic, c_snapshotMagic, sizeof(header->magic)) != 0 ||
+	    header->version != c_snapshotVersion || header->headerSize != sizeof(SnapshotHeader) ||
+	    header->stateSize != sizeof(SimulationState) ||
+	    header->layoutHash != snapshotLayoutHash() ||
+	    mapping->size != header->headerSize + header->stateSize)
+	{
+		fprintf(stderr, "%s is not a snapshot this build can load\n", filename);
+		snapshotUnmap(mapping);
+		return false;
+	}
+
+	const SimulationState* state =
+	    (const SimulationState*)((const char*)mapping->data + header->headerSize);
+	if (snapshotChecksum(state) != header->checksum || !snapshotStateInBounds(state))
+	{
+		fprintf(stderr, "Snapshot %s is corrupt\n", filename);
+		snapshotUnmap(mapping);
+		return false;
+	}
+
+	mapping->state = state;
+	return true;
+}
+
+void snapshotUnmap(SnapshotMapping* mapping)
+{
+	if (mapping->data)
+	{
+#ifdef WINDOWS
+		UnmapViewOfFile(mapping->data);
+#else
+		munmap(mapping->data, mapping->size);
+#endif
+	}
+	memset(mapping, 0, sizeof(SnapshotMapping));
+}
+
+bool snapshotLoad(SimulationState* state, const char* filename)
+{
+	SnapshotMapping mapping;
+	if (!snapshotMap(&mapping, filename))
+		return false;
+	memcpy(state, mapping.state, sizeof(SimulationState));
+	snapshotUnmap(&mapping);
+	return true;
+}
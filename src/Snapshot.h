@@ -0,0 +1,40 @@
+#pragma once
+
+// Save and restore the whole simulation. SimulationState holds indices rather than pointers, so a
+// snapshot is just a header followed by the state's bytes: it is written in one sequential pass and
+// loaded by mapping the file, with nothing to parse or fix up. Snapshots are only meant to be read
+// by the same build on the same kind of machine; the header catches anything else
+
+#include "Simulation.h"
+
+#include <stddef.h>
+
+typedef struct SnapshotHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t stateSize;
+	// Sizes, offsets, limits, and byte order of the state's layout. Catches layout changes even
+	// when someone forgets to bump the version
+	uint64_t layoutHash;
+	// Of the state's bytes, to make sure the contents survived
+	uint64_t checksum;
+} SnapshotHeader;
+
+typedef struct SnapshotMapping
+{
+	void* data;
+	size_t size;
+	// Points into the mapping. Read-only, and only valid until snapshotUnmap()
+	const SimulationState* state;
+} SnapshotMapping;
+
+bool snapshotSave(const SimulationState* state, const char* filename);
+
+// Map the file and validate it without copying the state out
+bool snapshotMap(SnapshotMapping* mapping, const char* filename);
+void snapshotUnmap(SnapshotMapping* mapping);
+
+// Map, validate, and copy into state. state is untouched on failure
+bool snapshotLoad(SimulationState* state, const char* filename);
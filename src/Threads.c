@@ -0,0 +1,220 @@
+// For SCHED_IDLE
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "Threads.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WINDOWS
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+//
+// Threads
+//
+
+typedef struct ThreadStart
+{
+	ThreadFunction function;
+	void* userData;
+} ThreadStart;
+
+#ifdef WINDOWS
+static DWORD WINAPI threadEntry(LPVOID startData)
+#else
+static void* threadEntry(void* startData)
+#endif
+{
+	ThreadStart start = *(ThreadStart*)startData;
+	free(startData);
+	start.function(start.userData);
+	return 0;
+}
+
+bool threadCreate(Thread* thread, ThreadFunction function, void* userData)
+{
+	ThreadStart* start = malloc(sizeof(ThreadStart));
+	if (!start)
+		return false;
+	start->function = function;
+	start->userData = userData;
+#ifdef WINDOWS
+	*thread = CreateThread(NULL, 0, threadEntry, start, 0, NULL);
+	if (!*thread)
+#else
+	if (pthread_create(thread, NULL, threadEntry, start) != 0)
+#endif
+	{
+		free(start);
+		return false;
+	}
+	return true;
+}
+
+void threadJoin(Thread* thread)
+{
+#ifdef WINDOWS
+	WaitForSingleObject(*thread, INFINITE);
+	CloseHandle(*thread);
+#else
+	pthread_join(*thread, NULL);
+#endif
+}
+
+int threadNumHardwareThreads()
+{
+#ifdef WINDOWS
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	int numThreads = (int)systemInfo.dwNumberOfProcessors;
+#else
+	int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return numThreads > 0 ? numThreads : 1;
+}
+
+void threadSleep(double seconds)
+{
+	if (seconds <= 0.0)
+		return;
+#ifdef WINDOWS
+	Sleep((DWORD)(seconds * 1000.0));
+#else
+	struct timespec duration;
+	duration.tv_sec = (time_t)seconds;
+	duration.tv_nsec = (long)((seconds - (double)duration.tv_sec) * 1000000000.0);
+	nanosleep(&duration, NULL);
+#endif
+}
+
+void threadYield()
+{
+#ifdef WINDOWS
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+void threadSetBackgroundPriority()
+{
+#ifdef WINDOWS
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+	struct sched_param parameters = {0};
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &parameters);
+#else
+	struct sched_param parameters = {0};
+	parameters.sched_priority = sched_get_priority_min(SCHED_OTHER);
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &parameters);
+#endif
+}
+
+//
+// Synchronization
+//
+
+void mutexInitialize(Mutex* mutex)
+{
+#ifdef WINDOWS
+	InitializeSRWLock(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void mutexDestroy(Mutex* mutex)
+{
+#ifndef WINDOWS
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+void mutexLock(Mutex* mutex)
+{
+#ifdef WINDOWS
+	AcquireSRWLockExclusive(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void mutexUnlock(Mutex* mutex)
+{
+#ifdef WINDOWS
+	ReleaseSRWLockExclusive(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+void conditionInitialize(Condition* condition)
+{
+#ifdef WINDOWS
+	InitializeConditionVariable(condition);
+#else
+	pthread_cond_init(condition, NULL);
+#endif
+}
+
+void conditionDestroy(Condition* condition)
+{
+#ifndef WINDOWS
+	pthread_cond_destroy(condition);
+#endif
+}
+
+void conditionWait(Condition* condition, Mutex* mutex)
+{
+#ifdef WINDOWS
+	SleepConditionVariableSRW(condition, mutex, INFINITE, 0);
+#else
+	pthread_cond_wait(condition, mutex);
+#endif
+}
+
+void conditionWakeAll(Condition* condition)
+{
+#ifdef WINDOWS
+	WakeAllConditionVariable(condition);
+#else
+	pthread_cond_broadcast(condition);
+#endif
+}
+
+int32_t atomicFetchAdd(volatile int32_t* value, int32_t amount)
+{
+#ifdef WINDOWS
+	return InterlockedExchangeAdd((volatile LONG*)value, amount);
+#else
+	return __atomic_fetch_add(value, amount, __ATOMIC_SEQ_CST);
+#endif
+}
+
+int32_t atomicLoad(volatile int32_t* value)
+{
+#ifdef WINDOWS
+	return InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void atomicStore(volatile int32_t* value, int32_t newValue)
+{
+	atomicExchange(value, newValue);
+}
+
+int32_t atomicExchange(volatile int32_t* value, int32_t newValue)
+{
+#ifdef WINDOWS
+	return InterlockedExchange((volatile LONG*)value, newValue);
+#else
+	return __atomic_exchange_n(value, newValue, __ATOMIC_SEQ_CST);
+#endif
+}
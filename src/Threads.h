@@ -0,0 +1,50 @@
+#pragma once
+
+// Just enough threading to spread independent work over the machine's cores. POSIX threads, or
+// the Win32 equivalents when WINDOWS is defined. Like Simulation.h, this must not depend on SDL
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Condition;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+#endif
+
+typedef void (*ThreadFunction)(void* userData);
+
+bool threadCreate(Thread* thread, ThreadFunction function, void* userData);
+void threadJoin(Thread* thread);
+int threadNumHardwareThreads();
+void threadSleep(double seconds);
+// Let another thread run, e.g. while spinning on something another thread will do soon
+void threadYield();
+// Only run the calling thread when nothing else wants the core, e.g. for work which mustn't make
+// the game hitch even on a machine with a single core
+void threadSetBackgroundPriority();
+
+void mutexInitialize(Mutex* mutex);
+void mutexDestroy(Mutex* mutex);
+void mutexLock(Mutex* mutex);
+void mutexUnlock(Mutex* mutex);
+
+void conditionInitialize(Condition* condition);
+void conditionDestroy(Condition* condition);
+// The mutex must be locked. It is unlocked while waiting and locked again before returning
+void conditionWait(Condition* condition, Mutex* mutex);
+void conditionWakeAll(Condition* condition);
+
+// Returns the value before adding
+int32_t atomicFetchAdd(volatile int32_t* value, int32_t amount);
+int32_t atomicLoad(volatile int32_t* value);
+void atomicStore(volatile int32_t* value, int32_t newValue);
+// Returns the value before exchanging
+int32_t atomicExchange(volatile int32_t* value, int32_t newValue);
@@ -11,7 +11,14 @@
 #include "SDL.cake.hpp"
 #include "SpaceFactory.cake.hpp"
 
-#define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
+#include "Autosave.h"
+#include "Jobs.h"
+#include "Netplay.h"
+#include "Rasterizer.h"
+#include "Replay.h"
+#include "Rewind.h"
+#include "Simulation.h"
+#include "Snapshot.h"
 
 //
 // SpaceFactory.cake generates these
@@ -31,33 +38,30 @@ static unsigned char* endTilesheetBmp = (&_binary_assets_TileSheet_bmp_end);
 #endif
 #endif
 
-// Math
-typedef struct Vec2
-{
-	float x;
-	float y;
-} Vec2;
-
-typedef struct IVec2
-{
-	int x;
-	int y;
-} IVec2;
-
-bool pointInFRect(Vec2* point, SDL_FRect* rect)
-{
-	return point->x >= rect->x && point->x < (rect->x + rect->w) && point->y >= rect->y &&
-	       point->y < (rect->y + rect->h);
-}
-
 //
 // Constants
 //
 
 const bool enableDeveloperOptions = true;
+// F5 saves a snapshot here, F9 loads it
+const char* c_quickSaveFilename = "QuickSave.sfs";
+// Saved every c_autosaveDefaultIntervalSeconds of play, in the background. Loads like a quick save
+const char* c_autosaveFilename = "Autosave.sfs";
+// The renderer which drew fastest on this machine. Deleted or out of date, it is measured again
+const char* c_rendererChoiceFilename = "Renderer.cfg";
+// Holding F3 rewinds up to this far back, at this many times normal speed
+const int c_rewindSeconds = 60;
+const float c_rewindSpeed = 3.f;
+const size_t c_rewindMaxMemoryBytes = 32 * 1024 * 1024;
+// Longer stalls than this (dragging the window, a breakpoint) are skipped rather than caught up
+const float c_maxCatchUpSeconds = 0.1f;
+// Wall time a frame may spend simulating. Ticks which don't fit are dropped, so the game slows
+// down instead of each frame taking longer than the last
+const float c_maxSimulationSecondsPerFrame = 0.0125f;
+// The simulation thread checks for the other player's packets at least this often
+const float c_netplayPollSeconds = 0.002f;
 
 /* const int c_arbitraryDelayTimeMilliseconds = 10; */
-const char c_tileSize = 32;
 
 const int c_fontWidth = 7;
 const int c_fontHeight = 10;
@@ -66,24 +70,17 @@ const int c_fontHeight = 10;
 const int c_scaledFontWidth = /*c_fontWidth * 2*/14;
 /* static const int c_scaledFontHeight = c_fontHeight * 2; */
 const int c_scaledFontHeight = /*c_fontHeight * 2*/20;
+// Between lines of text
+const int c_fontVerticalSpace = 5;
 
 const float c_typeOutTime = 0.75f;
 
-const float c_simulateUpdateRate = 1.f / 60.f;
-
-// space
-const int c_spaceSize = 10000;
-const int c_spawnBuffer = /*c_spaceSize / 10*/1000;  // 10% margins
-
 // goal
-const int c_goalSize = /*c_tileSize * 5*/160;
 const int c_goalMinimapScaleFactor = 2;
 
 // On failure
 const float c_timeToShowFailedOverlay = 0.25f;
 const float c_timeToShowDamagedText = 3.f;
-const unsigned int c_perCellDamageRoll = 30;
-const unsigned char c_numSustainableDamagesBeforeGameOver = 2;
 
 // minimap
 const int c_miniMapSize = 400;
@@ -94,87 +91,6 @@ typedef SDL_Rect Camera;
 const float c_cameraEaseFactor = 5.f;
 const bool c_enableCameraSmoothing = false;
 
-// Ship
-const float c_shipThrust = 300.f;
-const float c_maxSpeed = 1500.f;
-const float c_defaultStartFuel = 2.f;
-const float c_fuelConsumptionRate = 1.f;
-
-// Physics
-float playerDrag = 0.f;
-const float c_onFailurePlayerDrag = 0.1f;
-const float c_objectDrag = 0.05f;
-
-// These force transfer values fake Newton's Third Law of Motion (equal and opposite reactions) by
-// using hard-coded values rather than F=MA. This gives us more control over the feel.
-
-// Objects colliding with the ship will receive the player's velocity plus a bit more
-const float c_objectForceTransfer = 1.2f;
-// This will go straight to reducing player velocity, regardless of the object's velocity. By reducing the player's velocity, we give the asteriods a feeling of weight
-const float c_shipObjectForceTransfer = 8.f;
-
-// Factory
-const int c_maxFuel = 5;
-const unsigned char c_transitionThreshold = 128;
-const unsigned char c_conveyorTransitionPerSecond = 250;
-const unsigned char c_furnaceTransitionPerSecond = 100;
-
-//
-// Factory Cells
-//
-typedef struct EngineCell
-{
-	float fuel;
-	bool firing;
-} EngineCell;
-
-//
-// Grid
-//
-
-typedef struct GridCell
-{
-	unsigned char type;
-	EngineCell engineCell;
-} GridCell;
-
-typedef struct GridSpace
-{
-	unsigned char width;
-	unsigned char height;
-	GridCell* data;
-} GridSpace;
-
-#define GridCellAt(gridSpace, x, y) ((gridSpace)->data[((y) * (gridSpace)->width) + (x)])
-
-// Let's try to keep it static for now
-/* static GridSpace* createGridSpace(unsigned char width, unsigned char height) */
-/* { */
-/* 	char* mem = (char*)malloc(sizeof(GridSpace) + (width * height * sizeof(GridCell))); */
-/* 	GridSpace* newSpace = (GridSpace*)mem; */
-/* 	newSpace->width = width; */
-/* 	newSpace->height = height; */
-/* 	newSpace->data = (GridCell*)(mem + sizeof(GridSpace)); */
-/* 	return newSpace; */
-/* } */
-
-/* static void freeGridSpace(GridSpace* gridSpace) */
-/* { */
-/* 	free(gridSpace); */
-/* } */
-
-static void renderGridSpaceText(GridSpace* gridSpace)
-{
-	for (int y = 0; y < gridSpace->height; ++y)
-	{
-		for (int x = 0; x < gridSpace->width; ++x)
-		{
-			fprintf(stderr, "%c", GridCellAt(gridSpace, x, y).type);
-		}
-		fprintf(stderr, "\n");
-	}
-}
-
 typedef enum TextureTransform
 {
 	TextureTransform_None,
@@ -184,10 +100,6 @@ typedef enum TextureTransform
 	TextureTransform_CounterClockwise90,
 } TextureTransform;
 
-const float c_transformsToAngles[] = {0.f, 0.f, 0.f, 90.f, 270.f};
-const SDL_RendererFlip c_transformsToSDLRenderFlips[] = {
-    SDL_FLIP_NONE, SDL_FLIP_HORIZONTAL, SDL_FLIP_VERTICAL, SDL_FLIP_NONE, SDL_FLIP_NONE};
-
 typedef struct CharacterSheetCellAssociation
 {
 	char key;
@@ -197,580 +109,995 @@ typedef struct CharacterSheetCellAssociation
 	char transform;
 } CharacterSheetCellAssociation;
 
-typedef struct TileSheet
-{
-	// This is the number of distinct things that can be rendered from the tile sheet
-	CharacterSheetCellAssociation associations[17];
+// Everything which can be rendered from the tile sheet
+static const CharacterSheetCellAssociation c_tileSheetCells[] = {
+    // Wall
+    {'#', 0, 0, TextureTransform_None},
+    // Floor
+    {'.', 0, 1, TextureTransform_None},
+    // Conveyor to left
+    {'<', 0, 2, TextureTransform_None},
+    // Conveyor to right
+    {'>', 0, 2, TextureTransform_FlipHorizontal},
+    // Conveyor to up
+    {'A', 0, 2, TextureTransform_Clockwise90},
+    // Conveyor to down
+    {'V', 0, 2, TextureTransform_CounterClockwise90},
+    // Furnace
+    {'f', 2, 1, TextureTransform_None},
+    // Intake from right
+    {'R', 2, 0, TextureTransform_None},
+    // Intake from left
+    {'L', 2, 0, TextureTransform_FlipHorizontal},
+    // Intake from top
+    {'U', 2, 0, TextureTransform_CounterClockwise90},
+    // Intake from bottom
+    {'D', 2, 0, TextureTransform_Clockwise90},
+    // Engine to left (unpowered)
+    {'l', 1, 1, TextureTransform_FlipHorizontal},
+    {'r', 1, 1, TextureTransform_None},
+    {'u', 1, 1, TextureTransform_Clockwise90},
+    {'d', 1, 1, TextureTransform_CounterClockwise90},
+
+    // Objects
+    // Unrefined fuel (asteroid)
+    {'a', 0, 3, TextureTransform_None},
+    // Refined fuel
+    {'g', 1, 0, TextureTransform_None},
+};
 
-	SDL_Texture* texture;
-} TileSheet;
+//
+// Software rendering
+//
 
-bool isEngineTile(unsigned char c)
-{
-	return c == 'u' || c == 'l' || c == 'r' || c == 'd';
-}
+// For machines without a GPU, where SDL's own software renderer is slow. Whatever goes through the
+// sprite batch is drawn by the Rasterizer instead, then copied to the screen through one streaming
+// texture each time the batch flushes. Anything drawn with SDL directly still goes through SDL
+#define SOFTWARE_MAX_IMAGES 4
 
-static void renderGridSpaceFromTileSheet(SDL_Renderer* renderer, TileSheet* tileSheet,
-                                         GridSpace* gridSpace, int originX, int originY,
-                                         int cameraX, int cameraY)
+typedef struct SoftwareRenderer
 {
-	for (int cellY = 0; cellY < gridSpace->height; ++cellY)
-	{
-		for (int cellX = 0; cellX < gridSpace->width; ++cellX)
-		{
-			char tileToFind = GridCellAt(gridSpace, cellX, cellY).type;
-			for (int tileAssociation = 0; tileAssociation < ARRAY_SIZE(tileSheet->associations);
-			     ++tileAssociation)
-			{
-				CharacterSheetCellAssociation* association =
-				    &tileSheet->associations[tileAssociation];
-				if (tileToFind != association->key)
-					continue;
-
-				int textureX = association->column * c_tileSize;
-				int textureY = association->row * c_tileSize;
-				int screenX = originX + (cellX * c_tileSize) - cameraX;
-				int screenY = originY + (cellY * c_tileSize) - cameraY;
-				if (isEngineTile(tileToFind))
-				{
-					// if this is an engine tile, and its firing, swap the off sprite for the on
-					// sprite, and draw the trail
-					if (GridCellAt(gridSpace, cellX, cellY).engineCell.firing)
-					{
-						textureX += c_tileSize;
-						SDL_Rect sourceRectangle = {textureX + c_tileSize, textureY, c_tileSize,
-						                            c_tileSize};
-						// compute the trail sprite location
-						int trailX = screenX;
-						int trailY = screenY;
-						if (tileToFind == 'u')
-							trailY += c_tileSize;
-						if (tileToFind == 'd')
-							trailY -= c_tileSize;
-						if (tileToFind == 'l')
-							trailX -= c_tileSize;
-						if (tileToFind == 'r')
-							trailX += c_tileSize;
-						SDL_Rect destinationRectangle = {trailX, trailY, c_tileSize, c_tileSize};
-						SDL_RenderCopyEx(renderer, tileSheet->texture, &sourceRectangle,
-						                 &destinationRectangle,
-						                 c_transformsToAngles[association->transform],
-						                 /*rotate about (default = center)*/ NULL,
-						                 c_transformsToSDLRenderFlips[association->transform]);
-					}
-				}
-				SDL_Rect sourceRectangle = {textureX, textureY, c_tileSize, c_tileSize};
-				SDL_Rect destinationRectangle = {screenX, screenY, c_tileSize, c_tileSize};
-				SDL_RenderCopyEx(renderer, tileSheet->texture, &sourceRectangle,
-				                 &destinationRectangle,
-				                 c_transformsToAngles[association->transform],
-				                 /*rotate about (default = center)*/ NULL,
-				                 c_transformsToSDLRenderFlips[association->transform]);
-
-				// always draw the fuel display sprite for engines
-				if (isEngineTile(tileToFind))
-				{
-					const int c_meterShortLength = 5;
-					const int c_meterLongLength = 30;
-					int meterPosX = screenX;
-					int meterPosY = screenY;
-					int meterWidth;
-					int meterHeight;
-					if (tileToFind == 'u')
-					{
-						meterWidth = c_meterLongLength;
-						meterHeight = c_meterShortLength;
-					}
-					if (tileToFind == 'd')
-					{
-						meterPosY += c_tileSize - 5;
-						meterWidth = c_meterLongLength;
-						meterHeight = c_meterShortLength;
-					}
-					if (tileToFind == 'l')
-					{
-						meterPosX = screenX + c_tileSize - 5;
-						meterWidth = c_meterShortLength;
-						meterHeight = c_meterLongLength;
-					}
-					if (tileToFind == 'r')
-					{
-						meterWidth = c_meterShortLength;
-						meterHeight = c_meterLongLength;
-					}
-
-					SDL_Rect fuelMeterRect = {meterPosX, meterPosY, meterWidth + 2,
-					                          meterHeight + 2};
-					SDL_SetRenderDrawColor(renderer, 102, 138, 158, 255);
-					SDL_RenderDrawRect(renderer, &fuelMeterRect);
-					float fuelPercentage =
-					    (GridCellAt(gridSpace, cellX, cellY).engineCell.fuel) / c_maxFuel;
-					if (meterWidth > meterHeight)
-					{
-						meterWidth *= fuelPercentage;
-					}
-					else
-					{
-						meterHeight *= fuelPercentage;
-					}
-
-					SDL_Rect fuelRect = {meterPosX + 1, meterPosY + 1, meterWidth, meterHeight};
-					SDL_SetRenderDrawColor(renderer, 209, 193, 163, 255);
-					SDL_RenderFillRect(renderer, &fuelRect);
+	SDL_Renderer* renderer;
+	// The same size as the renderer's output and the rasterizer's framebuffer
+	SDL_Texture* texture;
+	Rasterizer rasterizer;
+	// Textures the rasterizer has its own copy of
+	SDL_Texture* imageTextures[SOFTWARE_MAX_IMAGES];
+	RasterImage images[SOFTWARE_MAX_IMAGES];
+	int numImages;
+} SoftwareRenderer;
+
+// Matches the framebuffer to the renderer's output, e.g. after the window was resized
+static bool softwareRendererFitOutput(SoftwareRenderer* software)
+{
+	int width = 0;
+	int height = 0;
+	SDL_GetRendererOutputSize(software->renderer, &width, &height);
+	if (software->texture && width == software->rasterizer.width &&
+	    height == software->rasterizer.height)
+		return true;
 
-					SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-				}
+	if (software->texture)
+		SDL_DestroyTexture(software->texture);
+	software->texture = SDL_CreateTexture(software->renderer, SDL_PIXELFORMAT_ARGB8888,
+	                                      SDL_TEXTUREACCESS_STREAMING, width, height);
+	if (!software->texture)
+		return false;
+	SDL_SetTextureBlendMode(software->texture, SDL_BLENDMODE_BLEND);
+	return rasterizerResize(&software->rasterizer, width, height);
+}
 
-				break;
-			}
-		}
-	}
+static void softwareRendererDestroy(SoftwareRenderer* software)
+{
+	if (software->texture)
+		SDL_DestroyTexture(software->texture);
+	rasterizerDestroy(&software->rasterizer);
+	for (int i = 0; i < software->numImages; ++i)
+		free(software->images[i].pixels);
+	memset(software, 0, sizeof(SoftwareRenderer));
 }
 
-static void setGridSpaceFromString(GridSpace* gridSpace, const char* str)
+// Bands are drawn on jobs, which only the render thread may use. NULL draws them all on the calling
+// thread
+static bool softwareRendererInitialize(SoftwareRenderer* software, SDL_Renderer* renderer,
+                                       JobSystem* jobs, RasterInstructionSet instructionSet)
 {
-	GridCell* writeHead = gridSpace->data;
-	GridCell* gridSpaceEnd = writeHead + (gridSpace->width * gridSpace->height);
-	for (const char* c = str; *c != 0; ++c)
+	memset(software, 0, sizeof(SoftwareRenderer));
+	software->renderer = renderer;
+	rasterizerInitialize(&software->rasterizer, jobs);
+	software->rasterizer.instructionSet = instructionSet;
+	if (!softwareRendererFitOutput(software))
 	{
-		if (*c == '\n')
-			continue;
-		assert(writeHead < gridSpaceEnd && "GridSpace doesn't have enough room to fit the string.");
-		writeHead->type = *c;
-		if (isEngineTile(*c))
-		{
-			writeHead->engineCell.fuel = c_defaultStartFuel;
-			writeHead->engineCell.firing = false;
-		}
-
-		++writeHead;
+		softwareRendererDestroy(software);
+		return false;
 	}
+	return true;
 }
 
-static void renderStarField(SDL_Renderer* renderer, Camera* camera, int windowWidth,
-                            int windowHeight)
+// Keeps a copy of the surface the texture was made from, so the rasterizer can draw it.
+// Color-keyed pixels become transparent
+static bool softwareRendererAddImage(SoftwareRenderer* software, SDL_Texture* texture,
+                                     SDL_Surface* surface)
 {
-	static SDL_FRect stars[128] = {0};
-	static SDL_FRect dynstars[128] = {0};
-	static int starsSizeX = 0;
-	static int starsSizeY = 0;
-	if (starsSizeX != windowWidth || starsSizeY != windowHeight)
+	if (software->numImages == SOFTWARE_MAX_IMAGES)
+		return false;
+	SDL_Surface* converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (!converted)
+		return false;
+	Uint32 colorKey = 0;
+	bool hasColorKey = SDL_GetColorKey(surface, &colorKey) == 0;
+	Uint8 keyRed, keyGreen, keyBlue;
+	SDL_GetRGB(colorKey, surface->format, &keyRed, &keyGreen, &keyBlue);
+	Uint32 key = ((Uint32)keyRed << 16) | ((Uint32)keyGreen << 8) | keyBlue;
+
+	RasterImage* image = &software->images[software->numImages];
+	image->width = converted->w;
+	image->height = converted->h;
+	image->pixels = malloc((size_t)image->width * image->height * sizeof(uint32_t));
+	if (!image->pixels)
+	{
+		SDL_FreeSurface(converted);
+		return false;
+	}
+	SDL_LockSurface(converted);
+	for (int y = 0; y < image->height; ++y)
 	{
-		starsSizeX = windowWidth;
-		starsSizeY = windowHeight;
-		for (int i = 0; i < ARRAY_SIZE(stars); ++i)
+		const Uint32* row =
+		    (const Uint32*)((const char*)converted->pixels + (y * converted->pitch));
+		for (int x = 0; x < image->width; ++x)
 		{
-			stars[i].x = rand() % starsSizeX;
-			stars[i].y = rand() % starsSizeY;
-			stars[i].w = rand() % 5 + 1;
-			stars[i].h = rand() % 5 + 1;
-			dynstars[i].w = stars[i].w;
-			dynstars[i].h = stars[i].h;
+			Uint32 color = row[x] & 0xffffff;
+			image->pixels[(y * image->width) + x] =
+			    hasColorKey && color == key ? 0 : color | 0xff000000;
 		}
 	}
+	SDL_UnlockSurface(converted);
+	SDL_FreeSurface(converted);
+	software->imageTextures[software->numImages++] = texture;
+	return true;
+}
 
-	for (int i = 0; i < ARRAY_SIZE(stars); ++i)
+// NULL if the rasterizer can't draw the texture
+static const RasterImage* softwareRendererFindImage(SoftwareRenderer* software,
+                                                    SDL_Texture* texture)
+{
+	for (int i = 0; i < software->numImages; ++i)
 	{
-		dynstars[i].x = stars[i].x - camera->x / 1000;
-		dynstars[i].y = stars[i].y - camera->y / 1000;
+		if (software->imageTextures[i] == texture)
+			return &software->images[i];
 	}
+	return NULL;
+}
 
-	SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
-	SDL_RenderFillRectsF(renderer, dynstars, ARRAY_SIZE(dynstars));
+// Draws what the rasterizer has been given and copies it to the renderer
+static void softwareRendererFlush(SoftwareRenderer* software)
+{
+	Rasterizer* rasterizer = &software->rasterizer;
+	rasterizerDraw(rasterizer);
+	RasterRect* dirty = &rasterizer->dirty;
+	if (!dirty->width || !dirty->height || !software->texture)
+		return;
+	SDL_Rect dirtyRect = {dirty->x, dirty->y, dirty->width, dirty->height};
+	SDL_UpdateTexture(software->texture, &dirtyRect,
+	                  &rasterizer->pixels[(dirty->y * rasterizer->width) + dirty->x],
+	                  rasterizer->width * sizeof(uint32_t));
+	SDL_RenderCopy(software->renderer, software->texture, &dirtyRect, &dirtyRect);
+	rasterizerClearDirty(rasterizer);
 }
 
 //
-// Physics
+// Sprite batching
 //
 
-typedef struct RigidBody
-{
-	Vec2 position;
-	Vec2 velocity;
-} RigidBody;
+#define SPRITE_BATCH_MAX_QUADS 4096
 
-bool objHittingGrid(RigidBody* gridPos, GridSpace* gridSheet, RigidBody* objPos)
+// Collects quads into one vertex buffer and submits them with a single SDL_RenderGeometry() each
+// time the texture or blend mode changes, rather than making an SDL call per sprite. Anything
+// drawn with SDL directly must flush first so it ends up in the right order
+typedef struct SpriteBatch
 {
-	SDL_FRect playerBoundingBox = {
-	    gridPos->position.x,
-	    gridPos->position.y,
-	    (float)((gridSheet->width) * c_tileSize),
-	    (float)((gridSheet->height) * c_tileSize),
-	};
-
-	return (pointInFRect(&objPos->position, &playerBoundingBox));
+	SDL_Renderer* renderer;
+	// Draw with the rasterizer rather than SDL_RenderGeometry(). NULL to use SDL
+	SoftwareRenderer* software;
+	// What the queued quads are drawn with
+	SDL_Texture* texture;
+	SDL_BlendMode blendMode;
+	float inverseTextureWidth;
+	float inverseTextureHeight;
+
+	int numQuads;
+	SDL_Vertex vertices[SPRITE_BATCH_MAX_QUADS * 4];
+	// Every quad is the same two triangles, so these are filled in once
+	int indices[SPRITE_BATCH_MAX_QUADS * 6];
+
+	// Counted during the frame, and kept from the last one for the debug UI
+	int numSubmissions;
+	int numQuadsSubmitted;
+	int lastFrameNumSubmissions;
+	int lastFrameNumQuads;
+} SpriteBatch;
+
+static void spriteBatchInitialize(SpriteBatch* batch, SDL_Renderer* renderer)
+{
+	memset(batch, 0, sizeof(SpriteBatch));
+	batch->renderer = renderer;
+	for (int quad = 0; quad < SPRITE_BATCH_MAX_QUADS; ++quad)
+	{
+		int* indices = &batch->indices[quad * 6];
+		int firstVertex = quad * 4;
+		indices[0] = firstVertex;
+		indices[1] = firstVertex + 1;
+		indices[2] = firstVertex + 2;
+		indices[3] = firstVertex;
+		indices[4] = firstVertex + 2;
+		indices[5] = firstVertex + 3;
+	}
 }
 
-// Collision Detection
-IVec2 TileCoordinateHit(RigidBody* gridPos, GridSpace* gridSheet, RigidBody* objPos)
+static void spriteBatchFlush(SpriteBatch* batch)
 {
-	assert(objHittingGrid(gridPos, gridSheet, objPos));
-
-	float objX = objPos->position.x;
-	float objY = objPos->position.y;
-	float gridX = gridPos->position.x;
-	float gridY = gridPos->position.y;
+	if (!batch->numQuads)
+		return;
+	if (batch->software)
+		softwareRendererFlush(batch->software);
+	else
+	{
+		SDL_SetTextureBlendMode(batch->texture, batch->blendMode);
+		SDL_RenderGeometry(batch->renderer, batch->texture, batch->vertices, batch->numQuads * 4,
+		                   batch->indices, batch->numQuads * 6);
+	}
+	++batch->numSubmissions;
+	batch->numQuadsSubmitted += batch->numQuads;
+	batch->numQuads = 0;
+}
 
-	float distToTop = abs(gridY - objY);
-	float distToBottom = abs(gridY + gridSheet->height * c_tileSize - objY);
-	float distToLeft = abs(gridX - objX);
-	float distToRight = abs(gridX + gridSheet->width * c_tileSize - objX);
-	int tileX;
-	int tileY;
-	if (distToTop < distToBottom && distToTop < distToLeft && distToTop < distToRight)
+// A NULL source uses the whole texture
+static void spriteBatchAddQuad(SpriteBatch* batch, SDL_Texture* texture, SDL_BlendMode blendMode,
+                               const SDL_Rect* source, const SDL_Rect* destination,
+                               SDL_Color color)
+{
+	if (batch->software)
 	{
-		tileX = (int)(objX - gridX) / c_tileSize;
-		tileY = 0;
-		assert(tileX < gridSheet->width);
-		assert(tileY < gridSheet->height);
+		const RasterImage* image = softwareRendererFindImage(batch->software, texture);
+		if (image)
+		{
+			// The rasterizer only draws sprites as they are
+			SDL_Rect wholeImage = {0, 0, image->width, image->height};
+			if (!source)
+				source = &wholeImage;
+			rasterizerAddSprite(&batch->software->rasterizer, image, destination->x,
+			                    destination->y, destination->w, destination->h, source->x,
+			                    source->y, source->w, source->h);
+			++batch->numQuads;
+			return;
+		}
+		// Let SDL draw it, after everything queued before it
+		spriteBatchFlush(batch);
+		SDL_SetTextureBlendMode(texture, blendMode);
+		SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+		SDL_SetTextureAlphaMod(texture, color.a);
+		SDL_RenderCopy(batch->renderer, texture, source, destination);
+		++batch->numSubmissions;
+		++batch->numQuadsSubmitted;
+		return;
 	}
-	else if (distToBottom < distToTop && distToBottom < distToLeft && distToBottom < distToRight)
+
+	if (texture != batch->texture || blendMode != batch->blendMode)
 	{
-		tileX = (int)(objX - gridX) / c_tileSize;
-		tileY = gridSheet->height - 1;
-		assert(tileX < gridSheet->width);
-		assert(tileY < gridSheet->height);
+		spriteBatchFlush(batch);
+		int textureWidth = 1;
+		int textureHeight = 1;
+		SDL_QueryTexture(texture, NULL, NULL, &textureWidth, &textureHeight);
+		batch->texture = texture;
+		batch->blendMode = blendMode;
+		batch->inverseTextureWidth = 1.f / textureWidth;
+		batch->inverseTextureHeight = 1.f / textureHeight;
 	}
-	else if (distToLeft < distToTop && distToLeft < distToBottom && distToLeft < distToRight)
+	if (batch->numQuads == SPRITE_BATCH_MAX_QUADS)
+		spriteBatchFlush(batch);
+
+	float left = 0.f;
+	float top = 0.f;
+	float right = 1.f;
+	float bottom = 1.f;
+	if (source)
 	{
-		tileX = 0;
-		tileY = (int)(objY - gridPos->position.y) / c_tileSize;
-		assert(tileX < gridSheet->width);
-		assert(tileY < gridSheet->height);
+		left = source->x * batch->inverseTextureWidth;
+		top = source->y * batch->inverseTextureHeight;
+		right = (source->x + source->w) * batch->inverseTextureWidth;
+		bottom = (source->y + source->h) * batch->inverseTextureHeight;
 	}
-	else
-	{  // must be hitting the right side
-		tileX = gridSheet->width - 1;
-		tileY = (int)(objY - gridPos->position.y) / c_tileSize;
-		assert(tileX < gridSheet->width);
-		assert(tileY < gridSheet->height);
+	float x = (float)destination->x;
+	float y = (float)destination->y;
+	float w = (float)destination->w;
+	float h = (float)destination->h;
+	SDL_Vertex* vertices = &batch->vertices[batch->numQuads * 4];
+	vertices[0] = (SDL_Vertex){{x, y}, color, {left, top}};
+	vertices[1] = (SDL_Vertex){{x + w, y}, color, {right, top}};
+	vertices[2] = (SDL_Vertex){{x + w, y + h}, color, {right, bottom}};
+	vertices[3] = (SDL_Vertex){{x, y + h}, color, {left, bottom}};
+	++batch->numQuads;
+}
+
+// A quad of solid color, drawn from a white patch of texture
+static void spriteBatchAddFill(SpriteBatch* batch, SDL_Texture* texture, const SDL_Rect* white,
+                               const SDL_Rect* destination, SDL_Color color)
+{
+	if (!batch->software)
+	{
+		spriteBatchAddQuad(batch, texture, SDL_BLENDMODE_BLEND, white, destination, color);
+		return;
 	}
-	IVec2 result = {tileX, tileY};
-	return result;
+	rasterizerAddFill(&batch->software->rasterizer, destination->x, destination->y,
+	                  destination->w, destination->h,
+	                  ((Uint32)color.a << 24) | ((Uint32)color.r << 16) | ((Uint32)color.g << 8) |
+	                      color.b);
+	++batch->numQuads;
 }
 
-float Magnitude(Vec2* vec)
+// Flushes, then presents the frame
+static void spriteBatchPresent(SpriteBatch* batch)
 {
-	return sqrt(vec->x * vec->x + vec->y * vec->y);
+	spriteBatchFlush(batch);
+	SDL_RenderPresent(batch->renderer);
+	if (batch->software)
+		softwareRendererFitOutput(batch->software);
+	batch->lastFrameNumSubmissions = batch->numSubmissions;
+	batch->lastFrameNumQuads = batch->numQuadsSubmitted;
+	batch->numSubmissions = 0;
+	batch->numQuadsSubmitted = 0;
 }
 
-void UpdatePhysics(RigidBody* object, float drag, float dt)
+// Engines have two more sprites in the columns to the right of theirs
+typedef enum TileVariant
+{
+	TileVariant_Normal,
+	TileVariant_EngineFiring,
+	TileVariant_EngineTrail,
+	NUM_TILE_VARIANTS,
+} TileVariant;
+
+typedef struct TileSheet
 {
-	// update via implicit euler integration
-	object->velocity.x /= (1.f + (dt * drag));
-	object->velocity.y /= (1.f + (dt * drag));
+	// Indexed by tile or object type. Every sprite is already transformed, so it is drawn with a
+	// plain copy. w is 0 for types the sheet has nothing for
+	SDL_Rect sprites[256][NUM_TILE_VARIANTS];
 
-	object->position.x += object->velocity.x * dt;
-	object->position.y += object->velocity.y * dt;
+	// The original sheet, font included, with the transformed sprites packed below it
+	SDL_Texture* texture;
+	// A patch of solid white in texture, so filled rectangles batch along with the sprites
+	SDL_Rect white;
 
-	if (object->position.x > c_spaceSize)
-		object->position.x = 0;
+	// Where everything drawn from the sheet waits to be submitted
+	SpriteBatch* batch;
+	// Text and panels already drawn into textures. NULL to always draw them glyph by glyph
+	struct TextCache* textCache;
+} TileSheet;
 
-	if (object->position.x < 0)
-		object->position.x = c_spaceSize;
+static const SDL_Color c_spriteColor = {255, 255, 255, 255};
+
+static void batchSprite(TileSheet* tileSheet, const SDL_Rect* source, const SDL_Rect* destination)
+{
+	spriteBatchAddQuad(tileSheet->batch, tileSheet->texture, SDL_BLENDMODE_BLEND, source,
+	                   destination, c_spriteColor);
+}
 
-	if (object->position.y > c_spaceSize)
-		object->position.y = 0;
+static void batchFillRect(TileSheet* tileSheet, const SDL_Rect* destination, SDL_Color color)
+{
+	spriteBatchAddFill(tileSheet->batch, tileSheet->texture, &tileSheet->white, destination,
+	                   color);
+}
 
-	if (object->position.y < 0)
-		object->position.y = c_spaceSize;
+// One pixel thick, inside the rectangle like SDL_RenderDrawRect()
+static void batchDrawRect(TileSheet* tileSheet, const SDL_Rect* rectangle, SDL_Color color)
+{
+	SDL_Rect edges[] = {
+	    {rectangle->x, rectangle->y, rectangle->w, 1},
+	    {rectangle->x, rectangle->y + rectangle->h - 1, rectangle->w, 1},
+	    {rectangle->x, rectangle->y + 1, 1, rectangle->h - 2},
+	    {rectangle->x + rectangle->w - 1, rectangle->y + 1, 1, rectangle->h - 2}};
+	for (int i = 0; i < ARRAY_SIZE(edges); ++i)
+		batchFillRect(tileSheet, &edges[i], color);
 }
 
-RigidBody SpawnPlayerPhys()
+// Returns NULL if the sheet has nothing for this type
+static const SDL_Rect* tileSheetSprite(const TileSheet* tileSheet, char type, TileVariant variant)
 {
-	RigidBody player;
-	player.position.x = c_spaceSize / 2;
-	player.position.y = c_spaceSize / 2;
-	player.velocity.x = 0.f;
-	player.velocity.y = 0.f;
-	return player;
+	const SDL_Rect* sprite = &tileSheet->sprites[(unsigned char)type][variant];
+	return sprite->w ? sprite : NULL;
 }
 
-void damageShip(GridSpace* gridSpace)
+// Copies a tile from sheet to atlas the way SDL_RenderCopyEx would draw it with this transform.
+// Both surfaces must be 32 bits per pixel
+static void copyTransformedTile(SDL_Surface* sheet, int sourceX, int sourceY, SDL_Surface* atlas,
+                                int destinationX, int destinationY, TextureTransform transform)
 {
-	for (int cellY = 0; cellY < gridSpace->height; ++cellY)
+	const int last = c_tileSize - 1;
+	for (int y = 0; y < c_tileSize; ++y)
 	{
-		for (int cellX = 0; cellX < gridSpace->width; ++cellX)
+		Uint32* destinationRow =
+		    (Uint32*)((Uint8*)atlas->pixels + ((destinationY + y) * atlas->pitch)) + destinationX;
+		for (int x = 0; x < c_tileSize; ++x)
 		{
-			GridCell* currentCell = &GridCellAt(gridSpace, cellX, cellY);
-			if (rand() % c_perCellDamageRoll == 1)
+			int fromX = x;
+			int fromY = y;
+			switch (transform)
 			{
-				memset(currentCell, 0, sizeof(GridCell));
+				case TextureTransform_FlipHorizontal:
+					fromX = last - x;
+					break;
+				case TextureTransform_FlipVertical:
+					fromY = last - y;
+					break;
+				case TextureTransform_Clockwise90:
+					fromX = y;
+					fromY = last - x;
+					break;
+				case TextureTransform_CounterClockwise90:
+					fromX = last - y;
+					fromY = x;
+					break;
+				default:
+					break;
 			}
+			const Uint32* sourceRow =
+			    (const Uint32*)((const Uint8*)sheet->pixels + ((sourceY + fromY) * sheet->pitch));
+			destinationRow[x] = sourceRow[sourceX + fromX];
 		}
 	}
 }
 
-//
-// Objects
-//
-
-typedef struct Object
+// Turns the loaded sheet into tileSheet's texture. Everything c_tileSheetCells draws transformed
+// is baked into new space below the sheet, so each sprite is a plain copy from one texture and
+// finding it is a single lookup
+// software is given a copy of the atlas too, unless it's NULL
+static bool createTileSheet(SDL_Renderer* renderer, SoftwareRenderer* software,
+                            SDL_Surface* sheetSurface, TileSheet* tileSheet)
 {
-	char type;
-	bool inFactory;
-	unsigned char tileX;
-	unsigned char tileY;
-	// Once this reaches a certain threshold, transition
-	unsigned char transition;
-	RigidBody body;
-} Object;
+	memset(tileSheet, 0, sizeof(TileSheet));
+	SDL_Surface* sheet = SDL_ConvertSurfaceFormat(sheetSurface, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (!sheet)
+		return false;
+
+	// Plus one for the white patch
+	int numBakedSprites = 1;
+	for (int i = 0; i < ARRAY_SIZE(c_tileSheetCells); ++i)
+	{
+		if (c_tileSheetCells[i].transform != TextureTransform_None)
+			numBakedSprites += isEngineTile(c_tileSheetCells[i].key) ? NUM_TILE_VARIANTS : 1;
+	}
+	int spritesPerRow = sheet->w / c_tileSize;
+	int atlasHeight =
+	    sheet->h + (((numBakedSprites + spritesPerRow - 1) / spritesPerRow) * c_tileSize);
+	SDL_Surface* atlas =
+	    SDL_CreateRGBSurfaceWithFormat(0, sheet->w, atlasHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+	if (!atlas)
+	{
+		SDL_FreeSurface(sheet);
+		return false;
+	}
+	// Copy the sheet as is, rather than blending it onto the empty atlas
+	SDL_SetSurfaceBlendMode(sheet, SDL_BLENDMODE_NONE);
+	SDL_BlitSurface(sheet, NULL, atlas, NULL);
 
-Object objects[1024] = {0};
-const int c_numObjectsToCreate = 400;
+	int nextBakedSprite = 0;
+	for (int i = 0; i < ARRAY_SIZE(c_tileSheetCells); ++i)
+	{
+		const CharacterSheetCellAssociation* cell = &c_tileSheetCells[i];
+		int numVariants = isEngineTile(cell->key) ? NUM_TILE_VARIANTS : 1;
+		for (int variant = 0; variant < numVariants; ++variant)
+		{
+			SDL_Rect* sprite = &tileSheet->sprites[(unsigned char)cell->key][variant];
+			sprite->x = (cell->column + variant) * c_tileSize;
+			sprite->y = cell->row * c_tileSize;
+			sprite->w = c_tileSize;
+			sprite->h = c_tileSize;
+			if (cell->transform == TextureTransform_None)
+				continue;
 
-void renderObjects(SDL_Renderer* renderer, TileSheet* tileSheet, Camera* camera,
-                   Vec2 extrapolatedPlayerPosition, float extrapolateTime)
+			int bakedX = (nextBakedSprite % spritesPerRow) * c_tileSize;
+			int bakedY = sheet->h + ((nextBakedSprite / spritesPerRow) * c_tileSize);
+			++nextBakedSprite;
+			copyTransformedTile(sheet, sprite->x, sprite->y, atlas, bakedX, bakedY,
+			                    cell->transform);
+			sprite->x = bakedX;
+			sprite->y = bakedY;
+		}
+	}
+
+	// Filling a whole tile means filtering never blends in a neighbor; only its middle is used
+	SDL_Rect whiteTile = {(nextBakedSprite % spritesPerRow) * c_tileSize,
+	                      sheet->h + ((nextBakedSprite / spritesPerRow) * c_tileSize), c_tileSize,
+	                      c_tileSize};
+	SDL_FillRect(atlas, &whiteTile, SDL_MapRGB(atlas->format, 255, 255, 255));
+	tileSheet->white.x = whiteTile.x + (c_tileSize / 4);
+	tileSheet->white.y = whiteTile.y + (c_tileSize / 4);
+	tileSheet->white.w = c_tileSize / 2;
+	tileSheet->white.h = c_tileSize / 2;
+
+	// Use pure black as our chroma key
+	SDL_SetColorKey(atlas, SDL_TRUE, SDL_MapRGB(atlas->format, 0, 0, 0));
+	tileSheet->texture = SDL_CreateTextureFromSurface(renderer, atlas);
+	bool addedImage = !software || !tileSheet->texture ||
+	                  softwareRendererAddImage(software, tileSheet->texture, atlas);
+	SDL_FreeSurface(atlas);
+	SDL_FreeSurface(sheet);
+	return tileSheet->texture != NULL && addedImage;
+}
+
+// Engines swap sprites and draw a trail while firing, and always show how much fuel they have
+static void renderEngineTile(SDL_Renderer* renderer, TileSheet* tileSheet, const GridCell* cell,
+                             int screenX, int screenY)
 {
-	for (int i = 0; i < ARRAY_SIZE(objects); ++i)
+	char tileToFind = cell->type;
+	const SDL_Rect* sourceRectangle = tileSheetSprite(tileSheet, tileToFind, TileVariant_Normal);
+	if (!sourceRectangle)
+		return;
+
+	// if this is an engine tile, and its firing, swap the off sprite for the on sprite, and draw
+	// the trail
+	if (cell->engineCell.firing)
 	{
-		const Object* currentObject = &objects[i];
-		if (!currentObject->type)
-			continue;
+		sourceRectangle = tileSheetSprite(tileSheet, tileToFind, TileVariant_EngineFiring);
+		// compute the trail sprite location
+		int trailX = screenX;
+		int trailY = screenY;
+		if (tileToFind == 'u')
+			trailY += c_tileSize;
+		if (tileToFind == 'd')
+			trailY -= c_tileSize;
+		if (tileToFind == 'l')
+			trailX -= c_tileSize;
+		if (tileToFind == 'r')
+			trailX += c_tileSize;
+		SDL_Rect destinationRectangle = {trailX, trailY, c_tileSize, c_tileSize};
+		batchSprite(tileSheet, tileSheetSprite(tileSheet, tileToFind, TileVariant_EngineTrail),
+		            &destinationRectangle);
+	}
+	SDL_Rect destinationRectangle = {screenX, screenY, c_tileSize, c_tileSize};
+	batchSprite(tileSheet, sourceRectangle, &destinationRectangle);
+
+	// always draw the fuel display sprite for engines
+	const int c_meterShortLength = 5;
+	const int c_meterLongLength = 30;
+	int meterPosX = screenX;
+	int meterPosY = screenY;
+	int meterWidth;
+	int meterHeight;
+	if (tileToFind == 'u')
+	{
+		meterWidth = c_meterLongLength;
+		meterHeight = c_meterShortLength;
+	}
+	if (tileToFind == 'd')
+	{
+		meterPosY += c_tileSize - 5;
+		meterWidth = c_meterLongLength;
+		meterHeight = c_meterShortLength;
+	}
+	if (tileToFind == 'l')
+	{
+		meterPosX = screenX + c_tileSize - 5;
+		meterWidth = c_meterShortLength;
+		meterHeight = c_meterLongLength;
+	}
+	if (tileToFind == 'r')
+	{
+		meterWidth = c_meterShortLength;
+		meterHeight = c_meterLongLength;
+	}
 
-		for (int tileAssociation = 0; tileAssociation < ARRAY_SIZE(tileSheet->associations);
-		     ++tileAssociation)
-		{
-			CharacterSheetCellAssociation* association = &tileSheet->associations[tileAssociation];
-			if (currentObject->type != association->key)
-				continue;
+	SDL_Rect fuelMeterRect = {meterPosX, meterPosY, meterWidth + 2, meterHeight + 2};
+	SDL_Color fuelMeterColor = {102, 138, 158, 255};
+	batchDrawRect(tileSheet, &fuelMeterRect, fuelMeterColor);
+	float fuelPercentage = (float)(cell->engineCell.fuel) / c_maxFuel;
+	if (meterWidth > meterHeight)
+	{
+		meterWidth *= fuelPercentage;
+	}
+	else
+	{
+		meterHeight *= fuelPercentage;
+	}
 
-			Vec2 extrapolatedObjectPosition = currentObject->body.position;
-			if (!currentObject->inFactory)
-			{
-				extrapolatedObjectPosition.x = currentObject->body.position.x +
-				                               (currentObject->body.velocity.x * extrapolateTime) -
-				                               c_tileSize / 2;
+	SDL_Rect fuelRect = {meterPosX + 1, meterPosY + 1, meterWidth, meterHeight};
+	SDL_Color fuelColor = {209, 193, 163, 255};
+	batchFillRect(tileSheet, &fuelRect, fuelColor);
+}
 
-				extrapolatedObjectPosition.y = currentObject->body.position.y +
-				                               (currentObject->body.velocity.y * extrapolateTime) -
-				                               c_tileSize / 2;
-			}
-			else
+// Cells [first, end) on each axis. Other than engines, which are always drawn, only if
+// includeNonEngines
+static void renderGridCells(SDL_Renderer* renderer, TileSheet* tileSheet, GridSpace* gridSpace,
+                            int originX, int originY, int cameraX, int cameraY, int firstCellX,
+                            int firstCellY, int endCellX, int endCellY, bool includeNonEngines)
+{
+	for (int cellY = firstCellY; cellY < endCellY; ++cellY)
+	{
+		for (int cellX = firstCellX; cellX < endCellX; ++cellX)
+		{
+			const GridCell* cell = &GridCellAt(gridSpace, cellX, cellY);
+			int screenX = originX + (cellX * c_tileSize) - cameraX;
+			int screenY = originY + (cellY * c_tileSize) - cameraY;
+			if (isEngineTile(cell->type))
 			{
-				extrapolatedObjectPosition.x =
-				    (currentObject->tileX * c_tileSize) + extrapolatedPlayerPosition.x;
-				extrapolatedObjectPosition.y =
-				    (currentObject->tileY * c_tileSize) + extrapolatedPlayerPosition.y;
+				renderEngineTile(renderer, tileSheet, cell, screenX, screenY);
+				continue;
 			}
+			if (!includeNonEngines)
+				continue;
 
-			int textureX = association->column * c_tileSize;
-			int textureY = association->row * c_tileSize;
-			int screenX = extrapolatedObjectPosition.x - camera->x;
-			int screenY = extrapolatedObjectPosition.y - camera->y;
-			SDL_Rect sourceRectangle = {textureX, textureY, c_tileSize, c_tileSize};
+			const SDL_Rect* sourceRectangle =
+			    tileSheetSprite(tileSheet, cell->type, TileVariant_Normal);
+			if (!sourceRectangle)
+				continue;
 			SDL_Rect destinationRectangle = {screenX, screenY, c_tileSize, c_tileSize};
-			SDL_RenderCopyEx(renderer, tileSheet->texture, &sourceRectangle, &destinationRectangle,
-			                 c_transformsToAngles[association->transform],
-			                 /*rotate about (default = center)*/ NULL,
-			                 c_transformsToSDLRenderFlips[association->transform]);
-			break;
+			batchSprite(tileSheet, sourceRectangle, &destinationRectangle);
 		}
 	}
 }
 
-int controlEnginesInDirection(GridSpace* gridSpace, char tileType, bool set)
+static void renderGridSpaceFromTileSheet(SDL_Renderer* renderer, TileSheet* tileSheet,
+                                         GridSpace* gridSpace, int originX, int originY,
+                                         int cameraX, int cameraY)
 {
-	assert(isEngineTile(tileType) &&
-	       "tile passed to controlEnginesInDirection was not an engine tile");
-	int count = 0;
-	for (int cellY = 0; cellY < gridSpace->height; ++cellY)
+	renderGridCells(renderer, tileSheet, gridSpace, originX, originY, cameraX, cameraY, 0, 0,
+	                gridSpace->width, gridSpace->height, true);
+}
+
+//
+// Culling
+//
+
+// Free objects bucketed by position, and objects in factories listed by their ship, so drawing
+// only visits what's near the camera. Built on the job threads when a snapshot is published
+#define OBJECT_BUCKET_SIZE 512
+// Enough to cover c_spaceSize
+#define NUM_OBJECT_BUCKETS_PER_AXIS 20
+
+typedef struct ObjectGrid
+{
+	SimulationState* simulation;
+	// bucketObjects[bucketStart[bucket]] to bucketObjects[bucketStart[bucket + 1] - 1]
+	unsigned short bucketStart[(NUM_OBJECT_BUCKETS_PER_AXIS * NUM_OBJECT_BUCKETS_PER_AXIS) + 1];
+	unsigned short bucketObjects[MAX_OBJECTS];
+	// The same for the objects inside each ship
+	unsigned short shipStart[MAX_SHIPS + 1];
+	unsigned short shipObjects[MAX_OBJECTS];
+	// Fastest free object along either axis. Objects are bucketed where they were at the tick, so
+	// lookups widen by how far one could have drifted since
+	float maxObjectSpeed;
+} ObjectGrid;
+
+// How many draws were submitted and how many were skipped for being off screen, this frame
+typedef struct CullStats
+{
+	unsigned int numDrawn;
+	unsigned int numCulled;
+} CullStats;
+
+static int objectBucketCoordinate(float worldCoordinate)
+{
+	int bucket = (int)worldCoordinate / OBJECT_BUCKET_SIZE;
+	if (bucket < 0)
+		return 0;
+	if (bucket >= NUM_OBJECT_BUCKETS_PER_AXIS)
+		return NUM_OBJECT_BUCKETS_PER_AXIS - 1;
+	return bucket;
+}
+
+static int objectBucket(const Object* object)
+{
+	return (objectBucketCoordinate(object->body.position.y) * NUM_OBJECT_BUCKETS_PER_AXIS) +
+	       objectBucketCoordinate(object->body.position.x);
+}
+
+// Counting sort, so objects stay in index order within each bucket and overlaps draw the same way
+// every frame
+static void prepareObjectGrid(void* userData, int begin, int end, int workerIndex)
+{
+	ObjectGrid* grid = (ObjectGrid*)userData;
+	SimulationState* simulation = grid->simulation;
+	memset(grid->bucketStart, 0, sizeof(grid->bucketStart));
+	memset(grid->shipStart, 0, sizeof(grid->shipStart));
+	grid->maxObjectSpeed = 0.f;
+	for (int i = 0; i < ARRAY_SIZE(simulation->objects); ++i)
 	{
-		for (int cellX = 0; cellX < gridSpace->width; ++cellX)
+		const Object* object = &simulation->objects[i];
+		if (!object->type)
+			continue;
+		if (object->inFactory)
 		{
-			GridCell* cell = &GridCellAt(gridSpace, cellX, cellY);
-			if (tileType == cell->type && cell->engineCell.fuel > 0)
-			{
-				cell->engineCell.firing = set;
-				count++;
-			}
+			++grid->shipStart[object->ship + 1];
+			continue;
 		}
+		++grid->bucketStart[objectBucket(object) + 1];
+		float speedX = fabsf(object->body.velocity.x);
+		float speedY = fabsf(object->body.velocity.y);
+		if (speedX > grid->maxObjectSpeed)
+			grid->maxObjectSpeed = speedX;
+		if (speedY > grid->maxObjectSpeed)
+			grid->maxObjectSpeed = speedY;
+	}
+	for (int i = 1; i < ARRAY_SIZE(grid->bucketStart); ++i)
+		grid->bucketStart[i] += grid->bucketStart[i - 1];
+	for (int i = 1; i < ARRAY_SIZE(grid->shipStart); ++i)
+		grid->shipStart[i] += grid->shipStart[i - 1];
+
+	// Fill each range from its end, walking backwards to keep index order
+	unsigned short bucketEnd[ARRAY_SIZE(grid->bucketStart)];
+	unsigned short shipEnd[ARRAY_SIZE(grid->shipStart)];
+	memcpy(bucketEnd, &grid->bucketStart[1], sizeof(bucketEnd) - sizeof(bucketEnd[0]));
+	memcpy(shipEnd, &grid->shipStart[1], sizeof(shipEnd) - sizeof(shipEnd[0]));
+	for (int i = ARRAY_SIZE(simulation->objects) - 1; i >= 0; --i)
+	{
+		const Object* object = &simulation->objects[i];
+		if (!object->type)
+			continue;
+		if (object->inFactory)
+			grid->shipObjects[--shipEnd[object->ship]] = (unsigned short)i;
+		else
+			grid->bucketObjects[--bucketEnd[objectBucket(object)]] = (unsigned short)i;
 	}
-	return count;
 }
 
-void updateEngineFuel(GridSpace* gridSpace, float deltaTime)
+// Fills in one stage, which only reads the simulation. Wait for the graph before using the grid or
+// changing the simulation
+static void setUpObjectGridStage(ObjectGrid* grid, SimulationState* simulation, JobStage* stage)
 {
-	for (int cellY = 0; cellY < gridSpace->height; ++cellY)
+	grid->simulation = simulation;
+	stage->name = "ObjectGrid";
+	stage->function = prepareObjectGrid;
+	stage->userData = grid;
+	stage->numItems = 1;
+}
+
+static bool isOnCamera(const Camera* camera, int x, int y, int width, int height)
+{
+	return x < camera->x + camera->w && x + width > camera->x && y < camera->y + camera->h &&
+	       y + height > camera->y;
+}
+
+static void renderObject(TileSheet* tileSheet, const Camera* camera, const Object* object,
+                         int x, int y, CullStats* stats)
+{
+	if (!isOnCamera(camera, x, y, c_tileSize, c_tileSize))
 	{
-		for (int cellX = 0; cellX < gridSpace->width; ++cellX)
+		++stats->numCulled;
+		return;
+	}
+	const SDL_Rect* sourceRectangle = tileSheetSprite(tileSheet, object->type, TileVariant_Normal);
+	if (!sourceRectangle)
+		return;
+	SDL_Rect destinationRectangle = {x - camera->x, y - camera->y, c_tileSize, c_tileSize};
+	batchSprite(tileSheet, sourceRectangle, &destinationRectangle);
+	++stats->numDrawn;
+}
+
+void renderObjects(SDL_Renderer* renderer, TileSheet* tileSheet, Camera* camera,
+                   SimulationState* simulation, const ObjectGrid* grid, float extrapolateTime,
+                   CullStats* stats)
+{
+	// Objects in factories move with their ship, so a ship off screen takes all of its with it
+	for (int shipIndex = 0; shipIndex < simulation->numShips; ++shipIndex)
+	{
+		int begin = grid->shipStart[shipIndex];
+		int end = grid->shipStart[shipIndex + 1];
+		if (begin == end)
+			continue;
+		Ship* ship = &simulation->ships[shipIndex];
+		RigidBody* shipBody = &ship->body;
+		int shipX = shipBody->position.x + (shipBody->velocity.x * extrapolateTime);
+		int shipY = shipBody->position.y + (shipBody->velocity.y * extrapolateTime);
+		if (!isOnCamera(camera, shipX, shipY, ship->width * c_tileSize, ship->height * c_tileSize))
 		{
-			GridCell* cell = &GridCellAt(gridSpace, cellX, cellY);
-			if (isEngineTile(cell->type) && cell->engineCell.firing)
-			{
-				cell->engineCell.fuel -= c_fuelConsumptionRate * deltaTime;
+			stats->numCulled += end - begin;
+			continue;
+		}
+		for (int i = begin; i < end; ++i)
+		{
+			const Object* object = &simulation->objects[grid->shipObjects[i]];
+			renderObject(tileSheet, camera, object, (object->tileX * c_tileSize) + shipX,
+			             (object->tileY * c_tileSize) + shipY, stats);
+		}
+	}
 
-				if (cell->engineCell.fuel <= 0.f)
-				{
-					cell->engineCell.fuel = 0.f;
-					cell->engineCell.firing = false;
-				}
-			}
+	// Free objects are drawn centered on where they are headed
+	int margin = (int)(grid->maxObjectSpeed * extrapolateTime) + c_tileSize;
+	int minBucketX = objectBucketCoordinate(camera->x - margin);
+	int maxBucketX = objectBucketCoordinate(camera->x + camera->w + margin);
+	int minBucketY = objectBucketCoordinate(camera->y - margin);
+	int maxBucketY = objectBucketCoordinate(camera->y + camera->h + margin);
+	int numFreeObjects = grid->bucketStart[ARRAY_SIZE(grid->bucketStart) - 1];
+	unsigned int numDrawnBefore = stats->numDrawn;
+	unsigned int numCulledBefore = stats->numCulled;
+	for (int bucketY = minBucketY; bucketY <= maxBucketY; ++bucketY)
+	{
+		// A row's buckets are next to each other in bucketObjects, so it's one range
+		int firstBucket = (bucketY * NUM_OBJECT_BUCKETS_PER_AXIS) + minBucketX;
+		int lastBucket = (bucketY * NUM_OBJECT_BUCKETS_PER_AXIS) + maxBucketX;
+		for (int i = grid->bucketStart[firstBucket]; i < grid->bucketStart[lastBucket + 1]; ++i)
+		{
+			const Object* object = &simulation->objects[grid->bucketObjects[i]];
+			int x = object->body.position.x + (object->body.velocity.x * extrapolateTime) -
+			        c_tileSize / 2;
+			int y = object->body.position.y + (object->body.velocity.y * extrapolateTime) -
+			        c_tileSize / 2;
+			renderObject(tileSheet, camera, object, x, y, stats);
 		}
 	}
+	// Everything in the buckets which weren't looked at
+	stats->numCulled = numCulledBefore + (numFreeObjects - (stats->numDrawn - numDrawnBefore));
 }
 
-typedef struct TransitionDelta
+//
+// Ship layers
+//
+
+// A ship's cells, except for its engines, drawn once into a texture so the whole ship is a single
+// copy each frame. Engines change whenever they fire or burn fuel, so they are drawn over it. The
+// texture is only redrawn when the simulation changes the ship's layout
+typedef struct ShipLayer
 {
-	char tile;
-	char x;
-	char y;
-} TransitionDelta;
+	SDL_Texture* texture;
+	unsigned char width;
+	unsigned char height;
+	// The Ship::layoutHash the texture was drawn from
+	uint64_t layoutHash;
+	// The texture's contents were lost or never drawn
+	bool needsRedraw;
+} ShipLayer;
 
-static const TransitionDelta c_transitions[] = {{'R', -1, 0}, {'U', 0, 1},  {'D', 0, -1},
-                                                {'L', 1, 0},  {'<', -1, 0}, {'V', 0, 1},
-                                                {'A', 0, -1}, {'>', 1, 0}};
-typedef struct TileDelta
+typedef struct ShipLayerCache
 {
-	char x;
-	char y;
-	char conveyor;
-} TileDelta;
-// Useful to check all cardinal directions of a tile
-static const TileDelta c_deltas[] = {{-1, 0, '<'}, {1, 0, '>'}, {0, -1, 'A'}, {0, 1, 'V'}};
+	ShipLayer layers[MAX_SHIPS];
+} ShipLayerCache;
 
-// Pick a random outgoing conveyor and move the object onto it
-static void conveyorAway(GridSpace* gridSpace, Object* objectToConveyor)
+static void destroyShipLayers(ShipLayerCache* cache)
 {
-	for (int directionIndex = 0; directionIndex < ARRAY_SIZE(c_deltas); ++directionIndex)
+	for (int i = 0; i < MAX_SHIPS; ++i)
 	{
-		char directionCellX = objectToConveyor->tileX + c_deltas[directionIndex].x;
-		char directionCellY = objectToConveyor->tileY + c_deltas[directionIndex].y;
+		if (cache->layers[i].texture)
+			SDL_DestroyTexture(cache->layers[i].texture);
+	}
+	memset(cache, 0, sizeof(ShipLayerCache));
+}
 
-		// Don't allow out of bounds
-		if (directionCellX < 0 || directionCellX >= gridSpace->width || directionCellY < 0 ||
-		    directionCellY >= gridSpace->height)
-			return;
+// E.g. when the renderer reports that render targets were reset
+static void invalidateShipLayers(ShipLayerCache* cache)
+{
+	for (int i = 0; i < MAX_SHIPS; ++i)
+		cache->layers[i].needsRedraw = true;
+}
+
+// Brings the texture up to date with the ship. Returns false if there's no texture to draw
+static bool updateShipLayer(SDL_Renderer* renderer, TileSheet* tileSheet, ShipLayer* layer,
+                            GridSpace* gridSpace, uint64_t layoutHash)
+{
+	// A quick load could change the ship's size
+	if (layer->texture && (layer->width != gridSpace->width || layer->height != gridSpace->height))
+	{
+		SDL_DestroyTexture(layer->texture);
+		layer->texture = NULL;
+	}
+	if (!layer->texture)
+	{
+		layer->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+		                                   SDL_TEXTUREACCESS_TARGET, gridSpace->width * c_tileSize,
+		                                   gridSpace->height * c_tileSize);
+		if (!layer->texture)
+			return false;
+		SDL_SetTextureBlendMode(layer->texture, SDL_BLENDMODE_BLEND);
+		layer->width = gridSpace->width;
+		layer->height = gridSpace->height;
+		layer->needsRedraw = true;
+	}
+	if (!layer->needsRedraw && layer->layoutHash == layoutHash)
+		return true;
 
-		GridCell* currentCell = &GridCellAt(gridSpace, directionCellX, directionCellY);
-		GridCell* cellTo = &GridCellAt(gridSpace, directionCellX, directionCellY);
-		// TODO: Hack to "randomly" distribute objects in directions
-		if (cellTo->type == c_deltas[directionIndex].conveyor && rand() % 4 == 0)
+	// Whatever is queued belongs on the screen
+	spriteBatchFlush(tileSheet->batch);
+	SDL_SetRenderTarget(renderer, layer->texture);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+	SDL_RenderClear(renderer);
+	for (int cellY = 0; cellY < gridSpace->height; ++cellY)
+	{
+		for (int cellX = 0; cellX < gridSpace->width; ++cellX)
 		{
-			objectToConveyor->tileX = directionCellX;
-			objectToConveyor->tileY = directionCellY;
-			objectToConveyor->transition = 0;
-			break;
+			unsigned char type = GridCellAt(gridSpace, cellX, cellY).type;
+			const SDL_Rect* sourceRectangle = tileSheetSprite(tileSheet, type, TileVariant_Normal);
+			if (isEngineTile(type) || !sourceRectangle)
+				continue;
+			SDL_Rect destinationRectangle = {cellX * c_tileSize, cellY * c_tileSize, c_tileSize,
+			                                 c_tileSize};
+			SDL_RenderCopy(renderer, tileSheet->texture, sourceRectangle, &destinationRectangle);
 		}
 	}
+	SDL_SetRenderTarget(renderer, NULL);
+	layer->layoutHash = layoutHash;
+	layer->needsRedraw = false;
+	return true;
+}
+
+// Clamps the cells on screen along one axis to [0, numCells). One extra cell either side, because
+// engine trails are drawn in the cell next to their engine
+static void cellsOnCamera(int origin, int cameraStart, int cameraSize, int numCells, int* firstCell,
+                          int* endCell)
+{
+	*firstCell = ((cameraStart - origin) / c_tileSize) - 1;
+	*endCell = ((cameraStart + cameraSize - origin) / c_tileSize) + 2;
+	if (*firstCell < 0)
+		*firstCell = 0;
+	if (*endCell > numCells)
+		*endCell = numCells;
 }
 
-static bool isIntake(char cellType)
+static void renderShip(SDL_Renderer* renderer, TileSheet* tileSheet, ShipLayer* layer,
+                       GridSpace* gridSpace, uint64_t layoutHash, int originX, int originY,
+                       const Camera* camera, CullStats* stats)
 {
-	static const char intakes[] = {'L', 'R', 'U', 'D'};
-	for (int i = 0; i < ARRAY_SIZE(intakes); ++i)
+	int width = gridSpace->width * c_tileSize;
+	int height = gridSpace->height * c_tileSize;
+	if (!isOnCamera(camera, originX - c_tileSize, originY - c_tileSize, width + (2 * c_tileSize),
+	                height + (2 * c_tileSize)))
 	{
-		if (intakes[i] == cellType)
-			return true;
+		++stats->numCulled;
+		return;
 	}
-	return false;
+	++stats->numDrawn;
+
+	int firstCellX, endCellX, firstCellY, endCellY;
+	cellsOnCamera(originX, camera->x, camera->w, gridSpace->width, &firstCellX, &endCellX);
+	cellsOnCamera(originY, camera->y, camera->h, gridSpace->height, &firstCellY, &endCellY);
+
+	// Without render targets, fall back to drawing every cell
+	bool hasLayer = layer && updateShipLayer(renderer, tileSheet, layer, gridSpace, layoutHash);
+	if (hasLayer)
+	{
+		SDL_Rect destinationRectangle = {originX - camera->x, originY - camera->y, width, height};
+		spriteBatchAddQuad(tileSheet->batch, layer->texture, SDL_BLENDMODE_BLEND, NULL,
+		                   &destinationRectangle, c_spriteColor);
+	}
+	renderGridCells(renderer, tileSheet, gridSpace, originX, originY, camera->x, camera->y,
+	                firstCellX, firstCellY, endCellX, endCellY, !hasLayer);
 }
 
-void doFactory(GridSpace* gridSpace, float deltaTime)
+typedef struct StarField
 {
-	for (int cellY = 0; cellY < gridSpace->height; ++cellY)
+	SDL_FRect stars[128];
+	SDL_FRect dynstars[128];
+	// The window size the stars were scattered for
+	int sizeX;
+	int sizeY;
+} StarField;
+
+static void renderStarField(SDL_Renderer* renderer, StarField* starField, Camera* camera,
+                            RandomState* random, int windowWidth, int windowHeight)
+{
+	SDL_FRect* stars = starField->stars;
+	SDL_FRect* dynstars = starField->dynstars;
+	if (starField->sizeX != windowWidth || starField->sizeY != windowHeight)
 	{
-		for (int cellX = 0; cellX < gridSpace->width; ++cellX)
+		starField->sizeX = windowWidth;
+		starField->sizeY = windowHeight;
+		for (int i = 0; i < ARRAY_SIZE(starField->stars); ++i)
 		{
-			GridCell* cell = &GridCellAt(gridSpace, cellX, cellY);
-			switch (cell->type)
-			{
-				// Destroy anything that touches empty spaces. Usually only from ship damage
-				case 0:
-				{
-					for (int i = 0; i < ARRAY_SIZE(objects); ++i)
-					{
-						Object* currentObject = &objects[i];
-						if (!currentObject->type || currentObject->tileX != cellX ||
-						    currentObject->tileY != cellY || !currentObject->inFactory)
-							continue;
-						currentObject->type = 0;
-					}
-					break;
-				}
-
-				case 'L':
-				case 'R':
-				case 'U':
-				case 'D':
-				case '<':
-				case 'V':
-				case 'A':
-				case '>':
-				{
-					for (int i = 0; i < ARRAY_SIZE(objects); ++i)
-					{
-						Object* currentObject = &objects[i];
-						if (!currentObject->type || currentObject->tileX != cellX ||
-						    currentObject->tileY != cellY || !currentObject->inFactory)
-							continue;
-
-						// TODO This isn't very safe because if <1, the object will never transition
-						currentObject->transition += c_conveyorTransitionPerSecond * deltaTime;
-						if (currentObject->transition > c_transitionThreshold)
-						{
-							for (int transitionIndex = 0;
-							     transitionIndex < ARRAY_SIZE(c_transitions); ++transitionIndex)
-							{
-								if (c_transitions[transitionIndex].tile != cell->type)
-									continue;
-								currentObject->tileX += c_transitions[transitionIndex].x;
-								currentObject->tileY += c_transitions[transitionIndex].y;
-								currentObject->transition = 0;
-							}
-						}
-					}
-					break;
-				}
-					// Furnaces always output to cells away from them
-				case 'f':
-				{
-					for (int i = 0; i < ARRAY_SIZE(objects); ++i)
-					{
-						Object* currentObject = &objects[i];
-						if (!currentObject->type || currentObject->tileX != cellX ||
-						    currentObject->tileY != cellY || !currentObject->inFactory)
-							continue;
-
-						// Move objects along which aren't unrefined the same speed as a conveyor
-						if (currentObject->type == 'a')
-							currentObject->transition += c_furnaceTransitionPerSecond * deltaTime;
-						else
-							currentObject->transition += c_conveyorTransitionPerSecond * deltaTime;
-						if (currentObject->transition > c_transitionThreshold)
-						{
-							if (currentObject->type == 'a')
-								currentObject->type = 'g';
-
-							conveyorAway(gridSpace, currentObject);
-						}
-					}
-					break;
-				}
-				case 'l':
-				case 'r':
-				case 'u':
-				case 'd':
-				{
-					for (int i = 0; i < ARRAY_SIZE(objects); ++i)
-					{
-						Object* currentObject = &objects[i];
-						if (!currentObject->type || currentObject->tileX != cellX ||
-						    currentObject->tileY != cellY || !currentObject->inFactory)
-							continue;
-
-						// Only refined objects will give fuel; everything else just gets destroyed
-						if (currentObject->type == 'g')
-							cell->engineCell.fuel += 1.f;
-						currentObject->type = 0;
-					}
-					break;
-				}
-				default:
-					break;
-			}
+			stars[i].x = randomRange(random, starField->sizeX);
+			stars[i].y = randomRange(random, starField->sizeY);
+			stars[i].w = randomRange(random, 5) + 1;
+			stars[i].h = randomRange(random, 5) + 1;
+			dynstars[i].w = stars[i].w;
+			dynstars[i].h = stars[i].h;
 		}
 	}
+
+	for (int i = 0; i < ARRAY_SIZE(starField->stars); ++i)
+	{
+		dynstars[i].x = stars[i].x - camera->x / 1000;
+		dynstars[i].y = stars[i].y - camera->y / 1000;
+	}
+
+	SDL_SetRenderDrawColor(renderer, 128, 128, 128, 255);
+	SDL_RenderFillRectsF(renderer, dynstars, ARRAY_SIZE(starField->dynstars));
 }
 
 void snapCameraToGrid(Camera* camera, Vec2* position, GridSpace* grid, float deltaTime)
@@ -812,104 +1139,6 @@ void snapCameraToGrid(Camera* camera, Vec2* position, GridSpace* grid, float del
 	 * position->y, deltaX, deltaY); */
 }
 
-void updateObjects(RigidBody* playerPhys, GridSpace* playerShipData, float deltaTime)
-{
-	for (int i = 0; i < ARRAY_SIZE(objects); i++)
-	{
-		Object* currentObject = &objects[i];
-		if (!currentObject->type)
-			continue;
-		if (!currentObject->inFactory)
-			UpdatePhysics(&currentObject->body, c_objectDrag, deltaTime);
-		else
-		{
-			// if the object has been captured into the ship factory, snap it to its tile
-			// location, and don't update any other physics
-			currentObject->body.position.x =
-			    (currentObject->tileX * c_tileSize) + playerPhys->position.x;
-			currentObject->body.position.y =
-			    (currentObject->tileY * c_tileSize) + playerPhys->position.y;
-			currentObject->body.velocity.x = 0;
-			currentObject->body.velocity.y = 0;
-			continue;
-		}
-
-		if (objHittingGrid(playerPhys, playerShipData, &currentObject->body))
-		{
-			IVec2 tileCoords = TileCoordinateHit(playerPhys, playerShipData, &currentObject->body);
-			unsigned char shipTileX = (unsigned char)tileCoords.x;
-			unsigned char shipTileY = (unsigned char)tileCoords.y;
-			GridCell cell = GridCellAt(playerShipData, shipTileX, shipTileY);
-
-			if (isIntake(cell.type))
-			{
-				currentObject->body.position.x = (shipTileX * c_tileSize) + playerPhys->position.x;
-				currentObject->body.position.y = (shipTileY * c_tileSize) + playerPhys->position.y;
-				currentObject->body.velocity.x = 0;
-				currentObject->body.velocity.y = 0;
-				currentObject->tileX = shipTileX;
-				currentObject->tileY = shipTileY;
-				currentObject->inFactory = true;
-			}
-			else  // collide with an edge of the ship, accounting for momentum
-			{
-				float* objX = &currentObject->body.position.x;
-				float* objY = &currentObject->body.position.y;
-				float* objVX = &currentObject->body.velocity.x;
-				float* objVY = &currentObject->body.velocity.y;
-				float plyVX = playerPhys->velocity.x;
-				float plyVY = playerPhys->velocity.y;
-				// if the asteroid hits an edge, move it to the outside of the ship,
-				// then give it velocity
-				if (shipTileX == 0)  // hit left side
-				{
-					if (*objX > playerPhys->position.x)
-						*objX = playerPhys->position.x;
-
-					if (plyVX <= 0)
-					{
-						*objVX = plyVX * c_objectForceTransfer;
-						playerPhys->velocity.x += c_shipObjectForceTransfer;
-					}
-				}
-				else if (shipTileX == playerShipData->width - 1)
-				{  // hit right side
-
-					if (*objX < playerPhys->position.x + playerShipData->width * c_tileSize)
-						*objX = playerPhys->position.x + playerShipData->width * c_tileSize;
-
-					if (plyVX >= 0)
-					{
-						*objVX = plyVX * c_objectForceTransfer;
-						playerPhys->velocity.x -= c_shipObjectForceTransfer;
-					}
-				}
-				else if (shipTileY == 0)
-				{  // hit top
-					if (*objY > playerPhys->position.y)
-						*objY = playerPhys->position.y;
-					*objY = playerPhys->position.y;
-					if (plyVY <= 0)
-					{
-						*objVY = plyVY * c_objectForceTransfer;
-						playerPhys->velocity.y += c_shipObjectForceTransfer;
-					}
-				}
-				else if (shipTileY == playerShipData->height - 1)
-				{  // hit bottom
-					if (*objY < playerPhys->position.y + playerShipData->height * c_tileSize)
-						*objY = playerPhys->position.y + playerShipData->height * c_tileSize;
-					if (plyVY >= 0)
-					{
-						*objVY = plyVY * c_objectForceTransfer;
-						playerPhys->velocity.y -= c_shipObjectForceTransfer;
-					}
-				}
-			}
-		};
-	}
-}
-
 //
 // Ship editing
 //
@@ -935,7 +1164,7 @@ static GridCell* pickGridCellFromWorldSpace(Vec2 gridSpaceWorldPosition, GridSpa
 	return &GridCellAt(searchGridSpace, cellX, cellY);
 }
 
-static void drawOutlineRectangle(SDL_Renderer* renderer, SDL_Rect* rectangleToOutline,
+static void drawOutlineRectangle(TileSheet* tileSheet, SDL_Rect* rectangleToOutline,
                                  Uint32 mouseButtonState)
 {
 	const int selectionRectanglePadding = 3;
@@ -945,13 +1174,34 @@ static void drawOutlineRectangle(SDL_Renderer* renderer, SDL_Rect* rectangleToOu
 	selectionRectangle.w += selectionRectanglePadding * 2;
 	selectionRectangle.h += selectionRectanglePadding * 2;
 
+	SDL_Color color = {255, 178, 109, 255};
 	if (mouseButtonState & SDL_BUTTON_LMASK)
-		SDL_SetRenderDrawColor(renderer, 251, 227, 205, 255);
-	else
-		SDL_SetRenderDrawColor(renderer, 255, 178, 109, 255);
+		color = (SDL_Color){251, 227, 205, 255};
 
 	// Indicate selection
-	SDL_RenderFillRect(renderer, &selectionRectangle);
+	batchFillRect(tileSheet, &selectionRectangle, color);
+}
+
+// The size renderText() would cover on screen
+static void measureText(const char* text, int* widthOut, int* heightOut)
+{
+	int numLines = 1;
+	int lineLength = 0;
+	int longestLineLength = 0;
+	for (const char* read = text; *read; ++read)
+	{
+		if (*read == '\n')
+		{
+			++numLines;
+			lineLength = 0;
+			continue;
+		}
+		++lineLength;
+		if (lineLength > longestLineLength)
+			longestLineLength = lineLength;
+	}
+	*widthOut = longestLineLength * c_scaledFontWidth;
+	*heightOut = (numLines * (c_scaledFontHeight + c_fontVerticalSpace)) - c_fontVerticalSpace;
 }
 
 static void renderText(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int y, const char* text)
@@ -961,7 +1211,6 @@ static void renderText(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int
 	const int c_numberStartX = 56;
 	const int c_numberStartY = 114;
 	const int c_charactersPerRow = 18;
-	const int c_fontVerticalSpace = 5;
 	int currentX = 0;
 	int currentY = 0;
 	for (const char* read = text; *read; ++read)
@@ -998,7 +1247,7 @@ static void renderText(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int
 		int screenY = currentY + y;
 		SDL_Rect sourceRectangle = {textureX, textureY, c_fontWidth, c_fontHeight};
 		SDL_Rect destinationRectangle = {screenX, screenY, c_scaledFontWidth, c_scaledFontHeight};
-		SDL_RenderCopy(renderer, tileSheet->texture, &sourceRectangle, &destinationRectangle);
+		batchSprite(tileSheet, &sourceRectangle, &destinationRectangle);
 
 		currentX += c_scaledFontWidth;
 	}
@@ -1021,37 +1270,191 @@ static void renderNumber(SDL_Renderer* renderer, TileSheet* tileSheet, int x, in
 		int screenY = y;
 		SDL_Rect sourceRectangle = {textureX, textureY, c_fontWidth, c_fontHeight};
 		SDL_Rect destinationRectangle = {screenX, screenY, c_scaledFontWidth, c_scaledFontHeight};
-		SDL_RenderCopy(renderer, tileSheet->texture, &sourceRectangle, &destinationRectangle);
+		batchSprite(tileSheet, &sourceRectangle, &destinationRectangle);
+	}
+}
+
+//
+// Text cache
+//
+
+// Text and panels which don't change are drawn once into a texture of their own, so each one costs
+// a single quad per frame instead of one per glyph or tile
+#define TEXT_CACHE_SIZE 32
+
+typedef struct CachedText
+{
+	// Of the text or panel key. 0 for a free entry
+	uint64_t hash;
+	SDL_Texture* texture;
+	int width;
+	int height;
+	// The cache's useCount when last drawn; the smallest is evicted first
+	unsigned int lastUsed;
+} CachedText;
+
+typedef struct TextCache
+{
+	SDL_Renderer* renderer;
+	CachedText entries[TEXT_CACHE_SIZE];
+	unsigned int useCount;
+	// Since startup
+	unsigned int numMisses;
+	unsigned int numEvictions;
+} TextCache;
+
+static void textCacheInitialize(TextCache* cache, SDL_Renderer* renderer)
+{
+	memset(cache, 0, sizeof(TextCache));
+	cache->renderer = renderer;
+}
+
+static void textCacheClear(TextCache* cache)
+{
+	for (int i = 0; i < TEXT_CACHE_SIZE; ++i)
+	{
+		if (cache->entries[i].texture)
+			SDL_DestroyTexture(cache->entries[i].texture);
+	}
+	memset(cache->entries, 0, sizeof(cache->entries));
+}
+
+// FNV-1a. Entries are told apart by hash alone; at 64 bits a collision isn't worth guarding against
+static uint64_t hashText(const char* text)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char* read = text; *read; ++read)
+	{
+		hash ^= (unsigned char)*read;
+		hash *= 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
+
+// Returns the entry for hash, or a fresh one with no texture yet, evicting the least recently used
+static CachedText* textCacheLookup(TextCache* cache, uint64_t hash)
+{
+	CachedText* leastRecentlyUsed = &cache->entries[0];
+	for (int i = 0; i < TEXT_CACHE_SIZE; ++i)
+	{
+		CachedText* entry = &cache->entries[i];
+		if (entry->hash == hash)
+		{
+			entry->lastUsed = ++cache->useCount;
+			return entry;
+		}
+		if (!entry->hash)
+			leastRecentlyUsed = entry;
+		else if (leastRecentlyUsed->hash && entry->lastUsed < leastRecentlyUsed->lastUsed)
+			leastRecentlyUsed = entry;
+	}
+
+	++cache->numMisses;
+	if (leastRecentlyUsed->texture)
+	{
+		SDL_DestroyTexture(leastRecentlyUsed->texture);
+		++cache->numEvictions;
+	}
+	memset(leastRecentlyUsed, 0, sizeof(CachedText));
+	leastRecentlyUsed->hash = hash;
+	leastRecentlyUsed->lastUsed = ++cache->useCount;
+	return leastRecentlyUsed;
+}
+
+typedef void (*PanelDrawFunction)(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int y,
+                                  const void* userData);
+
+// Draws into the entry's texture at 0, 0. Returns false if there's no texture to draw
+static bool drawCachedText(SDL_Renderer* renderer, TileSheet* tileSheet, CachedText* entry,
+                           int width, int height, PanelDrawFunction draw, const void* userData)
+{
+	if (entry->texture)
+		return true;
+	if (!SDL_RenderTargetSupported(renderer))
+		return false;
+	entry->texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+	                                   SDL_TEXTUREACCESS_TARGET, width, height);
+	if (!entry->texture)
+		return false;
+	SDL_SetTextureBlendMode(entry->texture, SDL_BLENDMODE_BLEND);
+	entry->width = width;
+	entry->height = height;
+
+	// Whatever is queued belongs on the screen
+	spriteBatchFlush(tileSheet->batch);
+	// The clear must overwrite, but fills drawn after this one still expect to blend
+	SDL_BlendMode blendMode = SDL_BLENDMODE_BLEND;
+	SDL_GetRenderDrawBlendMode(renderer, &blendMode);
+	SDL_SetRenderTarget(renderer, entry->texture);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+	SDL_RenderClear(renderer);
+	draw(renderer, tileSheet, 0, 0, userData);
+	spriteBatchFlush(tileSheet->batch);
+	SDL_SetRenderTarget(renderer, NULL);
+	SDL_SetRenderDrawBlendMode(renderer, blendMode);
+	return true;
+}
+
+static void renderCachedPanel(SDL_Renderer* renderer, TileSheet* tileSheet, uint64_t hash, int x,
+                              int y, int width, int height, PanelDrawFunction draw,
+                              const void* userData)
+{
+	TextCache* cache = tileSheet->textCache;
+	CachedText* entry = cache ? textCacheLookup(cache, hash) : NULL;
+	if (!entry || !drawCachedText(renderer, tileSheet, entry, width, height, draw, userData))
+	{
+		draw(renderer, tileSheet, x, y, userData);
+		return;
 	}
+	SDL_Rect destinationRectangle = {x, y, entry->width, entry->height};
+	spriteBatchAddQuad(tileSheet->batch, entry->texture, SDL_BLENDMODE_BLEND, NULL,
+	                   &destinationRectangle, c_spriteColor);
+}
+
+static void drawTextPanel(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int y,
+                          const void* userData)
+{
+	renderText(renderer, tileSheet, x, y, (const char*)userData);
+}
+
+// For text which stays the same from frame to frame. Anything that changes often, like numbers,
+// would only churn the cache, so should use renderText() instead
+static void renderCachedText(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int y,
+                             const char* text)
+{
+	int width;
+	int height;
+	measureText(text, &width, &height);
+	if (!width || !height)
+		return;
+	renderCachedPanel(renderer, tileSheet, hashText(text), x, y, width, height, drawTextPanel,
+	                  text);
 }
 
-static void doEditUI(SDL_Renderer* renderer, TileSheet* tileSheet, int windowWidth,
+// Returns whether the player made an edit, which is written to editOut. The edit is not applied
+// until the simulation receives it. selectedButtonIndex is kept by the caller between frames
+static bool doEditUI(SDL_Renderer* renderer, TileSheet* tileSheet, int windowWidth,
                      int windowHeight, IVec2 cameraPosition, Vec2 gridSpaceWorldPosition,
-                     GridSpace* editGridSpace, unsigned short* inventory, int inventorySize,
-                     float* fuelPool)
+                     SimulationState* simulation, unsigned char editShip, char* selectedButtonIndex,
+                     EditCommand* editOut)
 {
+	GridSpace editGridSpaceData = shipGridSpace(simulation, &simulation->ships[editShip]);
+	GridSpace* editGridSpace = &editGridSpaceData;
+	unsigned short* inventory = simulation->inventory;
+	int* fuelPool = &simulation->constructionFuelPool;
+
 	int mouseX = 0;
 	int mouseY = 0;
 	Uint32 mouseButtonState = SDL_GetMouseState(&mouseX, &mouseY);
-	static char currentSelectedButtonIndex = 0;
-	char editButtons[] = {'#', '.', '<', '>', 'A', 'V', 'f', 'L',
-	                      'R', 'U', 'D', 'l', 'r', 'u', 'd'};
+	char currentSelectedButtonIndex = *selectedButtonIndex;
+	const char* editButtons = c_buildableTiles;
 	const char* editButtonLabels[] = {"WALL", "FLOOR", "CONVEYOR LEFT", "CONVEYOR RIGHT",
 	                                  "CONVEYOR UP", "CONVEYOR DOWN", "REFINERY",
 	                                  // Intakes
 	                                  "INTAKE LEFT", "INTAKE RIGHT", "INTAKE UP", "INTAKE DOWN",
 	                                  // Engines
 	                                  "ENGINE LEFT", "ENGINE RIGHT", "ENGINE UP", "ENGINE DOWN"};
-	typedef enum PlacementRestriction
-	{
-		Restrict_None,
-		Restrict_Inside,
-		Restrict_EdgeAny,
-		Restrict_EdgeLeft,
-		Restrict_EdgeRight,
-		Restrict_EdgeTop,
-		Restrict_EdgeBottom,
-	} PlacementRestriction;
 	static const char* restrictionExplanation[] = {
 	    /*Restrict_None=*/
 	    "",
@@ -1066,198 +1469,110 @@ static void doEditUI(SDL_Renderer* renderer, TileSheet* tileSheet, int windowWid
 	    /*Restrict_EdgeTop=*/
 	    "MUST PLACE ON TOP EDGE",
 	    /*Restrict_EdgeBottom=*/"MUST PLACE ON BOTTOM EDGE"};
-	static PlacementRestriction restrictions[] = {
-	    /*WALL*/ Restrict_EdgeAny, /*FLOOR*/ Restrict_Inside, /*CONVEYOR LEFT*/ Restrict_Inside,
-	    /*CONVEYOR RIGHT*/ Restrict_Inside,
-	    /*CONVEYOR UP*/ Restrict_Inside, /*CONVEYOR DOWN*/ Restrict_Inside,
-	    /*REFINERY*/ Restrict_Inside,
-	    // Intakes
-	    /*INTAKE LEFT*/ Restrict_EdgeLeft, /*INTAKE RIGHT*/ Restrict_EdgeRight,
-	    /*INTAKE UP*/ Restrict_EdgeTop, /*INTAKE DOWN*/ Restrict_EdgeBottom,
-	    // Engines
-	    /*ENGINE LEFT*/ Restrict_EdgeLeft, /*ENGINE RIGHT*/ Restrict_EdgeRight,
-	    /*ENGINE UP*/ Restrict_EdgeBottom, /*ENGINE DOWN*/ Restrict_EdgeTop};
-
-	assert(inventorySize == ARRAY_SIZE(editButtons) &&
-	       ARRAY_SIZE(editButtonLabels) == ARRAY_SIZE(editButtons) &&
-	       ARRAY_SIZE(restrictions) == ARRAY_SIZE(editButtons) &&
+	assert(ARRAY_SIZE(editButtonLabels) == NUM_BUILDABLE_TILES &&
 	       "An array for the edit UI has gotten out of sync. Check that it has the same number of "
-	       "elements as editButtons.");
+	       "elements as c_buildableTiles.");
 
 	const int c_buttonMarginX = 22;
 	int startButtonBarX =
-	    ((windowWidth / 2) - ((ARRAY_SIZE(editButtons) * (c_tileSize + c_buttonMarginX)) / 2));
+	    ((windowWidth / 2) - ((NUM_BUILDABLE_TILES * (c_tileSize + c_buttonMarginX)) / 2));
 	const int buttonBarY = 32;
 	const int c_numberMargin = 8;
 	const int c_toolTipMargin = 28;
 
-	renderText(renderer, tileSheet, startButtonBarX, buttonBarY - 25, "INVENTORY");
+	renderCachedText(renderer, tileSheet, startButtonBarX, buttonBarY - 25, "INVENTORY");
 
-	renderText(renderer, tileSheet, startButtonBarX + 475, buttonBarY - 25, "FUEL IN RESERVE");
+	renderCachedText(renderer, tileSheet, startButtonBarX + 475, buttonBarY - 25,
+	                 "FUEL IN RESERVE");
 	renderNumber(renderer, tileSheet, startButtonBarX + 700, buttonBarY - 25,
-	             (unsigned int)(*fuelPool * 10.f));
+	             (unsigned int)((*fuelPool * 10) / FIXED_UNITS_PER_SECOND));
 
-	for (int buttonIndex = 0; buttonIndex < ARRAY_SIZE(editButtons); ++buttonIndex)
+	for (int buttonIndex = 0; buttonIndex < NUM_BUILDABLE_TILES; ++buttonIndex)
 	{
-		for (int tileAssociation = 0; tileAssociation < ARRAY_SIZE(tileSheet->associations);
-		     ++tileAssociation)
-		{
-			CharacterSheetCellAssociation* association = &tileSheet->associations[tileAssociation];
-			if (editButtons[buttonIndex] != association->key)
-				continue;
-
-			int textureX = association->column * c_tileSize;
-			int textureY = association->row * c_tileSize;
-			int screenX = startButtonBarX + (buttonIndex * (c_tileSize + c_buttonMarginX));
-			int screenY = buttonBarY;
-			SDL_Rect sourceRectangle = {textureX, textureY, c_tileSize, c_tileSize};
-			SDL_Rect destinationRectangle = {screenX, screenY, c_tileSize, c_tileSize};
-
-			if (mouseX > destinationRectangle.x - (c_buttonMarginX / 2) &&
-			    mouseX <= destinationRectangle.x + destinationRectangle.w + (c_buttonMarginX / 2) &&
-			    mouseY >= destinationRectangle.y &&
-			    mouseY <= destinationRectangle.y + destinationRectangle.h)
-			{
-				if (mouseButtonState & SDL_BUTTON_LMASK)
-					currentSelectedButtonIndex = buttonIndex;
+		const SDL_Rect* sourceRectangle =
+		    tileSheetSprite(tileSheet, editButtons[buttonIndex], TileVariant_Normal);
+		if (!sourceRectangle)
+			continue;
 
-				drawOutlineRectangle(renderer, &destinationRectangle, mouseButtonState);
+		int screenX = startButtonBarX + (buttonIndex * (c_tileSize + c_buttonMarginX));
+		int screenY = buttonBarY;
+		SDL_Rect destinationRectangle = {screenX, screenY, c_tileSize, c_tileSize};
 
-				renderText(renderer, tileSheet, screenX, screenY + c_tileSize + c_toolTipMargin,
-				           editButtonLabels[buttonIndex]);
-			}
-			else if (currentSelectedButtonIndex == buttonIndex)
+		if (mouseX > destinationRectangle.x - (c_buttonMarginX / 2) &&
+		    mouseX <= destinationRectangle.x + destinationRectangle.w + (c_buttonMarginX / 2) &&
+		    mouseY >= destinationRectangle.y &&
+		    mouseY <= destinationRectangle.y + destinationRectangle.h)
+		{
+			if (mouseButtonState & SDL_BUTTON_LMASK)
 			{
-				// TODO: This should probably be a different color
-				drawOutlineRectangle(renderer, &destinationRectangle, mouseButtonState);
+				currentSelectedButtonIndex = buttonIndex;
+				*selectedButtonIndex = buttonIndex;
 			}
 
-			SDL_RenderCopyEx(renderer, tileSheet->texture, &sourceRectangle, &destinationRectangle,
-			                 c_transformsToAngles[association->transform],
-			                 /*rotate about (default = center)*/ NULL,
-			                 c_transformsToSDLRenderFlips[association->transform]);
+			drawOutlineRectangle(tileSheet, &destinationRectangle, mouseButtonState);
 
-			renderNumber(renderer, tileSheet, screenX, screenY + c_tileSize + c_numberMargin,
-			             inventory[buttonIndex]);
-			break;
+			renderCachedText(renderer, tileSheet, screenX, screenY + c_tileSize + c_toolTipMargin,
+			                 editButtonLabels[buttonIndex]);
 		}
-	}
-
-	IVec2 pickWorldPosition = {mouseX + cameraPosition.x, mouseY + cameraPosition.y};
-	unsigned char selectedCellX = 0;
-	unsigned char selectedCellY = 0;
-	GridCell* selectedCell = pickGridCellFromWorldSpace(
-	    gridSpaceWorldPosition, editGridSpace, pickWorldPosition, &selectedCellX, &selectedCellY);
-	if (selectedCell)
-	{
-		bool isValidPlacement = true;
+		else if (currentSelectedButtonIndex == buttonIndex)
 		{
-			switch (restrictions[currentSelectedButtonIndex])
-			{
-				case Restrict_None:
-					break;
-				case Restrict_Inside:
-					if (selectedCellX == 0 || selectedCellX == editGridSpace->width - 1 ||
-					    selectedCellY == 0 || selectedCellY == editGridSpace->height - 1)
-						isValidPlacement = false;
-					break;
-				case Restrict_EdgeAny:
-					if ((selectedCellX != 0 && selectedCellX != editGridSpace->width - 1) &&
-					    (selectedCellY != 0 && selectedCellY != editGridSpace->height - 1))
-						isValidPlacement = false;
-					break;
-				case Restrict_EdgeLeft:
-					if (selectedCellX != 0)
-						isValidPlacement = false;
-					break;
-				case Restrict_EdgeRight:
-					if (selectedCellX != editGridSpace->width - 1)
-						isValidPlacement = false;
-					break;
-				case Restrict_EdgeTop:
-					if (selectedCellY != 0)
-						isValidPlacement = false;
-					break;
-				case Restrict_EdgeBottom:
-					if (selectedCellY != editGridSpace->height - 1)
-						isValidPlacement = false;
-					break;
-			}
-
-			if (inventory[currentSelectedButtonIndex] == 0)
-				isValidPlacement = false;
+			// TODO: This should probably be a different color
+			drawOutlineRectangle(tileSheet, &destinationRectangle, mouseButtonState);
 		}
 
-		for (int tileAssociation = 0; tileAssociation < ARRAY_SIZE(tileSheet->associations);
-		     ++tileAssociation)
-		{
-			CharacterSheetCellAssociation* association = &tileSheet->associations[tileAssociation];
-			if (editButtons[currentSelectedButtonIndex] != association->key)
-				continue;
+		batchSprite(tileSheet, sourceRectangle, &destinationRectangle);
+
+		renderNumber(renderer, tileSheet, screenX, screenY + c_tileSize + c_numberMargin,
+		             inventory[buttonIndex]);
+	}
 
-			int textureX = association->column * c_tileSize;
-			int textureY = association->row * c_tileSize;
+	IVec2 pickWorldPosition = {mouseX + cameraPosition.x, mouseY + cameraPosition.y};
+	unsigned char selectedCellX = 0;
+	unsigned char selectedCellY = 0;
+	GridCell* selectedCell = pickGridCellFromWorldSpace(
+	    gridSpaceWorldPosition, editGridSpace, pickWorldPosition, &selectedCellX, &selectedCellY);
+	if (selectedCell)
+	{
+		EditCommand edit = {editShip, selectedCellX, selectedCellY,
+		                    (unsigned char)currentSelectedButtonIndex};
+		PlacementRestriction failedRestriction = simulationPlacementRestriction(simulation, &edit);
+		bool isValidPlacement =
+		    failedRestriction == Restrict_None && inventory[currentSelectedButtonIndex] != 0;
+
+		const SDL_Rect* sourceRectangle = tileSheetSprite(
+		    tileSheet, editButtons[currentSelectedButtonIndex], TileVariant_Normal);
+		if (sourceRectangle)
+		{
 			int screenX =
 			    (gridSpaceWorldPosition.x - cameraPosition.x) + (selectedCellX * c_tileSize);
 			int screenY =
 			    (gridSpaceWorldPosition.y - cameraPosition.y) + (selectedCellY * c_tileSize);
-			SDL_Rect sourceRectangle = {textureX, textureY, c_tileSize, c_tileSize};
 			SDL_Rect destinationRectangle = {screenX, screenY, c_tileSize, c_tileSize};
 
 			if (!isValidPlacement)
 			{
-				SDL_SetRenderDrawColor(renderer, 245, 15, 15, 255);
-				SDL_RenderDrawRect(renderer, &destinationRectangle);
-				const char* explanation =
-				    restrictionExplanation[restrictions[currentSelectedButtonIndex]];
+				SDL_Color invalidColor = {245, 15, 15, 255};
+				batchDrawRect(tileSheet, &destinationRectangle, invalidColor);
+				const char* explanation = restrictionExplanation[failedRestriction];
 				if (inventory[currentSelectedButtonIndex] == 0)
 					explanation = "NONE LEFT";
-				renderText(renderer, tileSheet, screenX, screenY + c_tileSize, explanation);
+				renderCachedText(renderer, tileSheet, screenX, screenY + c_tileSize, explanation);
 			}
 			else
 			{
-				drawOutlineRectangle(renderer, &destinationRectangle, mouseButtonState);
+				drawOutlineRectangle(tileSheet, &destinationRectangle, mouseButtonState);
 
-				SDL_RenderCopyEx(renderer, tileSheet->texture, &sourceRectangle,
-				                 &destinationRectangle,
-				                 c_transformsToAngles[association->transform],
-				                 /*rotate about (default = center)*/ NULL,
-				                 c_transformsToSDLRenderFlips[association->transform]);
+				batchSprite(tileSheet, sourceRectangle, &destinationRectangle);
 			}
-			break;
 		}
 
-		if (isValidPlacement && mouseButtonState & SDL_BUTTON_LMASK &&
-		    inventory[currentSelectedButtonIndex] &&
-		    selectedCell->type != editButtons[currentSelectedButtonIndex])
+		if (mouseButtonState & SDL_BUTTON_LMASK && simulationCanApplyEdit(simulation, &edit))
 		{
-			// Give back resources
-			for (int buttonIndex = 0; buttonIndex < ARRAY_SIZE(editButtons); ++buttonIndex)
-			{
-				if (selectedCell->type == editButtons[buttonIndex])
-				{
-					inventory[buttonIndex] += 1;
-					if (isEngineTile(selectedCell->type))
-						*fuelPool += selectedCell->engineCell.fuel;
-					break;
-				}
-			}
-
-			// Make the placement
-			inventory[currentSelectedButtonIndex] -= 1;
-			memset(selectedCell, 0, sizeof(GridCell));
-			selectedCell->type = editButtons[currentSelectedButtonIndex];
-			if (isEngineTile(selectedCell->type))
-			{
-				float fuelToAdd = *fuelPool >= c_defaultStartFuel ? c_defaultStartFuel : *fuelPool;
-				if (fuelToAdd > 0.f)
-				{
-					selectedCell->engineCell.fuel = fuelToAdd;
-					*fuelPool -= fuelToAdd;
-				}
-			}
+			*editOut = edit;
+			return true;
 		}
 	}
+	return false;
 }
 
 static void renderMainMenu(SDL_Renderer* renderer, TileSheet* tileSheet, SDL_Texture* logoTexture)
@@ -1271,27 +1586,28 @@ static void renderMainMenu(SDL_Renderer* renderer, TileSheet* tileSheet, SDL_Tex
 	SDL_Rect sourceRectangle = {0, 0, c_logoWidth, c_logoHeight};
 	SDL_Rect destinationRectangle = {(windowWidth / 2) - ((c_logoWidth * 12) / 2), 100,
 	                                 c_logoWidth * 12, c_logoHeight * 12};
-	SDL_RenderCopy(renderer, logoTexture, &sourceRectangle, &destinationRectangle);
+	spriteBatchAddQuad(tileSheet->batch, logoTexture, SDL_BLENDMODE_BLEND, &sourceRectangle,
+	                   &destinationRectangle, c_spriteColor);
 
 	int currentY = 800;
 	const char* text = "A GAME MADE IN 8 DAYS BY";
-	renderText(renderer, tileSheet, (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2),
-	           currentY, text);
+	renderCachedText(renderer, tileSheet,
+	                 (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2), currentY, text);
 
 	currentY += c_scaledFontHeight + 20;
 	text = "MACOY MADSON    WILL CHAMBERS";
-	renderText(renderer, tileSheet, (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2),
-	           currentY, text);
+	renderCachedText(renderer, tileSheet,
+	                 (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2), currentY, text);
 
 	currentY += c_scaledFontHeight + 50;
 	text = "PRESS SPACE TO PLAY";
-	renderText(renderer, tileSheet, (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2),
-	           currentY, text);
+	renderCachedText(renderer, tileSheet,
+	                 (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2), currentY, text);
 
 	currentY += c_scaledFontHeight + 50;
 	text = "COPYRIGHT 2022  AVAILABLE UNDER TERMS OF GNU GENERAL PUBLIC LICENSE VERSION 3";
-	renderText(renderer, tileSheet, (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2),
-	           currentY, text);
+	renderCachedText(renderer, tileSheet,
+	                 (windowWidth / 2) - ((strlen(text) * c_scaledFontWidth) / 2), currentY, text);
 }
 
 static void doTutorial(SDL_Renderer* renderer, TileSheet* tileSheet, int page)
@@ -1311,7 +1627,7 @@ static void doTutorial(SDL_Renderer* renderer, TileSheet* tileSheet, int page)
 	    "YOUR CREW DEPENDS ON YOU\n\n\n"
 	    "PRESS THE SPACE KEY TO CONTINUE",
 	};
-	renderText(renderer, tileSheet, 200, 200, tutorialText[page]);
+	renderCachedText(renderer, tileSheet, 200, 200, tutorialText[page]);
 }
 
 static void doEndScreenFailure(SDL_Renderer* renderer, TileSheet* tileSheet)
@@ -1328,7 +1644,7 @@ static void doEndScreenFailure(SDL_Renderer* renderer, TileSheet* tileSheet)
 	    "WILL CHAMBERS\n\n"
 	    "COPYRIGHT 2022\n"
 	    "AVAILABLE UNDER TERMS OF GNU GENERAL PUBLIC LICENSE VERSION 3\n";
-	renderText(renderer, tileSheet, 400, 200, endScreenFailure);
+	renderCachedText(renderer, tileSheet, 400, 200, endScreenFailure);
 }
 
 static void doEndScreenSuccess(SDL_Renderer* renderer, TileSheet* tileSheet)
@@ -1345,53 +1661,19 @@ static void doEndScreenSuccess(SDL_Renderer* renderer, TileSheet* tileSheet)
 	    "WILL CHAMBERS\n\n"
 	    "COPYRIGHT 2022\n"
 	    "AVAILABLE UNDER TERMS OF GNU GENERAL PUBLIC LICENSE VERSION 3\n";
-	renderText(renderer, tileSheet, 200, 200, endScreenSuccess);
+	renderCachedText(renderer, tileSheet, 200, 200, endScreenSuccess);
 }
 
 // Goal
 // for now just a simple rect
 //
 
-typedef SDL_Rect Goal;
-
-static void renderGoal(SDL_Renderer* renderer, Camera* camera, Goal* goal)
+static void renderGoal(TileSheet* tileSheet, Camera* camera, IRect* goal)
 {
-	SDL_SetRenderDrawColor(renderer, 84, 211, 115, 155);
+	SDL_Color goalColor = {84, 211, 115, 155};
 	SDL_Rect goalVis = {(int)(goal->x - camera->x), (int)((float)goal->y - camera->y), (int)goal->w,
 	                    (int)goal->h};
-	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-	SDL_RenderFillRect(renderer, &goalVis);
-	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
-	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-}
-
-bool pointInRect(Vec2* point, SDL_Rect* rect)
-{
-	return point->x > rect->x && point->x < (rect->x + rect->w) && point->y > rect->y &&
-	       point->y < (rect->y + rect->h);
-}
-
-bool CheckGoalSatisfied(Vec2* playerPos, GridSpace* playerShip, Goal* goal)
-{
-	// aligned box collision WILL BREAK IF WE EVER ROTATE ANYTHING
-	Vec2 goalTL = {(float)goal->x, (float)goal->y};
-	Vec2 goalTR = {(float)(goal->x + goal->w), (float)goal->y};
-	Vec2 goalBL = {(float)goal->x, (float)(goal->y + goal->h)};
-	Vec2 goalBR = {(float)(goal->x + goal->w), (float)(goal->y + goal->h)};
-
-	int playerWidth = playerShip->width * c_tileSize;
-	int playerHeight = playerShip->height * c_tileSize;
-
-	Vec2 playerTR = {(playerPos->x + playerWidth), (float)playerPos->y};
-	Vec2 playerBL = {(float)playerPos->x, (float)(playerPos->y + playerHeight)};
-	Vec2 playerBR = {(float)(playerPos->x + playerWidth), (float)(playerPos->y + playerHeight)};
-
-	SDL_Rect playerBoundingBox = {(int)playerPos->x, (int)playerPos->y, playerWidth, playerHeight};
-
-	return pointInRect(&goalTL, &playerBoundingBox) || pointInRect(&goalTR, &playerBoundingBox) ||
-	       pointInRect(&goalBL, &playerBoundingBox) || pointInRect(&goalBR, &playerBoundingBox) ||
-	       pointInRect(playerPos, goal) || pointInRect(&playerTR, goal) ||
-	       pointInRect(&playerBL, goal) || pointInRect(&playerBR, goal);
+	batchFillRect(tileSheet, &goalVis, goalColor);
 }
 
 IVec2 toMiniMapCoordinates(float worldCoordX, float worldCoordY)
@@ -1417,26 +1699,243 @@ SDL_Rect scaleRectToMinimap(float x, float y, float w, float h)
 	return result;
 }
 
-void renderMiniMap(SDL_Renderer* renderer, int windowWidth, int windowHeight, Vec2* playerPos,
-                   GridSpace* playerShip, Goal* goal)
+// Objects are shown by how many there are in each bin, rather than one by one, so the minimap costs
+// the same however many there are. Each bin is 4 by 4 minimap pixels, the size objects used to be
+#define MINI_MAP_HEATMAP_SIZE 100
+
+// Filled in on the job threads, so drawing the minimap is only a few batched draws. Rects are
+// relative to the minimap's top left corner, which depends on the window size
+typedef struct MiniMapPreparation
+{
+	// Only prepared while the render thread wants a refresh. Otherwise the rest is left stale
+	bool isPrepared;
+	SimulationState* simulation;
+	int playerShipIndex;
+	// The rest of the fleet
+	SDL_Rect shipRects[MAX_SHIPS];
+	int numShipRects;
+	// Number of objects in each bin, row by row
+	unsigned short objectDensity[MINI_MAP_HEATMAP_SIZE * MINI_MAP_HEATMAP_SIZE];
+} MiniMapPreparation;
+
+static void prepareMiniMapShips(void* userData, int begin, int end, int workerIndex)
+{
+	MiniMapPreparation* preparation = (MiniMapPreparation*)userData;
+	SimulationState* simulation = preparation->simulation;
+	preparation->numShipRects = 0;
+	for (int shipIndex = 0; shipIndex < simulation->numShips; ++shipIndex)
+	{
+		if (shipIndex == preparation->playerShipIndex)
+			continue;
+		Ship* ship = &simulation->ships[shipIndex];
+		preparation->shipRects[preparation->numShipRects++] =
+		    scaleRectToMinimap(ship->body.position.x, ship->body.position.y,
+		                       ship->width * c_tileSize, ship->height * c_tileSize);
+	}
+}
+
+static int heatmapBin(int miniMapCoordinate)
+{
+	int bin = (miniMapCoordinate * MINI_MAP_HEATMAP_SIZE) / c_miniMapSize;
+	if (bin < 0)
+		return 0;
+	if (bin >= MINI_MAP_HEATMAP_SIZE)
+		return MINI_MAP_HEATMAP_SIZE - 1;
+	return bin;
+}
+
+static void prepareMiniMapObjects(void* userData, int begin, int end, int workerIndex)
+{
+	MiniMapPreparation* preparation = (MiniMapPreparation*)userData;
+	memset(preparation->objectDensity, 0, sizeof(preparation->objectDensity));
+	for (int i = 0; i < ARRAY_SIZE(preparation->simulation->objects); i++)
+	{
+		Object* currentObject = &preparation->simulation->objects[i];
+		if (!currentObject->type)
+			continue;
+		IVec2 miniMapObjPos = toMiniMapCoordinates(currentObject->body.position.x,
+		                                           currentObject->body.position.y);
+		++preparation->objectDensity[(heatmapBin(miniMapObjPos.y) * MINI_MAP_HEATMAP_SIZE) +
+		                             heatmapBin(miniMapObjPos.x)];
+	}
+}
+
+#define NUM_MINI_MAP_STAGES 2
+
+// Fills in NUM_MINI_MAP_STAGES stages. They only read the simulation, so they can overlap
+// anything else that only reads it. Wait for the graph before using the preparation or changing
+// the simulation
+static void setUpMiniMapStages(MiniMapPreparation* preparation, SimulationState* simulation,
+                               int playerShipIndex, JobStage* stages)
+{
+	preparation->simulation = simulation;
+	preparation->playerShipIndex = playerShipIndex;
+
+	JobStage* stage = &stages[0];
+	stage->name = "MiniMapShips";
+	stage->function = prepareMiniMapShips;
+	stage->userData = preparation;
+	stage->numItems = 1;
+
+	stage = &stages[1];
+	stage->name = "MiniMapObjects";
+	stage->function = prepareMiniMapObjects;
+	stage->userData = preparation;
+	stage->numItems = 1;
+}
+
+// How often the fleet and objects on the minimap are redrawn, unless --minimap-refresh says
+// otherwise. The player's ship and the goal are drawn over them every frame
+static const float c_miniMapDefaultRefreshesPerSecond = 10.f;
+
+typedef struct MiniMap
+{
+	// What the minimap shows of the rest of the world, redrawn refreshesPerSecond. NULL without
+	// render targets, in which case it is drawn straight to the screen each frame instead
+	SDL_Texture* texture;
+	// One pixel per bin of the object density
+	SDL_Texture* heatmap;
+	// The fleet as of the last refresh
+	SDL_Rect shipRects[MAX_SHIPS];
+	int numShipRects;
+	bool hasRefreshed;
+	float refreshesPerSecond;
+	float secondsUntilRefresh;
+	// The simulation thread only prepares the minimap while this is set, and the refresh happens
+	// with the first snapshot it's prepared in
+	bool isRefreshDue;
+} MiniMap;
+
+static void miniMapInitialize(SDL_Renderer* renderer, MiniMap* miniMap, float refreshesPerSecond)
+{
+	memset(miniMap, 0, sizeof(MiniMap));
+	miniMap->refreshesPerSecond = refreshesPerSecond;
+	if (SDL_RenderTargetSupported(renderer))
+		miniMap->texture =
+		    SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+		                      c_miniMapSize, c_miniMapSize);
+	miniMap->heatmap =
+	    SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+	                      MINI_MAP_HEATMAP_SIZE, MINI_MAP_HEATMAP_SIZE);
+	if (miniMap->heatmap)
+		SDL_SetTextureBlendMode(miniMap->heatmap, SDL_BLENDMODE_BLEND);
+}
+
+static void destroyMiniMap(MiniMap* miniMap)
+{
+	if (miniMap->texture)
+		SDL_DestroyTexture(miniMap->texture);
+	if (miniMap->heatmap)
+		SDL_DestroyTexture(miniMap->heatmap);
+	memset(miniMap, 0, sizeof(MiniMap));
+}
+
+// E.g. when the renderer reports that render targets were reset
+static void invalidateMiniMap(MiniMap* miniMap)
+{
+	miniMap->secondsUntilRefresh = 0.f;
+	miniMap->hasRefreshed = false;
+}
+
+// Lone objects are drawn in the usual object blue, and crowded bins brighten towards white
+static Uint32 heatmapColor(unsigned short density)
+{
+	if (!density)
+		return 0;
+	const int c_maxDensity = 8;
+	int heat = density < c_maxDensity ? density - 1 : c_maxDensity - 1;
+	Uint32 red = 102 + ((heat * (230 - 102)) / (c_maxDensity - 1));
+	Uint32 green = 138 + ((heat * (235 - 138)) / (c_maxDensity - 1));
+	Uint32 blue = 158 + ((heat * (240 - 158)) / (c_maxDensity - 1));
+	Uint32 alpha = 160 + ((heat * (255 - 160)) / (c_maxDensity - 1));
+	return (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+static void updateHeatmap(MiniMap* miniMap, const MiniMapPreparation* preparation)
+{
+	void* pixels;
+	int pitch;
+	if (!miniMap->heatmap || SDL_LockTexture(miniMap->heatmap, NULL, &pixels, &pitch) != 0)
+		return;
+	for (int binY = 0; binY < MINI_MAP_HEATMAP_SIZE; ++binY)
+	{
+		Uint32* row = (Uint32*)((char*)pixels + (binY * pitch));
+		const unsigned short* densityRow =
+		    &preparation->objectDensity[binY * MINI_MAP_HEATMAP_SIZE];
+		for (int binX = 0; binX < MINI_MAP_HEATMAP_SIZE; ++binX)
+			row[binX] = heatmapColor(densityRow[binX]);
+	}
+	SDL_UnlockTexture(miniMap->heatmap);
+}
+
+// Everything but the player's ship and the goal, with the minimap's top left at 0, 0
+static void drawMiniMapContents(SDL_Renderer* renderer, const MiniMap* miniMap)
+{
+	SDL_Rect miniMapBounds = {0, 0, c_miniMapSize, c_miniMapSize};
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderFillRect(renderer, &miniMapBounds);
+	SDL_SetRenderDrawColor(renderer, 82, 74, 63, 255);
+	SDL_RenderDrawRect(renderer, &miniMapBounds);
+
+	// The rest of the fleet
+	SDL_SetRenderDrawColor(renderer, 122, 88, 80, 255);
+	SDL_RenderFillRects(renderer, miniMap->shipRects, miniMap->numShipRects);
+
+	if (miniMap->heatmap && miniMap->hasRefreshed)
+		SDL_RenderCopy(renderer, miniMap->heatmap, NULL, &miniMapBounds);
+}
+
+void renderMiniMap(SDL_Renderer* renderer, MiniMap* miniMap, float deltaTime, int windowWidth,
+                   int windowHeight, const MiniMapPreparation* preparation, Vec2* playerPos,
+                   GridSpace* playerShip, IRect* goal)
 {
 	const int miniMapMargin = 10;
 	int miniMapX = windowWidth - c_miniMapSize - miniMapMargin;
 	int miniMapY = windowHeight - c_miniMapSize - miniMapMargin;
+	SDL_Rect miniMapBounds = {miniMapX, miniMapY, c_miniMapSize, c_miniMapSize};
+
+	miniMap->secondsUntilRefresh -= deltaTime;
+	if (miniMap->secondsUntilRefresh <= 0.f)
+	{
+		miniMap->secondsUntilRefresh += 1.f / miniMap->refreshesPerSecond;
+		// Don't try to catch up on refreshes missed while the minimap was hidden
+		if (miniMap->secondsUntilRefresh <= 0.f)
+			miniMap->secondsUntilRefresh = 1.f / miniMap->refreshesPerSecond;
+		miniMap->isRefreshDue = true;
+	}
+	bool needsRefresh = miniMap->isRefreshDue && preparation->isPrepared;
+	if (needsRefresh)
+	{
+		miniMap->isRefreshDue = false;
+		miniMap->hasRefreshed = true;
+		updateHeatmap(miniMap, preparation);
+		miniMap->numShipRects = preparation->numShipRects;
+		memcpy(miniMap->shipRects, preparation->shipRects,
+		       preparation->numShipRects * sizeof(SDL_Rect));
+	}
+
+	if (miniMap->texture && miniMap->hasRefreshed)
+	{
+		if (needsRefresh)
+		{
+			SDL_SetRenderTarget(renderer, miniMap->texture);
+			drawMiniMapContents(renderer, miniMap);
+			SDL_SetRenderTarget(renderer, NULL);
+		}
+		SDL_RenderCopy(renderer, miniMap->texture, NULL, &miniMapBounds);
+	}
+	else
+	{
+		SDL_RenderSetViewport(renderer, &miniMapBounds);
+		drawMiniMapContents(renderer, miniMap);
+		SDL_RenderSetViewport(renderer, NULL);
+	}
 
 	SDL_Rect miniPlayer =
 	    scaleRectToMinimap(playerPos->x, playerPos->y, playerShip->width * c_tileSize,
 	                       playerShip->height * c_tileSize);
-
 	miniPlayer.x += miniMapX;
 	miniPlayer.y += miniMapY;
-
-	SDL_Rect miniMapBounds = {miniMapX, miniMapY, c_miniMapSize, c_miniMapSize};
-	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-	SDL_RenderFillRect(renderer, &miniMapBounds);
-	SDL_SetRenderDrawColor(renderer, 82, 74, 63, 255);
-	SDL_RenderDrawRect(renderer, &miniMapBounds);
-
 	SDL_SetRenderDrawColor(renderer, 184, 98, 76, 255);
 	SDL_RenderFillRect(renderer, &miniPlayer);
 
@@ -1449,25 +1948,14 @@ void renderMiniMap(SDL_Renderer* renderer, int windowWidth, int windowHeight, Ve
 		SDL_SetRenderDrawColor(renderer, 84, 211, 115, 255);
 		SDL_RenderFillRect(renderer, &miniGoal);
 	}
-
-	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-
-	for (int i = 0; i < ARRAY_SIZE(objects); i++)
-	{
-		Object* currentObject = &objects[i];
-		if (!currentObject->type)
-			continue;
-		IVec2 miniMapObjPos =
-		    toMiniMapCoordinates(currentObject->body.position.x, currentObject->body.position.y);
-		miniMapObjPos.x += miniMapX;
-		miniMapObjPos.y += miniMapY;
-		SDL_Rect miniObj = {miniMapObjPos.x, miniMapObjPos.y, 4, 4};
-		SDL_SetRenderDrawColor(renderer, 102, 138, 158, 255);
-		SDL_RenderFillRect(renderer, &miniObj);
-	}
 }
 
-static void renderFactoryGuide(SDL_Renderer* renderer, TileSheet* tileSheet)
+// Big enough for everything drawFactoryGuide() draws
+static const int c_factoryGuideWidth = 760;
+static const int c_factoryGuideHeight = 400;
+
+static void drawFactoryGuide(SDL_Renderer* renderer, TileSheet* tileSheet, int x, int y,
+                             const void* userData)
 {
 	// Show a guide for ship construction
 	GridSpace tutorialGrid = {0};
@@ -1477,17 +1965,18 @@ static void renderFactoryGuide(SDL_Renderer* renderer, TileSheet* tileSheet)
 	GridCell tutorialGridCells[5 * 3] = {0};
 	tutorialGrid.data = tutorialGridCells;
 
-	int currentY = 650;
+	int currentY = y;
 	const int addMargin = 20;
-	renderText(renderer, tileSheet, 100, currentY, "USE THE MOUSE TO EDIT SHIP");
+	renderText(renderer, tileSheet, x, currentY, "USE THE MOUSE TO EDIT SHIP");
 	currentY += 40;
-	renderText(renderer, tileSheet, 100, currentY, "INTAKES MOVE ASTEROIDS THEY TOUCH INSIDE\n");
+	renderText(renderer, tileSheet, x, currentY, "INTAKES MOVE ASTEROIDS THEY TOUCH INSIDE\n");
 	tutorialGridCells[0].type = 'a';
 	tutorialGridCells[1].type = 'L';
 	tutorialGridCells[2].type = '>';
-	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, 120, currentY + 20 + 7, 0, 0);
+	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, x + 20, currentY + 20 + 7,
+	                             0, 0);
 	currentY += 20 + 32 + addMargin;
-	renderText(renderer, tileSheet, 100, currentY, "FURNACES REFINE ASTEROIDS INTO FUEL\n");
+	renderText(renderer, tileSheet, x, currentY, "FURNACES REFINE ASTEROIDS INTO FUEL\n");
 	memset(tutorialGridCells, 0, sizeof(tutorialGridCells));
 	/* tutorialGridCells[0].type = '>'; */
 	/* tutorialGridCells[1].type = 'f'; */
@@ -1498,9 +1987,10 @@ static void renderFactoryGuide(SDL_Renderer* renderer, TileSheet* tileSheet)
 	tutorialGridCells[2].type = 'f';
 	tutorialGridCells[3].type = '>';
 	tutorialGridCells[4].type = 'g';
-	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, 120, currentY + 20 + 7, 0, 0);
+	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, x + 20, currentY + 20 + 7,
+	                             0, 0);
 	currentY += 20 + 32 + addMargin;
-	renderText(renderer, tileSheet, 100, currentY,
+	renderText(renderer, tileSheet, x, currentY,
 	           "FURNACES OUTPUT TO RANDOM ADJACENT OUTGOING CONVEYORS\n");
 	memset(tutorialGridCells, 0, sizeof(tutorialGridCells));
 	GridCellAt(&tutorialGrid, 1, 1).type = 'f';
@@ -1508,16 +1998,24 @@ static void renderFactoryGuide(SDL_Renderer* renderer, TileSheet* tileSheet)
 	GridCellAt(&tutorialGrid, 1, 0).type = 'V';
 	GridCellAt(&tutorialGrid, 1, 2).type = 'V';
 	GridCellAt(&tutorialGrid, 2, 1).type = '>';
-	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, 120, currentY + 20 + 7, 0, 0);
+	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, x + 20, currentY + 20 + 7,
+	                             0, 0);
 	currentY += 20 + (32 * 3) + addMargin;
-	renderText(renderer, tileSheet, 100, currentY, "ENGINES ONLY ACCEPT REFINED FUEL\n");
+	renderText(renderer, tileSheet, x, currentY, "ENGINES ONLY ACCEPT REFINED FUEL\n");
 	memset(tutorialGridCells, 0, sizeof(tutorialGridCells));
 	tutorialGridCells[0].type = 'L';
 	tutorialGridCells[1].type = '>';
 	tutorialGridCells[2].type = 'f';
 	tutorialGridCells[3].type = '>';
 	tutorialGridCells[4].type = 'r';
-	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, 120, currentY + 20 + 7, 0, 0);
+	renderGridSpaceFromTileSheet(renderer, tileSheet, &tutorialGrid, x + 20, currentY + 20 + 7,
+	                             0, 0);
+}
+
+static void renderFactoryGuide(SDL_Renderer* renderer, TileSheet* tileSheet)
+{
+	renderCachedPanel(renderer, tileSheet, hashText("FactoryGuide"), 100, 650, c_factoryGuideWidth,
+	                  c_factoryGuideHeight, drawFactoryGuide, NULL);
 }
 
 //
@@ -1573,6 +2071,8 @@ bool doMainMenu(SDL_Window* window, SDL_Renderer* renderer, TileSheet* tileSheet
 			{
 				return false;
 			}
+			if (event.type == SDL_RENDER_TARGETS_RESET)
+				textCacheClear(tileSheet->textCache);
 		}
 
 		const Uint8* currentKeyStates = SDL_GetKeyboardState(NULL);
@@ -1622,14 +2122,58 @@ bool doMainMenu(SDL_Window* window, SDL_Renderer* renderer, TileSheet* tileSheet
 				break;
 		}
 
-		SDL_RenderPresent(renderer);
+		spriteBatchPresent(tileSheet->batch);
 		SDL_UpdateWindowSurface(window);
 	}
 	return false;
 }
 
-static void addRenderDiagnostics(SDL_Renderer* renderer, float deltaTime,
-                                 int numSimulationUpdatesThisFrame)
+//
+// Frame budget
+//
+
+typedef struct FrameBudget
+{
+	// Totals for the session
+	float droppedSeconds;
+	unsigned int numStalls;
+	unsigned int numFramesOverBudget;
+
+	// Game seconds simulated per real second, 1 when keeping up. Measured over windows of
+	// c_timeDilationWindowSeconds
+	float timeDilation;
+	float windowRealSeconds;
+	float windowSimulatedSeconds;
+
+	// The most an autosave has held up the simulation thread
+	float longestAutosaveSeconds;
+} FrameBudget;
+
+static const float c_timeDilationWindowSeconds = 0.5f;
+
+// Throws away accumulated time beyond keepSeconds
+static void dropSimulationTime(FrameBudget* budget, float* accumulatedTime, float keepSeconds)
+{
+	if (*accumulatedTime <= keepSeconds)
+		return;
+	budget->droppedSeconds += *accumulatedTime - keepSeconds;
+	*accumulatedTime = keepSeconds;
+}
+
+static void updateTimeDilation(FrameBudget* budget, float realSeconds, float simulatedSeconds)
+{
+	budget->windowRealSeconds += realSeconds;
+	budget->windowSimulatedSeconds += simulatedSeconds;
+	if (budget->windowRealSeconds < c_timeDilationWindowSeconds)
+		return;
+	budget->timeDilation = budget->windowSimulatedSeconds / budget->windowRealSeconds;
+	budget->windowRealSeconds = 0.f;
+	budget->windowSimulatedSeconds = 0.f;
+}
+
+static void addRenderDiagnostics(SDL_Renderer* renderer, TileSheet* tileSheet, float deltaTime,
+                                 int numSimulationUpdatesThisFrame, const FrameBudget* budget,
+                                 const CullStats* cullStats)
 {
 #define NUM_FRAME_TIMES 256
 	// Not actually used, only the points are used currently
@@ -1654,133 +2198,753 @@ static void addRenderDiagnostics(SDL_Renderer* renderer, float deltaTime,
 	if (writeTimeIndex >= ARRAY_SIZE(s_frameTimes))
 		writeTimeIndex = 0;
 
+	// The graphs are drawn with SDL directly
+	spriteBatchFlush(tileSheet->batch);
 	SDL_SetRenderDrawColor(renderer, 10, 240, 10, 255);
 	SDL_RenderDrawPointsF(renderer, s_frameRateGraph, ARRAY_SIZE(s_frameRateGraph));
 
-	SDL_SetRenderDrawColor(renderer, 10, 240, 240, 255);
-	SDL_RenderDrawPointsF(renderer, s_simulationUpdateGraph, ARRAY_SIZE(s_simulationUpdateGraph));
+	SDL_SetRenderDrawColor(renderer, 10, 240, 240, 255);
+	SDL_RenderDrawPointsF(renderer, s_simulationUpdateGraph, ARRAY_SIZE(s_simulationUpdateGraph));
+
+	SDL_SetRenderDrawColor(renderer, 240, 10, 10, 255);
+	const SDL_Point sixtyHertzLine[] = {{marginX, graphHeight},
+	                                    {graphWidth + marginX, graphHeight}};
+	SDL_RenderDrawLines(renderer, sixtyHertzLine, ARRAY_SIZE(sixtyHertzLine));
+
+	const int textX = graphWidth + (marginX * 4);
+	renderText(renderer, tileSheet, textX, 100, "SPEED PERCENT");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 100,
+	             (unsigned int)((budget->timeDilation * 100.f) + 0.5f));
+	renderText(renderer, tileSheet, textX, 125, "DROPPED MS");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 125,
+	             (unsigned int)(budget->droppedSeconds * 1000.f));
+	renderText(renderer, tileSheet, textX, 150, "SLOW FRAMES");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 150,
+	             budget->numFramesOverBudget);
+	renderText(renderer, tileSheet, textX, 175, "STALLS");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 175, budget->numStalls);
+	renderText(renderer, tileSheet, textX, 200, "AUTOSAVE US");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 200,
+	             (unsigned int)(budget->longestAutosaveSeconds * 1000000.f));
+	renderText(renderer, tileSheet, textX, 225, "SUBMISSIONS");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 225,
+	             tileSheet->batch->lastFrameNumSubmissions);
+	renderText(renderer, tileSheet, textX, 250, "QUADS");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 250,
+	             tileSheet->batch->lastFrameNumQuads);
+	renderText(renderer, tileSheet, textX, 275, "DRAWN");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 275, cullStats->numDrawn);
+	renderText(renderer, tileSheet, textX, 300, "CULLED");
+	renderNumber(renderer, tileSheet, textX + (c_scaledFontWidth * 14), 300, cullStats->numCulled);
+}
+
+typedef enum GameplayResult
+{
+	GameplayResult_ExitGame,
+	GameplayResult_StartNewGame,
+} GameplayResult;
+
+// Recording and playback follow the session from its seed, so they stop when it jumps somewhere
+// else (loading a snapshot, rewinding)
+static void stopReplaysBeforeJump(SimulationState* simulation, ReplayWriter** recorder,
+                                  ReplayReader** replay)
+{
+	if (*recorder)
+	{
+		fprintf(stderr, "Stopped recording the replay because the session jumped\n");
+		replayWriterClose(*recorder, simulation->tick, simulationStateHash(simulation));
+		*recorder = NULL;
+	}
+	if (*replay)
+	{
+		fprintf(stderr, "Stopped playing the replay because the session jumped\n");
+		replayReaderClose(*replay);
+		*replay = NULL;
+	}
+}
+
+//
+// Simulation thread
+//
+
+// The fixed-step simulation runs on its own thread so that presenting a frame (which blocks with
+// vsync) never holds up a tick, and a slow tick never holds up a frame. The render thread only sees
+// snapshots the simulation publishes, and only talks back through a command queue
+
+// Everything the render thread needs of one simulated moment. The simulation thread fills one in
+// and never touches it again until the render thread has swapped it back
+typedef struct RenderSnapshot
+{
+	SimulationState state;
+	MiniMapPreparation miniMap;
+	ObjectGrid objectGrid;
+	// Prepare the object grid and, when asked for, the minimap
+	JobStage preparationStages[1 + NUM_MINI_MAP_STAGES];
+	// The simulation was this far past state.tick at publishedCounterTicks. Positions are
+	// extrapolated forward from there using the velocities in state
+	float accumulatedTime;
+	Uint64 publishedCounterTicks;
+	// Stop extrapolating, e.g. while rewinding or waiting for the other player
+	bool isPaused;
+	bool isPlayingReplay;
+	// Since the session started. Counts rather than flags, so the render thread can't miss one
+	// which happened in a snapshot it never saw
+	unsigned int numPhasesFailed;
+	FrameBudget frameBudget;
+} RenderSnapshot;
+
+#define SNAPSHOT_FRESH_BIT 4
+
+// Lock-free triple buffer. The simulation fills its back snapshot then swaps it for the middle
+// one; the render thread swaps its front snapshot for the middle one whenever the middle one is
+// fresh. Neither ever waits for the other, and the render thread always has a complete snapshot
+typedef struct SnapshotTripleBuffer
+{
+	RenderSnapshot snapshots[3];
+	// Index of the middle snapshot, with SNAPSHOT_FRESH_BIT set if the render thread hasn't seen it
+	volatile int32_t middle;
+	// Only the simulation thread uses this
+	int back;
+	// Only the render thread uses this
+	int front;
+} SnapshotTripleBuffer;
+
+typedef enum SimulationCommandType
+{
+	// Held until the next one
+	SimulationCommand_EngineInput,
+	SimulationCommand_Edit,
+	SimulationCommand_SkipPhase,
+	SimulationCommand_QuickSave,
+	SimulationCommand_QuickLoad,
+	// Jump back rewindSeconds. The simulation stays paused until SimulationCommand_Resume
+	SimulationCommand_Rewind,
+	SimulationCommand_Resume,
+} SimulationCommandType;
+
+typedef struct SimulationCommand
+{
+	SimulationCommandType type;
+	// When it happened, on the performance counter. It applies to the first tick which ends after
+	// this. 0 means when it was pushed
+	Uint64 counterTicks;
+	unsigned char engineInput;
+	float rewindSeconds;
+	EditCommand edit;
+} SimulationCommand;
+
+#define COMMAND_QUEUE_SIZE 256
+
+// Single producer (render thread), single consumer (simulation thread) ring. Lock-free; a full
+// queue drops the command rather than waiting
+typedef struct CommandQueue
+{
+	SimulationCommand commands[COMMAND_QUEUE_SIZE];
+	// Only the render thread writes this
+	volatile int32_t head;
+	// Only the simulation thread writes this
+	volatile int32_t tail;
+} CommandQueue;
+
+typedef struct SimulationThread
+{
+	SimulationState state;
+	JobSystem* jobs;
+	NetplaySession* netplay;
+	int localPlayer;
+	ReplayReader* replay;
+	ReplayWriter* recorder;
+	RewindBuffer rewind;
+	bool hasRewind;
+	Autosave autosave;
+	bool hasAutosave;
+
+	SnapshotTripleBuffer snapshots;
+	CommandQueue commands;
+	volatile int32_t isQuitting;
+	// Set by the render thread while it waits for a minimap refresh. Building the heatmap every
+	// publish would mostly go to waste, since it's only redrawn a few times a second
+	volatile int32_t isMiniMapRefreshDue;
+	Thread thread;
+
+	// Only the simulation thread touches these while it runs
+	SimulationInput pendingInput;
+	unsigned char localEngineInput;
+	float accumulatedTime;
+	bool isRewinding;
+	bool isWaitingForPeer;
+	unsigned int numPhasesFailed;
+	FrameBudget frameBudget;
+	unsigned int lastAutosaveTick;
+} SimulationThread;
+
+static bool pushSimulationCommand(CommandQueue* queue, SimulationCommand* command)
+{
+	int32_t head = queue->head;
+	if (head - atomicLoad(&queue->tail) >= COMMAND_QUEUE_SIZE)
+		return false;
+	queue->commands[head % COMMAND_QUEUE_SIZE] = *command;
+	if (!command->counterTicks)
+		queue->commands[head % COMMAND_QUEUE_SIZE].counterTicks = SDL_GetPerformanceCounter();
+	atomicStore(&queue->head, head + 1);
+	return true;
+}
+
+// The command stays at the front of the queue until popped, so it can be left for later
+static SimulationCommand* peekSimulationCommand(CommandQueue* queue)
+{
+	int32_t tail = queue->tail;
+	if (tail == atomicLoad(&queue->head))
+		return NULL;
+	return &queue->commands[tail % COMMAND_QUEUE_SIZE];
+}
+
+static void popSimulationCommand(CommandQueue* queue)
+{
+	atomicStore(&queue->tail, queue->tail + 1);
+}
+
+static void publishSnapshot(SimulationThread* thread)
+{
+	SnapshotTripleBuffer* buffer = &thread->snapshots;
+	RenderSnapshot* snapshot = &buffer->snapshots[buffer->back];
+	// Preparing only reads the state, so it can happen while the state is copied
+	JobStage* stages = snapshot->preparationStages;
+	memset(stages, 0, sizeof(snapshot->preparationStages));
+	setUpObjectGridStage(&snapshot->objectGrid, &thread->state, &stages[0]);
+	int numStages = 1;
+	snapshot->miniMap.isPrepared = atomicLoad(&thread->isMiniMapRefreshDue) != 0;
+	if (snapshot->miniMap.isPrepared)
+	{
+		setUpMiniMapStages(&snapshot->miniMap, &thread->state, thread->localPlayer,
+		                   &stages[numStages]);
+		numStages += NUM_MINI_MAP_STAGES;
+	}
+	jobSystemBeginGraph(thread->jobs, stages, numStages);
+	memcpy(&snapshot->state, &thread->state, sizeof(SimulationState));
+	snapshot->accumulatedTime = thread->accumulatedTime;
+	snapshot->publishedCounterTicks = SDL_GetPerformanceCounter();
+	snapshot->isPaused = thread->isRewinding || thread->isWaitingForPeer;
+	snapshot->isPlayingReplay = thread->replay != NULL;
+	snapshot->numPhasesFailed = thread->numPhasesFailed;
+	snapshot->frameBudget = thread->frameBudget;
+	jobSystemWaitGraph(thread->jobs);
+	// The preparations point at the live state, which the render thread must not see
+	snapshot->miniMap.simulation = &snapshot->state;
+	snapshot->objectGrid.simulation = &snapshot->state;
+
+	buffer->back = atomicExchange(&buffer->middle, buffer->back | SNAPSHOT_FRESH_BIT) &
+	               ~SNAPSHOT_FRESH_BIT;
+}
+
+// Returns the newest snapshot. It stays valid until the next call
+static const RenderSnapshot* acquireSnapshot(SnapshotTripleBuffer* buffer)
+{
+	if (atomicLoad(&buffer->middle) & SNAPSHOT_FRESH_BIT)
+		buffer->front = atomicExchange(&buffer->middle, buffer->front) & ~SNAPSHOT_FRESH_BIT;
+	return &buffer->snapshots[buffer->front];
+}
+
+// Handles commands which happened before untilCounterTicks. Later ones are left for a later tick.
+// Returns whether the simulation jumped somewhere else, so a new snapshot is needed even if it
+// doesn't tick
+static bool processSimulationCommands(SimulationThread* thread, Uint64 untilCounterTicks)
+{
+	SimulationState* simulation = &thread->state;
+	SimulationInput* pendingInput = &thread->pendingInput;
+	bool jumped = false;
+	SimulationCommand* command;
+	while ((command = peekSimulationCommand(&thread->commands)) &&
+	       command->counterTicks <= untilCounterTicks)
+	{
+		switch (command->type)
+		{
+			case SimulationCommand_EngineInput:
+				thread->localEngineInput = command->engineInput;
+				break;
+			case SimulationCommand_Edit:
+			{
+				int maxEdits =
+				    thread->netplay ? MAX_EDITS_PER_PLAYER : ARRAY_SIZE(pendingInput->edits);
+				// Leave it for the next tick
+				if (pendingInput->numEdits >= maxEdits)
+					return jumped;
+				if (!thread->replay)
+					pendingInput->edits[pendingInput->numEdits++] = command->edit;
+				break;
+			}
+			case SimulationCommand_SkipPhase:
+				if (!thread->replay)
+					pendingInput->skipPhase = true;
+				break;
+			case SimulationCommand_QuickSave:
+				snapshotSave(simulation, c_quickSaveFilename);
+				break;
+			case SimulationCommand_QuickLoad:
+			{
+				SnapshotMapping quickSave;
+				if (thread->netplay || !snapshotMap(&quickSave, c_quickSaveFilename))
+					break;
+				stopReplaysBeforeJump(simulation, &thread->recorder, &thread->replay);
+				memcpy(simulation, quickSave.state, sizeof(SimulationState));
+				snapshotUnmap(&quickSave);
+				pendingInput->numEdits = 0;
+				thread->accumulatedTime = 0.f;
+				jumped = true;
+				break;
+			}
+			case SimulationCommand_Rewind:
+			{
+				if (!thread->hasRewind)
+					break;
+				unsigned int ticksToRewind =
+				    (unsigned int)(command->rewindSeconds * simulation->ticksPerSecond) + 1;
+				unsigned int oldestTick = rewindOldestTick(&thread->rewind);
+				unsigned int targetTick = simulation->tick > oldestTick + ticksToRewind ?
+				                              simulation->tick - ticksToRewind :
+				                              oldestTick;
+				stopReplaysBeforeJump(simulation, &thread->recorder, &thread->replay);
+				rewindTo(&thread->rewind, simulation, targetTick);
+				pendingInput->numEdits = 0;
+				thread->isRewinding = true;
+				jumped = true;
+				break;
+			}
+			case SimulationCommand_Resume:
+				thread->isRewinding = false;
+				jumped = true;
+				break;
+		}
+		popSimulationCommand(&thread->commands);
+	}
+	return jumped;
+}
+
+// Returns SimulationEvent flags, or 0 if the tick couldn't happen yet
+static unsigned int tickSimulationThread(SimulationThread* thread, double nowSeconds)
+{
+	SimulationState* simulation = &thread->state;
+	SimulationInput* pendingInput = &thread->pendingInput;
+	if (thread->replay && !replayReaderNextTick(thread->replay, simulation->tick, pendingInput))
+	{
+		// Hand control back to the player once the recording runs out
+		if (thread->replay->isCorrupt)
+			fprintf(stderr, "Replay was cut short or is corrupt\n");
+		else if (thread->replay->finalStateHash != simulationStateHash(simulation))
+			fprintf(stderr, "Replay desynced from the recorded session\n");
+		else
+			fprintf(stderr, "Replay finished and matched the recorded session\n");
+		replayReaderClose(thread->replay);
+		thread->replay = NULL;
+	}
+	if (!thread->replay)
+		pendingInput->engineInput[thread->localPlayer] = thread->localEngineInput;
+
+	unsigned int events = 0;
+	if (thread->netplay)
+	{
+		PlayerInput localInput = {0};
+		localInput.engineInput = pendingInput->engineInput[thread->localPlayer];
+		localInput.skipPhase = pendingInput->skipPhase;
+		localInput.numEdits = pendingInput->numEdits;
+		memcpy(localInput.edits, pendingInput->edits, sizeof(localInput.edits));
+		thread->isWaitingForPeer =
+		    !netplayAdvance(thread->netplay, simulation, &localInput, nowSeconds, &events);
+		if (thread->isWaitingForPeer)
+			return 0;
+	}
+	else
+	{
+		if (thread->recorder)
+			replayWriterRecordTick(thread->recorder, simulation->tick, pendingInput);
+		if (thread->hasRewind)
+			rewindRecordTick(&thread->rewind, simulation, pendingInput);
+		events = simulationTickWithJobs(simulation, pendingInput, thread->jobs);
+	}
+
+	// Only deliver these once
+	pendingInput->numEdits = 0;
+	pendingInput->skipPhase = false;
+	return events;
+}
+
+static void simulationThreadMain(void* userData)
+{
+	SimulationThread* thread = (SimulationThread*)userData;
+	SimulationState* simulation = &thread->state;
+	FrameBudget* frameBudget = &thread->frameBudget;
+	const Uint64 performanceNumTicksPerSecond = SDL_GetPerformanceFrequency();
+	Uint64 lastCounterTicks = SDL_GetPerformanceCounter();
+	while (!atomicLoad(&thread->isQuitting))
+	{
+		Uint64 currentCounterTicks = SDL_GetPerformanceCounter();
+		float deltaTime =
+		    (currentCounterTicks - lastCounterTicks) / (float)performanceNumTicksPerSecond;
+		lastCounterTicks = currentCounterTicks;
+		thread->accumulatedTime += deltaTime;
+		if (thread->accumulatedTime > c_maxCatchUpSeconds)
+		{
+			++frameBudget->numStalls;
+			dropSimulationTime(frameBudget, &thread->accumulatedTime, c_maxCatchUpSeconds);
+		}
+		double nowSeconds = currentCounterTicks / (double)performanceNumTicksPerSecond;
+
+		// Corrects any predictions of the other player's input which turned out wrong
+		if (thread->netplay)
+			netplayPoll(thread->netplay, simulation, nowSeconds);
+
+		bool wasWaitingForPeer = thread->isWaitingForPeer;
+		bool needsSnapshot = false;
+		int numTicks = 0;
+		while (thread->accumulatedTime >= simulation->secondsPerTick)
+		{
+			// Always tick at least once so the game never stops outright. Keep the part of a tick
+			// which is left so extrapolation stays smooth
+			float simulationSeconds = (SDL_GetPerformanceCounter() - currentCounterTicks) /
+			                          (float)performanceNumTicksPerSecond;
+			if (numTicks && simulationSeconds > c_maxSimulationSecondsPerFrame)
+			{
+				++frameBudget->numFramesOverBudget;
+				dropSimulationTime(frameBudget, &thread->accumulatedTime,
+				                   fmodf(thread->accumulatedTime, simulation->secondsPerTick));
+				break;
+			}
+
+			// The tick being caught up on ended this long ago. Input from before then belongs to
+			// it, even when a slow frame delivered it together with later input
+			Uint64 tickEndCounterTicks =
+			    currentCounterTicks -
+			    (Uint64)((thread->accumulatedTime - simulation->secondsPerTick) *
+			             performanceNumTicksPerSecond);
+			needsSnapshot |= processSimulationCommands(thread, tickEndCounterTicks);
+			// Jumps restart the clock
+			if (thread->isRewinding || thread->accumulatedTime < simulation->secondsPerTick)
+				break;
+
+			unsigned int events = tickSimulationThread(thread, nowSeconds);
+			if (thread->isWaitingForPeer)
+			{
+				// Catching up all at once later would only put us further ahead of them
+				thread->accumulatedTime = 0.f;
+				break;
+			}
+			if (events & SimulationEvent_PhaseFailed)
+				++thread->numPhasesFailed;
+			++numTicks;
+			thread->accumulatedTime -= simulation->secondsPerTick;
+		}
+		updateTimeDilation(frameBudget, deltaTime, numTicks * simulation->secondsPerTick);
+
+		// The rest happened after the last tick ended, so it belongs to the next one. Jumps still
+		// need handling while nothing ticks
+		needsSnapshot |= processSimulationCommands(thread, currentCounterTicks);
+		// Don't simulate forward again until the rewind key is released
+		if (thread->isRewinding)
+			thread->accumulatedTime = 0.f;
+
+		// Jumps start the wait for the next autosave over. Replays aren't the player's game, so
+		// they never replace its autosave
+		if (needsSnapshot)
+			thread->lastAutosaveTick = simulation->tick;
+		if (thread->hasAutosave && !thread->replay && !thread->isRewinding &&
+		    simulation->tick - thread->lastAutosaveTick >=
+		        (unsigned int)(c_autosaveDefaultIntervalSeconds * simulation->ticksPerSecond))
+		{
+			Uint64 autosaveStartCounterTicks = SDL_GetPerformanceCounter();
+			autosaveRequest(&thread->autosave, simulation);
+			float autosaveSeconds = (SDL_GetPerformanceCounter() - autosaveStartCounterTicks) /
+			                        (float)performanceNumTicksPerSecond;
+			if (autosaveSeconds > frameBudget->longestAutosaveSeconds)
+				frameBudget->longestAutosaveSeconds = autosaveSeconds;
+			thread->lastAutosaveTick = simulation->tick;
+		}
+
+		if (numTicks || needsSnapshot || wasWaitingForPeer != thread->isWaitingForPeer)
+			publishSnapshot(thread);
+
+		// Sleep until the next tick is due. Netplay needs polling more often than that
+		float secondsUntilTick = simulation->secondsPerTick - thread->accumulatedTime;
+		if (thread->netplay && secondsUntilTick > c_netplayPollSeconds)
+			secondsUntilTick = c_netplayPollSeconds;
+		if (secondsUntilTick > 0.f)
+			threadSleep(secondsUntilTick);
+		else
+			threadYield();
+	}
+}
+
+// Takes ownership of the state and everything else the session uses until
+// stopSimulationThread()
+static bool startSimulationThread(SimulationThread* thread)
+{
+	thread->snapshots.front = 0;
+	thread->snapshots.middle = 1;
+	thread->snapshots.back = 2;
+	thread->commands.head = 0;
+	thread->commands.tail = 0;
+	thread->isQuitting = 0;
+	thread->isMiniMapRefreshDue = 1;
+	memset(&thread->pendingInput, 0, sizeof(thread->pendingInput));
+	thread->localEngineInput = 0;
+	thread->accumulatedTime = 0.f;
+	thread->isRewinding = false;
+	thread->isWaitingForPeer = false;
+	thread->numPhasesFailed = 0;
+	memset(&thread->frameBudget, 0, sizeof(thread->frameBudget));
+	thread->frameBudget.timeDilation = 1.f;
+	thread->lastAutosaveTick = thread->state.tick;
+
+	// So the render thread has something to draw straight away
+	publishSnapshot(thread);
+	acquireSnapshot(&thread->snapshots);
+	return threadCreate(&thread->thread, simulationThreadMain, thread);
+}
+
+static void stopSimulationThread(SimulationThread* thread)
+{
+	atomicStore(&thread->isQuitting, 1);
+	threadJoin(&thread->thread);
+}
+
+//
+// Input
+//
+
+typedef struct EngineKey
+{
+	SDL_Scancode scancode;
+	unsigned char engineInput;
+} EngineKey;
+
+static const EngineKey c_engineKeys[] = {
+    {SDL_SCANCODE_W, EngineInput_Up},    {SDL_SCANCODE_UP, EngineInput_Up},
+    {SDL_SCANCODE_S, EngineInput_Down},  {SDL_SCANCODE_DOWN, EngineInput_Down},
+    {SDL_SCANCODE_A, EngineInput_Left},  {SDL_SCANCODE_LEFT, EngineInput_Left},
+    {SDL_SCANCODE_D, EngineInput_Right}, {SDL_SCANCODE_RIGHT, EngineInput_Right}};
+
+// keysDown has a bit for each of c_engineKeys. Applies the key event, if there is one, and returns
+// the engine input the keys now down add up to
+static unsigned char updateEngineKeys(unsigned char* keysDown, const SDL_KeyboardEvent* key)
+{
+	unsigned char engineInput = 0;
+	for (int i = 0; i < ARRAY_SIZE(c_engineKeys); ++i)
+	{
+		if (key && key->keysym.scancode == c_engineKeys[i].scancode)
+		{
+			if (key->type == SDL_KEYDOWN)
+				*keysDown |= 1 << i;
+			else
+				*keysDown &= ~(1 << i);
+		}
+		if (*keysDown & (1 << i))
+			engineInput |= c_engineKeys[i].engineInput;
+	}
+	return engineInput;
+}
 
-	SDL_SetRenderDrawColor(renderer, 240, 10, 10, 255);
-	const SDL_Point sixtyHertzLine[] = {{marginX, graphHeight},
-	                                    {graphWidth + marginX, graphHeight}};
-	SDL_RenderDrawLines(renderer, sixtyHertzLine, ARRAY_SIZE(sixtyHertzLine));
+// SDL stamps events in milliseconds since it started. The simulation thread keeps time with the
+// performance counter
+static Uint64 eventCounterTicks(Uint32 eventTimestamp)
+{
+	Uint64 nowCounterTicks = SDL_GetPerformanceCounter();
+	Uint64 millisecondsAgo = (Uint32)(SDL_GetTicks() - eventTimestamp);
+	Uint64 counterTicksAgo = (millisecondsAgo * SDL_GetPerformanceFrequency()) / 1000;
+	return counterTicksAgo < nowCounterTicks ? nowCounterTicks - counterTicksAgo : nowCounterTicks;
 }
 
-typedef enum GameplayResult
+// Returns false if the player gave up waiting
+static bool waitForNetplayConnection(SDL_Renderer* renderer, TileSheet* tileSheet,
+                                     NetplaySession* netplay, SimulationState* simulation)
 {
-	GameplayResult_ExitGame,
-	GameplayResult_StartNewGame,
-} GameplayResult;
+	const Uint64 performanceNumTicksPerSecond = SDL_GetPerformanceFrequency();
+	while (!netplay->isConnected)
+	{
+		SDL_Event event;
+		while (SDL_PollEvent((&event)))
+		{
+			if ((event.type == SDL_QUIT))
+				return false;
+		}
+		if (SDL_GetKeyboardState(NULL)[SDL_SCANCODE_ESCAPE])
+			return false;
+
+		netplayPoll(netplay, simulation,
+		            SDL_GetPerformanceCounter() / (double)performanceNumTicksPerSecond);
+
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		renderText(renderer, tileSheet, 100, 100,
+		           netplay->localPlayer == 0 ? "WAITING FOR PLAYER 2 TO JOIN" :
+		                                       "JOINING PLAYER 1");
+		spriteBatchPresent(tileSheet->batch);
+		SDL_Delay(10);
+	}
+	return true;
+}
 
-GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet tileSheet)
+typedef struct GameOptions
+{
+	int simulationTicksPerSecond;
+	// Saves each session so it can be reproduced. A new game overwrites the last one
+	const char* recordReplayFilename;
+	// Plays a recorded session instead of reading the player's input
+	const char* playReplayFilename;
+	// Play co-op with another instance of the game. NULL for single player
+	const NetplayOptions* netplay;
+	// Higher is smoother, lower is cheaper on big fleets
+	float miniMapRefreshesPerSecond;
+} GameOptions;
+
+GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet* tileSheet,
+                          const GameOptions* options, JobSystem* jobs)
 {
 	int windowWidth;
 	int windowHeight;
 	SDL_GetRendererOutputSize(renderer, &windowWidth, &windowHeight);
 
-	// Make some grids
-	GridSpace playerShipData = {0};
-	playerShipData.width = 18;
-	playerShipData.height = 7;
-	GridCell playerShipCells[18 * 7] = {0};
-	playerShipData.data = playerShipCells;
-	GridSpace* playerShip = &playerShipData;
+	// Too big for the stack
+	static SimulationThread simulationThreadData;
+	SimulationThread* simulationThread = &simulationThreadData;
+	SimulationState* simulation = &simulationThread->state;
+
+	// Rollbacks rewrite history, so replays and developer time travel are single player only
+	NetplaySession netplayData;
+	NetplaySession* netplay = NULL;
+	int localPlayer = c_playerShipIndex;
+	if (options->netplay)
+	{
+		if (options->recordReplayFilename || options->playReplayFilename)
+			fprintf(stderr, "Replays are not supported in co-op. Ignoring them\n");
+		NetplayOptions netplayOptions = *options->netplay;
+		netplayOptions.seed = (uint64_t)time(NULL);
+		netplayOptions.ticksPerSecond = options->simulationTicksPerSecond;
+		if (!netplayOpen(&netplayData, &netplayOptions))
+		{
+			fprintf(stderr, "Could not start co-op\n");
+			return GameplayResult_ExitGame;
+		}
+		netplay = &netplayData;
+		localPlayer = netplay->localPlayer;
+		if (!waitForNetplayConnection(renderer, tileSheet, netplay, simulation))
+		{
+			netplayClose(netplay);
+			return GameplayResult_ExitGame;
+		}
+	}
+
+	ReplayReader replayData;
+	ReplayReader* replay = NULL;
+	ReplayWriter recorderData;
+	ReplayWriter* recorder = NULL;
+	if (!netplay)
 	{
-		setGridSpaceFromString(playerShip,
-		                       "#######d##########"
-		                       "#......A.........#"
-		                       "l<<<<<<f<<<<<<<<<R"
-		                       "l<<<<<<<<<<f<<<<<R"
-		                       "#..........V.....#"
-		                       "#..........>>>>>>r"
-		                       "#######u##########");
+		uint64_t seed = (uint64_t)time(NULL);
+		int ticksPerSecond = options->simulationTicksPerSecond;
+		int numPlayers = 1;
+		if (options->playReplayFilename &&
+		    replayReaderOpen(&replayData, options->playReplayFilename))
+		{
+			replay = &replayData;
+			seed = replay->seed;
+			ticksPerSecond = replay->ticksPerSecond;
+			numPlayers = replay->numPlayers;
+		}
 
-		renderGridSpaceText(playerShip);
+		simulationInitialize(simulation, seed, ticksPerSecond, numPlayers);
+
+		if (options->recordReplayFilename &&
+		    replayWriterOpen(&recorderData, options->recordReplayFilename, seed, ticksPerSecond,
+		                     numPlayers))
+			recorder = &recorderData;
+	}
+
+	// The simulation's stages and the minimap spread across the cores. Without threads, everything
+	// just runs on the simulation thread
+	simulationThread->jobs = jobs;
+	simulationThread->netplay = netplay;
+	simulationThread->localPlayer = localPlayer;
+	simulationThread->replay = replay;
+	simulationThread->recorder = recorder;
+	simulationThread->hasRewind =
+	    enableDeveloperOptions && !netplay &&
+	    rewindInitialize(&simulationThread->rewind, simulation->ticksPerSecond, c_rewindSeconds,
+	                     c_rewindMaxMemoryBytes);
+	simulationThread->hasAutosave =
+	    autosaveInitialize(&simulationThread->autosave, c_autosaveFilename);
+	if (!startSimulationThread(simulationThread))
+	{
+		fprintf(stderr, "Could not start the simulation thread\n");
+		if (simulationThread->hasRewind)
+			rewindDestroy(&simulationThread->rewind);
+		if (simulationThread->hasAutosave)
+			autosaveDestroy(&simulationThread->autosave);
+		if (recorder)
+			replayWriterClose(recorder, simulation->tick, simulationStateHash(simulation));
+		if (replay)
+			replayReaderClose(replay);
+		if (netplay)
+			netplayClose(netplay);
+		return GameplayResult_ExitGame;
 	}
-	RigidBody playerPhys = SpawnPlayerPhys();
+	// From here on, the render thread only reads snapshots
+	const RenderSnapshot* snapshot = acquireSnapshot(&simulationThread->snapshots);
+	simulation = (SimulationState*)&snapshot->state;
+
+	GridSpace playerShipData = shipGridSpace(simulation, &simulation->ships[localPlayer]);
+	GridSpace* playerShip = &playerShipData;
+	renderGridSpaceText(playerShip);
+	RigidBody* playerPhys = &simulation->ships[localPlayer].body;
 	// snap the camera to the player postion
 	Camera camera;
-	camera.x = playerPhys.position.x - (windowWidth / 2) + (playerShipData.width * c_tileSize) / 2;
+	camera.x = playerPhys->position.x - (windowWidth / 2) + (playerShipData.width * c_tileSize) / 2;
 	camera.y =
-	    playerPhys.position.y - (windowHeight / 2) + (playerShipData.height * c_tileSize) / 2;
+	    playerPhys->position.y - (windowHeight / 2) + (playerShipData.height * c_tileSize) / 2;
 	camera.w = windowWidth;
 	camera.h = windowHeight;
+	StarField starField = {0};
+	// Snapshots are read only, so the star field rolls its own copy
+	RandomState starRandom = simulation->cosmeticRandom;
+	char selectedEditButton = 0;
+	// Too big for the stack. Without render targets, ships are drawn a cell at a time
+	static ShipLayerCache shipLayers;
+	// The rasterizer can't draw from layer textures either
+	bool useShipLayers = SDL_RenderTargetSupported(renderer) && !tileSheet->batch->software;
+	CullStats cullStats = {0};
+	MiniMap miniMap;
+	miniMapInitialize(renderer, &miniMap, options->miniMapRefreshesPerSecond);
 
-	srand(time(NULL));
-
-	Goal goal;
-	goal.x = rand() % c_spaceSize;
-	goal.y = rand() % c_spaceSize;
-	goal.w = c_goalSize;
-	goal.h = c_goalSize;
-
-	typedef enum Objective
-	{
-		Objective_None,
-		// This does some weird stuff like hide the HUD, so use with caution
-		Objective_ShipConstruct,
-		Objective_ReachGoalPoint,
-	} Objective;
-	typedef struct GamePhase
-	{
-		const char* prompt;
-		int timeToCompleteSeconds;
-		Objective objective;
-	} GamePhase;
-	GamePhase gamePhases[] = {
-	    {"CONSTRUCT YOUR SHIP", 60 + 30, Objective_ShipConstruct},
-	    {"ENEMY RADAR SIGNAL DETECTED", 10, Objective_None},
-	    {"REACH GREEN AREA 1", 30, Objective_ReachGoalPoint},
-	    {"REACH GREEN AREA 2", 25, Objective_ReachGoalPoint},
-	    {"ENEMY RADAR IN COOLDOWN", 5, Objective_None},
-	    {"REFIT YOUR SHIP", 30, Objective_None},
-	    {"REACH GREEN AREA 3", 15, Objective_ReachGoalPoint},
-	    {"REACH GREEN AREA 4", 10, Objective_ReachGoalPoint},
-	    {"REACH GREEN AREA 5", 5, Objective_ReachGoalPoint},
-	};
-	int currentGamePhase = 0;
 	const Uint64 performanceNumTicksPerSecond = SDL_GetPerformanceFrequency();
-	Uint64 gamePhaseStartTicks = SDL_GetPerformanceCounter();
-	int startPhaseSeconds = gamePhaseStartTicks / performanceNumTicksPerSecond;
-	unsigned char numDamagesSustained = 0;
 	float timeSinceFailedPhase = 0.f;
 	float timeSinceFailedPhaseDamage = 0.f;
-
-	// Make some objects
-	memset(objects, 0, sizeof(objects));
-	for (int i = 0; i < c_numObjectsToCreate; ++i)
-	{
-		Object* object = &objects[i];
-		object->type = 'a';
-		object->body.position.x = (float)(rand() % c_spaceSize);
-		object->body.position.y = (float)(rand() % c_spaceSize);
-		object->body.velocity.x = (float)((rand() % 50) - 25);
-		object->body.velocity.y = (float)((rand() % 50) - 25);
-	}
-
-	// Player inventory (MUST MATCH size of editor buttons)
-	unsigned short inventory[] = {/*'#'=*/100, /*'.'=*/999, /*'<'=*/100, /*'>'=*/100,
-	                              /*'A'=*/100, /*'V'=*/100, /*'f'=*/8,   /*'L'=*/8,
-	                              /*'R'=*/8,   /*'U'=*/8,   /*'D'=*/8,
-	                              /*'l'=*/4,   /*'r'=*/4,   /*'u'=*/4,   /*'d'=*/4};
-
-	// Enough to fuel two engines per side
-	float constructionFuelPool = 4 * 2 * c_defaultStartFuel;
+	unsigned int numPhasesFailedSeen = 0;
+	unsigned int lastRenderedTick = simulation->tick;
 
 	// Main loop
 	bool enableDebugUI = false;
 	bool isPhaseSkipPressed = false;
-	float accumulatedTime = 0.f;
+	bool isQuickSavePressed = false;
+	bool isQuickLoadPressed = false;
+	bool isRewindPressed = false;
+	// From key events rather than the keyboard state, so a tap between two frames isn't missed
+	unsigned char engineKeysDown = 0;
+	for (int i = 0; i < ARRAY_SIZE(c_engineKeys); ++i)
+	{
+		if (SDL_GetKeyboardState(NULL)[c_engineKeys[i].scancode])
+			engineKeysDown |= 1 << i;
+	}
+	unsigned char engineInput = updateEngineKeys(&engineKeysDown, NULL);
+	unsigned char lastSentEngineInput = 0;
 	float startPromptTimeToTypeOut = 0.f;
 	Uint64 lastFrameNumTicks = SDL_GetPerformanceCounter();
 	const char* exitReason = NULL;
-	while (!(exitReason))
+	bool startNewGame = false;
+	while (!(exitReason) && !startNewGame)
 	{
 		Uint64 currentCounterTicks = SDL_GetPerformanceCounter();
 		Uint64 frameDiffTicks = (currentCounterTicks - lastFrameNumTicks);
 		lastFrameNumTicks = currentCounterTicks;
 		float deltaTime = (frameDiffTicks / ((float)performanceNumTicksPerSecond));
-		accumulatedTime += deltaTime;
+		CommandQueue* commands = &simulationThread->commands;
 
 		SDL_Event event;
 		while (SDL_PollEvent((&event)))
@@ -1789,6 +2953,36 @@ GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet
 			{
 				exitReason = "Window event";
 			}
+			if (event.type == SDL_RENDER_TARGETS_RESET)
+			{
+				invalidateShipLayers(&shipLayers);
+				invalidateMiniMap(&miniMap);
+				textCacheClear(tileSheet->textCache);
+			}
+			if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat)
+			{
+				unsigned char newEngineInput = updateEngineKeys(&engineKeysDown, &event.key);
+				if (newEngineInput == engineInput)
+					continue;
+				engineInput = newEngineInput;
+				// Stamped with when it happened, so the simulation can apply it on the tick it
+				// happened during rather than whichever one comes after this frame
+				SimulationCommand command = {0};
+				command.type = SimulationCommand_EngineInput;
+				command.counterTicks = eventCounterTicks(event.key.timestamp);
+				command.engineInput = engineInput;
+				if (pushSimulationCommand(commands, &command))
+					lastSentEngineInput = engineInput;
+			}
+		}
+		// Only if the queue was full. Late is better than never
+		if (engineInput != lastSentEngineInput)
+		{
+			SimulationCommand command = {0};
+			command.type = SimulationCommand_EngineInput;
+			command.engineInput = engineInput;
+			if (pushSimulationCommand(commands, &command))
+				lastSentEngineInput = engineInput;
 		}
 		SDL_GetRendererOutputSize(renderer, &windowWidth, &windowHeight);
 		camera.w = windowWidth;
@@ -1800,101 +2994,69 @@ GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet
 		}
 
 		// Developer options
-		bool forceStartNewPhase = false;
 		if (enableDeveloperOptions)
 		{
+			SimulationCommand command = {0};
 			if (currentKeyStates[SDL_SCANCODE_F1])
 				enableDebugUI = true;
 			// Advance to next phase
 			if (currentKeyStates[SDL_SCANCODE_F2])
 			{
+				command.type = SimulationCommand_SkipPhase;
 				if (!isPhaseSkipPressed)
-					forceStartNewPhase = true;
+					pushSimulationCommand(commands, &command);
 				isPhaseSkipPressed = true;
 			}
 			else
 				isPhaseSkipPressed = false;
-		}
-
-		int numSimulationUpdatesThisFrame = 0;
-		/* accumulatedTime = c_simulateUpdateRate;// Fixed update */
-		while (accumulatedTime >= c_simulateUpdateRate)
-		{
-			++numSimulationUpdatesThisFrame;
-			float shipThrust = c_shipThrust * c_simulateUpdateRate;
 
-			if (currentKeyStates[SDL_SCANCODE_W] || currentKeyStates[SDL_SCANCODE_UP])
-			{
-				playerPhys.velocity.y +=
-				    -shipThrust * controlEnginesInDirection(&playerShipData, 'u', true);
-			}
-			else
-			{
-				controlEnginesInDirection(&playerShipData, 'u', false);
-			}
-			if (currentKeyStates[SDL_SCANCODE_S] || currentKeyStates[SDL_SCANCODE_DOWN])
-			{
-				playerPhys.velocity.y +=
-				    shipThrust * controlEnginesInDirection(&playerShipData, 'd', true);
-			}
-			else
-			{
-				controlEnginesInDirection(&playerShipData, 'd', false);
-			}
-			if (currentKeyStates[SDL_SCANCODE_A] || currentKeyStates[SDL_SCANCODE_LEFT])
-			{
-				playerPhys.velocity.x +=
-				    -shipThrust * controlEnginesInDirection(&playerShipData, 'r', true);
-			}
-			else
-			{
-				controlEnginesInDirection(&playerShipData, 'r', false);
-			}
-			if (currentKeyStates[SDL_SCANCODE_D] || currentKeyStates[SDL_SCANCODE_RIGHT])
-			{
-				playerPhys.velocity.x +=
-				    shipThrust * controlEnginesInDirection(&playerShipData, 'l', true);
-			}
-			else
-			{
-				controlEnginesInDirection(&playerShipData, 'l', false);
-			}
+			command.type = SimulationCommand_QuickSave;
+			if (currentKeyStates[SDL_SCANCODE_F5] && !isQuickSavePressed)
+				pushSimulationCommand(commands, &command);
+			isQuickSavePressed = currentKeyStates[SDL_SCANCODE_F5];
 
-			updateEngineFuel(&playerShipData, c_simulateUpdateRate);
+			command.type = SimulationCommand_QuickLoad;
+			if (currentKeyStates[SDL_SCANCODE_F9] && !isQuickLoadPressed)
+				pushSimulationCommand(commands, &command);
+			isQuickLoadPressed = currentKeyStates[SDL_SCANCODE_F9];
 
-			bool playerAtMaxVelocity = false;
-			if (playerPhys.velocity.y > c_maxSpeed)
-			{
-				playerPhys.velocity.y = c_maxSpeed;
-				playerAtMaxVelocity = true;
-			}
-			if (playerPhys.velocity.y < -c_maxSpeed)
-			{
-				playerPhys.velocity.y = -c_maxSpeed;
-				playerAtMaxVelocity = true;
-			}
-			if (playerPhys.velocity.x > c_maxSpeed)
+			// Hold to scrub back through recent history
+			if (currentKeyStates[SDL_SCANCODE_F3])
 			{
-				playerPhys.velocity.x = c_maxSpeed;
-				playerAtMaxVelocity = true;
+				command.type = SimulationCommand_Rewind;
+				command.rewindSeconds = deltaTime * c_rewindSpeed;
+				pushSimulationCommand(commands, &command);
+				isRewindPressed = true;
 			}
-			if (playerPhys.velocity.x < -c_maxSpeed)
+			else if (isRewindPressed)
 			{
-				playerPhys.velocity.x = -c_maxSpeed;
-				playerAtMaxVelocity = true;
+				command.type = SimulationCommand_Resume;
+				isRewindPressed = !pushSimulationCommand(commands, &command);
 			}
+		}
 
-			UpdatePhysics(&playerPhys,
-			              numDamagesSustained <= c_numSustainableDamagesBeforeGameOver ?
-			                  playerDrag :
-			                  c_onFailurePlayerDrag,
-			              c_simulateUpdateRate);
-			updateObjects(&playerPhys, &playerShipData, c_simulateUpdateRate);
-
-			doFactory(playerShip, c_simulateUpdateRate);
-			accumulatedTime -= c_simulateUpdateRate;
+		snapshot = acquireSnapshot(&simulationThread->snapshots);
+		// Rendering only reads it, but the helpers weren't written with const in mind
+		simulation = (SimulationState*)&snapshot->state;
+		// Ship cells never move once spawned, but a quick load could change the ship's size
+		playerShipData = shipGridSpace(simulation, &simulation->ships[localPlayer]);
+		playerPhys = &simulation->ships[localPlayer].body;
+		int numSimulationUpdatesThisFrame =
+		    simulation->tick > lastRenderedTick ? simulation->tick - lastRenderedTick : 0;
+		lastRenderedTick = simulation->tick;
+
+		// How far to extrapolate positions past the snapshot's tick
+		float accumulatedTime = 0.f;
+		if (!snapshot->isPaused)
+		{
+			accumulatedTime = snapshot->accumulatedTime +
+			                  (currentCounterTicks - snapshot->publishedCounterTicks) /
+			                      (float)performanceNumTicksPerSecond;
+			if (accumulatedTime > c_maxCatchUpSeconds)
+				accumulatedTime = c_maxCatchUpSeconds;
+			if (accumulatedTime < 0.f)
+				accumulatedTime = 0.f;
 		}
-		/* fprintf(stderr, "%d\n", numSimulationUpdatesThisFrame); */
 
 		// Rendering
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
@@ -1902,62 +3064,85 @@ GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet
 
 		Vec2 extrapolatedPlayerPosition;
 		extrapolatedPlayerPosition.x =
-		    playerPhys.position.x + (accumulatedTime * playerPhys.velocity.x);
+		    playerPhys->position.x + (accumulatedTime * playerPhys->velocity.x);
 		extrapolatedPlayerPosition.y =
-		    playerPhys.position.y + (accumulatedTime * playerPhys.velocity.y);
+		    playerPhys->position.y + (accumulatedTime * playerPhys->velocity.y);
+
+		if (snapshot->numPhasesFailed != numPhasesFailedSeen)
+		{
+			numPhasesFailedSeen = snapshot->numPhasesFailed;
+			timeSinceFailedPhase = c_timeToShowFailedOverlay;
+			timeSinceFailedPhaseDamage = c_timeToShowDamagedText;
+		}
+
+		const GamePhase* phase = simulationCurrentPhase(simulation);
 
 		// Let the ship drift away on success or failure
-		if (numDamagesSustained <= c_numSustainableDamagesBeforeGameOver &&
-		    currentGamePhase < ARRAY_SIZE(gamePhases))
+		if (!simulationIsPlayerDestroyed(simulation) && phase)
 		{
 			snapCameraToGrid(&camera, &extrapolatedPlayerPosition, playerShip, deltaTime);
 		}
 
-		renderStarField(renderer, &camera, windowWidth, windowHeight);
+		renderStarField(renderer, &starField, &camera, &starRandom, windowWidth, windowHeight);
 
 		// Note: SDL doesn't render at a subpixel level, so we cast away the floating point of the
 		// camera to ensure our tiles will be at exact pixels. If we didn't do this, we would get
 		// seams due to floating point inaccuracies.
-		renderGridSpaceFromTileSheet(renderer, &tileSheet, playerShip, extrapolatedPlayerPosition.x,
-		                             extrapolatedPlayerPosition.y, (int)camera.x, (int)camera.y);
+		memset(&cullStats, 0, sizeof(cullStats));
+		for (int shipIndex = 0; shipIndex < simulation->numShips; ++shipIndex)
+		{
+			Ship* ship = &simulation->ships[shipIndex];
+			GridSpace shipGrid = shipGridSpace(simulation, ship);
+			renderShip(renderer, tileSheet, useShipLayers ? &shipLayers.layers[shipIndex] : NULL,
+			           &shipGrid, ship->layoutHash,
+			           ship->body.position.x + (accumulatedTime * ship->body.velocity.x),
+			           ship->body.position.y + (accumulatedTime * ship->body.velocity.y), &camera,
+			           &cullStats);
+		}
 
-		renderObjects(renderer, &tileSheet, &camera, extrapolatedPlayerPosition, accumulatedTime);
+		renderObjects(renderer, tileSheet, &camera, simulation, &snapshot->objectGrid,
+		              accumulatedTime, &cullStats);
 
 		// HUD
-		if (numDamagesSustained > c_numSustainableDamagesBeforeGameOver)
+		bool isMiniMapRefreshDue = false;
+		if (simulationIsPlayerDestroyed(simulation))
 		{
-			doEndScreenFailure(renderer, &tileSheet);
+			doEndScreenFailure(renderer, tileSheet);
 			if (continuePressed())
-				return GameplayResult_StartNewGame;
+				startNewGame = true;
 		}
-		else if (currentGamePhase >= ARRAY_SIZE(gamePhases))
+		else if (!phase)
 		{
-			doEndScreenSuccess(renderer, &tileSheet);
+			doEndScreenSuccess(renderer, tileSheet);
 			if (continuePressed())
-				return GameplayResult_StartNewGame;
+				startNewGame = true;
 		}
 		else
 		{
 			// Hide part of the hud during ship construction
-			if (gamePhases[currentGamePhase].objective != Objective_ShipConstruct)
+			if (phase->objective != Objective_ShipConstruct)
 			{
-				renderMiniMap(
-				    renderer, windowWidth, windowHeight, &extrapolatedPlayerPosition, playerShip,
-				    gamePhases[currentGamePhase].objective == Objective_ReachGoalPoint ? &goal :
-				                                                                         NULL);
-
-				int playerVelocity = (int)(Magnitude(&playerPhys.velocity));
-				renderNumber(renderer, &tileSheet, 100, 100, playerVelocity);
-				renderText(renderer, &tileSheet, 100, 80, "VELOCITY");
+				// The minimap is drawn with SDL directly
+				spriteBatchFlush(tileSheet->batch);
+				renderMiniMap(renderer, &miniMap, deltaTime, windowWidth, windowHeight,
+				              &snapshot->miniMap, &extrapolatedPlayerPosition, playerShip,
+				              phase->objective == Objective_ReachGoalPoint ? &simulation->goal :
+				                                                             NULL);
+				isMiniMapRefreshDue = miniMap.isRefreshDue;
+
+				int playerVelocity = (int)(Magnitude(&playerPhys->velocity));
+				renderNumber(renderer, tileSheet, 100, 100, playerVelocity);
+				renderCachedText(renderer, tileSheet, 100, 80, "VELOCITY");
 				// This is a bit weird, but informs the player that they will just waste fuel if
 				// they keep burning in that direction
 				if (playerVelocity >= (int)c_maxSpeed)
-					renderText(renderer, &tileSheet, 100, 60, "WARNING   MAX VELOCITY REACHED");
+					renderCachedText(renderer, tileSheet, 100, 60,
+					                 "WARNING   MAX VELOCITY REACHED");
 
 				{
-					renderText(renderer, &tileSheet, 100, 300 - 40, "SHIP ARMOR");
+					renderCachedText(renderer, tileSheet, 100, 300 - 40, "SHIP ARMOR");
 					char remainingHealth =
-					    c_numSustainableDamagesBeforeGameOver - numDamagesSustained;
+					    c_numSustainableDamagesBeforeGameOver - simulation->numDamagesSustained;
 					if (remainingHealth)
 					{
 						GridSpace shipHealth = {0};
@@ -1968,32 +3153,22 @@ GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet
 						for (int i = 0; i < remainingHealth; ++i)
 							shipHealthCells[i].type = '#';
 						shipHealth.data = shipHealthCells;
-						renderGridSpaceFromTileSheet(renderer, &tileSheet, &shipHealth, 100,
+						renderGridSpaceFromTileSheet(renderer, tileSheet, &shipHealth, 100,
 						                             300 - 20, 0, 0);
 					}
 					else
-						renderText(renderer, &tileSheet, 100, 300 - 20, "NONE");
+						renderCachedText(renderer, tileSheet, 100, 300 - 20, "NONE");
 				}
 			}
 			else
 			{
-				renderFactoryGuide(renderer, &tileSheet);
+				renderFactoryGuide(renderer, tileSheet);
 			}
 
-			if (currentGamePhase < ARRAY_SIZE(gamePhases))
 			{
-				bool startNewPhase = false;
-				if (gamePhases[currentGamePhase].objective == Objective_ReachGoalPoint)
-				{
-					renderGoal(renderer, &camera, &goal);
-					if (CheckGoalSatisfied(&extrapolatedPlayerPosition, playerShip, &goal))
-						startNewPhase = true;
-				}
+				if (phase->objective == Objective_ReachGoalPoint)
+					renderGoal(tileSheet, &camera, &simulation->goal);
 
-				Uint64 currentGamePhaseTicks = SDL_GetPerformanceCounter();
-				int currentSeconds = currentGamePhaseTicks / performanceNumTicksPerSecond;
-				int secondsInCurrentPhase = currentSeconds - startPhaseSeconds;
-				GamePhase* phase = &gamePhases[currentGamePhase];
 				static const char* currentPrompt = NULL;
 				char typeOutPrompt[256] = {0};
 				if (currentPrompt != phase->prompt)
@@ -2012,70 +3187,39 @@ GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet
 				{
 					typeOutPrompt[i] = currentPrompt[i];
 				}
-				renderText(renderer, &tileSheet,
+				renderText(renderer, tileSheet,
 				           (windowWidth / 2) - ((strlen(phase->prompt) * c_scaledFontWidth) / 2),
 				           120, typeOutPrompt);
-				int phaseTimeLeft = phase->timeToCompleteSeconds - secondsInCurrentPhase;
+				int phaseTimeLeft =
+				    phase->timeToCompleteSeconds - simulationSecondsInCurrentPhase(simulation);
 				if (phaseTimeLeft)
-					renderNumber(renderer, &tileSheet, (windowWidth / 2) - c_fontWidth, 145,
+					renderNumber(renderer, tileSheet, (windowWidth / 2) - c_fontWidth, 145,
 					             phaseTimeLeft);
 
-				bool failedPhase = false;
-				if (secondsInCurrentPhase >= phase->timeToCompleteSeconds)
-				{
-					switch (gamePhases[currentGamePhase].objective)
-					{
-						case Objective_None:
-							startNewPhase = true;
-							break;
-						case Objective_ShipConstruct:
-							startNewPhase = true;
-							break;
-						case Objective_ReachGoalPoint:
-							failedPhase = true;
-							break;
-					}
-				}
-
-				if (failedPhase)
-				{
-					timeSinceFailedPhase = c_timeToShowFailedOverlay;
-					timeSinceFailedPhaseDamage = c_timeToShowDamagedText;
-					startNewPhase = true;
-
-					damageShip(playerShip);
-					++numDamagesSustained;
-				}
-
 				if (timeSinceFailedPhaseDamage > 0.f)
 				{
 					timeSinceFailedPhaseDamage -= 1.f * deltaTime;
 					if (timeSinceFailedPhaseDamage < 0.f)
 						timeSinceFailedPhaseDamage = 0.f;
 
-					renderText(renderer, &tileSheet, 100, 320, "DAMAGE DAMAGE DAMAGE");
-					if (numDamagesSustained == c_numSustainableDamagesBeforeGameOver)
-						renderText(renderer, &tileSheet, 100, 340,
-						           "WE WILL NOT SURVIVE ANOTHER HIT");
-				}
-
-				if (startNewPhase || forceStartNewPhase)
-				{
-					startPhaseSeconds = currentSeconds;
-					++currentGamePhase;
-					if (gamePhases[currentGamePhase].objective == Objective_ReachGoalPoint)
-					{
-						goal.x = (rand() % (c_spaceSize - (c_spawnBuffer * 2))) + c_spawnBuffer;
-						goal.y = (rand() % (c_spaceSize - (c_spawnBuffer * 2))) + c_spawnBuffer;
-					}
+					renderCachedText(renderer, tileSheet, 100, 320, "DAMAGE DAMAGE DAMAGE");
+					if (simulation->numDamagesSustained == c_numSustainableDamagesBeforeGameOver)
+						renderCachedText(renderer, tileSheet, 100, 340,
+						                 "WE WILL NOT SURVIVE ANOTHER HIT");
 				}
 			}
 
 			IVec2 cameraPosition = {(int)camera.x, (int)camera.y};
-			doEditUI(renderer, &tileSheet, windowWidth, windowHeight, cameraPosition,
-			         extrapolatedPlayerPosition, &playerShipData, inventory, ARRAY_SIZE(inventory),
-			         &constructionFuelPool);
+			SimulationCommand command = {0};
+			command.type = SimulationCommand_Edit;
+			if (doEditUI(renderer, tileSheet, windowWidth, windowHeight, cameraPosition,
+			             extrapolatedPlayerPosition, simulation, localPlayer, &selectedEditButton,
+			             &command.edit) &&
+			    !snapshot->isPlayingReplay)
+				pushSimulationCommand(commands, &command);
 		}
+		// Hidden, it needn't be prepared at all
+		atomicStore(&simulationThread->isMiniMapRefreshDue, isMiniMapRefreshDue);
 
 		// Draw this even after the game is over
 		if (timeSinceFailedPhase > 0.f)
@@ -2083,27 +3227,368 @@ GameplayResult doGameplay(SDL_Window* window, SDL_Renderer* renderer, TileSheet
 			timeSinceFailedPhase -= 1.f * deltaTime;
 			if (timeSinceFailedPhase < 0.f)
 				timeSinceFailedPhase = 0.f;
-			SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-			SDL_SetRenderDrawColor(renderer, 255, 255, 255,
-			                       (255 * timeSinceFailedPhase) / c_timeToShowFailedOverlay);
+			SDL_Color overlayColor = {
+			    255, 255, 255, (Uint8)((255 * timeSinceFailedPhase) / c_timeToShowFailedOverlay)};
 			SDL_Rect fullScreenRect = {0, 0, windowWidth, windowHeight};
-			SDL_RenderFillRect(renderer, &fullScreenRect);
-			SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+			batchFillRect(tileSheet, &fullScreenRect, overlayColor);
 		}
 
 		if (enableDebugUI)
-			addRenderDiagnostics(renderer, deltaTime, numSimulationUpdatesThisFrame);
+			addRenderDiagnostics(renderer, tileSheet, deltaTime, numSimulationUpdatesThisFrame,
+			                     &snapshot->frameBudget, &cullStats);
 
-		SDL_RenderPresent(renderer);
+		spriteBatchPresent(tileSheet->batch);
 		SDL_UpdateWindowSurface(window);
 		/* SDL_Delay(c_arbitraryDelayTimeMilliseconds); */
 	}
 
+	stopSimulationThread(simulationThread);
+	destroyShipLayers(&shipLayers);
+	destroyMiniMap(&miniMap);
+	simulation = &simulationThread->state;
+	FrameBudget* frameBudget = &simulationThread->frameBudget;
+	if (frameBudget->droppedSeconds > 0.f)
+		fprintf(stderr,
+		        "Dropped %.2f seconds of simulation: %u stalls, %u frames over the simulation "
+		        "budget\n",
+		        frameBudget->droppedSeconds, frameBudget->numStalls,
+		        frameBudget->numFramesOverBudget);
+
+	// The simulation thread may have stopped these early
+	if (simulationThread->recorder)
+		replayWriterClose(simulationThread->recorder, simulation->tick,
+		                  simulationStateHash(simulation));
+	if (simulationThread->replay)
+		replayReaderClose(simulationThread->replay);
+	if (simulationThread->hasRewind)
+		rewindDestroy(&simulationThread->rewind);
+	if (simulationThread->hasAutosave)
+	{
+		autosaveDestroy(&simulationThread->autosave);
+		fprintf(stderr, "Autosaved %u times. The longest the simulation waited on one was %.3f "
+		        "milliseconds\n",
+		        simulationThread->autosave.numSaved, frameBudget->longestAutosaveSeconds * 1000.f);
+	}
+	if (netplay)
+		netplayClose(netplay);
+
 	if (exitReason)
 	{
 		fprintf(stderr, "Exiting. Reason: %s\n", exitReason);
 	}
-	return GameplayResult_ExitGame;
+	return startNewGame ? GameplayResult_StartNewGame : GameplayResult_ExitGame;
+}
+
+//
+// Renderer benchmark
+//
+
+static const int c_rendererBenchmarkWidth = 1920;
+static const int c_rendererBenchmarkHeight = 1080;
+static const int c_rendererBenchmarkFrames = 100;
+// Fewer, because the game waits on it the first time it starts
+static const int c_rendererProbeFrames = 10;
+// Untimed, for uploading textures and compiling shaders
+static const int c_rendererWarmUpFrames = 3;
+
+static SDL_Surface* loadTileSheetSurface()
+{
+#define NO_DATA_BUNDLE
+#ifdef NO_DATA_BUNDLE
+	return SDL_LoadBMP("assets/TileSheet.bmp");
+#else
+	SDL_RWops* tileSheetRWOps =
+	    SDL_RWFromMem(startTilesheetBmp, endTilesheetBmp - startTilesheetBmp);
+	return SDL_LoadBMP_RW(tileSheetRWOps, /*freesrc=*/1);
+#endif
+}
+
+// About as busy as a frame of the game gets: a screen full of ship tiles, every object, a page of
+// text, fuel meters and a translucent overlay
+static void drawBenchmarkScene(SDL_Renderer* renderer, TileSheet* tileSheet, int width, int height,
+                               int frame)
+{
+	for (int y = 0; y < height; y += c_tileSize)
+	{
+		for (int x = 0; x < width; x += c_tileSize)
+		{
+			int cell = ((x / c_tileSize) + (y / c_tileSize) + frame) % ARRAY_SIZE(c_tileSheetCells);
+			const SDL_Rect* sourceRectangle =
+			    tileSheetSprite(tileSheet, c_tileSheetCells[cell].key, TileVariant_Normal);
+			if (!sourceRectangle)
+				continue;
+			SDL_Rect destinationRectangle = {x, y, c_tileSize, c_tileSize};
+			batchSprite(tileSheet, sourceRectangle, &destinationRectangle);
+		}
+	}
+
+	RandomState random;
+	randomSeed(&random, 1, 0);
+	const SDL_Rect* asteroid = tileSheetSprite(tileSheet, 'a', TileVariant_Normal);
+	for (int i = 0; i < MAX_OBJECTS && asteroid; ++i)
+	{
+		SDL_Rect destinationRectangle = {randomRange(&random, width) + frame - (c_tileSize / 2),
+		                                 randomRange(&random, height) - (c_tileSize / 2),
+		                                 c_tileSize, c_tileSize};
+		batchSprite(tileSheet, asteroid, &destinationRectangle);
+	}
+
+	for (int line = 0; line < 20; ++line)
+		renderText(renderer, tileSheet, 100, 100 + (line * 25),
+		           "THE CONGLOMERATE IS NOT HAPPY WITH YOU SPREADING THESE IDEALS");
+
+	SDL_Color fuelColor = {209, 193, 163, 255};
+	for (int i = 0; i < 200; ++i)
+	{
+		SDL_Rect fuelRect = {randomRange(&random, width), randomRange(&random, height), 5, 30};
+		batchFillRect(tileSheet, &fuelRect, fuelColor);
+	}
+
+	SDL_Color overlayColor = {255, 255, 255, 96};
+	SDL_Rect overlayRect = {0, 0, width, height / 2};
+	batchFillRect(tileSheet, &overlayRect, overlayColor);
+}
+
+// Seconds per frame drawing and presenting the scene
+static double timeBenchmarkScene(SDL_Renderer* renderer, TileSheet* tileSheet, int numFrames)
+{
+	int width = 0;
+	int height = 0;
+	SDL_GetRendererOutputSize(renderer, &width, &height);
+	Uint64 startTicks = SDL_GetPerformanceCounter();
+	for (int frame = 0; frame < numFrames; ++frame)
+	{
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_RenderClear(renderer);
+		drawBenchmarkScene(renderer, tileSheet, width, height, frame);
+		spriteBatchPresent(tileSheet->batch);
+	}
+	// Reading a pixel back waits for the GPU to finish what was queued up
+	Uint32 pixel = 0;
+	SDL_Rect pixelRect = {0, 0, 1, 1};
+	SDL_RenderReadPixels(renderer, &pixelRect, SDL_PIXELFORMAT_ARGB8888, &pixel, sizeof(pixel));
+	return ((double)(SDL_GetPerformanceCounter() - startTicks) /
+	        (double)SDL_GetPerformanceFrequency()) /
+	       numFrames;
+}
+
+// Times the scene with a fresh tile sheet, after a few frames to let the driver settle
+static bool timeRenderer(SDL_Renderer* renderer, SoftwareRenderer* software,
+                         SDL_Surface* tileSheetSurface, int numFrames, double* secondsPerFrameOut,
+                         int* numQuadsOut)
+{
+	// Too big for the stack
+	static TileSheet tileSheet;
+	static SpriteBatch spriteBatch;
+	if (!createTileSheet(renderer, software, tileSheetSurface, &tileSheet))
+		return false;
+	spriteBatchInitialize(&spriteBatch, renderer);
+	spriteBatch.software = software;
+	tileSheet.batch = &spriteBatch;
+	timeBenchmarkScene(renderer, &tileSheet, c_rendererWarmUpFrames);
+	*secondsPerFrameOut = timeBenchmarkScene(renderer, &tileSheet, numFrames);
+	if (numQuadsOut)
+		*numQuadsOut = spriteBatch.lastFrameNumQuads;
+	SDL_DestroyTexture(tileSheet.texture);
+	return true;
+}
+
+// Draws the same scene into an offscreen surface with SDL's software renderer, then with the
+// rasterizer at each instruction set the CPU supports, on one thread and on all of them
+static bool benchmarkRenderers()
+{
+	SDL_Surface* tileSheetSurface = loadTileSheetSurface();
+	SDL_Surface* target =
+	    SDL_CreateRGBSurfaceWithFormat(0, c_rendererBenchmarkWidth, c_rendererBenchmarkHeight, 32,
+	                                   SDL_PIXELFORMAT_ARGB8888);
+	SDL_Renderer* renderer = target ? SDL_CreateSoftwareRenderer(target) : NULL;
+	if (!tileSheetSurface || !renderer)
+	{
+		sdlPrintError();
+		if (target)
+			SDL_FreeSurface(target);
+		if (tileSheetSurface)
+			SDL_FreeSurface(tileSheetSurface);
+		return false;
+	}
+
+	// Too big for the stack
+	static SoftwareRenderer software;
+	static JobSystem jobs;
+	printf("Drawing %d frames at %dx%d\n", c_rendererBenchmarkFrames, c_rendererBenchmarkWidth,
+	       c_rendererBenchmarkHeight);
+
+	double sdlSeconds = 0.0;
+	int numQuads = 0;
+	bool succeeded = timeRenderer(renderer, NULL, tileSheetSurface, c_rendererBenchmarkFrames,
+	                              &sdlSeconds, &numQuads);
+	if (succeeded)
+		printf("SDL software renderer: %.2f milliseconds per frame (%d quads)\n",
+		       sdlSeconds * 1000.0, numQuads);
+
+	int numHardwareThreads = threadNumHardwareThreads();
+	int threadCounts[] = {1, numHardwareThreads};
+	RasterInstructionSet bestInstructionSet = rasterizerBestInstructionSet();
+	for (int instructionSet = 0; instructionSet <= bestInstructionSet && succeeded;
+	     ++instructionSet)
+	{
+		for (int i = 0; i < (numHardwareThreads > 1 ? 2 : 1) && succeeded; ++i)
+		{
+			// With one thread, the rasterizer draws every band itself
+			bool hasJobs = threadCounts[i] > 1 && jobSystemInitialize(&jobs, threadCounts[i]);
+			succeeded = softwareRendererInitialize(&software, renderer, hasJobs ? &jobs : NULL,
+			                                       (RasterInstructionSet)instructionSet);
+			if (!succeeded)
+			{
+				if (hasJobs)
+					jobSystemDestroy(&jobs);
+				break;
+			}
+			double seconds = 0.0;
+			succeeded = timeRenderer(renderer, &software, tileSheetSurface,
+			                         c_rendererBenchmarkFrames, &seconds, NULL);
+			if (succeeded)
+				printf("Rasterizer, %s, %d thread%s: %.2f milliseconds per frame (%.1fx)\n",
+				       rasterInstructionSetName((RasterInstructionSet)instructionSet),
+				       threadCounts[i], threadCounts[i] == 1 ? "" : "s", seconds * 1000.0,
+				       sdlSeconds / seconds);
+			softwareRendererDestroy(&software);
+			if (hasJobs)
+				jobSystemDestroy(&jobs);
+		}
+	}
+	if (!succeeded)
+		sdlPrintError();
+
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(target);
+	SDL_FreeSurface(tileSheetSurface);
+	return succeeded;
+}
+
+//
+// Renderer selection
+//
+
+typedef struct RendererChoice
+{
+	// As SDL names the driver, e.g. "opengl" or "software"
+	char driverName[32];
+	// Draw on the CPU and give the driver finished frames
+	bool useSoftwareRasterizer;
+} RendererChoice;
+
+static int findRenderDriver(const char* name)
+{
+	int numDrivers = SDL_GetNumRenderDrivers();
+	for (int driver = 0; driver < numDrivers; ++driver)
+	{
+		SDL_RendererInfo info;
+		if (SDL_GetRenderDriverInfo(driver, &info) == 0 && strcmp(info.name, name) == 0)
+			return driver;
+	}
+	return -1;
+}
+
+static bool loadRendererChoice(RendererChoice* choice)
+{
+	FILE* file = fopen(c_rendererChoiceFilename, "r");
+	if (!file)
+		return false;
+	int useSoftwareRasterizer = 0;
+	bool isValid = fscanf(file, "driver %31s rasterizer %d", choice->driverName,
+	                      &useSoftwareRasterizer) == 2;
+	fclose(file);
+	choice->useSoftwareRasterizer = useSoftwareRasterizer != 0;
+	// A different SDL build may not have the same drivers
+	return isValid && findRenderDriver(choice->driverName) >= 0;
+}
+
+static void saveRendererChoice(const RendererChoice* choice)
+{
+	FILE* file = fopen(c_rendererChoiceFilename, "w");
+	if (!file)
+	{
+		fprintf(stderr, "Failed to write %s\n", c_rendererChoiceFilename);
+		return;
+	}
+	fprintf(file, "driver %s\nrasterizer %d\n", choice->driverName,
+	        choice->useSoftwareRasterizer ? 1 : 0);
+	fclose(file);
+}
+
+// Draws into a hidden window, so the probe doesn't flash anything on screen
+static bool probeRenderer(int driver, bool useSoftwareRasterizer, JobSystem* jobs,
+                          SDL_Surface* tileSheetSurface, int width, int height,
+                          double* secondsPerFrameOut)
+{
+	SDL_Window* window =
+	    SDL_CreateWindow("Space Factory", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width,
+	                     height, SDL_WINDOW_HIDDEN);
+	if (!window)
+		return false;
+	SDL_Renderer* renderer = SDL_CreateRenderer(window, driver, 0);
+	// Too big for the stack
+	static SoftwareRenderer software;
+	bool succeeded = renderer != NULL;
+	if (succeeded && useSoftwareRasterizer)
+		succeeded = softwareRendererInitialize(&software, renderer, jobs,
+		                                       rasterizerBestInstructionSet());
+	if (succeeded)
+	{
+		succeeded = timeRenderer(renderer, useSoftwareRasterizer ? &software : NULL,
+		                         tileSheetSurface, c_rendererProbeFrames, secondsPerFrameOut,
+		                         NULL);
+		if (useSoftwareRasterizer)
+			softwareRendererDestroy(&software);
+	}
+	if (renderer)
+		SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	return succeeded;
+}
+
+// Times every driver SDL has, with and without the rasterizer, at the window's size
+static bool probeRenderers(JobSystem* jobs, int width, int height, RendererChoice* choice)
+{
+	SDL_Surface* tileSheetSurface = loadTileSheetSurface();
+	if (!tileSheetSurface)
+		return false;
+	// Waiting on the display would make every driver look the same
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, "0");
+
+	double bestSeconds = 0.0;
+	bool foundRenderer = false;
+	int numDrivers = SDL_GetNumRenderDrivers();
+	for (int driver = 0; driver < numDrivers; ++driver)
+	{
+		SDL_RendererInfo info;
+		if (SDL_GetRenderDriverInfo(driver, &info) != 0)
+			continue;
+		for (int rasterize = 0; rasterize < 2; ++rasterize)
+		{
+			const char* rasterizerLabel = rasterize ? " with the rasterizer" : "";
+			double seconds = 0.0;
+			if (!probeRenderer(driver, rasterize, jobs, tileSheetSurface, width, height, &seconds))
+			{
+				fprintf(stderr, "Renderer %s%s is unavailable: %s\n", info.name, rasterizerLabel,
+				        SDL_GetError());
+				continue;
+			}
+			fprintf(stderr, "Renderer %s%s: %.2f milliseconds per frame\n", info.name,
+			        rasterizerLabel, seconds * 1000.0);
+			if (foundRenderer && seconds >= bestSeconds)
+				continue;
+			foundRenderer = true;
+			bestSeconds = seconds;
+			snprintf(choice->driverName, sizeof(choice->driverName), "%s", info.name);
+			choice->useSoftwareRasterizer = rasterize;
+		}
+	}
+
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
+	SDL_FreeSurface(tileSheetSurface);
+	return foundRenderer;
 }
 
 #ifdef WINDOWS
@@ -2120,6 +3605,74 @@ int main(int numArguments, char** arguments)
 	SetDPIAware();
 #endif
 
+	GameOptions options = {0};
+	// Lower rates are cheaper on constrained hardware without changing how the factory plays
+	options.simulationTicksPerSecond = c_defaultTicksPerSecond;
+	options.miniMapRefreshesPerSecond = c_miniMapDefaultRefreshesPerSecond;
+	NetplayOptions netplayOptions = {0};
+	netplayOptions.inputDelayTicks = c_netplayDefaultInputDelayTicks;
+	// Draw on the CPU rather than through SDL, for machines without a GPU
+	bool useSoftwareRasterizer = false;
+	bool shouldBenchmarkRenderers = false;
+	bool shouldProbeRenderers = false;
+	for (int i = 1; i < numArguments; ++i)
+	{
+		if (strcmp(arguments[i], "--software-rasterizer") == 0)
+			useSoftwareRasterizer = true;
+		else if (strcmp(arguments[i], "--benchmark-renderers") == 0)
+			shouldBenchmarkRenderers = true;
+		else if (strcmp(arguments[i], "--probe-renderers") == 0)
+			shouldProbeRenderers = true;
+		else if (strcmp(arguments[i], "--record") == 0 && i + 1 < numArguments)
+			options.recordReplayFilename = arguments[++i];
+		else if (strcmp(arguments[i], "--replay") == 0 && i + 1 < numArguments)
+			options.playReplayFilename = arguments[++i];
+		else if ((strcmp(arguments[i], "--host") == 0 || strcmp(arguments[i], "--join") == 0) &&
+		         i + 1 < numArguments)
+		{
+			netplayOptions.localPlayer = strcmp(arguments[i], "--host") == 0 ? 0 : 1;
+			netplayOptions.port = (unsigned short)atoi(arguments[++i]);
+			options.netplay = &netplayOptions;
+		}
+		else if (strcmp(arguments[i], "--host-address") == 0 && i + 1 < numArguments)
+			netplayOptions.hostAddress = arguments[++i];
+		else if (strcmp(arguments[i], "--input-delay") == 0 && i + 1 < numArguments)
+			netplayOptions.inputDelayTicks = atoi(arguments[++i]);
+		// Artificial network conditions, for testing co-op on one machine
+		else if (strcmp(arguments[i], "--net-latency") == 0 && i + 1 < numArguments)
+			netplayOptions.conditions.latencyMilliseconds = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--net-jitter") == 0 && i + 1 < numArguments)
+			netplayOptions.conditions.jitterMilliseconds = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--net-loss") == 0 && i + 1 < numArguments)
+			netplayOptions.conditions.lossPercent = atoi(arguments[++i]);
+		else if (strcmp(arguments[i], "--minimap-refresh") == 0 && i + 1 < numArguments)
+		{
+			options.miniMapRefreshesPerSecond = (float)atof(arguments[++i]);
+			if (!(options.miniMapRefreshesPerSecond > 0.f))
+			{
+				fprintf(stderr, "Minimap refreshes per second must be more than 0\n");
+				return 1;
+			}
+		}
+		else if (strcmp(arguments[i], "--tick-rate") == 0 && i + 1 < numArguments)
+		{
+			options.simulationTicksPerSecond = atoi(arguments[++i]);
+			if (!simulationIsValidTickRate(options.simulationTicksPerSecond))
+			{
+				fprintf(stderr, "Tick rate must divide %d evenly, e.g. 30, 60, 120, or 240\n",
+				        FIXED_UNITS_PER_SECOND);
+				return 1;
+			}
+		}
+	}
+
+	if (shouldBenchmarkRenderers)
+	{
+		// Offscreen, so there's no window to set up
+		initializeCakelisp();
+		return benchmarkRenderers() ? 0 : 1;
+	}
+
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 6);
 	SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
@@ -2132,11 +3685,52 @@ int main(int numArguments, char** arguments)
 		return 1;
 	}
 
-	// Initialize the hardware-accelerated 2D renderer
-	// Note: I had to set the driver to -1 so that a compatible one is automatically chosen.
-	// Otherwise, I get a window that doesn't vsync
+	// Set up bundled data. The renderer probe draws with it
+	initializeCakelisp();
+
+	// The render and simulation threads each get their own workers, so neither ever waits for the
+	// other's jobs. Together they use one thread per core: the rasterizer gets half when it draws,
+	// and the simulation and minimap get the rest. A NULL system runs jobs on the thread asking
+	int numHardwareThreads = threadNumHardwareThreads();
+	int numRenderThreads = numHardwareThreads / 2;
+	static JobSystem renderJobSystem;
+	JobSystem* renderJobs = numRenderThreads > 1 &&
+	                                jobSystemInitialize(&renderJobSystem, numRenderThreads) ?
+	                            &renderJobSystem :
+	                            NULL;
+
+	// Pick whichever renderer drew fastest here. Asking for the rasterizer, or for a driver through
+	// SDL_RENDER_DRIVER, skips the choice
 	sdlList2dRenderDrivers();
-	SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	int renderDriver = -1;
+	if (!useSoftwareRasterizer && !SDL_GetHint(SDL_HINT_RENDER_DRIVER))
+	{
+		RendererChoice rendererChoice = {0};
+		bool hasChoice = !shouldProbeRenderers && loadRendererChoice(&rendererChoice);
+		if (!hasChoice)
+		{
+			fprintf(stderr, "Measuring which renderer is fastest. It will be saved to %s\n",
+			        c_rendererChoiceFilename);
+			hasChoice = probeRenderers(renderJobs, windowWidth, windowHeight, &rendererChoice);
+			if (hasChoice)
+				saveRendererChoice(&rendererChoice);
+		}
+		if (hasChoice)
+		{
+			renderDriver = findRenderDriver(rendererChoice.driverName);
+			useSoftwareRasterizer = rendererChoice.useSoftwareRasterizer;
+			fprintf(stderr, "Using renderer %s%s\n", rendererChoice.driverName,
+			        useSoftwareRasterizer ? " with the rasterizer" : "");
+		}
+	}
+
+	// Note: I had to set the driver to -1 so that a compatible one is automatically chosen.
+	// Otherwise, I get a window that doesn't vsync. A chosen driver asks for vsync outright
+	SDL_Renderer* renderer =
+	    renderDriver >= 0 ? SDL_CreateRenderer(window, renderDriver, SDL_RENDERER_PRESENTVSYNC) :
+	                        NULL;
+	if (!renderer)
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 	if (!renderer)
 	{
 		sdlPrintError();
@@ -2147,72 +3741,64 @@ int main(int numArguments, char** arguments)
 	/* SDL_SetWindowSize(window, 3840, 2160); */
 	/* SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN); */
 
-	// Set up bundled data
-	initializeCakelisp();
+	// Too big for the stack
+	static SoftwareRenderer softwareRenderer;
+	SoftwareRenderer* software = NULL;
+	if (useSoftwareRasterizer)
+	{
+		if (softwareRendererInitialize(&softwareRenderer, renderer, renderJobs,
+		                               rasterizerBestInstructionSet()))
+		{
+			software = &softwareRenderer;
+			fprintf(stderr, "Drawing with the %s rasterizer\n",
+			        rasterInstructionSetName(software->rasterizer.instructionSet));
+		}
+		else
+			fprintf(stderr, "Failed to set up the software rasterizer. Drawing with SDL\n");
+	}
+	// Drawing with SDL leaves all the cores to the simulation
+	if (!software)
+	{
+		if (renderJobs)
+			jobSystemDestroy(renderJobs);
+		renderJobs = NULL;
+		numRenderThreads = 0;
+	}
+	// On one thread, the job system is only bookkeeping; the headless --jobs-scaling shows the cost
+	int numSimulationThreads = numHardwareThreads - numRenderThreads;
+	static JobSystem simulationJobSystem;
+	JobSystem* simulationJobs = numSimulationThreads > 1 &&
+	                                    jobSystemInitialize(&simulationJobSystem,
+	                                                        numSimulationThreads) ?
+	                                &simulationJobSystem :
+	                                NULL;
 
 	// Load tile sheet into texture
-	SDL_Texture* tileSheetTexture = NULL;
+	static TileSheet tileSheet;
 	{
-#define NO_DATA_BUNDLE
-#ifdef NO_DATA_BUNDLE
-		SDL_Surface* tileSheetSurface = SDL_LoadBMP("assets/TileSheet.bmp");
-#else
-		SDL_RWops* tileSheetRWOps =
-		    SDL_RWFromMem(startTilesheetBmp, endTilesheetBmp - startTilesheetBmp);
-		SDL_Surface* tileSheetSurface = SDL_LoadBMP_RW(tileSheetRWOps, /*freesrc=*/1);
-#endif
+		SDL_Surface* tileSheetSurface = loadTileSheetSurface();
 		if (!tileSheetSurface)
 		{
 			fprintf(stderr, "Failed to load tile sheet\n");
 			return 1;
 		}
-		// Use pure black as our chroma key
-		SDL_SetColorKey(tileSheetSurface, SDL_TRUE, SDL_MapRGB(tileSheetSurface->format, 0, 0, 0));
-		tileSheetTexture = SDL_CreateTextureFromSurface(renderer, tileSheetSurface);
+		bool createdTileSheet = createTileSheet(renderer, software, tileSheetSurface, &tileSheet);
 		SDL_FreeSurface(tileSheetSurface);
-		if (!tileSheetTexture)
+		if (!createdTileSheet)
 		{
 			sdlPrintError();
 			return 1;
 		}
 	}
-	// TODO: Turn this into a direct lookup table
-	TileSheet tileSheet = {{
-	                           // Wall
-	                           {'#', 0, 0, TextureTransform_None},
-	                           // Floor
-	                           {'.', 0, 1, TextureTransform_None},
-	                           // Conveyor to left
-	                           {'<', 0, 2, TextureTransform_None},
-	                           // Conveyor to right
-	                           {'>', 0, 2, TextureTransform_FlipHorizontal},
-	                           // Conveyor to up
-	                           {'A', 0, 2, TextureTransform_Clockwise90},
-	                           // Conveyor to down
-	                           {'V', 0, 2, TextureTransform_CounterClockwise90},
-	                           // Furnace
-	                           {'f', 2, 1, TextureTransform_None},
-	                           // Intake from right
-	                           {'R', 2, 0, TextureTransform_None},
-	                           // Intake from left
-	                           {'L', 2, 0, TextureTransform_FlipHorizontal},
-	                           // Intake from top
-	                           {'U', 2, 0, TextureTransform_CounterClockwise90},
-	                           // Intake from bottom
-	                           {'D', 2, 0, TextureTransform_Clockwise90},
-	                           // Engine to left (unpowered)
-	                           {'l', 1, 1, TextureTransform_FlipHorizontal},
-	                           {'r', 1, 1, TextureTransform_None},
-	                           {'u', 1, 1, TextureTransform_Clockwise90},
-	                           {'d', 1, 1, TextureTransform_CounterClockwise90},
-
-	                           // Objects
-	                           // Unrefined fuel (asteroid)
-	                           {'a', 0, 3, TextureTransform_None},
-	                           // Refined fuel
-	                           {'g', 1, 0, TextureTransform_None},
-	                       },
-	                       tileSheetTexture};
+	// Too big for the stack
+	static SpriteBatch spriteBatch;
+	spriteBatchInitialize(&spriteBatch, renderer);
+	spriteBatch.software = software;
+	tileSheet.batch = &spriteBatch;
+	static TextCache textCache;
+	textCacheInitialize(&textCache, renderer);
+	// Cached text is drawn from textures the rasterizer has no copy of
+	tileSheet.textCache = software ? NULL : &textCache;
 
 	if (!doMainMenu(window, renderer, &tileSheet))
 		return 0;
@@ -2220,9 +3806,16 @@ int main(int numArguments, char** arguments)
 	GameplayResult result = GameplayResult_StartNewGame;
 	while (result == GameplayResult_StartNewGame)
 	{
-		result = doGameplay(window, renderer, tileSheet);
+		result = doGameplay(window, renderer, &tileSheet, &options, simulationJobs);
 	}
 
+	textCacheClear(&textCache);
+	if (software)
+		softwareRendererDestroy(software);
+	if (renderJobs)
+		jobSystemDestroy(renderJobs);
+	if (simulationJobs)
+		jobSystemDestroy(simulationJobs);
 	SDL_DestroyRenderer(renderer);
 	sdlShutdown(window);
 